@@ -121,24 +121,54 @@ vca_pace_good(void)
  */
 
 void
-VCA_NewPool(struct pool *pp)
+VCA_NewPool(struct pool *pp, unsigned pool_no)
 {
 	struct acceptor *vca;
 
 	VCA_Foreach(vca) {
 		CHECK_OBJ_NOTNULL(vca, ACCEPTOR_MAGIC);
-		vca->accept(pp);
+		vca->accept(pp, pool_no);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Called before pool pp dies.  Its accept tasks keep running until they
+ * notice, but the listen sockets nobody else accepts on, the shards of
+ * a reuseport group, are handed over to the surviving pools.
+ */
+
 void
 VCA_DestroyPool(struct pool *pp)
 {
-	struct poolsock *ps;
+	struct poolsock *ps, *ps2;
+	struct pool *heir;
 
 	while (!VTAILQ_EMPTY(&pp->poolsocks)) {
 		ps = VTAILQ_FIRST(&pp->poolsocks);
+		CHECK_OBJ_NOTNULL(ps, POOLSOCK_MAGIC);
 		VTAILQ_REMOVE(&pp->poolsocks, ps, list);
+		pp->npoolsocks--;
+
+		heir = pool_heir(pp);
+		if (heir == NULL)
+			continue;
+		VTAILQ_FOREACH(ps2, &heir->poolsocks, list)
+			if (ps2->lsock == ps->lsock)
+				break;
+		if (ps2 != NULL)
+			continue;
+
+		ALLOC_OBJ(ps2, POOLSOCK_MAGIC);
+		AN(ps2);
+		ps2->lsock = ps->lsock;
+		ps2->task->func = ps->task->func;
+		ps2->task->priv = ps2;
+		ps2->pool = heir;
+		VTAILQ_INSERT_TAIL(&heir->poolsocks, ps2, list);
+		heir->npoolsocks++;
+		VSL(SLT_Debug, NO_VXID, "Pool %u takes over %s shard %u",
+		    heir->pool_no, ps->lsock->name, ps->lsock->shard);
+		AZ(Pool_Task(heir, ps2->task, TASK_QUEUE_VCA));
 	}
 }
 
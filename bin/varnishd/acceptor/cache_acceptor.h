@@ -51,7 +51,7 @@ typedef int acceptor_reopen_f(void);
 typedef void acceptor_start_f(struct cli *);
 typedef void acceptor_event_f(struct cli *, struct listen_sock *,
     enum vca_event);
-typedef void acceptor_accept_f(struct pool *);
+typedef void acceptor_accept_f(struct pool *, unsigned);
 typedef void acceptor_update_f(pthread_mutex_t *);
 typedef void acceptor_shutdown_f(void);
 
@@ -33,9 +33,14 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+#  include <linux/filter.h>
+#endif
+
 #include "cache/cache_varnishd.h"
 
 #include "acceptor/cache_acceptor.h"
@@ -51,6 +56,11 @@
 #include "vtcp.h"
 #include "vtim.h"
 
+#if defined(HAVE_IO_URING)
+#  include "vuring.h"
+#  include "waiter/mgt_waiter.h"
+#endif
+
 /*--------------------------------------------------------------------
  * TCP options we want to control
  */
@@ -292,6 +302,38 @@ vca_tcp_listen(struct cli *cli, struct listen_sock *ls)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Steer connections to the shard of a reuseport group matching the CPU
+ * which received them.  The index a cBPF program returns selects the
+ * socket in the order they started listening, which is shard order.
+ */
+
+static void
+vca_tcp_steer(const struct listen_sock *ls)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	struct sock_filter code[] = {
+		/* A = current CPU */
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		/* A = A % nshards */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, ls->nshards },
+		/* return A */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof code / sizeof code[0];
+	prog.filter = code;
+	if (setsockopt(ls->sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+	    &prog, sizeof prog))
+		VSL(SLT_Error, NO_VXID,
+		    "Reuseport steering: sock=%d, errno=%d %s",
+		    ls->sock, errno, VAS_errtxt(errno));
+#else
+	(void)ls;
+#endif
+}
+
 static void
 vca_tcp_start(struct cli *cli)
 {
@@ -307,6 +349,14 @@ vca_tcp_start(struct cli *cli)
 		if (vca_tcp_listen(cli, ls))
 			return;
 	}
+
+	/* Only once all shards listen */
+	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
+		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+
+		if (ls->steer && ls->shard == 0)
+			vca_tcp_steer(ls);
+	}
 }
 
 static void
@@ -317,6 +367,8 @@ vca_tcp_event(struct cli *cli, struct listen_sock *ls, enum vca_event event)
 	(void) ls; // XXX const?
 	switch (event) {
 	case VCA_EVENT_LADDR:
+		if (ls->shard > 0)
+			break;
 		VTCP_myname(ls->sock, h, sizeof h, p, sizeof p);
 		VCLI_Out(cli, "%s %s %s\n", ls->name, h, p);
 		break;
@@ -414,6 +466,181 @@ vca_tcp_make_session(struct worker *wrk, void *arg)
 	WS_Release(wrk->aws, 0);
 }
 
+#if defined(HAVE_IO_URING)
+/*--------------------------------------------------------------------
+ * With the io_uring waiter we also accept through io_uring: a number of
+ * accepts are kept armed on the listen socket, and a single
+ * io_uring_enter(2) collects however many connections arrived since
+ * the last one.  Multishot accept would save the re-arming, but it
+ * cannot tell us the peer address.
+ *
+ * The ring belongs to the poolsock, completions not handled by one run
+ * of the accept task are picked up by the next.
+ */
+
+#define VCA_URING_NSLOT		16
+
+struct vca_uring {
+	unsigned		magic;
+#define VCA_URING_MAGIC		0x5d0e9a37
+	struct vuring		*ring;
+	unsigned		outstanding;
+	unsigned		cancelled;
+	struct {
+		struct sockaddr_storage	addr;
+		socklen_t		addrlen;
+	}			slot[VCA_URING_NSLOT];
+};
+
+static void
+vca_uring_arm(struct vca_uring *vcu, const struct listen_sock *ls,
+    unsigned u)
+{
+
+	CHECK_OBJ_NOTNULL(vcu, VCA_URING_MAGIC);
+	assert(u < VCA_URING_NSLOT);
+	if (ls->sock < 0)
+		return;		/* VCA_Shutdown */
+	vcu->slot[u].addrlen = sizeof vcu->slot[u].addr;
+	VURING_Accept(vcu->ring, ls->sock, (void*)&vcu->slot[u].addr,
+	    &vcu->slot[u].addrlen, u + 1);
+	vcu->outstanding++;
+}
+
+static struct vca_uring *
+vca_uring_new(const struct listen_sock *ls)
+{
+	struct vca_uring *vcu;
+	unsigned u;
+
+	ALLOC_OBJ(vcu, VCA_URING_MAGIC);
+	AN(vcu);
+	vcu->ring = VURING_New(2 * VCA_URING_NSLOT);
+	if (vcu->ring == NULL) {
+		VSL(SLT_Debug, NO_VXID, "io_uring accept unavailable: %s",
+		    VAS_errtxt(errno));
+		FREE_OBJ(vcu);
+		return (NULL);
+	}
+	for (u = 0; u < VCA_URING_NSLOT; u++)
+		vca_uring_arm(vcu, ls, u);
+	VURING_Flush(vcu->ring);
+	return (vcu);
+}
+
+/*
+ * The armed accepts hold a reference to the listen socket, which
+ * closing it in VCA_Shutdown does not drop, so they are cancelled.
+ * Whatever they accepted before the cancel got to them is closed.
+ */
+
+static void
+vca_uring_cancel(struct vca_uring *vcu)
+{
+
+	CHECK_OBJ_NOTNULL(vcu, VCA_URING_MAGIC);
+	if (vcu->cancelled)
+		return;
+	vcu->cancelled = 1;
+	if (vcu->outstanding == 0)
+		return;
+	VURING_CancelAll(vcu->ring, 0);
+	VURING_Flush(vcu->ring);
+}
+
+static void
+vca_uring_destroy(struct vca_uring **vcup)
+{
+	struct vca_uring *vcu;
+	struct vuring_cqe cqe;
+
+	TAKE_OBJ_NOTNULL(vcu, vcup, VCA_URING_MAGIC);
+	vca_uring_cancel(vcu);
+	while (vcu->outstanding > 0) {
+		assert(VURING_Enter(vcu->ring, 1, 1.) >= 0);
+		while (VURING_Reap(vcu->ring, &cqe, 1) == 1) {
+			if (cqe.data == 0)
+				continue;
+			vcu->outstanding--;
+			/* Accepted before the cancel got to it */
+			if (cqe.res >= 0)
+				(void)close(cqe.res);
+		}
+	}
+	VURING_Destroy(&vcu->ring);
+	FREE_OBJ(vcu);
+}
+
+static int
+vca_uring_accept(struct vca_uring *vcu, const struct poolsock *ps,
+    struct wrk_accept *wa)
+{
+	struct vuring_cqe cqe;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(vcu, VCA_URING_MAGIC);
+	while (1) {
+		if (ps->lsock->sock < 0)
+			vca_uring_cancel(vcu);	/* VCA_Shutdown */
+		if (VURING_Reap(vcu->ring, &cqe, 1) == 1) {
+			if (cqe.data == 0)
+				continue;
+			u = (unsigned)cqe.data - 1;
+			assert(u < VCA_URING_NSLOT);
+			AN(vcu->outstanding);
+			vcu->outstanding--;
+			if (vcu->cancelled) {
+				if (cqe.res >= 0)
+					(void)close(cqe.res);
+				continue;
+			}
+			if (cqe.res >= 0) {
+				memcpy(&wa->acceptaddr, &vcu->slot[u].addr,
+				    sizeof wa->acceptaddr);
+				wa->acceptaddrlen = vcu->slot[u].addrlen;
+			}
+			vca_uring_arm(vcu, ps->lsock, u);
+			VURING_Flush(vcu->ring);
+			if (cqe.res >= 0)
+				return (cqe.res);
+			errno = -cqe.res;
+			return (-1);
+		}
+		if (ps->pool->die) {
+			errno = EAGAIN;
+			return (-1);
+		}
+		if (vcu->outstanding == 0) {
+			errno = EBADF;
+			return (-1);
+		}
+		/* Wake up now and then to notice the pool dying */
+		assert(VURING_Enter(vcu->ring, 1, 1.) >= 0);
+	}
+}
+#endif
+
+static int
+vca_tcp_accept_one(const struct poolsock *ps, struct wrk_accept *wa)
+{
+	int i;
+
+#if defined(HAVE_IO_URING)
+	struct vca_uring *vcu;
+
+	if (ps->vca_priv != NULL) {
+		CAST_OBJ_NOTNULL(vcu, ps->vca_priv, VCA_URING_MAGIC);
+		return (vca_uring_accept(vcu, ps, wa));
+	}
+#endif
+	wa->acceptaddrlen = sizeof wa->acceptaddr;
+	do {
+		i = accept(ps->lsock->sock, (void*)&wa->acceptaddr,
+		    &wa->acceptaddrlen);
+	} while (i < 0 && errno == EAGAIN && !ps->pool->die);
+	return (i);
+}
+
 /*--------------------------------------------------------------------
  * This function accepts on a single socket for a single thread pool.
  *
@@ -430,6 +657,9 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	struct listen_sock *ls;
 	struct wrk_accept wa;
 	struct poolsock *ps;
+#if defined(HAVE_IO_URING)
+	struct vca_uring *vcu;
+#endif
 	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -445,17 +675,18 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	if (wrk->wpriv->vcl != NULL)
 		VCL_Rel(&wrk->wpriv->vcl);
 
+#if defined(HAVE_IO_URING)
+	if (ps->vca_priv == NULL && waiter == &waiter_io_uring)
+		ps->vca_priv = vca_uring_new(ls);
+#endif
+
 	while (!ps->pool->die) {
 		INIT_OBJ(&wa, WRK_ACCEPT_MAGIC);
 		wa.acceptlsock = ls;
 
 		vca_pace_check();
 
-		wa.acceptaddrlen = sizeof wa.acceptaddr;
-		do {
-			i = accept(ls->sock, (void*)&wa.acceptaddr,
-			    &wa.acceptaddrlen);
-		} while (i < 0 && errno == EAGAIN && !ps->pool->die);
+		i = vca_tcp_accept_one(ps, &wa);
 
 		if (i < 0 && ps->pool->die)
 			break;
@@ -502,7 +733,7 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 			VSL(SLT_SessError, NO_VXID, "%s %s %s %d %d \"%s\"",
 			    wa.acceptlsock->name, laddr, lport,
 			    ls->sock, i, VAS_errtxt(i));
-			(void)Pool_TrySumstat(wrk);
+			Pool_Sumstat(wrk);
 			continue;
 		}
 
@@ -528,11 +759,39 @@ vca_tcp_accept_task(struct worker *wrk, void *arg)
 	}
 
 	VSL(SLT_Debug, NO_VXID, "XXX Accept thread dies %p", ps);
+#if defined(HAVE_IO_URING)
+	if (ps->vca_priv != NULL) {
+		CAST_OBJ_NOTNULL(vcu, ps->vca_priv, VCA_URING_MAGIC);
+		ps->vca_priv = NULL;
+		vca_uring_destroy(&vcu);
+	}
+#endif
 	FREE_OBJ(ps);
 }
 
+/*--------------------------------------------------------------------
+ * Pool pool_no accepts on the shards s of a reuseport group for which
+ * s == pool_no (modulo thread_pools), so that with at least as many
+ * shards as pools no two pools share one.  With fewer shards, pool_no
+ * falls back to shard pool_no (modulo shards) and pools share.  Either
+ * way every shard gets at least one pool, also as pools are added.
+ * The shards of a dropped pool are taken over by VCA_DestroyPool().
+ */
+
+static int
+vca_tcp_shard_ours(const struct listen_sock *ls, unsigned pool_no)
+{
+	unsigned npools;
+
+	if (ls->nshards < 2)
+		return (1);
+	npools = vmax_t(unsigned, cache_param->wthread_pools, 1);
+	return (ls->shard % npools == pool_no % npools ||
+	    ls->shard == pool_no % ls->nshards);
+}
+
 static void
-vca_tcp_accept(struct pool *pp)
+vca_tcp_accept(struct pool *pp, unsigned pool_no)
 {
 	struct listen_sock *ls;
 	struct poolsock *ps;
@@ -540,6 +799,9 @@ vca_tcp_accept(struct pool *pp)
 	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
 		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
+		if (!vca_tcp_shard_ours(ls, pool_no))
+			continue;
+
 		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
 		AN(ps);
 		ps->lsock = ls;
@@ -547,6 +809,7 @@ vca_tcp_accept(struct pool *pp)
 		ps->task->priv = ps;
 		ps->pool = pp;
 		VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
+		pp->npoolsocks++;
 		AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
 	}
 }
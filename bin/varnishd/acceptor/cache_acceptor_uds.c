@@ -445,7 +445,7 @@ vca_uds_accept_task(struct worker *wrk, void *arg)
 
 			VSL(SLT_SessError, NO_VXID, "%s 0.0.0.0 0 %d %d \"%s\"",
 			    wa.acceptlsock->name, ls->sock, i, VAS_errtxt(i));
-			(void)Pool_TrySumstat(wrk);
+			Pool_Sumstat(wrk);
 			continue;
 		}
 
@@ -475,11 +475,13 @@ vca_uds_accept_task(struct worker *wrk, void *arg)
 }
 
 static void
-vca_uds_accept(struct pool *pp)
+vca_uds_accept(struct pool *pp, unsigned pool_no)
 {
 	struct listen_sock *ls;
 	struct poolsock *ps;
 
+	(void)pool_no;
+
 	VTAILQ_FOREACH(ls, &UDS_acceptor.socks, vcalist) {
 		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 
@@ -490,6 +492,7 @@ vca_uds_accept(struct pool *pp)
 		ps->task->priv = ps;
 		ps->pool = pp;
 		VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
+		pp->npoolsocks++;
 		AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
 	}
 }
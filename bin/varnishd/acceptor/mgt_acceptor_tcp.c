@@ -71,7 +71,10 @@ vca_tcp_opensocket(struct listen_sock *ls)
 		closefd(&ls->sock);
 	}
 
-	ls->sock = VTCP_bind(ls->addr, NULL);
+	if (ls->nshards > 1)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else
+		ls->sock = VTCP_bind(ls->addr, NULL);
 	fail = errno;
 
 	if (ls->sock < 0) {
@@ -85,24 +88,16 @@ vca_tcp_opensocket(struct listen_sock *ls)
 	return (0);
 }
 
-static int v_matchproto_(vss_resolved_f)
-vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
+static int
+vca_tcp_open_shard(struct listen_arg *la, const struct suckaddr *sa,
+    unsigned shard)
 {
-	struct listen_arg *la;
 	struct listen_sock *ls;
 	char abuf[VTCP_ADDRBUFSIZE], pbuf[VTCP_PORTBUFSIZE];
 	char nbuf[VTCP_ADDRBUFSIZE+VTCP_PORTBUFSIZE+2];
 	int fail;
 
-	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
-
-	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
-		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
-
-		if (!VSA_Compare(sa, ls->addr))
-			ARGV_ERR("-a arguments %s and %s have same address\n",
-			    ls->endpoint, la->endpoint);
-	}
+	CHECK_OBJ_NOTNULL(la, LISTEN_ARG_MAGIC);
 
 	ALLOC_OBJ(ls, LISTEN_SOCK_MAGIC);
 	AN(ls);
@@ -117,6 +112,9 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	ls->name = la->name;
 	ls->transport = la->transport;
 	ls->perms = la->perms;
+	ls->shard = shard;
+	ls->nshards = la->nshards;
+	ls->steer = la->steer;
 
 	VJ_master(JAIL_MASTER_PRIVPORT);
 	fail = vca_tcp_opensocket(ls);
@@ -126,10 +124,10 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 		VSA_free(&ls->addr);
 		free(ls->endpoint);
 		FREE_OBJ(ls);
-		if (fail != EAFNOSUPPORT)
+		if (fail != EAFNOSUPPORT || shard > 0)
 			ARGV_ERR("Could not get socket %s: %s\n",
 			    la->endpoint, VAS_errtxt(fail));
-		return (0);
+		return (-1);
 	}
 
 	AZ(ls->uds);
@@ -158,6 +156,38 @@ vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
 	return (0);
 }
 
+static int v_matchproto_(vss_resolved_f)
+vca_tcp_open_cb(void *priv, const struct suckaddr *sa)
+{
+	struct listen_arg *la;
+	struct listen_sock *ls;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
+
+	VTAILQ_FOREACH(ls, &TCP_acceptor.socks, vcalist) {
+		CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+
+		if (!VSA_Compare(sa, ls->addr))
+			ARGV_ERR("-a arguments %s and %s have same address\n",
+			    ls->endpoint, la->endpoint);
+	}
+
+	if (vca_tcp_open_shard(la, sa, 0))
+		return (0);
+
+	/*
+	 * The other shards join the SO_REUSEPORT group of the first one,
+	 * on the port it was given if the argument asked for port zero.
+	 */
+	ls = VTAILQ_LAST(&la->socks, listen_sock_head);
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	for (u = 1; u < la->nshards; u++)
+		AZ(vca_tcp_open_shard(la, ls->addr, u));
+
+	return (0);
+}
+
 
 int
 vca_tcp_open(char **av, struct listen_arg *la, const char **err)
@@ -173,8 +203,13 @@ vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 		ARGV_ERR("Unix domain socket addresses must be"
 		    " absolute paths in -a (%s)\n", la->endpoint);
 
+	la->nshards = 1;
+
 	for (int i = 0; av[i] != NULL; i++) {
-		if (strchr(av[i], '=') == NULL) {
+		char *eq, *val, *p;
+		unsigned long n;
+
+		if ((eq = strchr(av[i], '=')) == NULL) {
 			if (xp != NULL)
 				ARGV_ERR("Too many protocol sub-args"
 				    " in -a (%s)\n", av[i]);
@@ -184,9 +219,45 @@ vca_tcp_open(char **av, struct listen_arg *la, const char **err)
 			continue;
 		}
 
+		val = eq + 1;
+
+		if (!strncmp(av[i], "reuseport=", val - av[i])) {
+			if (la->nshards != 1)
+				ARGV_ERR("Too many reuseport sub-args"
+				    " in -a (%s)\n", av[i]);
+			errno = 0;
+			n = strtoul(val, &p, 10);
+			if (*val == '\0' || *p != '\0' || errno ||
+			    n < 1 || n > 256)
+				ARGV_ERR("Invalid reuseport sub-arg %s"
+				    " in -a\n", val);
+#ifndef SO_REUSEPORT
+			ARGV_ERR("SO_REUSEPORT is not supported"
+			    " on this platform (%s)\n", av[i]);
+#endif
+			la->nshards = n;
+			continue;
+		}
+
+		if (!strncmp(av[i], "steer=", val - av[i])) {
+			if (strcmp(val, "cpu"))
+				ARGV_ERR("Invalid steer sub-arg %s"
+				    " in -a\n", val);
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+			ARGV_ERR("Connection steering is not supported"
+			    " on this platform (%s)\n", av[i]);
+#endif
+			la->steer = 1;
+			continue;
+		}
+
 		ARGV_ERR("Invalid sub-arg %s in -a\n", av[i]);
 	}
 
+	if (la->steer && la->nshards < 2)
+		ARGV_ERR("steer sub-arg requires reuseport in -a (%s)\n",
+		    la->endpoint);
+
 	if (xp == NULL)
 		xp = XPORT_Find("http");
 
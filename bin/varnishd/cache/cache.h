@@ -210,6 +210,7 @@ struct pool_task {
 	VTAILQ_ENTRY(pool_task)		list;
 	task_func_t			*func;
 	void				*priv;
+	vtim_mono			t_queued;
 };
 
 /*
@@ -415,6 +416,10 @@ struct busyobj {
 
 	struct pool_task	fetch_task[1];
 
+	/* Background fetch queue */
+	unsigned		bg_idx;
+	VCL_INT			bg_hits;
+
 #define BERESP_FLAG(l, r, w, f, d) unsigned	l:1;
 #define BEREQ_FLAG(l, r, w, d) BERESP_FLAG(l, r, w, 0, d)
 #include "tbl/bereq_flags.h"
@@ -34,6 +34,9 @@
 
 #include "config.h"
 
+#include <sys/socket.h>
+
+#include <poll.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
@@ -48,6 +51,7 @@
 #include "cache_transport.h"
 #include "cache_vcl.h"
 #include "http1/cache_http1.h"
+#include "http2/cache_http2.h"
 #include "proxy/cache_proxy.h"
 
 #include "VSC_vbe.h"
@@ -73,6 +77,11 @@ static const char * const vbe_proto_ident = "HTTP Backend";
 
 static struct lock backends_mtx;
 
+/* Backends with min_idle or max_idle in warm VCLs, under backends_mtx */
+static VTAILQ_HEAD(, backend) vbe_warm_head =
+    VTAILQ_HEAD_INITIALIZER(vbe_warm_head);
+static pthread_cond_t vbe_warm_cond;
+
 /*--------------------------------------------------------------------*/
 
 void
@@ -134,8 +143,35 @@ VBE_Connect_Error(struct VSC_vbe *vsc, int err)
 #define FIND_BE_TMO(tmx, dst, be)					\
 	FIND_BE_SPEC(tmx, dst, be, -1.0)
 
+/* Time constant of the response time EWMA */
+#define VBE_EWMA_DECAY	10.0
+
+/* Adaptive connection limit, see vbe_limit_sample_locked() */
+#define VBE_LIMIT_SHORT		0.1
+#define VBE_LIMIT_LONG		0.005
+#define VBE_LIMIT_TOLERANCE	1.5
+#define VBE_LIMIT_BACKOFF	0.9
+#define VBE_LIMIT_SMOOTH	0.2
+
+/* Hedging needs this many recent samples */
+#define VBE_TTFB_MIN		32
+#define VBE_TTFB_DECAY		1024
+
+#define BE_LIMIT(be)	\
+	((be)->min_connections > 0 ? (unsigned)(be)->conn_limit :	\
+	    (be)->max_connections)
+
 #define BE_BUSY(be)	\
-	(be->max_connections > 0 && be->n_conn >= be->max_connections)
+	(BE_LIMIT(be) > 0 && be->n_conn >= BE_LIMIT(be))
+
+/*--------------------------------------------------------------------
+ * Latency histograms of VSC_vbe.  They are updated without taking the
+ * director lock.
+ */
+
+#define VBE_HIST(vsc, hist, t)						\
+	(void)__atomic_fetch_add(					\
+	    VSC_vbe_hist_##hist(vsc, VHIST_Bucket(t)), 1, __ATOMIC_RELAXED)
 
 /*--------------------------------------------------------------------*/
 
@@ -162,7 +198,7 @@ vbe_connwait_signal_locked(const struct backend *bp)
 
 	Lck_AssertHeld(bp->director->mtx);
 
-	if (bp->n_conn < bp->max_connections) {
+	if (!BE_BUSY(bp)) {
 		cw = VTAILQ_FIRST(&bp->cw_head);
 		if (cw != NULL) {
 			CHECK_OBJ(cw, CONNWAIT_MAGIC);
@@ -182,27 +218,23 @@ vbe_connwait_fini(struct connwait *cw)
 }
 
 /*--------------------------------------------------------------------
- * Get a connection to the backend
+ * Admit a fetch to the backend, waiting for a slot if it is busy, and
+ * allocate its http_conn.
  *
- * note: wrk is a separate argument because it differs for pipe vs. fetch
+ * HTTP/2 streams are not held to max_connections here, H2F_Get() limits
+ * them to http2_streams on each of the max_connections connections.
  */
 
-static struct pfd *
-vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
-    unsigned force_fresh)
+static int
+vbe_dir_admit(VRT_CTX, VCL_BACKEND dir, struct backend *bp, int stream)
 {
 	struct busyobj *bo;
-	struct pfd *pfd;
-	int *fdp, err;
-	vtim_dur tmod;
-	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
-	char pbuf1[VTCP_PORTBUFSIZE], pbuf2[VTCP_PORTBUFSIZE];
 	unsigned wait_limit;
 	vtim_dur wait_tmod;
 	vtim_dur wait_end;
 	struct connwait cw[1];
+	int err;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
 	bo = ctx->bo;
 	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
@@ -213,7 +245,7 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 		     "backend %s: unhealthy", VRT_BACKEND_string(dir));
 		bp->vsc->unhealthy++;
 		VSC_C_main->backend_unhealthy++;
-		return (NULL);
+		return (-1);
 	}
 	INIT_OBJ(cw, CONNWAIT_MAGIC);
 	PTOK(pthread_cond_init(&cw->cw_cond, NULL));
@@ -221,7 +253,7 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	FIND_BE_PARAM(backend_wait_limit, wait_limit, bp);
 	FIND_BE_TMO(backend_wait_timeout, wait_tmod, bp);
 	cw->cw_state = CW_DO_CONNECT;
-	if (!VTAILQ_EMPTY(&bp->cw_head) || BE_BUSY(bp))
+	if (!stream && (!VTAILQ_EMPTY(&bp->cw_head) || BE_BUSY(bp)))
 		cw->cw_state = CW_BE_BUSY;
 
 	if (cw->cw_state == CW_BE_BUSY && wait_limit > 0 &&
@@ -244,7 +276,9 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 			cw->cw_state = CW_BE_BUSY;
 		}
 	}
-	if (cw->cw_state != CW_BE_BUSY)
+	if (cw->cw_state != CW_BE_BUSY && stream)
+		bp->n_stream++;
+	else if (cw->cw_state != CW_BE_BUSY)
 		bp->n_conn++;
 	Lck_Unlock(bp->director->mtx);
 
@@ -254,8 +288,9 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 		bp->vsc->busy++;
 		VSC_C_main->backend_busy++;
 		vbe_connwait_fini(cw);
-		return (NULL);
+		return (-1);
 	}
+	vbe_connwait_fini(cw);
 
 	AZ(bo->htc);
 	bo->htc = WS_Alloc(bo->ws, sizeof *bo->htc);
@@ -264,16 +299,47 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 		VSLb(bo->vsl, SLT_FetchError, "out of workspace");
 		/* XXX: counter ? */
 		Lck_Lock(bp->director->mtx);
-		bp->n_conn--;
+		if (stream)
+			bp->n_stream--;
+		else
+			bp->n_conn--;
 		vbe_connwait_signal_locked(bp);
 		Lck_Unlock(bp->director->mtx);
-		vbe_connwait_fini(cw);
-		return (NULL);
+		return (-1);
 	}
 	bo->htc->doclose = SC_NULL;
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Get a connection to the backend
+ *
+ * note: wrk is a separate argument because it differs for pipe vs. fetch
+ */
+
+static struct pfd *
+vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
+    unsigned force_fresh)
+{
+	struct busyobj *bo;
+	struct pfd *pfd;
+	int *fdp, err;
+	vtim_dur tmod;
+	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
+	char pbuf1[VTCP_PORTBUFSIZE], pbuf2[VTCP_PORTBUFSIZE];
+	vtim_mono t0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+
+	if (vbe_dir_admit(ctx, dir, bp, 0))
+		return (NULL);
 
 	FIND_TMO(connect_timeout, tmod, bo, bp);
+	t0 = VTIM_mono();
 	pfd = VCP_Get(bp->conn_pool, tmod, wrk, force_fresh, &err);
 	if (pfd == NULL) {
 		Lck_Lock(bp->director->mtx);
@@ -286,11 +352,12 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 		     VRT_BACKEND_string(dir), err, VAS_errtxt(err));
 		VSC_C_main->backend_fail++;
 		bo->htc = NULL;
-		vbe_connwait_fini(cw);
 		return (NULL);
 	}
 
 	VSLb_ts_busyobj(bo, "Connected", W_TIM_real(wrk));
+	if (PFD_State(pfd) != PFD_STATE_STOLEN && !PFD_Warm(pfd))
+		VBE_HIST(bp->vsc, connect, VTIM_mono() - t0);
 	fdp = PFD_Fd(pfd);
 	AN(fdp);
 	assert(*fdp >= 0);
@@ -298,8 +365,16 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	Lck_Lock(bp->director->mtx);
 	bp->vsc->conn++;
 	bp->vsc->req++;
+	if (bp->min_idle > 0 && PFD_Warm(pfd))
+		bp->vsc->prewarm_hit++;
+	else if (bp->min_idle > 0 && PFD_State(pfd) != PFD_STATE_STOLEN)
+		bp->vsc->prewarm_miss++;
 	Lck_Unlock(bp->director->mtx);
 
+	/* Top up what we took */
+	if (bp->min_idle > 0)
+		VCP_Warm(bp->conn_pool, bp->min_idle, bp->max_idle);
+
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
 	err = 0;
@@ -321,7 +396,6 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 		bp->vsc->req--;
 		vbe_connwait_signal_locked(bp);
 		Lck_Unlock(bp->director->mtx);
-		vbe_connwait_fini(cw);
 		return (NULL);
 	}
 	bo->acct.bereq_hdrbytes += err;
@@ -340,46 +414,125 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	    bo->htc->first_byte_timeout, bo, bp);
 	FIND_TMO(between_bytes_timeout,
 	    bo->htc->between_bytes_timeout, bo, bp);
-	vbe_connwait_fini(cw);
 	return (pfd);
 }
 
+/*--------------------------------------------------------------------
+ * Get a stream on one of the HTTP/2 connections to the backend
+ */
+
+static int
+vbe_dir_getstream(VRT_CTX, struct worker *wrk, VCL_BACKEND dir,
+    struct backend *bp)
+{
+	struct busyobj *bo;
+	vtim_dur tmod;
+	int i, err;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	AN(bp->h2f);
+
+	if (vbe_dir_admit(ctx, dir, bp, 1))
+		return (-1);
+
+	INIT_OBJ(bo->htc, HTTP_CONN_MAGIC);
+	bo->htc->doclose = SC_NULL;
+	FIND_TMO(first_byte_timeout,
+	    bo->htc->first_byte_timeout, bo, bp);
+	FIND_TMO(between_bytes_timeout,
+	    bo->htc->between_bytes_timeout, bo, bp);
+	FIND_TMO(connect_timeout, tmod, bo, bp);
+
+	i = H2F_Get(bp->h2f, bo, tmod, bp->max_connections, &err);
+	if (i != 0) {
+		Lck_Lock(bp->director->mtx);
+		if (i < 0)
+			VBE_Connect_Error(bp->vsc, err);
+		assert(bp->n_stream > 0);
+		bp->n_stream--;
+		vbe_connwait_signal_locked(bp);
+		Lck_Unlock(bp->director->mtx);
+		if (i > 0) {
+			VSLb(bo->vsl, SLT_FetchError,
+			     "backend %s: busy", VRT_BACKEND_string(dir));
+			bp->vsc->busy++;
+			VSC_C_main->backend_busy++;
+		} else {
+			VSLb(bo->vsl, SLT_FetchError,
+			     "backend %s: fail errno %d (%s)",
+			     VRT_BACKEND_string(dir), err, VAS_errtxt(err));
+			VSC_C_main->backend_fail++;
+		}
+		bo->htc = NULL;
+		return (-1);
+	}
+
+	VSLb_ts_busyobj(bo, "Connected", W_TIM_real(wrk));
+	Lck_Lock(bp->director->mtx);
+	bp->vsc->conn++;
+	bp->vsc->req++;
+	Lck_Unlock(bp->director->mtx);
+	H2F_Log(bo->htc, bo->vsl, VRT_BACKEND_string(dir));
+	return (0);
+}
+
 static void v_matchproto_(vdi_finish_f)
 vbe_dir_finish(VRT_CTX, VCL_BACKEND d)
 {
 	struct backend *bp;
 	struct busyobj *bo;
 	struct pfd *pfd;
+	unsigned *np;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	bo = ctx->bo;
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+	np = &bp->n_conn;
 
 	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
-	pfd = bo->htc->priv;
-	bo->htc->priv = NULL;
-	if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
+	if (H2F_Owns(bo->htc)) {
+		if (bo->htc->doclose != SC_NULL)
+			VSLb(bo->vsl, SLT_BackendClose, "%d %s close %s",
+			    *bo->htc->rfd, VRT_BACKEND_string(d),
+			    bo->htc->doclose->name);
+		else
+			VSLb(bo->vsl, SLT_BackendClose, "%d %s recycle",
+			    *bo->htc->rfd, VRT_BACKEND_string(d));
+		H2F_Finish(bo);
+		Lck_Lock(bp->director->mtx);
+		if (bo->htc->doclose == SC_NULL)
+			VSC_C_main->backend_recycle++;
+		np = &bp->n_stream;
+	} else if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
+		pfd = bo->htc->priv;
+		bo->htc->priv = NULL;
 		VSLb(bo->vsl, SLT_BackendClose, "%d %s close %s", *PFD_Fd(pfd),
 		    VRT_BACKEND_string(d), bo->htc->doclose->name);
 		VCP_Close(&pfd);
 		AZ(pfd);
 		Lck_Lock(bp->director->mtx);
 	} else {
+		pfd = bo->htc->priv;
+		bo->htc->priv = NULL;
 		assert (PFD_State(pfd) == PFD_STATE_USED);
 		VSLb(bo->vsl, SLT_BackendClose, "%d %s recycle", *PFD_Fd(pfd),
 		    VRT_BACKEND_string(d));
 		Lck_Lock(bp->director->mtx);
-		VSC_C_main->backend_recycle++;
-		VCP_Recycle(bo->wrk, &pfd);
+		if (VCP_Recycle(bo->wrk, &pfd, bp->max_idle))
+			VSC_C_main->backend_recycle++;
 	}
-	assert(bp->n_conn > 0);
-	bp->n_conn--;
+	assert(*np > 0);
+	(*np)--;
 	AN(bp->vsc);
 	bp->vsc->conn--;
+	VBE_HIST(bp->vsc, fetch, VTIM_real() - bo->t_first);
 #define ACCT(foo)	bp->vsc->foo += bo->acct.foo;
 #include "tbl/acct_fields_bereq.h"
 	vbe_connwait_signal_locked(bp);
@@ -387,6 +540,353 @@ vbe_dir_finish(VRT_CTX, VCL_BACKEND d)
 	bo->htc = NULL;
 }
 
+/*--------------------------------------------------------------------
+ * Gradient based connection limit for backends with min_connections,
+ * after the Gradient2 limiter of Netflix' concurrency-limits.
+ *
+ * The time from having a connection to the response headers is kept as
+ * a short and a long term average.  While the short term average does
+ * not exceed the long term one by more than the tolerance, the limit
+ * grows by its square root, provided at least half of it is in use.
+ * Beyond the tolerance, the limit shrinks in proportion, by at most a
+ * half per sample.  Errors on a connection shrink the limit by a tenth.
+ */
+
+static void
+vbe_limit_sample_locked(struct backend *bp, vtim_dur rtt, unsigned failed)
+{
+	double gradient, limit, hi;
+	unsigned old;
+
+	Lck_AssertHeld(bp->director->mtx);
+
+	if (bp->min_connections == 0)
+		return;
+
+	old = BE_LIMIT(bp);
+	limit = bp->conn_limit;
+	if (failed) {
+		limit *= VBE_LIMIT_BACKOFF;
+	} else if (rtt > 0) {
+		if (bp->rtt_long == 0) {
+			bp->rtt_short = rtt;
+			bp->rtt_long = rtt;
+		}
+		bp->rtt_short += (rtt - bp->rtt_short) * VBE_LIMIT_SHORT;
+		bp->rtt_long += (rtt - bp->rtt_long) * VBE_LIMIT_LONG;
+
+		/* Let the long term average recover after a slow period */
+		if (bp->rtt_long > 2 * bp->rtt_short)
+			bp->rtt_long *= 0.95;
+
+		gradient = vmin(1.0, vmax(0.5,
+		    VBE_LIMIT_TOLERANCE * bp->rtt_long / bp->rtt_short));
+		limit = limit * gradient + sqrt(limit);
+		limit = bp->conn_limit * (1 - VBE_LIMIT_SMOOTH) +
+		    limit * VBE_LIMIT_SMOOTH;
+
+		/* Do not grow beyond what is actually used */
+		if (limit > bp->conn_limit && 2 * bp->n_conn < bp->conn_limit)
+			return;
+	} else {
+		return;
+	}
+
+	hi = bp->max_connections > 0 ? bp->max_connections : UINT_MAX;
+	bp->conn_limit = vmin(hi, vmax((double)bp->min_connections, limit));
+	bp->vsc->conn_limit = BE_LIMIT(bp);
+	if (BE_LIMIT(bp) > old)
+		vbe_connwait_signal_locked(bp);
+}
+
+/*--------------------------------------------------------------------
+ * Histogram of recent times from having a connection to the response
+ * headers, in the buckets of the VSC histograms.  Once it holds
+ * VBE_TTFB_DECAY samples, all buckets are halved, so older samples
+ * fade out.
+ */
+
+static void
+vbe_ttfb_sample_locked(struct backend *bp, vtim_dur rtt)
+{
+	unsigned u;
+
+	Lck_AssertHeld(bp->director->mtx);
+
+	bp->ttfb_hist[VHIST_Bucket(rtt)]++;
+	if (++bp->ttfb_n < VBE_TTFB_DECAY)
+		return;
+	bp->ttfb_n = 0;
+	for (u = 0; u <= VHIST_INF; u++) {
+		bp->ttfb_hist[u] >>= 1;
+		bp->ttfb_n += bp->ttfb_hist[u];
+	}
+}
+
+/* Interpolated percentile of the histogram, zero with too few samples */
+
+static vtim_dur
+vbe_ttfb_percentile_locked(const struct backend *bp, double pct)
+{
+	double want, lo;
+	unsigned u, n = 0;
+
+	Lck_AssertHeld(bp->director->mtx);
+
+	if (bp->ttfb_n < VBE_TTFB_MIN)
+		return (0.);
+	want = bp->ttfb_n * pct / 100.;
+	for (u = 0; u < VHIST_INF; u++) {
+		if (n + bp->ttfb_hist[u] >= want)
+			break;
+		n += bp->ttfb_hist[u];
+	}
+	lo = u > 0 ? VHIST_Bound(u - 1) : 0.;
+	if (u == VHIST_INF || bp->ttfb_hist[u] == 0)
+		return (lo);
+	return (lo + (VHIST_Bound(u) - lo) * (want - n) / bp->ttfb_hist[u]);
+}
+
+/*--------------------------------------------------------------------
+ * Peak EWMA of the time until the response headers arrived, including
+ * the wait for a connection.  A sample above the average replaces it,
+ * lower ones are blended in with a weight which grows with the time
+ * since the previous sample.
+ *
+ * The same sample feeds the adaptive connection limit with rtt, the
+ * time spent on the connection, or an error on a connection.
+ */
+
+static void
+vbe_ewma_sample(struct backend *bp, vtim_dur rt, vtim_dur rtt,
+    unsigned failed)
+{
+	vtim_mono now;
+	double w;
+
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	now = VTIM_mono();
+	Lck_Lock(bp->director->mtx);
+	if (bp->ewma_t > 0 && rt < bp->ewma) {
+		w = exp((bp->ewma_t - now) / VBE_EWMA_DECAY);
+		bp->ewma = bp->ewma * w + rt * (1 - w);
+	} else {
+		bp->ewma = rt;
+	}
+	bp->ewma_t = now;
+	if (rtt > 0 && !failed)
+		vbe_ttfb_sample_locked(bp, rtt);
+	vbe_limit_sample_locked(bp, rtt, failed);
+	Lck_Unlock(bp->director->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Hedged requests
+ *
+ * A cacheable GET without a body, which has not seen any response by
+ * the backend_hedge_percentile of recent response times, is sent once
+ * more to whatever the director picks now.  The first connection with
+ * response bytes to read wins, the other one is closed.  A connection
+ * which fails or is closed by the backend first loses to the other one.
+ *
+ * The copy of the bereq is accounted to the backend which loses, so
+ * the bereq bytes of the busyobj are only counted once.
+ */
+
+static vdi_gethdrs_f vbe_dir_gethdrs;
+
+static int
+vbe_hedge_ok(const struct busyobj *bo)
+{
+
+	return (cache_param->backend_hedge_percentile > 0. &&
+	    !bo->uncacheable && bo->bereq_body == NULL && bo->req == NULL &&
+	    http_method_eq(bo->bereq->hd[HTTP_HDR_METHOD].b, GET));
+}
+
+/* 1: response bytes to read, -1: failed or closed, 0: nothing yet */
+
+static int
+vbe_hedge_ready(const struct pollfd *pfd)
+{
+	ssize_t l;
+	char c;
+
+	if (pfd->revents == 0)
+		return (0);
+	if (pfd->revents & (POLLERR | POLLNVAL))
+		return (-1);
+	l = recv(pfd->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (l > 0)
+		return (1);
+	if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+	    errno == EINTR))
+		return (0);
+	return (-1);
+}
+
+static void
+vbe_hedge_close(struct busyobj *bo, VCL_BACKEND d, struct http_conn *htc,
+    uint64_t hdrbytes, uint64_t bodybytes)
+{
+	struct backend *bp;
+	struct pfd *pfd;
+
+	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+
+	pfd = htc->priv;
+	htc->priv = NULL;
+	VSLb(bo->vsl, SLT_BackendClose, "%d %s close %s", *PFD_Fd(pfd),
+	    VRT_BACKEND_string(d), SC_RX_TIMEOUT->name);
+	VCP_Close(&pfd);
+	AZ(pfd);
+	Lck_Lock(bp->director->mtx);
+	assert(bp->n_conn > 0);
+	bp->n_conn--;
+	bp->vsc->conn--;
+	bp->vsc->bereq_hdrbytes += hdrbytes;
+	bp->vsc->bereq_bodybytes += bodybytes;
+	vbe_connwait_signal_locked(bp);
+	Lck_Unlock(bp->director->mtx);
+}
+
+static struct pfd *
+vbe_hedge(VRT_CTX, VCL_BACKEND *dp, struct pfd *pfd, vtim_mono *t1)
+{
+	struct busyobj *bo;
+	struct backend *bp, *bp2;
+	struct http_conn *htc;
+	struct pollfd pfds[2];
+	struct pfd *pfd2;
+	VCL_BACKEND d2;
+	vtim_dur delay;
+	vtim_mono t0, t2;
+	uint64_t hdrbytes = 0, bodybytes = 0;
+	int i, r0, r1;
+
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(bp, (*dp)->priv, BACKEND_MAGIC);
+	htc = bo->htc;
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+
+	Lck_Lock(bp->director->mtx);
+	delay = vbe_ttfb_percentile_locked(bp,
+	    cache_param->backend_hedge_percentile);
+	Lck_Unlock(bp->director->mtx);
+	if (delay <= 0. || delay >= htc->first_byte_timeout)
+		return (pfd);
+
+	t0 = VTIM_mono();
+	memset(pfds, 0, sizeof pfds);
+	pfds[0].fd = *PFD_Fd(pfd);
+	pfds[0].events = POLLIN;
+	if (poll(pfds, 1, VTIM_poll_tmo(delay)) != 0)
+		return (pfd);
+
+	d2 = VRT_DirectorResolve(ctx, bo->director_req);
+	if (d2 == NULL || d2->vdir->methods->gethdrs != vbe_dir_gethdrs)
+		return (pfd);
+	CAST_OBJ_NOTNULL(bp2, d2->priv, BACKEND_MAGIC);
+	if (bp2->h2f != NULL)
+		return (pfd);
+
+	bo->htc = NULL;
+	pfd2 = vbe_dir_getfd(ctx, bo->wrk, d2, bp2, 0);
+	if (pfd2 == NULL) {
+		AZ(bo->htc);
+		bo->htc = htc;
+		return (pfd);
+	}
+	t2 = VTIM_mono();
+	bo->wrk->stats->backend_hedge++;
+	i = V1F_SendReq(bo->wrk, bo, &hdrbytes, &bodybytes);
+	if (i == 0 && PFD_State(pfd2) != PFD_STATE_USED &&
+	    VCP_Wait(bo->wrk, pfd2, VTIM_real() + delay) != 0)
+		i = -1;
+	if (i != 0 || bo->htc->doclose != SC_NULL) {
+		vbe_hedge_close(bo, d2, bo->htc, hdrbytes, bodybytes);
+		bo->htc = htc;
+		return (pfd);
+	}
+
+	pfds[1].fd = *PFD_Fd(pfd2);
+	pfds[1].events = POLLIN;
+	(void)poll(pfds, 2, VTIM_poll_tmo(htc->first_byte_timeout -
+	    (VTIM_mono() - t0)));
+	r0 = vbe_hedge_ready(&pfds[0]);
+	r1 = vbe_hedge_ready(&pfds[1]);
+
+	if (r0 > 0 || r1 < 0 || r0 == r1) {
+		/* The original connection answered first or is no worse */
+		vbe_hedge_close(bo, d2, bo->htc, hdrbytes, bodybytes);
+		bo->htc = htc;
+		htc->first_byte_timeout =
+		    vmax(0., htc->first_byte_timeout - (VTIM_mono() - t0));
+		return (pfd);
+	}
+
+	/* The hedge answered, or the original connection failed */
+	vbe_hedge_close(bo, *dp, htc, hdrbytes, bodybytes);
+	if (r1 > 0)
+		bo->wrk->stats->backend_hedge_won++;
+	VRT_Assign_Backend(&bo->director_resp, d2);
+	bo->htc->first_byte_timeout =
+	    vmax(0., bo->htc->first_byte_timeout - (VTIM_mono() - t2));
+	*dp = d2;
+	*t1 = t2;
+	return (pfd2);
+}
+
+/*
+ * Fetch over HTTP/2, with one more attempt if the stream was refused
+ * or its connection went away before the response headers.
+ */
+
+static int
+vbe_h2_gethdrs(VRT_CTX, VCL_BACKEND d, struct backend *bp)
+{
+	int i, extrachance = 1;
+	struct busyobj *bo;
+	struct worker *wrk;
+	vtim_mono t0, t1 = 0, now;
+	vtim_dur tmo;
+
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	wrk = bo->wrk;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+
+	t0 = VTIM_mono();
+	do {
+		if (vbe_dir_getstream(ctx, wrk, d, bp))
+			break;
+		t1 = VTIM_mono();
+		i = H2F_SendReq(wrk, bo);
+		if (i == 0)
+			i = H2F_FetchRespHdr(bo);
+		if (i == 0) {
+			http_VSL_log(bo->beresp);
+			now = VTIM_mono();
+			VBE_HIST(bp->vsc, ttfb, now - t1);
+			vbe_ewma_sample(bp, now - t0, now - t1, 0);
+			return (0);
+		}
+		vbe_dir_finish(ctx, d);
+		AZ(bo->htc);
+		if (i < 0 || extrachance == 0)
+			break;
+		if (bo->no_retry != NULL)
+			break;
+		VSC_C_main->backend_retry++;
+	} while (extrachance--);
+
+	FIND_BE_TMO(first_byte_timeout, tmo, bp);
+	vbe_ewma_sample(bp, vmax(VTIM_mono() - t0, tmo), 0, t1 > 0);
+	return (-1);
+}
+
 static int v_matchproto_(vdi_gethdrs_f)
 vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 {
@@ -395,6 +895,8 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 	struct pfd *pfd;
 	struct busyobj *bo;
 	struct worker *wrk;
+	vtim_mono t0, t1 = 0, now;
+	vtim_dur tmo;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
@@ -415,12 +917,17 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp->hosthdr != NULL)
 		http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
 
+	if (bp->h2f != NULL && bo->bereq_body == NULL && bo->req == NULL)
+		return (vbe_h2_gethdrs(ctx, d, bp));
+
+	t0 = VTIM_mono();
 	do {
 		if (bo->htc != NULL)
 			CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 		pfd = vbe_dir_getfd(ctx, wrk, d, bp, extrachance == 0 ? 1 : 0);
 		if (pfd == NULL)
-			return (-1);
+			break;
+		t1 = VTIM_mono();
 		AN(bo->htc);
 		CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 		if (PFD_State(pfd) != PFD_STATE_STOLEN)
@@ -439,6 +946,11 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 			}
 		}
 
+		if (i == 0 && bo->htc->doclose == SC_NULL && vbe_hedge_ok(bo)) {
+			pfd = vbe_hedge(ctx, &d, pfd, &t1);
+			CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+		}
+
 		if (bo->htc->doclose == SC_NULL) {
 			assert(PFD_State(pfd) == PFD_STATE_USED);
 			if (i == 0)
@@ -446,6 +958,9 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 			if (i == 0) {
 				AN(bo->htc->priv);
 				http_VSL_log(bo->beresp);
+				now = VTIM_mono();
+				VBE_HIST(bp->vsc, ttfb, now - t1);
+				vbe_ewma_sample(bp, now - t0, now - t1, 0);
 				return (0);
 			}
 		}
@@ -464,6 +979,10 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 			break;
 		VSC_C_main->backend_retry++;
 	} while (extrachance--);
+
+	/* Failures count as slow as the first byte timeout */
+	FIND_BE_TMO(first_byte_timeout, tmo, bp);
+	vbe_ewma_sample(bp, vmax(VTIM_mono() - t0, tmo), 0, t1 > 0);
 	return (-1);
 }
 
@@ -476,6 +995,8 @@ vbe_dir_getip(VRT_CTX, VCL_BACKEND d)
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(ctx->bo->htc, HTTP_CONN_MAGIC);
+	if (H2F_Owns(ctx->bo->htc))
+		return (H2F_GetIp(ctx->bo->htc));
 	pfd = ctx->bo->htc->priv;
 
 	return (VCP_GetIp(pfd));
@@ -535,6 +1056,64 @@ vbe_dir_http1pipe(VRT_CTX, VCL_BACKEND d)
 
 /*--------------------------------------------------------------------*/
 
+/*--------------------------------------------------------------------
+ * The warmer keeps the min_idle connections of healthy backends in warm
+ * VCLs, and applies max_idle to their connection pools.
+ */
+
+static int
+vbe_warm_sick(const struct backend *bp)
+{
+	const struct vdi_ahealth *ah;
+
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	CHECK_OBJ_NOTNULL(bp->director, DIRECTOR_MAGIC);
+	ah = bp->director->vdir->admin_health;
+	return (ah == VDI_AH_SICK || (ah == VDI_AH_AUTO && bp->sick));
+}
+
+static void
+vbe_warm_list(struct backend *bp, unsigned warm)
+{
+
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	if (bp->min_idle == 0 && bp->max_idle == 0)
+		return;
+	Lck_Lock(&backends_mtx);
+	if (warm && !bp->warm_listed) {
+		VTAILQ_INSERT_TAIL(&vbe_warm_head, bp, warm_list);
+		bp->warm_listed = 1;
+		PTOK(pthread_cond_signal(&vbe_warm_cond));
+	} else if (!warm && bp->warm_listed) {
+		VTAILQ_REMOVE(&vbe_warm_head, bp, warm_list);
+		bp->warm_listed = 0;
+	}
+	Lck_Unlock(&backends_mtx);
+}
+
+static void * v_matchproto_(bgthread_t)
+vbe_warmer(struct worker *wrk, void *priv)
+{
+	struct backend *bp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	Lck_Lock(&backends_mtx);
+	while (1) {
+		VTAILQ_FOREACH(bp, &vbe_warm_head, warm_list) {
+			CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+			if (bp->director != NULL && !vbe_warm_sick(bp))
+				VCP_Warm(bp->conn_pool, bp->min_idle,
+				    bp->max_idle);
+		}
+		(void)Lck_CondWaitTimeout(&vbe_warm_cond, &backends_mtx, 1.0);
+	}
+	NEEDLESS(Lck_Unlock(&backends_mtx));
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------*/
+
 static void
 vbe_dir_event(const struct director *d, enum vcl_event_e ev)
 {
@@ -547,7 +1126,9 @@ vbe_dir_event(const struct director *d, enum vcl_event_e ev)
 		VRT_VSC_Reveal(bp->vsc_seg);
 		if (bp->probe != NULL)
 			VBP_Control(bp, 1);
+		vbe_warm_list(bp, 1);
 	} else if (ev == VCL_EVENT_COLD) {
+		vbe_warm_list(bp, 0);
 		if (bp->probe != NULL)
 			VBP_Control(bp, 0);
 		VRT_VSC_Hide(bp->vsc_seg);
@@ -569,9 +1150,12 @@ vbe_free(struct backend *be)
 
 	CHECK_OBJ_NOTNULL(be, BACKEND_MAGIC);
 
+	vbe_warm_list(be, 0);
 	if (be->probe != NULL)
 		VBP_Remove(be);
 
+	if (be->h2f != NULL)
+		H2F_Destroy(&be->h2f);
 	VSC_vbe_Destroy(&be->vsc_seg);
 	Lck_Lock(&backends_mtx);
 	VSC_C_main->n_backend--;
@@ -612,6 +1196,7 @@ vbe_panic(const struct director *d, struct vsb *vsb)
 	VCP_Panic(vsb, bp->conn_pool);
 	VSB_printf(vsb, "hosthdr = %s,\n", bp->hosthdr);
 	VSB_printf(vsb, "n_conn = %u,\n", bp->n_conn);
+	VSB_printf(vsb, "n_stream = %u,\n", bp->n_stream);
 }
 
 /*--------------------------------------------------------------------
@@ -841,6 +1426,10 @@ VRT_new_backend_clustered(VRT_CTX, struct vsmw_cluster *vc,
 #undef DA
 #undef DN
 
+	if (be->max_connections > 0 && be->min_connections > be->max_connections)
+		be->min_connections = be->max_connections;
+	be->conn_limit = be->min_connections;
+
 #define CPTMO(a, b, x) do {				\
 		if ((a)->x < 0.0 || isnan((a)->x))	\
 			(a)->x = (b)->x;		\
@@ -871,6 +1460,7 @@ VRT_new_backend_clustered(VRT_CTX, struct vsmw_cluster *vc,
 	be->vsc = VSC_vbe_New(vc, &be->vsc_seg,
 	    "%s.%s", VCL_Name(ctx->vcl), vrt->vcl_name);
 	AN(be->vsc);
+	be->vsc->conn_limit = be->min_connections;
 	if (! vcl->temp->is_warm)
 		VRT_VSC_Hide(be->vsc_seg);
 
@@ -884,6 +1474,11 @@ VRT_new_backend_clustered(VRT_CTX, struct vsmw_cluster *vc,
 	be->conn_pool = VCP_Ref(vep, vbe_proto_ident);
 	AN(be->conn_pool);
 
+	/* The PROXY header is per client, so it needs HTTP/1 */
+	if (be->http2_streams > 0 && be->proxy_header == 0)
+		be->h2f = H2F_New(be->conn_pool, be->http2_streams,
+		    vep->uds_path != NULL, be->vsc);
+
 	vbp = vrt->probe;
 	if (vbp == NULL)
 		vbp = VCL_DefaultProbe(vcl);
@@ -909,7 +1504,9 @@ VRT_new_backend_clustered(VRT_CTX, struct vsmw_cluster *vc,
 	}
 	/* for cold VCL, update initial director state */
 	if (be->probe != NULL)
-		VBP_Update_Backend(be->probe);
+		VBP_Update_Backend(be);
+	if (vcl->temp->is_warm)
+		vbe_warm_list(be, 1);
 	return (be->director);
 }
 
@@ -937,11 +1534,46 @@ VRT_delete_backend(VRT_CTX, VCL_BACKEND *dp)
 	VRT_Assign_Backend(dp, NULL);
 }
 
+/*--------------------------------------------------------------------
+ * Report the fetches in progress on a backend and its response time
+ * EWMA, decayed towards zero since the last sample.  Returns zero if the
+ * director is not a backend.
+ */
+
+int
+VRT_BackendLoad(VRT_CTX, VCL_BACKEND d, unsigned *inflight,
+    VCL_DURATION *ewma)
+{
+	struct backend *bp;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	AN(inflight);
+	AN(ewma);
+	CHECK_OBJ_NOTNULL(d->vdir, VCLDIR_MAGIC);
+
+	if (d->vdir->methods != vbe_methods &&
+	    d->vdir->methods != vbe_methods_noprobe)
+		return (0);
+	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+
+	Lck_Lock(bp->director->mtx);
+	*inflight = bp->n_conn + bp->n_stream;
+	*ewma = bp->ewma;
+	if (bp->ewma_t > 0)
+		*ewma *= exp((bp->ewma_t - VTIM_mono()) / VBE_EWMA_DECAY);
+	Lck_Unlock(bp->director->mtx);
+	return (1);
+}
+
 /*---------------------------------------------------------------------*/
 
 void
 VBE_InitCfg(void)
 {
+	pthread_t thr;
 
 	Lck_New(&backends_mtx, lck_vbe);
+	PTOK(pthread_cond_init(&vbe_warm_cond, NULL));
+	WRK_BgThread(&thr, "backend-warmer", vbe_warmer, NULL);
 }
@@ -44,6 +44,7 @@ struct vrt_ctx;
 struct vrt_backend_probe;
 struct conn_pool;
 struct connwait;
+struct h2f_pool;
 
 /*--------------------------------------------------------------------
  * An instance of a backend from a VCL program.
@@ -54,6 +55,7 @@ struct backend {
 #define BACKEND_MAGIC		0x64c4c7c6
 
 	unsigned		n_conn;
+	unsigned		n_stream;
 
 	struct vrt_endpoint	*endpoint;
 
@@ -63,16 +65,31 @@ struct backend {
 	vtim_real		changed;
 
 	struct vbp_target	*probe;
+	VTAILQ_ENTRY(backend)	probe_list;
 
 	struct vsc_seg		*vsc_seg;
 	struct VSC_vbe		*vsc;
 
 	struct conn_pool	*conn_pool;
+	struct h2f_pool		*h2f;
 
 	VCL_BACKEND		director;
 
 	VTAILQ_HEAD(, connwait)	cw_head;
 	unsigned		cw_count;
+
+	VTAILQ_ENTRY(backend)	warm_list;
+	unsigned		warm_listed;
+
+	vtim_dur		ewma;
+	vtim_mono		ewma_t;
+
+	double			conn_limit;
+	vtim_dur		rtt_short;
+	vtim_dur		rtt_long;
+
+	unsigned		ttfb_n;
+	unsigned		ttfb_hist[VHIST_INF + 1];
 };
 
 /*---------------------------------------------------------------------
@@ -80,11 +97,11 @@ struct backend {
  */
 
 /* cache_backend_probe.c */
-void VBP_Update_Backend(struct vbp_target *vt);
+void VBP_Update_Backend(struct backend *b);
 void VBP_Insert(struct backend *b, struct vrt_backend_probe const *p,
     struct conn_pool *);
 void VBP_Remove(struct backend *b);
-void VBP_Control(const struct backend *b, int stop);
+void VBP_Control(struct backend *b, int stop);
 void VBP_Status(struct vsb *, const struct backend *, int details, int json);
 void VBE_Connect_Error(struct VSC_vbe *, int err);
 
@@ -30,10 +30,15 @@
  *
  * Poll backends for collection of health statistics
  *
- * We co-opt threads from the worker pool for probing the backends,
- * but we want to avoid a potentially messy cleanup operation when we
- * retire the backend, so the thread owns the health information, which
- * the backend references, rather than the other way around.
+ * The probes run on a few dedicated threads, each of which polls the
+ * connections of all the probes it has in progress, so probing does not
+ * take worker threads from client traffic.
+ *
+ * Backends with identical probes of the same endpoint, typically the
+ * same backend in several VCLs, share one target.  We want to avoid a
+ * potentially messy cleanup operation when we retire a backend, so the
+ * target owns the health information, which the backends reference,
+ * rather than the other way around.
  *
  */
 
@@ -46,6 +51,7 @@
 #include "cache_varnishd.h"
 
 #include "vbh.h"
+#include "vfil.h"
 #include "vsa.h"
 #include "vtcp.h"
 #include "vtim.h"
@@ -76,7 +82,10 @@ struct vbp_target {
 
 	VRT_BACKEND_PROBE_FIELDS()
 
-	struct backend			*backend;
+	VTAILQ_HEAD(, backend)		backends;
+	unsigned			n_enabled;
+	unsigned			proxy_header;
+	VRBT_ENTRY(vbp_target)		entry;
 	struct conn_pool		*conn_pool;
 
 	char				*req;
@@ -96,12 +105,43 @@ struct vbp_target {
 	vtim_real			due;
 	const struct vbp_state		*state;
 	int				heap_idx;
-	struct pool_task		task[1];
+
+	/* Probe in progress */
+	VTAILQ_ENTRY(vbp_target)	poll_list;
+	const struct suckaddr		*sa;
+	int				fd;
+	short				events;
+	unsigned			rlen;
+	vtim_real			t_start;
+	vtim_real			t_end;
+};
+
+VTAILQ_HEAD(vbp_target_head, vbp_target);
+
+struct vbp_poller {
+	unsigned			magic;
+#define VBP_POLLER_MAGIC		0x0f8d3b9e
+	int				pipe[2];
+	struct vbp_target_head		queue;
 };
 
 static struct lock			vbp_mtx;
 static pthread_cond_t			vbp_cond;
 static struct vbh			*vbp_heap;
+static struct vbp_poller		*vbp_poller;
+static unsigned				vbp_npoller;
+static unsigned				vbp_nxt;
+
+static int vbp_target_cmp(const struct vbp_target *, const struct vbp_target *);
+
+static VRBT_HEAD(vbp_tree, vbp_target) vbp_targets =
+    VRBT_INITIALIZER(&vbp_targets);
+VRBT_GENERATE_REMOVE_COLOR(vbp_tree, vbp_target, entry, static)
+VRBT_GENERATE_REMOVE(vbp_tree, vbp_target, entry, static)
+VRBT_GENERATE_FIND(vbp_tree, vbp_target, entry, vbp_target_cmp, static)
+VRBT_GENERATE_INSERT_COLOR(vbp_tree, vbp_target, entry, static)
+VRBT_GENERATE_INSERT_FINISH(vbp_tree, vbp_target, entry, static)
+VRBT_GENERATE_INSERT(vbp_tree, vbp_target, entry, vbp_target_cmp, static)
 
 static const unsigned char vbp_proxy_local[] = {
 	0x0d, 0x0a, 0x0d, 0x0a, 0x00, 0x0d, 0x0a, 0x51,
@@ -116,6 +156,8 @@ vbp_delete(struct vbp_target *vt)
 	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
 
 	assert(vt->heap_idx == VBH_NOIDX);
+	assert(VTAILQ_EMPTY(&vt->backends));
+	assert(vt->fd < 0);
 
 #define DN(x)	/**/
 	VRT_BACKEND_PROBE_HANDLE();
@@ -167,42 +209,74 @@ vbp_has_poked(struct vbp_target *vt)
 	vt->good = j;
 }
 
-void
-VBP_Update_Backend(struct vbp_target *vt)
+static void
+vbp_bits(const struct vbp_target *vt, char *bits, size_t len)
 {
-	unsigned i = 0, chg;
-	char bits[10];
-
-	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+	unsigned i = 0;
 
 #define BITMAP(n, c, t, b)			\
 	bits[i++] = (vt->n & 1) ? c : '-';
 #include "tbl/backend_poll.h"
 	bits[i] = '\0';
-	assert(i < sizeof bits);
+	assert(i < len);
+}
 
-	Lck_Lock(&vbp_mtx);
-	if (vt->backend == NULL) {
-		Lck_Unlock(&vbp_mtx);
-		return;
-	}
+static void
+vbp_update_backend(const struct vbp_target *vt, struct backend *be,
+    const char *bits)
+{
+	unsigned i, chg;
+
+	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+	CHECK_OBJ_NOTNULL(be, BACKEND_MAGIC);
+	Lck_AssertHeld(&vbp_mtx);
 
 	i = (vt->good < vt->threshold);
-	chg = (i != vt->backend->sick);
-	vt->backend->sick = i;
-	if (i && chg && vt->backend->director != NULL)
-		VDI_Event(vt->backend->director, VDI_EVENT_SICK);
+	chg = (i != be->sick);
+	be->sick = i;
+	if (i && chg && be->director != NULL)
+		VDI_Event(be->director, VDI_EVENT_SICK);
 
-	AN(vt->backend->vcl_name);
+	AN(be->vcl_name);
 	VSL(SLT_Backend_health, NO_VXID,
 	    "%s %s %s %s %u %u %u %.6f %.6f \"%s\"",
-	    vt->backend->vcl_name, chg ? "Went" : "Still",
+	    be->vcl_name, chg ? "Went" : "Still",
 	    i ? "sick" : "healthy", bits,
 	    vt->good, vt->threshold, vt->window,
 	    vt->last, vt->avg, vt->resp_buf);
-	vt->backend->vsc->happy = vt->happy;
+	be->vsc->happy = vt->happy;
 	if (chg)
-		vt->backend->changed = VTIM_real();
+		be->changed = VTIM_real();
+}
+
+static void
+vbp_update_backends(const struct vbp_target *vt)
+{
+	struct backend *be;
+	char bits[10];
+
+	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+	vbp_bits(vt, bits, sizeof bits);
+
+	Lck_Lock(&vbp_mtx);
+	VTAILQ_FOREACH(be, &vt->backends, probe_list)
+		vbp_update_backend(vt, be, bits);
+	Lck_Unlock(&vbp_mtx);
+}
+
+void
+VBP_Update_Backend(struct backend *be)
+{
+	struct vbp_target *vt;
+	char bits[10];
+
+	CHECK_OBJ_NOTNULL(be, BACKEND_MAGIC);
+	vt = be->probe;
+	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+	vbp_bits(vt, bits, sizeof bits);
+
+	Lck_Lock(&vbp_mtx);
+	vbp_update_backend(vt, be, bits);
 	Lck_Unlock(&vbp_mtx);
 }
 
@@ -286,31 +360,51 @@ vbp_write_proxy_v1(struct vbp_target *vt, int *sock)
 }
 
 static void
-vbp_poke(struct vbp_target *vt)
-{
-	int s, i, proxy_header, err;
-	vtim_real t_start, t_now, t_end;
-	vtim_dur tmo;
-	unsigned rlen, resp;
-	char buf[8192], *p;
-	struct pollfd pfda[1], *pfd = pfda;
-	const struct suckaddr *sa;
-
-	t_start = t_now = VTIM_real();
-	t_end = t_start + vt->timeout;
-
-	s = VCP_Open(vt->conn_pool, t_end - t_now, &sa, &err);
-	if (s < 0) {
-		bprintf(vt->resp_buf, "Open error %d (%s)", err, VAS_errtxt(err));
-		Lck_Lock(&vbp_mtx);
-		if (vt->backend)
-			VBE_Connect_Error(vt->backend->vsc, err);
-		Lck_Unlock(&vbp_mtx);
-		return;
+vbp_open_error(struct vbp_target *vt, int err)
+{
+	struct backend *be;
+
+	bprintf(vt->resp_buf, "Open error %d (%s)", err, VAS_errtxt(err));
+	Lck_Lock(&vbp_mtx);
+	VTAILQ_FOREACH(be, &vt->backends, probe_list)
+		VBE_Connect_Error(be->vsc, err);
+	Lck_Unlock(&vbp_mtx);
+}
+
+static int
+vbp_poke_open(struct vbp_target *vt)
+{
+	int err;
+
+	vt->t_start = VTIM_real();
+	vt->t_end = vt->t_start + vt->timeout;
+	vt->rlen = 0;
+
+	vt->fd = VCP_Open(vt->conn_pool, -1, &vt->sa, &err);
+	if (vt->fd < 0) {
+		vbp_open_error(vt, err);
+		return (-1);
 	}
+	return (0);
+}
+
+/* Returns zero once sent, positive while connecting, negative on errors */
+
+static int
+vbp_poke_send(struct vbp_target *vt)
+{
+	int i, err;
 
-	i = VSA_Get_Proto(sa);
-	if (VSA_Compare(sa, bogo_ip) == 0)
+	i = VCP_Connected(vt->conn_pool, &vt->fd, &vt->sa, &err);
+	if (i > 0)
+		return (1);
+	if (i < 0) {
+		vbp_open_error(vt, err);
+		return (-1);
+	}
+
+	i = VSA_Get_Proto(vt->sa);
+	if (VSA_Compare(vt->sa, bogo_ip) == 0)
 		vt->good_unix |= 1;
 	else if (i == AF_INET)
 		vt->good_ipv4 |= 1;
@@ -319,101 +413,94 @@ vbp_poke(struct vbp_target *vt)
 	else
 		WRONG("Wrong probe protocol family");
 
-	t_now = VTIM_real();
-	tmo = t_end - t_now;
-	if (tmo <= 0) {
-		bprintf(vt->resp_buf,
-			"Open timeout %.3fs exceeded by %.3fs",
-			vt->timeout, -tmo);
-		VTCP_close(&s);
-		return;
-	}
-
-	Lck_Lock(&vbp_mtx);
-	if (vt->backend != NULL)
-		proxy_header = vt->backend->proxy_header;
-	else
-		proxy_header = -1;
-	Lck_Unlock(&vbp_mtx);
-
-	if (proxy_header < 0) {
-		bprintf(vt->resp_buf, "%s", "No backend");
-		VTCP_close(&s);
-		return;
-	}
-
 	/* Send the PROXY header */
-	assert(proxy_header <= 2);
-	if (proxy_header == 1) {
-		if (vbp_write_proxy_v1(vt, &s) != 0)
-			return;
-	} else if (proxy_header == 2 &&
-	    vbp_write(vt, &s, vbp_proxy_local, sizeof vbp_proxy_local) != 0)
-		return;
+	assert(vt->proxy_header <= 2);
+	if (vt->proxy_header == 1) {
+		if (vbp_write_proxy_v1(vt, &vt->fd) != 0)
+			return (-1);
+	} else if (vt->proxy_header == 2 &&
+	    vbp_write(vt, &vt->fd, vbp_proxy_local,
+	    sizeof vbp_proxy_local) != 0)
+		return (-1);
 
 	/* Send the request */
-	if (vbp_write(vt, &s, vt->req, vt->req_len) != 0)
-		return;
+	if (vbp_write(vt, &vt->fd, vt->req, vt->req_len) != 0)
+		return (-1);
 
 	vt->good_xmit |= 1;
+	return (0);
+}
 
-	pfd->fd = s;
-	rlen = 0;
-	while (1) {
-		pfd->events = POLLIN;
-		pfd->revents = 0;
-		t_now = VTIM_real();
-		tmo = t_end - t_now;
-		if (tmo <= 0) {
-			bprintf(vt->resp_buf,
-			    "Poll timeout %.3fs exceeded by %.3fs",
-			    vt->timeout, -tmo);
-			i = -1;
-			break;
-		}
-		i = poll(pfd, 1, VTIM_poll_tmo(tmo));
-		if (i <= 0) {
-			if (!i) {
-				if (!vt->exp_close)
-					break;
-				errno = ETIMEDOUT;
-			}
-			bprintf(vt->resp_buf, "Poll error %d (%s)",
-			    errno, VAS_errtxt(errno));
-			i = -1;
-			break;
-		}
-		if (rlen < sizeof vt->resp_buf)
-			i = read(s, vt->resp_buf + rlen,
-			    sizeof vt->resp_buf - rlen);
-		else
-			i = read(s, buf, sizeof buf);
-		VTCP_Assert(i);
-		if (i <= 0) {
-			if (i < 0)
-				bprintf(vt->resp_buf, "Read error %d (%s)",
-					errno, VAS_errtxt(errno));
-			break;
-		}
-		rlen += i;
-	}
+/* Returns zero to keep polling, positive on a response, negative on errors */
 
-	VTCP_close(&s);
+static int
+vbp_poke_recv(struct vbp_target *vt, char *buf, size_t len)
+{
+	int i;
 
+	if (vt->rlen < sizeof vt->resp_buf)
+		i = read(vt->fd, vt->resp_buf + vt->rlen,
+		    sizeof vt->resp_buf - vt->rlen);
+	else
+		i = read(vt->fd, buf, len);
+	VTCP_Assert(i);
 	if (i < 0) {
-		/* errno reported above */
+		bprintf(vt->resp_buf, "Read error %d (%s)",
+			errno, VAS_errtxt(errno));
 		vt->err_recv |= 1;
-		return;
+		return (-1);
+	}
+	if (i == 0)
+		return (1);
+	vt->rlen += i;
+	return (0);
+}
+
+static int
+vbp_poke_event(struct vbp_target *vt, short revents, vtim_real now,
+    char *buf, size_t len)
+{
+	int i;
+
+	if (revents == 0) {
+		if (now < vt->t_end)
+			return (0);
+		if (vt->events == POLLOUT) {
+			vbp_open_error(vt, ETIMEDOUT);
+			return (-1);
+		}
+		if (!vt->exp_close)
+			return (1);
+		bprintf(vt->resp_buf, "Poll error %d (%s)",
+		    ETIMEDOUT, VAS_errtxt(ETIMEDOUT));
+		vt->err_recv |= 1;
+		return (-1);
+	}
+	if (vt->events == POLLOUT) {
+		i = vbp_poke_send(vt);
+		if (i < 0)
+			return (-1);
+		if (i == 0)
+			vt->events = POLLIN;
+		return (0);
 	}
+	return (vbp_poke_recv(vt, buf, len));
+}
 
-	if (rlen == 0) {
+static void
+vbp_poke_response(struct vbp_target *vt)
+{
+	unsigned resp;
+	char *p;
+	int i;
+
+	if (vt->rlen == 0) {
 		bprintf(vt->resp_buf, "%s", "Empty response");
 		return;
 	}
 
 	/* So we have a good receive ... */
-	t_now = VTIM_real();
-	vt->last = t_now - t_start;
+	vt->last = VTIM_real() - vt->t_start;
 	vt->good_recv |= 1;
 
 	/* Now find out if we like the response */
@@ -446,7 +533,7 @@ vbp_heap_insert(struct vbp_target *vt)
  */
 
 /*
- * called when a task was successful or could not get scheduled
+ * called when a probe was done or could not get started
  * returns non-NULL if target is to be deleted (outside mtx)
  */
 static struct vbp_target *
@@ -472,28 +559,106 @@ vbp_task_complete(struct vbp_target *vt)
 	return (vt);
 }
 
-static void v_matchproto_(task_func_t)
-vbp_task(struct worker *wrk, void *priv)
+static void
+vbp_poke_done(struct vbp_target *vt, int response)
 {
-	struct vbp_target *vt;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CAST_OBJ_NOTNULL(vt, priv, VBP_TARGET_MAGIC);
-
-	AN(vt->req);
-	assert(vt->req_len > 0);
+	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
 
-	vbp_start_poke(vt);
-	vbp_poke(vt);
+	if (vt->fd >= 0)
+		VTCP_close(&vt->fd);
+	if (response)
+		vbp_poke_response(vt);
 	vbp_has_poked(vt);
-	VBP_Update_Backend(vt);
+	vbp_update_backends(vt);
 
 	Lck_Lock(&vbp_mtx);
 	vt = vbp_task_complete(vt);
 	Lck_Unlock(&vbp_mtx);
-	if (vt == NULL)
-		return;
-	vbp_delete(vt);
+	if (vt != NULL)
+		vbp_delete(vt);
+}
+
+/*--------------------------------------------------------------------
+ * A probe thread runs the probes handed to it by the scheduler, with
+ * non-blocking connects and reads for all of them in one poll(2).
+ */
+
+static void * v_matchproto_(bgthread_t)
+vbp_poller_thread(struct worker *wrk, void *priv)
+{
+	struct vbp_poller *vp;
+	struct vbp_target_head active, start;
+	struct vbp_target *vt, *vt2;
+	struct pollfd *pfd = NULL;
+	unsigned n = 0, l = 0, u;
+	vtim_real now, due;
+	char buf[8192];
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(vp, priv, VBP_POLLER_MAGIC);
+	VTAILQ_INIT(&active);
+	while (1) {
+		VTAILQ_INIT(&start);
+		Lck_Lock(&vbp_mtx);
+		VTAILQ_CONCAT(&start, &vp->queue, poll_list);
+		Lck_Unlock(&vbp_mtx);
+
+		VTAILQ_FOREACH_SAFE(vt, &start, poll_list, vt2) {
+			VTAILQ_REMOVE(&start, vt, poll_list);
+			AN(vt->req);
+			assert(vt->req_len > 0);
+			vbp_start_poke(vt);
+			if (vbp_poke_open(vt)) {
+				vbp_poke_done(vt, 0);
+				continue;
+			}
+			vt->events = POLLOUT;
+			VTAILQ_INSERT_TAIL(&active, vt, poll_list);
+			n++;
+		}
+
+		if (n + 1 > l) {
+			l = 2 * (n + 1);
+			pfd = realloc(pfd, l * sizeof *pfd);
+			AN(pfd);
+		}
+		pfd[0].fd = vp->pipe[0];
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		due = VTIM_real() + 8.192;
+		u = 1;
+		VTAILQ_FOREACH(vt, &active, poll_list) {
+			pfd[u].fd = vt->fd;
+			pfd[u].events = vt->events;
+			pfd[u].revents = 0;
+			due = vmin(due, vt->t_end);
+			u++;
+		}
+		assert(u == n + 1);
+
+		i = poll(pfd, u, VTIM_poll_tmo(due - VTIM_real() + 1e-3));
+		assert(i >= 0 || errno == EINTR);
+		if (pfd[0].revents)
+			(void)read(vp->pipe[0], buf, sizeof buf);
+
+		now = VTIM_real();
+		u = 1;
+		VTAILQ_FOREACH_SAFE(vt, &active, poll_list, vt2) {
+			assert(pfd[u].fd == vt->fd);
+			i = vbp_poke_event(vt, pfd[u].revents, now,
+			    buf, sizeof buf);
+			u++;
+			if (i == 0)
+				continue;
+			VTAILQ_REMOVE(&active, vt, poll_list);
+			n--;
+			vbp_poke_done(vt, i > 0);
+		}
+	}
+	NEEDLESS(free(pfd));
+	NEEDLESS(return (NULL));
 }
 
 /*--------------------------------------------------------------------
@@ -502,9 +667,9 @@ vbp_task(struct worker *wrk, void *priv)
 static void * v_matchproto_(bgthread_t)
 vbp_scheduler(struct worker *wrk, void *priv)
 {
+	struct vbp_poller *vp;
 	vtim_real now, nxt;
 	struct vbp_target *vt;
-	int r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AZ(priv);
@@ -522,23 +687,11 @@ vbp_scheduler(struct worker *wrk, void *priv)
 			assert(vt->state == vbp_state_scheduled);
 			VBH_delete(vbp_heap, vt->heap_idx);
 			vt->state = vbp_state_running;
-			vt->task->func = vbp_task;
-			vt->task->priv = vt;
-			Lck_Unlock(&vbp_mtx);
-
-			r = Pool_Task_Any(vt->task, TASK_QUEUE_REQ);
-
-			Lck_Lock(&vbp_mtx);
-			if (r == 0)
-				continue;
-			vt = vbp_task_complete(vt);
-			if (vt == NULL)
-				continue;
-			Lck_Unlock(&vbp_mtx);
-
-			vbp_delete(vt);
-
-			Lck_Lock(&vbp_mtx);
+			vp = &vbp_poller[vbp_nxt++ % vbp_npoller];
+			CHECK_OBJ(vp, VBP_POLLER_MAGIC);
+			if (VTAILQ_EMPTY(&vp->queue))
+				(void)write(vp->pipe[1], "", 1);
+			VTAILQ_INSERT_TAIL(&vp->queue, vt, poll_list);
 		}
 	}
 	NEEDLESS(Lck_Unlock(&vbp_mtx));
@@ -582,10 +735,10 @@ VBP_Status(struct vsb *vsb, const struct backend *be, int details, int json)
 		if (json)
 			VSB_printf(vsb, "[%u, %u, \"%s\"]",
 			    vt->good, vt->window,
-			    vt->backend->sick ? "sick" : "healthy");
+			    be->sick ? "sick" : "healthy");
 		else
 			VSB_printf(vsb, "%u/%u\t%s", vt->good, vt->window,
-			    vt->backend->sick ? "sick" : "healthy");
+			    be->sick ? "sick" : "healthy");
 		return;
 	}
 
@@ -685,7 +838,7 @@ vbp_set_defaults(struct vbp_target *vt, const struct vrt_backend_probe *vp)
  */
 
 void
-VBP_Control(const struct backend *be, int enable)
+VBP_Control(struct backend *be, int enable)
 {
 	struct vbp_target *vt;
 
@@ -693,8 +846,17 @@ VBP_Control(const struct backend *be, int enable)
 	vt = be->probe;
 	CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
 
+	/* Another backend keeps the shared target going */
+	Lck_Lock(&vbp_mtx);
+	if (enable ? vt->n_enabled++ > 0 : --vt->n_enabled > 0) {
+		Lck_Unlock(&vbp_mtx);
+		VBP_Update_Backend(be);
+		return;
+	}
+	Lck_Unlock(&vbp_mtx);
+
 	vbp_reset(vt);
-	VBP_Update_Backend(vt);
+	vbp_update_backends(vt);
 
 	Lck_Lock(&vbp_mtx);
 	if (enable) {
@@ -728,7 +890,7 @@ void
 VBP_Insert(struct backend *b, const struct vrt_backend_probe *vp,
     struct conn_pool *tp)
 {
-	struct vbp_target *vt;
+	struct vbp_target *vt, *vt2;
 
 	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
 	CHECK_OBJ_NOTNULL(vp, VRT_BACKEND_PROBE_MAGIC);
@@ -739,15 +901,30 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *vp,
 	XXXAN(vt);
 
 	vt->state = vbp_state_cold;
+	vt->heap_idx = VBH_NOIDX;
+	vt->fd = -1;
 	vt->conn_pool = tp;
 	VCP_AddRef(vt->conn_pool);
-	vt->backend = b;
-	b->probe = vt;
+	VTAILQ_INIT(&vt->backends);
+	vt->proxy_header = b->proxy_header;
 
 	vbp_set_defaults(vt, vp);
 	vbp_build_req(vt, vp, b);
 
-	vbp_reset(vt);
+	Lck_Lock(&vbp_mtx);
+	vt2 = VRBT_FIND(vbp_tree, &vbp_targets, vt);
+	if (vt2 == NULL) {
+		AZ(VRBT_INSERT(vbp_tree, &vbp_targets, vt));
+		vbp_reset(vt);
+		vt2 = vt;
+		vt = NULL;
+	}
+	VTAILQ_INSERT_TAIL(&vt2->backends, b, probe_list);
+	b->probe = vt2;
+	Lck_Unlock(&vbp_mtx);
+
+	if (vt != NULL)
+		vbp_delete(vt);
 }
 
 void
@@ -762,12 +939,17 @@ VBP_Remove(struct backend *be)
 	Lck_Lock(&vbp_mtx);
 	be->sick = 1;
 	be->probe = NULL;
-	vt->backend = NULL;
-	if (vt->state == vbp_state_cooling) {
-		vt->state = vbp_state_deleted;
+	VTAILQ_REMOVE(&vt->backends, be, probe_list);
+	if (!VTAILQ_EMPTY(&vt->backends)) {
 		vt = NULL;
-	} else
-		assert(vt->state == vbp_state_cold);
+	} else {
+		VRBT_REMOVE(vbp_tree, &vbp_targets, vt);
+		if (vt->state == vbp_state_cooling) {
+			vt->state = vbp_state_deleted;
+			vt = NULL;
+		} else
+			assert(vt->state == vbp_state_cold);
+	}
 	Lck_Unlock(&vbp_mtx);
 	if (vt != NULL)
 		vbp_delete(vt);
@@ -797,16 +979,59 @@ vbp_update(void *priv, void *p, unsigned u)
 	vt->heap_idx = u;
 }
 
+/*-------------------------------------------------------------------
+ * Targets are shared by backends with the same endpoint, request and
+ * probe parameters.
+ */
+
+static int
+vbp_target_cmp(const struct vbp_target *a, const struct vbp_target *b)
+{
+
+	CHECK_OBJ_NOTNULL(a, VBP_TARGET_MAGIC);
+	CHECK_OBJ_NOTNULL(b, VBP_TARGET_MAGIC);
+
+	if (a->conn_pool != b->conn_pool)
+		return (a->conn_pool < b->conn_pool ? -1 : 1);
+#define VBP_CMP(x)						\
+	do {							\
+		if (a->x != b->x)				\
+			return (a->x < b->x ? -1 : 1);		\
+	} while (0)
+	VBP_CMP(proxy_header);
+#define DN(x)	VBP_CMP(x)
+	VRT_BACKEND_PROBE_HANDLE();
+#undef DN
+#undef VBP_CMP
+	return (strcmp(a->req, b->req));
+}
+
 /*-------------------------------------------------------------------*/
 
 void
 VBP_Init(void)
 {
+	struct vbp_poller *vp;
 	pthread_t thr;
+	unsigned u;
 
 	Lck_New(&vbp_mtx, lck_probe);
 	vbp_heap = VBH_new(NULL, vbp_cmp, vbp_update);
 	AN(vbp_heap);
 	PTOK(pthread_cond_init(&vbp_cond, NULL));
+
+	vbp_npoller = cache_param->backend_probe_threads;
+	AN(vbp_npoller);
+	vbp_poller = calloc(vbp_npoller, sizeof *vbp_poller);
+	AN(vbp_poller);
+	for (u = 0; u < vbp_npoller; u++) {
+		vp = &vbp_poller[u];
+		INIT_OBJ(vp, VBP_POLLER_MAGIC);
+		VTAILQ_INIT(&vp->queue);
+		AZ(pipe(vp->pipe));
+		AZ(VFIL_nonblocking(vp->pipe[0]));
+		AZ(VFIL_nonblocking(vp->pipe[1]));
+		WRK_BgThread(&thr, "backend-probe", vbp_poller_thread, vp);
+	}
 	WRK_BgThread(&thr, "backend-probe-scheduler", vbp_scheduler, NULL);
 }
@@ -753,10 +753,8 @@ ccf_ban(struct cli *cli, const char * const *av, void *priv)
 			break;
 	}
 
-	if (err == NULL) {
-		// XXX racy - grab wstat lock?
+	if (err == NULL)
 		err = BAN_Commit(bp);
-	}
 
 	if (err != NULL) {
 		VCLI_Out(cli, "%s", err);
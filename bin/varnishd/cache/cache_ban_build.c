@@ -396,6 +396,7 @@ BAN_Commit(struct ban_proto *bp)
 		ban_kick_lurker();
 	Lck_Unlock(&ban_mtx);
 
+	FHT_Flush();
 	BAN_Abandon(bp);
 	return (NULL);
 }
@@ -178,6 +178,9 @@ VBO_ReleaseBusyObj(struct worker *wrk, struct busyobj **pbo)
 	if (WS_Overflowed(bo->ws))
 		wrk->stats->ws_backend_overflow++;
 
+	if (bo->is_refresh)
+		HSH_RefreshDone();
+
 	if (bo->fetch_objcore != NULL) {
 		(void)HSH_DerefObjCore(wrk, &bo->fetch_objcore,
 		    HSH_RUSH_POLICY);
@@ -60,8 +60,10 @@ struct pfd {
 	VTAILQ_ENTRY(pfd)	list;
 	VCL_IP			addr;
 	uint8_t			state;
+	uint8_t			warm;
 	struct waited		waited[1];
 	struct conn_pool	*conn_pool;
+	struct vcp_shard	*shard;
 
 	pthread_cond_t		*cond;
 };
@@ -80,6 +82,27 @@ struct cp_methods {
 	cp_name_f				*remote_name;
 };
 
+/*--------------------------------------------------------------------
+ * The idle connections of a pool are split in shards, one per thread
+ * pool, so that workers in different thread pools do not fight over
+ * the same lock.  A worker recycles its connection into the shard of
+ * its own thread pool, and only looks at other shards when its own
+ * has nothing idle.
+ */
+
+struct vcp_shard {
+	unsigned				magic;
+#define VCP_SHARD_MAGIC				0x3b1d5e07
+	struct lock				mtx;
+
+	VTAILQ_HEAD(, pfd)			connlist;
+	int					n_conn;
+
+	int					n_kill;
+
+	int					n_used;
+};
+
 struct conn_pool {
 	unsigned				magic;
 #define CONN_POOL_MAGIC				0x85099bc3
@@ -93,15 +116,15 @@ struct conn_pool {
 	int					refcnt;
 	struct lock				mtx;
 
-	VTAILQ_HEAD(, pfd)			connlist;
-	int					n_conn;
-
-	int					n_kill;
-
-	int					n_used;
+	unsigned				n_shard;
+	struct vcp_shard			*shards;
 
 	vtim_mono				holddown;
 	int					holddown_errno;
+
+	unsigned				warm_target;
+	unsigned				warm_max;
+	struct pool_task			warm_task[1];
 };
 
 static struct lock conn_pools_mtx;
@@ -131,6 +154,13 @@ PFD_Fd(struct pfd *p)
 	return (&(p->fd));
 }
 
+unsigned
+PFD_Warm(const struct pfd *p)
+{
+	CHECK_OBJ_NOTNULL(p, PFD_MAGIC);
+	return (p->warm);
+}
+
 void
 PFD_LocalName(const struct pfd *p, char *abuf, unsigned alen, char *pbuf,
 	      unsigned plen)
@@ -158,6 +188,30 @@ vcp_cmp(const struct conn_pool *a, const struct conn_pool *b)
 	return (memcmp(a->ident, b->ident, sizeof b->ident));
 }
 
+static struct vcp_shard *
+vcp_shard(const struct conn_pool *cp, const struct worker *wrk)
+{
+	unsigned u = 0;
+
+	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	if (wrk->pool != NULL)
+		u = wrk->pool->pool_no % cp->n_shard;
+	return (&cp->shards[u]);
+}
+
+/* Unlocked, so only good enough for limits */
+static int
+vcp_n_conn(const struct conn_pool *cp)
+{
+	unsigned u;
+	int n = 0;
+
+	for (u = 0; u < cp->n_shard; u++)
+		n += cp->shards[u].n_conn;
+	return (n);
+}
+
 /*--------------------------------------------------------------------
  * Waiter-handler
  */
@@ -167,6 +221,7 @@ vcp_handle(struct waited *w, enum wait_event ev, vtim_real now)
 {
 	struct pfd *pfd;
 	struct conn_pool *cp;
+	struct vcp_shard *sh;
 
 	CHECK_OBJ_NOTNULL(w, WAITED_MAGIC);
 	CAST_OBJ_NOTNULL(pfd, w->priv1, PFD_MAGIC);
@@ -174,34 +229,75 @@ vcp_handle(struct waited *w, enum wait_event ev, vtim_real now)
 	(void)now;
 	CHECK_OBJ_NOTNULL(pfd->conn_pool, CONN_POOL_MAGIC);
 	cp = pfd->conn_pool;
+	sh = pfd->shard;
+	CHECK_OBJ_NOTNULL(sh, VCP_SHARD_MAGIC);
 
-	Lck_Lock(&cp->mtx);
+	Lck_Lock(&sh->mtx);
 
 	switch (pfd->state) {
 	case PFD_STATE_STOLEN:
 		pfd->state = PFD_STATE_USED;
-		VTAILQ_REMOVE(&cp->connlist, pfd, list);
+		VTAILQ_REMOVE(&sh->connlist, pfd, list);
 		AN(pfd->cond);
 		PTOK(pthread_cond_signal(pfd->cond));
 		break;
 	case PFD_STATE_AVAIL:
 		cp->methods->close(pfd);
-		VTAILQ_REMOVE(&cp->connlist, pfd, list);
-		cp->n_conn--;
+		VTAILQ_REMOVE(&sh->connlist, pfd, list);
+		sh->n_conn--;
 		FREE_OBJ(pfd);
 		break;
 	case PFD_STATE_CLEANUP:
 		cp->methods->close(pfd);
-		cp->n_kill--;
+		sh->n_kill--;
 		memset(pfd, 0x11, sizeof *pfd);
 		free(pfd);
 		break;
 	default:
 		WRONG("Wrong pfd state");
 	}
-	Lck_Unlock(&cp->mtx);
+	Lck_Unlock(&sh->mtx);
+}
+
+
+/*--------------------------------------------------------------------
+ */
+
+static void
+vcp_shards_init(struct conn_pool *cp)
+{
+	struct vcp_shard *sh;
+	unsigned u;
+
+	cp->n_shard = vmax_t(unsigned, cache_param->wthread_pools, 1);
+	cp->shards = calloc(cp->n_shard, sizeof *cp->shards);
+	AN(cp->shards);
+	for (u = 0; u < cp->n_shard; u++) {
+		sh = &cp->shards[u];
+		INIT_OBJ(sh, VCP_SHARD_MAGIC);
+		Lck_New(&sh->mtx, lck_conn_pool_shard);
+		VTAILQ_INIT(&sh->connlist);
+	}
 }
 
+static void
+vcp_shards_fini(struct conn_pool *cp)
+{
+	struct vcp_shard *sh;
+	unsigned u;
+
+	for (u = 0; u < cp->n_shard; u++) {
+		sh = &cp->shards[u];
+		CHECK_OBJ(sh, VCP_SHARD_MAGIC);
+		AZ(sh->n_conn);
+		AZ(sh->n_kill);
+		AZ(sh->n_used);
+		Lck_Delete(&sh->mtx);
+	}
+	free(cp->shards);
+	cp->shards = NULL;
+	cp->n_shard = 0;
+}
 
 /*--------------------------------------------------------------------
  */
@@ -225,7 +321,9 @@ void
 VCP_Rel(struct conn_pool **cpp)
 {
 	struct conn_pool *cp;
+	struct vcp_shard *sh;
 	struct pfd *pfd, *pfd2;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(cp, cpp, CONN_POOL_MAGIC);
 
@@ -235,54 +333,80 @@ VCP_Rel(struct conn_pool **cpp)
 		Lck_Unlock(&conn_pools_mtx);
 		return;
 	}
-	AZ(cp->n_used);
 	VRBT_REMOVE(vrb, &conn_pools, cp);
 	Lck_Unlock(&conn_pools_mtx);
 
-	Lck_Lock(&cp->mtx);
-	VTAILQ_FOREACH_SAFE(pfd, &cp->connlist, list, pfd2) {
-		VTAILQ_REMOVE(&cp->connlist, pfd, list);
-		cp->n_conn--;
-		assert(pfd->state == PFD_STATE_AVAIL);
-		pfd->state = PFD_STATE_CLEANUP;
-		(void)shutdown(pfd->fd, SHUT_RDWR);
-		cp->n_kill++;
-	}
-	while (cp->n_kill) {
-		Lck_Unlock(&cp->mtx);
-		(void)usleep(20000);
-		Lck_Lock(&cp->mtx);
+	for (u = 0; u < cp->n_shard; u++) {
+		sh = &cp->shards[u];
+		CHECK_OBJ(sh, VCP_SHARD_MAGIC);
+		Lck_Lock(&sh->mtx);
+		AZ(sh->n_used);
+		VTAILQ_FOREACH_SAFE(pfd, &sh->connlist, list, pfd2) {
+			VTAILQ_REMOVE(&sh->connlist, pfd, list);
+			sh->n_conn--;
+			assert(pfd->state == PFD_STATE_AVAIL);
+			pfd->state = PFD_STATE_CLEANUP;
+			(void)shutdown(pfd->fd, SHUT_RDWR);
+			sh->n_kill++;
+		}
+		while (sh->n_kill) {
+			Lck_Unlock(&sh->mtx);
+			(void)usleep(20000);
+			Lck_Lock(&sh->mtx);
+		}
+		Lck_Unlock(&sh->mtx);
 	}
-	Lck_Unlock(&cp->mtx);
+	vcp_shards_fini(cp);
 	Lck_Delete(&cp->mtx);
-	AZ(cp->n_conn);
-	AZ(cp->n_kill);
 	free(cp->endpoint);
 	FREE_OBJ(cp);
 }
 
 /*--------------------------------------------------------------------
- * Recycle a connection.
+ * Recycle a connection, returns true if it was kept.  Backends sharing
+ * the pool can have different max_idle, so the limit is the one of the
+ * backend recycling the connection.
  */
 
-void
-VCP_Recycle(const struct worker *wrk, struct pfd **pfdp)
+static int
+vcp_recycle(const struct worker *wrk, struct pfd *pfd, unsigned warm,
+    unsigned max_idle)
 {
-	struct pfd *pfd;
 	struct conn_pool *cp;
+	struct vcp_shard *sh, *osh;
 	int i = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	TAKE_OBJ_NOTNULL(pfd, pfdp, PFD_MAGIC);
+	CHECK_OBJ_NOTNULL(pfd, PFD_MAGIC);
 	cp = pfd->conn_pool;
 	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	osh = pfd->shard;
+	CHECK_OBJ_NOTNULL(osh, VCP_SHARD_MAGIC);
 
 	assert(pfd->state == PFD_STATE_USED);
 	assert(pfd->fd > 0);
 
-	Lck_Lock(&cp->mtx);
-	cp->n_used--;
+	sh = vcp_shard(cp, wrk);
+	if (osh != sh) {
+		Lck_Lock(&osh->mtx);
+		osh->n_used--;
+		Lck_Unlock(&osh->mtx);
+	}
 
+	Lck_Lock(&sh->mtx);
+	if (osh == sh)
+		sh->n_used--;
+	pfd->shard = sh;
+
+	if (max_idle > 0 && vcp_n_conn(cp) >= (int)max_idle) {
+		cp->methods->close(pfd);
+		memset(pfd, 0x33, sizeof *pfd);
+		free(pfd);
+		Lck_Unlock(&sh->mtx);
+		return (0);
+	}
+
+	pfd->warm = warm;
 	pfd->waited->priv1 = pfd;
 	pfd->waited->fd = pfd->fd;
 	pfd->waited->idle = VTIM_real();
@@ -296,13 +420,13 @@ VCP_Recycle(const struct worker *wrk, struct pfd **pfdp)
 		// XXX: stats
 		pfd = NULL;
 	} else {
-		VTAILQ_INSERT_HEAD(&cp->connlist, pfd, list);
+		VTAILQ_INSERT_HEAD(&sh->connlist, pfd, list);
 		i++;
 	}
 
 	if (pfd != NULL)
-		cp->n_conn++;
-	Lck_Unlock(&cp->mtx);
+		sh->n_conn++;
+	Lck_Unlock(&sh->mtx);
 
 	if (i && DO_DEBUG(DBG_VTC_MODE)) {
 		/*
@@ -320,61 +444,124 @@ VCP_Recycle(const struct worker *wrk, struct pfd **pfdp)
 		 */
 		(void)usleep(10000);
 	}
+	return (i);
+}
+
+int
+VCP_Recycle(const struct worker *wrk, struct pfd **pfdp, unsigned max_idle)
+{
+	struct pfd *pfd;
+
+	TAKE_OBJ_NOTNULL(pfd, pfdp, PFD_MAGIC);
+	return (vcp_recycle(wrk, pfd, 0, max_idle));
 }
 
 /*--------------------------------------------------------------------
- * Open a new connection from pool.
+ * Keep idle connections open ahead of demand.
+ *
+ * VCP_Warm() is called for backends with min_idle, and schedules a task
+ * which opens connections until the pool has that many idle ones.  They
+ * go straight to the waiter, like recycled connections, so the waiter
+ * takes care of the backend closing them.
  */
 
-int
-VCP_Open(struct conn_pool *cp, vtim_dur tmo, VCL_IP *ap, int *err)
+static void v_matchproto_(task_func_t)
+vcp_warm_task(struct worker *wrk, void *priv)
 {
-	int r;
-	vtim_mono h;
+	struct conn_pool *cp;
+	struct vcp_shard *sh;
+	struct pfd *pfd;
+	unsigned max_idle;
+	int err;
 
-	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
-	AN(err);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(cp, priv, CONN_POOL_MAGIC);
+	sh = vcp_shard(cp, wrk);
 
-	while (cp->holddown > 0) {
+	while (1) {
 		Lck_Lock(&cp->mtx);
-		if (cp->holddown == 0) {
+		if (vcp_n_conn(cp) >= (int)cp->warm_target) {
+			cp->warm_target = 0;
 			Lck_Unlock(&cp->mtx);
 			break;
 		}
+		max_idle = cp->warm_max;
+		Lck_Unlock(&cp->mtx);
 
-		if (VTIM_mono() >= cp->holddown) {
-			cp->holddown = 0;
+		Lck_Lock(&sh->mtx);
+		sh->n_used++;
+		Lck_Unlock(&sh->mtx);
+
+		ALLOC_OBJ(pfd, PFD_MAGIC);
+		AN(pfd);
+		INIT_OBJ(pfd->waited, WAITED_MAGIC);
+		pfd->state = PFD_STATE_USED;
+		pfd->conn_pool = cp;
+		pfd->shard = sh;
+		pfd->fd = VCP_Open(cp, cache_param->connect_timeout,
+		    &pfd->addr, &err);
+		if (pfd->fd < 0) {
+			FREE_OBJ(pfd);
+			Lck_Lock(&sh->mtx);
+			sh->n_used--;
+			Lck_Unlock(&sh->mtx);
+			Lck_Lock(&cp->mtx);
+			cp->warm_target = 0;
 			Lck_Unlock(&cp->mtx);
 			break;
 		}
+		wrk->stats->backend_prewarm++;
+		if (!vcp_recycle(wrk, pfd, 1, max_idle)) {
+			Lck_Lock(&cp->mtx);
+			cp->warm_target = 0;
+			Lck_Unlock(&cp->mtx);
+			break;
+		}
+	}
+	VCP_Rel(&cp);
+}
 
-		*err = 0;
-		errno = cp->holddown_errno;
+void
+VCP_Warm(struct conn_pool *cp, unsigned min_idle, unsigned max_idle)
+{
+
+	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+
+	if (max_idle > 0)
+		min_idle = vmin(min_idle, max_idle);
+
+	Lck_Lock(&cp->mtx);
+	if (cp->warm_target > 0 || vcp_n_conn(cp) >= (int)min_idle) {
+		/* Already warming or warm enough */
 		Lck_Unlock(&cp->mtx);
-		return (-1);
+		return;
 	}
+	cp->warm_target = min_idle;
+	cp->warm_max = max_idle;
+	Lck_Unlock(&cp->mtx);
 
-	*err = errno = 0;
-	r = cp->methods->open(cp, tmo, ap);
+	VCP_AddRef(cp);
+	cp->warm_task->func = vcp_warm_task;
+	cp->warm_task->priv = cp;
+	if (Pool_Task_Any(cp->warm_task, TASK_QUEUE_BO) == 0)
+		return;
 
-	if (r >= 0 && errno == 0 && cp->endpoint->preamble != NULL &&
-	     cp->endpoint->preamble->len > 0) {
-		if (write(r, cp->endpoint->preamble->blob,
-		    cp->endpoint->preamble->len) !=
-		    cp->endpoint->preamble->len) {
-			*err = errno;
-			closefd(&r);
-		}
-	} else {
-		*err = errno;
-	}
+	Lck_Lock(&cp->mtx);
+	cp->warm_target = 0;
+	Lck_Unlock(&cp->mtx);
+	VCP_Rel(&cp);
+}
 
-	if (r >= 0)
-		return (r);
+/*--------------------------------------------------------------------
+ * Hold down a pool after fundamental connection errors.
+ */
 
-	h = 0;
+static void
+vcp_holddown(struct conn_pool *cp, int err)
+{
+	vtim_mono h = 0;
 
-	switch (errno) {
+	switch (err) {
 	case EACCES:
 	case EPERM:
 		h = cache_param->backend_local_error_holddown;
@@ -393,20 +580,141 @@ VCP_Open(struct conn_pool *cp, vtim_dur tmo, VCL_IP *ap, int *err)
 	}
 
 	if (h == 0)
-		return (r);
+		return;
 
 	Lck_Lock(&cp->mtx);
 	h += VTIM_mono();
 	if (cp->holddown == 0 || h < cp->holddown) {
 		cp->holddown = h;
-		cp->holddown_errno = errno;
+		cp->holddown_errno = err;
 	}
 
 	Lck_Unlock(&cp->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Send the preamble of the endpoint, if any.
+ */
+
+static int
+vcp_preamble(const struct conn_pool *cp, int *fd, int *err)
+{
+
+	if (cp->endpoint->preamble == NULL ||
+	    cp->endpoint->preamble->len == 0)
+		return (0);
+	if (write(*fd, cp->endpoint->preamble->blob,
+	    cp->endpoint->preamble->len) == cp->endpoint->preamble->len)
+		return (0);
+	*err = errno;
+	closefd(fd);
+	return (-1);
+}
+
+/*--------------------------------------------------------------------
+ * Open a new connection from pool.
+ */
+
+int
+VCP_Open(struct conn_pool *cp, vtim_dur tmo, VCL_IP *ap, int *err)
+{
+	int r;
 
+	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	AN(err);
+
+	while (cp->holddown > 0) {
+		Lck_Lock(&cp->mtx);
+		if (cp->holddown == 0) {
+			Lck_Unlock(&cp->mtx);
+			break;
+		}
+
+		if (VTIM_mono() >= cp->holddown) {
+			cp->holddown = 0;
+			Lck_Unlock(&cp->mtx);
+			break;
+		}
+
+		*err = 0;
+		errno = cp->holddown_errno;
+		Lck_Unlock(&cp->mtx);
+		return (-1);
+	}
+
+	*err = errno = 0;
+	r = cp->methods->open(cp, tmo, ap);
+
+	if (r >= 0 && tmo < 0) {
+		*err = 0;
+		return (r);
+	}
+
+	if (r >= 0 && errno == 0)
+		(void)vcp_preamble(cp, &r, err);
+	else
+		*err = errno;
+
+	if (r >= 0)
+		return (r);
+
+	vcp_holddown(cp, errno);
 	return (r);
 }
 
+/*
+ * The address vtp_open() tries after the one given, if any.
+ */
+
+static VCL_IP
+vcp_next_addr(const struct conn_pool *cp, VCL_IP ap)
+{
+	VCL_IP first, second;
+
+	if (cache_param->prefer_ipv6) {
+		first = cp->endpoint->ipv6;
+		second = cp->endpoint->ipv4;
+	} else {
+		first = cp->endpoint->ipv4;
+		second = cp->endpoint->ipv6;
+	}
+	if (ap == NULL || ap != first)
+		return (NULL);
+	return (second);
+}
+
+int
+VCP_Connected(struct conn_pool *cp, int *fd, VCL_IP *ap, int *err)
+{
+	VCL_IP nap;
+
+	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	AN(fd);
+	AN(ap);
+	AN(err);
+	assert(*fd >= 0);
+
+	*err = 0;
+	if (VTCP_connected(*fd) >= 0)
+		return (vcp_preamble(cp, fd, err));
+
+	*err = errno;
+	*fd = -1;
+	nap = vcp_next_addr(cp, *ap);
+	if (nap != NULL) {
+		*fd = VTCP_connect(nap, -1);
+		if (*fd >= 0) {
+			*ap = nap;
+			*err = 0;
+			return (1);
+		}
+		*err = errno;
+		*fd = -1;
+	}
+	vcp_holddown(cp, *err);
+	return (-1);
+}
+
 /*--------------------------------------------------------------------
  * Close a connection.
  */
@@ -416,28 +724,63 @@ VCP_Close(struct pfd **pfdp)
 {
 	struct pfd *pfd;
 	struct conn_pool *cp;
+	struct vcp_shard *sh;
 
 	TAKE_OBJ_NOTNULL(pfd, pfdp, PFD_MAGIC);
 	cp = pfd->conn_pool;
 	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	sh = pfd->shard;
+	CHECK_OBJ_NOTNULL(sh, VCP_SHARD_MAGIC);
 
 	assert(pfd->fd > 0);
 
-	Lck_Lock(&cp->mtx);
+	Lck_Lock(&sh->mtx);
 	assert(pfd->state == PFD_STATE_USED || pfd->state == PFD_STATE_STOLEN);
-	cp->n_used--;
+	sh->n_used--;
 	if (pfd->state == PFD_STATE_STOLEN) {
 		(void)shutdown(pfd->fd, SHUT_RDWR);
-		VTAILQ_REMOVE(&cp->connlist, pfd, list);
+		VTAILQ_REMOVE(&sh->connlist, pfd, list);
 		pfd->state = PFD_STATE_CLEANUP;
-		cp->n_kill++;
+		sh->n_kill++;
 	} else {
 		assert(pfd->state == PFD_STATE_USED);
 		cp->methods->close(pfd);
 		memset(pfd, 0x44, sizeof *pfd);
 		free(pfd);
 	}
-	Lck_Unlock(&cp->mtx);
+	Lck_Unlock(&sh->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Take the first idle connection of a shard, if any
+ */
+
+static struct pfd *
+vcp_get_idle(const struct conn_pool *cp, struct vcp_shard *sh,
+    struct worker *wrk)
+{
+	struct pfd *pfd;
+
+	CHECK_OBJ_NOTNULL(sh, VCP_SHARD_MAGIC);
+
+	Lck_Lock(&sh->mtx);
+	pfd = VTAILQ_FIRST(&sh->connlist);
+	CHECK_OBJ_ORNULL(pfd, PFD_MAGIC);
+	if (pfd == NULL || pfd->state == PFD_STATE_STOLEN) {
+		Lck_Unlock(&sh->mtx);
+		return (NULL);
+	}
+	assert(pfd->conn_pool == cp);
+	assert(pfd->shard == sh);
+	assert(pfd->state == PFD_STATE_AVAIL);
+	VTAILQ_REMOVE(&sh->connlist, pfd, list);
+	VTAILQ_INSERT_TAIL(&sh->connlist, pfd, list);
+	sh->n_conn--;
+	sh->n_used++;
+	pfd->state = PFD_STATE_STOLEN;
+	pfd->cond = &wrk->cond;
+	Lck_Unlock(&sh->mtx);
+	return (pfd);
 }
 
 /*--------------------------------------------------------------------
@@ -449,44 +792,51 @@ VCP_Get(struct conn_pool *cp, vtim_dur tmo, struct worker *wrk,
     unsigned force_fresh, int *err)
 {
 	struct pfd *pfd;
+	struct vcp_shard *sh, *sh2;
+	unsigned u;
 
 	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AN(err);
 
 	*err = 0;
-	Lck_Lock(&cp->mtx);
-	pfd = VTAILQ_FIRST(&cp->connlist);
-	CHECK_OBJ_ORNULL(pfd, PFD_MAGIC);
-	if (force_fresh || pfd == NULL || pfd->state == PFD_STATE_STOLEN) {
-		pfd = NULL;
-	} else {
-		assert(pfd->conn_pool == cp);
-		assert(pfd->state == PFD_STATE_AVAIL);
-		VTAILQ_REMOVE(&cp->connlist, pfd, list);
-		VTAILQ_INSERT_TAIL(&cp->connlist, pfd, list);
-		cp->n_conn--;
-		VSC_C_main->backend_reuse++;
-		pfd->state = PFD_STATE_STOLEN;
-		pfd->cond = &wrk->cond;
+	sh = vcp_shard(cp, wrk);
+	if (!force_fresh) {
+		pfd = vcp_get_idle(cp, sh, wrk);
+		if (pfd != NULL) {
+			wrk->stats->backend_reuse++;
+			wrk->stats->backend_reuse_local++;
+			return (pfd);
+		}
+		for (u = 1; u < cp->n_shard; u++) {
+			sh2 = &cp->shards[(sh - cp->shards + u) % cp->n_shard];
+			if (sh2->n_conn == 0)	// Unlocked peek
+				continue;
+			pfd = vcp_get_idle(cp, sh2, wrk);
+			if (pfd != NULL) {
+				wrk->stats->backend_reuse++;
+				wrk->stats->backend_reuse_stolen++;
+				return (pfd);
+			}
+		}
 	}
-	cp->n_used++;			// Opening mostly works
-	Lck_Unlock(&cp->mtx);
 
-	if (pfd != NULL)
-		return (pfd);
+	Lck_Lock(&sh->mtx);
+	sh->n_used++;			// Opening mostly works
+	Lck_Unlock(&sh->mtx);
 
 	ALLOC_OBJ(pfd, PFD_MAGIC);
 	AN(pfd);
 	INIT_OBJ(pfd->waited, WAITED_MAGIC);
 	pfd->state = PFD_STATE_USED;
 	pfd->conn_pool = cp;
+	pfd->shard = sh;
 	pfd->fd = VCP_Open(cp, tmo, &pfd->addr, err);
 	if (pfd->fd < 0) {
 		FREE_OBJ(pfd);
-		Lck_Lock(&cp->mtx);
-		cp->n_used--;		// Nope, didn't work after all.
-		Lck_Unlock(&cp->mtx);
+		Lck_Lock(&sh->mtx);
+		sh->n_used--;		// Nope, didn't work after all.
+		Lck_Unlock(&sh->mtx);
 	} else
 		VSC_C_main->backend_conn++;
 
@@ -499,28 +849,29 @@ VCP_Get(struct conn_pool *cp, vtim_dur tmo, struct worker *wrk,
 int
 VCP_Wait(struct worker *wrk, struct pfd *pfd, vtim_real when)
 {
-	struct conn_pool *cp;
+	struct vcp_shard *sh;
 	int r;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(pfd, PFD_MAGIC);
-	cp = pfd->conn_pool;
-	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(pfd->conn_pool, CONN_POOL_MAGIC);
+	sh = pfd->shard;
+	CHECK_OBJ_NOTNULL(sh, VCP_SHARD_MAGIC);
 	assert(pfd->cond == &wrk->cond);
-	Lck_Lock(&cp->mtx);
+	Lck_Lock(&sh->mtx);
 	while (pfd->state == PFD_STATE_STOLEN) {
-		r = Lck_CondWaitUntil(&wrk->cond, &cp->mtx, when);
+		r = Lck_CondWaitUntil(&wrk->cond, &sh->mtx, when);
 		if (r != 0) {
 			if (r == EINTR)
 				continue;
 			assert(r == ETIMEDOUT);
-			Lck_Unlock(&cp->mtx);
+			Lck_Unlock(&sh->mtx);
 			return (1);
 		}
 	}
 	assert(pfd->state == PFD_STATE_USED);
 	pfd->cond = NULL;
-	Lck_Unlock(&cp->mtx);
+	Lck_Unlock(&sh->mtx);
 
 	return (0);
 }
@@ -571,6 +922,7 @@ VCP_Panic(struct vsb *vsb, struct conn_pool *cp)
 	VSB_cat(vsb, "ident = ");
 	VSB_quote(vsb, cp->ident, VSHA256_DIGEST_LENGTH, VSB_QUOTE_HEX);
 	VSB_cat(vsb, ",\n");
+	VSB_printf(vsb, "n_shard = %u,\n", cp->n_shard);
 	vcp_panic_endpoint(vsb, cp->endpoint);
 	VSB_indent(vsb, -2);
 	VSB_cat(vsb, "},\n");
@@ -740,7 +1092,7 @@ VCP_Ref(const struct vrt_endpoint *vep, const char *ident)
 	else
 		cp->methods = &vtp_methods;
 	Lck_New(&cp->mtx, lck_conn_pool);
-	VTAILQ_INIT(&cp->connlist);
+	vcp_shards_init(cp);
 
 	CHECK_OBJ_NOTNULL(cp, CONN_POOL_MAGIC);
 	Lck_Lock(&conn_pools_mtx);
@@ -759,9 +1111,8 @@ VCP_Ref(const struct vrt_endpoint *vep, const char *ident)
 		return (cp);
 	}
 
+	vcp_shards_fini(cp);
 	Lck_Delete(&cp->mtx);
-	AZ(cp->n_conn);
-	AZ(cp->n_kill);
 	FREE_OBJ(cp->endpoint);
 	FREE_OBJ(cp);
 	CHECK_OBJ_NOTNULL(cp2, CONN_POOL_MAGIC);
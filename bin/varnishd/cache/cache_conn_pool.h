@@ -45,6 +45,7 @@ struct pfd;
 
 unsigned PFD_State(const struct pfd *);
 int *PFD_Fd(struct pfd *);
+unsigned PFD_Warm(const struct pfd *);
 void PFD_LocalName(const struct pfd *, char *, unsigned, char *, unsigned);
 void PFD_RemoteName(const struct pfd *, char *, unsigned, char *, unsigned);
 
@@ -76,6 +77,18 @@ int VCP_Open(struct conn_pool *, vtim_dur tmo, VCL_IP *, int*);
 	/*
 	 * Open a new connection and return the address used.
 	 * errno will be returned in the last argument.
+	 * With a negative timeout the connection is not waited for,
+	 * the caller polls it for writing and calls VCP_Connected().
+	 */
+
+int VCP_Connected(struct conn_pool *, int *fd, VCL_IP *, int *err);
+	/*
+	 * Finish a connection opened with a negative timeout.  If it
+	 * failed and the endpoint has an address of the other family
+	 * which was not tried yet, a connection to that one is opened
+	 * the same way, the fd and address are replaced and 1 returned
+	 * for the caller to poll again.  On failure the fd is closed
+	 * and errno returned in the last argument.
 	 */
 
 void VCP_Close(struct pfd **);
@@ -83,9 +96,16 @@ void VCP_Close(struct pfd **);
 	 * Close a connection.
 	 */
 
-void VCP_Recycle(const struct worker *, struct pfd **);
+int VCP_Recycle(const struct worker *, struct pfd **, unsigned max_idle);
+	/*
+	 * Recycle an open connection, or close it if the pool already
+	 * has max_idle idle ones.  Returns true if it was kept.
+	 */
+
+void VCP_Warm(struct conn_pool *, unsigned min_idle, unsigned max_idle);
 	/*
-	 * Recycle an open connection.
+	 * Open connections in the background until the pool has min_idle
+	 * idle ones, but no more than max_idle.
 	 */
 
 struct pfd *VCP_Get(struct conn_pool *, vtim_dur tmo, struct worker *,
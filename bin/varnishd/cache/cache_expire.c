@@ -155,6 +155,8 @@ EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_ORNULL(new_oc, OBJCORE_MAGIC);
 
+	if (oc->objhead != NULL)
+		FHT_Forget(oc->objhead->digest);
 	if (oc->exp_flags & OC_EF_REFD) {
 		Lck_Lock(&exphdl->mtx);
 		if (new_oc != NULL)
@@ -258,6 +260,8 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
 	if (!(oc->exp_flags & OC_EF_REFD))
 		return;
 
+	if (oc->objhead != NULL)
+		FHT_Forget(oc->objhead->digest);
 	if (!isnan(ttl))
 		oc->ttl = now + ttl - oc->t_origin;
 	if (!isnan(grace))
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The fast hit table
+ *
+ * With the fast_hit feature, workers leave a serialized copy of small
+ * hits they delivered here, keyed by the hash digest, for the waiter
+ * to answer the next identical request from without a worker.
+ *
+ * The table is direct mapped, an entry replaces whatever was in its
+ * slot, which bounds it to FHT_NSLOT entries of at most FHT_MAXLEN
+ * bytes.  Entries carry no reference to their object, instead they are
+ * forgotten when the object is removed, rearmed or superseded, and
+ * all of them when a ban is added.  Every such event bumps fht_gen,
+ * so that an entry built while one happened is not inserted.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+
+#include "vend.h"
+
+#define FHT_NSLOT		1024
+
+struct fht_slot {
+	uint8_t			digest[DIGEST_LEN];
+	vtim_real		t_origin;
+	vtim_real		t_expire;
+	size_t			hdrlen;
+	size_t			len;
+	uint8_t			*buf;
+};
+
+static struct lock		fht_mtx;
+static struct fht_slot		fht_slot[FHT_NSLOT];
+static unsigned			fht_gen;
+static unsigned			fht_n;
+
+static struct fht_slot *
+fht_slot_of(const uint8_t *digest)
+{
+
+	AN(digest);
+	return (&fht_slot[vbe16dec(digest) % FHT_NSLOT]);
+}
+
+static void
+fht_clear(struct fht_slot *fs)
+{
+
+	Lck_AssertHeld(&fht_mtx);
+	if (fs->buf == NULL)
+		return;
+	AN(fht_n);
+	fht_n--;
+	free(fs->buf);
+	memset(fs, 0, sizeof *fs);
+}
+
+/*--------------------------------------------------------------------*/
+
+unsigned
+FHT_Gen(void)
+{
+	unsigned gen;
+
+	Lck_Lock(&fht_mtx);
+	gen = fht_gen;
+	Lck_Unlock(&fht_mtx);
+	return (gen);
+}
+
+/*
+ * Insert a copy of hdr and body, unless the table changed since gen
+ * was taken with FHT_Gen().
+ */
+
+void
+FHT_Insert(unsigned gen, const uint8_t *digest, vtim_real t_origin,
+    vtim_real t_expire, const void *hdr, size_t hdrlen, const void *body,
+    size_t bodylen)
+{
+	struct fht_slot *fs;
+	uint8_t *buf;
+
+	AN(hdr);
+	assert(hdrlen + bodylen <= FHT_MAXLEN);
+	buf = malloc(hdrlen + bodylen);
+	AN(buf);
+	memcpy(buf, hdr, hdrlen);
+	if (bodylen > 0)
+		memcpy(buf + hdrlen, body, bodylen);
+
+	fs = fht_slot_of(digest);
+	Lck_Lock(&fht_mtx);
+	if (gen == fht_gen) {
+		fht_clear(fs);
+		memcpy(fs->digest, digest, sizeof fs->digest);
+		fs->t_origin = t_origin;
+		fs->t_expire = t_expire;
+		fs->hdrlen = hdrlen;
+		fs->len = hdrlen + bodylen;
+		fs->buf = buf;
+		fht_n++;
+		buf = NULL;
+	}
+	Lck_Unlock(&fht_mtx);
+	free(buf);
+}
+
+/*
+ * Copy the entry for digest into buf, which must hold FHT_MAXLEN bytes.
+ * Returns its length, zero if there is no entry fresh at now.
+ */
+
+size_t
+FHT_Lookup(const uint8_t *digest, vtim_real now, uint8_t *buf,
+    size_t *hdrlen, vtim_real *t_origin)
+{
+	struct fht_slot *fs;
+	size_t len = 0;
+
+	AN(buf);
+	AN(hdrlen);
+	AN(t_origin);
+	fs = fht_slot_of(digest);
+	Lck_Lock(&fht_mtx);
+	if (fs->buf != NULL &&
+	    !memcmp(fs->digest, digest, sizeof fs->digest)) {
+		if (fs->t_expire > now) {
+			len = fs->len;
+			memcpy(buf, fs->buf, len);
+			*hdrlen = fs->hdrlen;
+			*t_origin = fs->t_origin;
+		} else
+			fht_clear(fs);
+	}
+	Lck_Unlock(&fht_mtx);
+	return (len);
+}
+
+/*
+ * Without the feature, and once the table is empty, nothing is being
+ * inserted either and the lock need not be taken.
+ */
+
+static int
+fht_idle(void)
+{
+
+	return (fht_n == 0 && !FEATURE(FEATURE_FAST_HIT));
+}
+
+void
+FHT_Forget(const uint8_t *digest)
+{
+	struct fht_slot *fs;
+
+	if (fht_idle())
+		return;
+	fs = fht_slot_of(digest);
+	Lck_Lock(&fht_mtx);
+	fht_gen++;
+	if (fs->buf != NULL &&
+	    !memcmp(fs->digest, digest, sizeof fs->digest))
+		fht_clear(fs);
+	Lck_Unlock(&fht_mtx);
+}
+
+void
+FHT_Flush(void)
+{
+	unsigned u;
+
+	if (fht_idle())
+		return;
+	Lck_Lock(&fht_mtx);
+	fht_gen++;
+	for (u = 0; u < FHT_NSLOT && fht_n > 0; u++)
+		fht_clear(&fht_slot[u]);
+	Lck_Unlock(&fht_mtx);
+}
+
+void
+FHT_Init(void)
+{
+
+	Lck_New(&fht_mtx, lck_fasthit);
+}
@@ -35,6 +35,7 @@
 #include "cache_filter.h"
 #include "cache_objhead.h"
 #include "storage/storage.h"
+#include "vbh.h"
 #include "vcl.h"
 #include "vtim.h"
 #include "vcc_interface.h"
@@ -163,7 +164,7 @@ Bereq_Rollback(VRT_CTX)
 static int
 vbf_beresp2obj(struct busyobj *bo)
 {
-	unsigned l, l2;
+	unsigned l, l2, l3 = 0;
 	const char *b;
 	uint8_t *bp;
 	struct vsb *vary = NULL;
@@ -202,6 +203,13 @@ vbf_beresp2obj(struct busyobj *bo)
 	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
 	l += l2;
 
+	/* The wire form goes after the packed headers in OA_HEADERS */
+	if (FEATURE(FEATURE_WIRE_HEADERS)) {
+		l3 = http_EstimateWire(bo->beresp,
+		    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
+		l += PRNDUP(l3);
+	}
+
 	if (bo->uncacheable)
 		oc->flags |= OC_F_HFM;
 
@@ -223,10 +231,12 @@ vbf_beresp2obj(struct busyobj *bo)
 	bo->beresp->logtag = SLT_ObjMethod;
 
 	/* Filter into object */
-	bp = ObjSetAttr(bo->wrk, oc, OA_HEADERS, l2, NULL);
+	bp = ObjSetAttr(bo->wrk, oc, OA_HEADERS, l2 + l3, NULL);
 	AN(bp);
 	HTTP_Encode(bo->beresp, bp, l2,
 	    bo->uncacheable ? HTTPH_A_PASS : HTTPH_A_INS);
+	if (l3 > 0)
+		HTTP_EncodeWire(bp, bp + l2, l3);
 
 	if (http_GetHdr(bo->beresp, H_Last_Modified, &b))
 		AZ(ObjSetDouble(bo->wrk, oc, OA_LASTMODIFIED, VTIM_parse(b)));
@@ -1068,6 +1078,184 @@ vbf_stp_done(struct worker *wrk, struct busyobj *bo)
 	NEEDLESS(return (F_STP_DONE));
 }
 
+/*--------------------------------------------------------------------
+ * Release a busyobj which never made it to a fetch thread
+ */
+
+static void
+vbf_abandon(struct worker *wrk, struct busyobj **pbo)
+{
+	struct busyobj *bo;
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	TAKE_OBJ_NOTNULL(bo, pbo, BUSYOBJ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	(void)vbf_stp_fail(wrk, bo);
+	if (bo->bereq_body != NULL)
+		(void)HSH_DerefObjCore(wrk, &bo->bereq_body, 0);
+	if (bo->stale_oc != NULL)
+		(void)HSH_DerefObjCore(wrk, &bo->stale_oc, 0);
+	HSH_DerefBoc(wrk, oc);
+	SES_Rel(bo->sp);
+	THR_SetBusyobj(NULL);
+	VBO_ReleaseBusyObj(wrk, &bo);
+}
+
+/*--------------------------------------------------------------------
+ * Background fetch scheduler
+ *
+ * At most bgfetch_max background fetches run at the same time, the
+ * others wait in a binary heap with the fetches for the stale objects
+ * with the most hits on top.  A queued fetch gets its bereq made by the
+ * client, which can then deliver the stale object right away.
+ *
+ * There is no need to weed out duplicates here: the busy objcore which
+ * HSH_Lookup() inserts for a bgfetch keeps further grace hits on the
+ * same object from starting another one.
+ */
+
+static struct lock vbf_bg_mtx;
+static struct vbh *vbf_bg_heap;
+static unsigned vbf_bg_queued;
+static unsigned vbf_bg_running;
+
+static int v_matchproto_(vbh_cmp_t)
+vbf_bg_cmp(void *priv, const void *a, const void *b)
+{
+	const struct busyobj *aa, *bb;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(aa, a, BUSYOBJ_MAGIC);
+	CAST_OBJ_NOTNULL(bb, b, BUSYOBJ_MAGIC);
+	if (aa->bg_hits != bb->bg_hits)
+		return (aa->bg_hits > bb->bg_hits);
+	return (aa->t_first < bb->t_first);
+}
+
+static void v_matchproto_(vbh_update_t)
+vbf_bg_update(void *priv, void *p, unsigned u)
+{
+	struct busyobj *bo;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(bo, p, BUSYOBJ_MAGIC);
+	bo->bg_idx = u;
+}
+
+static void
+vbf_bg_gauges(void)
+{
+
+	Lck_AssertHeld(&vbf_bg_mtx);
+	VSC_C_main->bgfetch_queued = vbf_bg_queued;
+	VSC_C_main->bgfetch_inflight = vbf_bg_running;
+}
+
+/*
+ * A bgfetch is over, hand its slot to the one on top of the heap.
+ */
+
+static void
+vbf_bg_done(struct worker *wrk)
+{
+	struct busyobj *bo;
+	unsigned max;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	Lck_Lock(&vbf_bg_mtx);
+	assert(vbf_bg_running > 0);
+	vbf_bg_running--;
+	while (vbf_bg_queued > 0) {
+		max = cache_param->bgfetch_max;
+		if (max > 0 && vbf_bg_running >= max)
+			break;
+		bo = VBH_root(vbf_bg_heap);
+		CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+		VBH_delete(vbf_bg_heap, bo->bg_idx);
+		assert(bo->bg_idx == VBH_NOIDX);
+		vbf_bg_queued--;
+		vbf_bg_running++;
+		vbf_bg_gauges();
+		Lck_Unlock(&vbf_bg_mtx);
+		if (Pool_Task(wrk->pool, bo->fetch_task, TASK_QUEUE_BG)) {
+			wrk->stats->bgfetch_no_thread++;
+			VSLb(bo->vsl, SLT_FetchError,
+			    "No thread available for bgfetch");
+			vbf_abandon(wrk, &bo);
+			Lck_Lock(&vbf_bg_mtx);
+			vbf_bg_running--;
+		} else
+			Lck_Lock(&vbf_bg_mtx);
+	}
+	vbf_bg_gauges();
+	Lck_Unlock(&vbf_bg_mtx);
+}
+
+/*
+ * Returns zero if the bgfetch runs or is queued, one if there was no
+ * thread for it and minus one if the queue is full.
+ */
+
+static int
+vbf_bg_schedule(struct worker *wrk, struct busyobj *bo)
+{
+	struct req *req;
+	unsigned max;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	req = bo->req;
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AN(bo->is_bgfetch);
+
+	max = cache_param->bgfetch_max;
+
+	/*
+	 * Peek at the running count to avoid making the bereq for fetches
+	 * which run right away.  A bgfetch which has to pass the req body
+	 * on to the backend cannot wait for a slot, it runs regardless.
+	 */
+	if (max > 0 && vbf_bg_running >= max &&
+	    (req->req_body_status->avail == 0 ||
+	    req->req_body_status == BS_CACHED)) {
+		if (bo->stale_oc != NULL)
+			bo->bg_hits = bo->stale_oc->hits;
+		VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+		AZ(bo->wrk);
+		bo->wrk = wrk;
+		(void)vbf_stp_mkbereq(wrk, bo);
+		bo->wrk = NULL;
+		AZ(bo->req);
+	}
+
+	Lck_Lock(&vbf_bg_mtx);
+	if (bo->req == NULL && max > 0 && vbf_bg_running >= max) {
+		if (vbf_bg_queued >= cache_param->bgfetch_queue_max) {
+			Lck_Unlock(&vbf_bg_mtx);
+			return (-1);
+		}
+		VBH_insert(vbf_bg_heap, bo);
+		vbf_bg_queued++;
+		vbf_bg_gauges();
+		Lck_Unlock(&vbf_bg_mtx);
+		return (0);
+	}
+	vbf_bg_running++;
+	vbf_bg_gauges();
+	Lck_Unlock(&vbf_bg_mtx);
+
+	if (!Pool_Task(wrk->pool, bo->fetch_task, TASK_QUEUE_BG))
+		return (0);
+	vbf_bg_done(wrk);
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ */
+
 static void v_matchproto_(task_func_t)
 vbf_fetch_thread(struct worker *wrk, void *priv)
 {
@@ -1075,18 +1263,28 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 	struct busyobj *bo;
 	struct objcore *oc;
 	const struct fetch_step *stp;
+	unsigned bg;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
-	CHECK_OBJ_NOTNULL(bo->req, REQ_MAGIC);
+	CHECK_OBJ_ORNULL(bo->req, REQ_MAGIC);
 	oc = bo->fetch_objcore;
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
 	THR_SetBusyobj(bo);
-	stp = F_STP_MKBEREQ;
-	assert(isnan(bo->t_first));
-	assert(isnan(bo->t_prev));
-	VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+	bg = bo->is_bgfetch;
+	if (bo->req != NULL) {
+		stp = F_STP_MKBEREQ;
+		assert(isnan(bo->t_first));
+		assert(isnan(bo->t_prev));
+		VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+	} else {
+		/* bereq made before going into the bgfetch queue */
+		AN(bg);
+		assert(oc->boc->state == BOS_REQ_DONE);
+		stp = F_STP_STARTFETCH;
+		VSLb_ts_busyobj(bo, "Dequeue", W_TIM_real(wrk));
+	}
 
 	bo->wrk = wrk;
 	wrk->vsl = bo->vsl;
@@ -1140,6 +1338,8 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 	SES_Rel(bo->sp);
 	VBO_ReleaseBusyObj(wrk, &bo);
 	THR_SetBusyobj(NULL);
+	if (bg)
+		vbf_bg_done(wrk);
 }
 
 /*--------------------------------------------------------------------
@@ -1153,6 +1353,7 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	struct busyobj *bo;
 	enum task_prio prio;
 	const char *how;
+	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -1182,6 +1383,12 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 		how = "bgfetch";
 		bo->is_bgfetch = 1;
 		break;
+	case VBF_REFRESH:
+		prio = TASK_QUEUE_BG;
+		how = "bgfetch";
+		bo->is_bgfetch = 1;
+		bo->is_refresh = 1;
+		break;
 	default:
 		WRONG("Wrong fetch mode");
 	}
@@ -1218,21 +1425,25 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	bo->fetch_task->priv = bo;
 	bo->fetch_task->func = vbf_fetch_thread;
 
-	if (Pool_Task(wrk->pool, bo->fetch_task, prio)) {
+	if (bo->is_bgfetch)
+		i = vbf_bg_schedule(wrk, bo);
+	else
+		i = Pool_Task(wrk->pool, bo->fetch_task, prio);
+
+	if (i > 0) {
 		wrk->stats->bgfetch_no_thread++;
 		VSLb(bo->vsl, SLT_FetchError,
 		    "No thread available for bgfetch");
-		(void)vbf_stp_fail(req->wrk, bo);
-		if (bo->stale_oc != NULL)
-			(void)HSH_DerefObjCore(wrk, &bo->stale_oc, 0);
-		HSH_DerefBoc(wrk, oc);
-		SES_Rel(bo->sp);
-		THR_SetBusyobj(NULL);
-		VBO_ReleaseBusyObj(wrk, &bo);
+		vbf_abandon(wrk, &bo);
+	} else if (i < 0) {
+		wrk->stats->bgfetch_queue_full++;
+		VSLb(bo->vsl, SLT_FetchError,
+		    "Background fetch queue full");
+		vbf_abandon(wrk, &bo);
 	} else {
 		THR_SetBusyobj(NULL);
 		bo = NULL; /* ref transferred to fetch thread */
-		if (mode == VBF_BACKGROUND) {
+		if (mode == VBF_BACKGROUND || mode == VBF_REFRESH) {
 			ObjWaitState(oc, BOS_REQ_DONE);
 			(void)VRB_Ignore(req);
 		} else {
@@ -1248,6 +1459,18 @@ VBF_Fetch(struct worker *wrk, struct req *req, struct objcore *oc,
 	VSLb_ts_req(req, "Fetch", W_TIM_real(wrk));
 	assert(oc->boc == boc);
 	HSH_DerefBoc(wrk, oc);
-	if (mode == VBF_BACKGROUND)
+	if (mode == VBF_BACKGROUND || mode == VBF_REFRESH)
 		(void)HSH_DerefObjCore(wrk, &oc, HSH_RUSH_POLICY);
 }
+
+/*--------------------------------------------------------------------
+ */
+
+void
+VBF_Init(void)
+{
+
+	Lck_New(&vbf_bg_mtx, lck_bgfetch);
+	vbf_bg_heap = VBH_new(NULL, vbf_bg_cmp, vbf_bg_update);
+	AN(vbf_bg_heap);
+}
@@ -355,6 +355,69 @@ hsh_insert_busyobj(const struct worker *wrk, struct objhead *oh)
 	return (oc);
 }
 
+/*---------------------------------------------------------------------
+ * Refresh-ahead: a hit on a fresh object within the last refresh_ahead
+ * fraction of its TTL starts a background fetch, once per object and
+ * within the global budget of refresh_ahead_max.
+ */
+
+static int
+hsh_refresh_ahead(struct worker *wrk, const struct req *req,
+    struct objcore *oc)
+{
+	uint64_t n;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	Lck_AssertHeld(&oc->objhead->mtx);
+
+	if (cache_param->refresh_ahead <= 0. ||
+	    (oc->flags & (OC_F_REFRESHED | OC_F_PRIVATE)) ||
+	    oc->boc != NULL || req->hash_ignore_busy ||
+	    oc->hits < (VCL_INT)cache_param->refresh_ahead_hits)
+		return (0);
+	if (EXP_Ttl(req, oc) - req->t_req >
+	    oc->ttl * cache_param->refresh_ahead)
+		return (0);
+
+	n = __atomic_add_fetch(&VSC_C_main->refresh_inflight, 1,
+	    __ATOMIC_RELAXED);
+	if (n > cache_param->refresh_ahead_max) {
+		HSH_RefreshDone();
+		wrk->stats->refresh_limited++;
+		return (0);
+	}
+	oc->flags |= OC_F_REFRESHED;
+	return (1);
+}
+
+void
+HSH_RefreshDone(void)
+{
+	uint64_t n;
+
+	n = __atomic_fetch_sub(&VSC_C_main->refresh_inflight, 1,
+	    __ATOMIC_RELAXED);
+	assert(n > 0);
+}
+
+/* vcl_hit{} did not deliver, let a later hit refresh the object */
+
+void
+HSH_RefreshCancel(struct objcore *oc)
+{
+	struct objhead *oh;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+	Lck_Lock(&oh->mtx);
+	AN(oc->flags & OC_F_REFRESHED);
+	oc->flags &= ~OC_F_REFRESHED;
+	Lck_Unlock(&oh->mtx);
+	HSH_RefreshDone();
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -521,7 +584,14 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp)
 		}
 		oc->hits++;
 		boc_progress = oc->boc == NULL ? -1 : oc->boc->fetched_so_far;
-		AN(hsh_deref_objhead_unlock(wrk, &oh, HSH_RUSH_POLICY));
+		if (!busy_found && hsh_refresh_ahead(wrk, req, oc)) {
+			/* NB: the busy object inherits our objhead ref */
+			*bocp = hsh_insert_busyobj(wrk, oh);
+			Lck_Unlock(&oh->mtx);
+		} else {
+			AN(hsh_deref_objhead_unlock(wrk, &oh,
+			    HSH_RUSH_POLICY));
+		}
 		Req_LogHit(wrk, req, oc, boc_progress);
 		return (HSH_HIT);
 	}
@@ -772,8 +842,10 @@ HSH_Purge(struct worker *wrk, struct objhead *oh, vtim_real ttl_now,
 	}
 
 	WS_Release(wrk->aws, 0);
-	if (is_purge)
-		Pool_PurgeStat(total);
+	if (is_purge) {
+		wrk->stats->n_purges++;
+		wrk->stats->n_obj_purged += total;
+	}
 	return (total);
 }
 
@@ -900,6 +972,9 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
 	}
 	Lck_Unlock(&oh->mtx);
+	/* Lookups find the new object from now on */
+	if (!(oc->flags & OC_F_PRIVATE))
+		FHT_Forget(oh->digest);
 	EXP_Insert(wrk, oc); /* Does nothing unless EXP_RefNewObjcore was
 			      * called */
 	hsh_rush2(wrk, &rush);
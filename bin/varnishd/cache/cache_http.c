@@ -1288,6 +1288,86 @@ HTTP_Encode(const struct http *fm, uint8_t *p0, unsigned l, unsigned how)
 	vbe16enc(p0, n + 1);
 }
 
+/*--------------------------------------------------------------------
+ * HTTP/1 wire form of the regular headers of an encoded http struct.
+ *
+ * The wire form is the packed byte string from HTTP_Encode() starting
+ * after :reason:, with every terminating NUL replaced by CRLF, so that
+ * runs of unmodified headers can be sent with a single write.
+ *
+ * It is stored in OA_HEADERS right after the (padded) packed string,
+ * which leaves struct object and the layout of objects without it alone.
+ */
+
+unsigned
+http_EstimateWire(const struct http *fm, unsigned how)
+{
+	unsigned u, l;
+
+	CHECK_OBJ_NOTNULL(fm, HTTP_MAGIC);
+	l = 0;
+	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
+		Tcheck(fm->hd[u]);
+		if (http_isfiltered(fm, u, how))
+			continue;
+		l += Tlen(fm->hd[u]) + 2L;
+	}
+	return (l);
+}
+
+void
+HTTP_EncodeWire(const uint8_t *fm, uint8_t *p0, unsigned l)
+{
+	const char *s;
+	uint8_t *p, *e;
+	size_t w;
+
+	AN(fm);
+	AN(p0);
+	p = p0;
+	e = p + l;
+	s = (const char *)fm + 4;
+	s = strchr(s, '\0') + 1;	/* Skip :proto: */
+	s = strchr(s, '\0') + 1;	/* Skip :status: */
+	s = strchr(s, '\0') + 1;	/* Skip :reason: */
+	while (*s != '\0') {
+		w = strlen(s);
+		assert(p + w + 2 <= e);
+		memcpy(p, s, w);
+		p += w;
+		*p++ = '\r';
+		*p++ = '\n';
+		s += w + 1;
+	}
+	assert(p == e);
+}
+
+const char *
+HTTP_GetWirePack(const char *pack, ssize_t len, ssize_t *packlen,
+    ssize_t *wirelen)
+{
+	const char *p;
+	unsigned n;
+
+	AN(pack);
+	AN(packlen);
+	AN(wirelen);
+	assert(len > 4);
+	n = vbe16dec(pack);
+	assert(n >= HTTP_HDR_FIRST - 2);
+	n -= HTTP_HDR_FIRST - 2;	/* Headers in the packed string */
+	p = pack + 4;
+	while (n-- > 0)
+		p = strchr(p, '\0') + 1;
+	AZ(*p);
+	*packlen = PRNDUP(p + 1 - pack);
+	assert(*packlen <= len);
+	*wirelen = len - *packlen;
+	if (*wirelen == 0)
+		return (NULL);
+	return (pack + *packlen);
+}
+
 /*--------------------------------------------------------------------
  * Decode byte string into http struct
  */
@@ -42,6 +42,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "vcli_serve.h"
+#include "vte.h"
 #include "vtim.h"
 
 #include "VSC_lck.h"
@@ -54,8 +56,46 @@ struct ilck {
 	pthread_t		owner;
 	const char		*w;
 	struct VSC_lck		*stat;
+	vtim_mono		t_hold;
 };
 
+/*--------------------------------------------------------------------
+ * Lock profiling
+ *
+ * One in lck_profile_rate lock operations of a class is sampled: we
+ * try the lock first to find out if we have to wait for it, and time
+ * both the wait and the time until it is released again.
+ */
+
+static inline int
+lck_sample(const struct ilck *il)
+{
+	unsigned rate;
+
+	rate = cache_param->lck_profile_rate;
+	return (rate > 0 && il->stat->locks % rate == 0);
+}
+
+static void
+lck_prof_wait(struct VSC_lck *st, vtim_dur d)
+{
+
+	st->prof_contended++;
+	st->prof_wait += (uint64_t)(d * 1e6);
+	(*VSC_lck_hist_prof_wait(st, VHIST_Bucket(d)))++;
+}
+
+static void
+lck_prof_hold(struct ilck *il)
+{
+
+	if (il->t_hold == 0.)
+		return;
+	il->stat->prof_holds++;
+	il->stat->prof_hold += (uint64_t)((VTIM_mono() - il->t_hold) * 1e6);
+	il->t_hold = 0.;
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -110,21 +150,32 @@ void v_matchproto_()
 Lck__Lock(struct lock *lck, const char *p, int l)
 {
 	struct ilck *ilck;
-	int r = EINVAL;
+	int r = EINVAL, sample;
+	vtim_mono t0 = 0.;
 
 	AN(lck);
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	if (DO_DEBUG(DBG_WITNESS))
 		Lck_Witness_Lock(ilck, p, l, "");
-	if (DO_DEBUG(DBG_LCK)) {
+	sample = lck_sample(ilck);
+	if (sample || DO_DEBUG(DBG_LCK)) {
 		r = pthread_mutex_trylock(&ilck->mtx);
 		assert(r == 0 || r == EBUSY);
 	}
-	if (r)
+	if (r) {
+		if (sample)
+			t0 = VTIM_mono();
 		PTOK(pthread_mutex_lock(&ilck->mtx));
+	}
 	AZ(ilck->held);
-	if (r == EBUSY)
+	if (r == EBUSY && DO_DEBUG(DBG_LCK))
 		ilck->stat->dbg_busy++;
+	if (sample) {
+		ilck->stat->prof_samples++;
+		ilck->t_hold = VTIM_mono();
+		if (r == EBUSY)
+			lck_prof_wait(ilck->stat, ilck->t_hold - t0);
+	}
 	ilck->stat->locks++;
 	ilck->owner = pthread_self();
 	ilck->held = 1;
@@ -142,6 +193,7 @@ Lck__Unlock(struct lock *lck, const char *p, int l)
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	assert(pthread_equal(ilck->owner, pthread_self()));
 	AN(ilck->held);
+	lck_prof_hold(ilck);
 	ilck->held = 0;
 	/*
 	 * #ifdef POSIX_STUPIDITY:
@@ -178,6 +230,10 @@ Lck__Trylock(struct lock *lck, const char *p, int l)
 	if (r == 0) {
 		AZ(ilck->held);
 		ilck->held = 1;
+		if (lck_sample(ilck)) {
+			ilck->stat->prof_samples++;
+			ilck->t_hold = VTIM_mono();
+		}
 		ilck->stat->locks++;
 		ilck->owner = pthread_self();
 	} else if (DO_DEBUG(DBG_LCK))
@@ -235,6 +291,7 @@ Lck_CondWaitUntil(pthread_cond_t *cond, struct lock *lck, vtim_real when)
 	CAST_OBJ_NOTNULL(ilck, lck->priv, ILCK_MAGIC);
 	AN(ilck->held);
 	assert(pthread_equal(ilck->owner, pthread_self()));
+	ilck->t_hold = 0.;
 	ilck->held = 0;
 	if (isinf(when)) {
 		errno = pthread_cond_wait(cond, &ilck->mtx);
@@ -330,6 +387,97 @@ Lck_DestroyClass(struct vsc_seg **sg)
 #define LOCK(nam) struct VSC_lck *lck_##nam;
 #include "tbl/locks.h"
 
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(cli_func_t)
+lck_cli_profile(struct cli *cli, const char * const *av, void *priv)
+{
+	struct vte *vte;
+	const struct VSC_lck *st;
+
+	(void)av;
+	(void)priv;
+	vte = VTE_new(7, 80);
+	AN(vte);
+	VTE_printf(vte, "%s\t%s\t%s\t%s\t%s\t%s\t%s\n", "Class", "Locks",
+	    "Sampled", "Contended", "Wait(us)", "Avg wait(us)", "Avg hold(us)");
+#define LOCK(nam)							\
+	st = lck_##nam;							\
+	if (st->prof_samples > 0)					\
+		VTE_printf(vte, "%s\t%ju\t%ju\t%ju\t%ju\t%.1f\t%.1f\n",	\
+		    #nam, (uintmax_t)st->locks,				\
+		    (uintmax_t)st->prof_samples,			\
+		    (uintmax_t)st->prof_contended,			\
+		    (uintmax_t)st->prof_wait,				\
+		    st->prof_contended ?				\
+		    (double)st->prof_wait / st->prof_contended : 0.,	\
+		    st->prof_holds ?					\
+		    (double)st->prof_hold / st->prof_holds : 0.);
+#include "tbl/locks.h"
+	AZ(VTE_finish(vte));
+	AZ(VTE_format(vte, VCLI_VTE_format, cli));
+	VTE_destroy(&vte);
+}
+
+static void
+lck_json_hist(struct cli *cli, struct VSC_lck *st)
+{
+	unsigned u;
+
+	VCLI_Out(cli, "\"wait_hist\": [");
+	for (u = 0; u <= VHIST_INF; u++)
+		VCLI_Out(cli, "%s%ju", u ? ", " : "",
+		    (uintmax_t)*VSC_lck_hist_prof_wait(st, u));
+	VCLI_Out(cli, "],\n");
+}
+
+static void v_matchproto_(cli_func_t)
+lck_cli_profile_json(struct cli *cli, const char * const *av, void *priv)
+{
+	const struct VSC_lck *st;
+	const char *sep = "";
+
+	(void)priv;
+	VCLI_JSON_begin(cli, 2, av);
+	VCLI_Out(cli, ",\n");
+	VCLI_Out(cli, "{\n");
+	VSB_indent(cli->sb, 2);
+#define LOCK(nam)							\
+	st = lck_##nam;							\
+	VCLI_Out(cli, "%s", sep);					\
+	VCLI_Out(cli, "\"%s\": {\n", #nam);				\
+	VSB_indent(cli->sb, 2);						\
+	VCLI_Out(cli, "\"locks\": %ju,\n", (uintmax_t)st->locks);	\
+	VCLI_Out(cli, "\"samples\": %ju,\n",				\
+	    (uintmax_t)st->prof_samples);				\
+	VCLI_Out(cli, "\"contended\": %ju,\n",			\
+	    (uintmax_t)st->prof_contended);				\
+	VCLI_Out(cli, "\"wait_us\": %ju,\n", (uintmax_t)st->prof_wait);	\
+	lck_json_hist(cli, lck_##nam);					\
+	VCLI_Out(cli, "\"holds\": %ju,\n", (uintmax_t)st->prof_holds);	\
+	VCLI_Out(cli, "\"hold_us\": %ju\n", (uintmax_t)st->prof_hold);	\
+	VSB_indent(cli->sb, -2);					\
+	VCLI_Out(cli, "}");						\
+	sep = ",\n";
+#include "tbl/locks.h"
+	VSB_indent(cli->sb, -2);
+	VCLI_Out(cli, "\n}");
+	VCLI_JSON_end(cli);
+}
+
+static struct cli_proto lck_cmds[] = {
+	{ CLICMD_LOCK_PROFILE,		"", lck_cli_profile,
+	    lck_cli_profile_json },
+	{ NULL }
+};
+
+void
+LCK_CLI_Init(void)
+{
+
+	CLI_AddFuncs(lck_cmds);
+}
+
 void
 LCK_Init(void)
 {
@@ -438,6 +438,7 @@ child_main(int sigmagic, size_t altstksz)
 	Lck_New(&vxid_lock, lck_vxid);
 
 	CLI_Init();
+	LCK_CLI_Init();
 	PAN_Init();
 	VFP_Init();
 
@@ -451,14 +452,15 @@ child_main(int sigmagic, size_t altstksz)
 	HTTP_Init();
 
 	VBO_Init();
+	VBF_Init();
 	VCP_Init();
 	VBP_Init();
 	VDI_Init();
 	VBE_InitCfg();
 	Pool_Init();
 	V1P_Init();
-	V2D_Init();
 
+	FHT_Init();
 	EXP_Init();
 	HSH_Init(heritage.hash);
 	BAN_Init();
@@ -37,40 +37,164 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
+/* cpu_set_t, sched_getaffinity() and sysfs are Linux specific */
+#if defined(HAVE_PTHREAD_SETAFFINITY_NP) && defined(__linux__)
+#  define POOL_AFFINITY
+#  include <sched.h>
+#endif
+
 #include "cache_varnishd.h"
 #include "cache_pool.h"
 
+#include "VSC_pool.h"
+
 static pthread_t		thr_pool_herder;
 
-static struct lock		wstat_mtx;
 struct lock			pool_mtx;
 static VTAILQ_HEAD(,pool)	pools = VTAILQ_HEAD_INITIALIZER(pools);
 
+/*
+ * The live pools, for finding a thief without pool_mtx. Slots are only
+ * written by the pool herder, under the write lock of pool_ring_rwl,
+ * and scanned under its read lock.  A dying pool is removed from its
+ * slot before it is freed, which waits for the scans in progress.
+ */
+#define POOL_RING_MAX		64
+static pthread_rwlock_t		pool_ring_rwl;
+static struct pool		*pool_ring[POOL_RING_MAX];
+static unsigned			pool_ring_n;
+static unsigned			pool_ring_next;
+
 /*--------------------------------------------------------------------
- * Summing of stats into global stats counters
+ * Per-thread shards of the worker counters
+ *
+ * The MAIN segment has room for a copy of struct VSC_main_wrk per
+ * thread after the global counters, and readers of the VSC add up the
+ * copies which were ever used.  A thread owning a shard counts straight
+ * into it, on cache lines of its own, without ever summing anything.
+ * A shard is never cleared, the next thread to own it keeps counting
+ * from where the previous one left off.
+ *
+ * Threads left without a shard count on their stack, and sum that into
+ * the global counters with atomic additions.
  */
 
+static uint64_t			stat_map[POOL_STAT_SHARDS / 64];
+
+static struct VSC_main_wrk *
+pool_stat_get(void)
+{
+	struct VSC_main_shards *sh;
+	uint64_t m, hwm;
+	unsigned u, b, n;
+
+	sh = VSC_main_shards(VSC_C_main);
+	n = vmin_t(unsigned, sh->n, POOL_STAT_SHARDS);
+	for (u = 0; u * 64 < n; u++) {
+		m = __atomic_load_n(&stat_map[u], __ATOMIC_RELAXED);
+		while (~m != 0) {
+			b = __builtin_ctzll(~m);
+			if (u * 64 + b >= n)
+				return (NULL);
+			if (!__atomic_compare_exchange_n(&stat_map[u], &m,
+			    m | (1ULL << b), 0, __ATOMIC_ACQUIRE,
+			    __ATOMIC_RELAXED))
+				continue;
+			b += u * 64;
+			hwm = __atomic_load_n(&sh->hwm, __ATOMIC_RELAXED);
+			while (hwm <= b && !__atomic_compare_exchange_n(
+			    &sh->hwm, &hwm, b + 1, 0, __ATOMIC_RELEASE,
+			    __ATOMIC_RELAXED))
+				continue;
+			return (VSC_main_shard(VSC_C_main, b));
+		}
+	}
+	return (NULL);
+}
+
+static unsigned
+pool_stat_shard(const struct VSC_main_wrk *ds)
+{
+	uintptr_t p, b;
+
+	p = (uintptr_t)ds;
+	b = (uintptr_t)VSC_main_shard(VSC_C_main, 0);
+	if (p < b || p >= b + VSC_main_shards(VSC_C_main)->n *
+	    VSC_main_shard_stride)
+		return (0);
+	assert((p - b) % VSC_main_shard_stride == 0);
+	return (1);
+}
+
+static void
+pool_stat_put(const struct VSC_main_wrk *ds)
+{
+	uint64_t m;
+	unsigned u;
+
+	u = ((uintptr_t)ds - (uintptr_t)VSC_main_shard(VSC_C_main, 0)) /
+	    VSC_main_shard_stride;
+	m = __atomic_fetch_and(&stat_map[u / 64], ~(1ULL << (u % 64)),
+	    __ATOMIC_RELEASE);
+	assert(m & (1ULL << (u % 64)));
+}
+
+void
+Pool_Getstat(struct worker *wrk, struct VSC_main_wrk *ds)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(ds);
+	wrk->stats = pool_stat_get();
+	if (wrk->stats != NULL)
+		return;
+	memset(ds, 0, sizeof *ds);
+	wrk->stats = ds;
+}
+
+void
+Pool_Putstat(struct worker *wrk)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(wrk->stats);
+	if (pool_stat_shard(wrk->stats))
+		pool_stat_put(wrk->stats);
+	else
+		Pool_Sumstat(wrk);
+	wrk->stats = NULL;
+}
+
 void
 Pool_Sumstat(const struct worker *wrk)
 {
 
-	Lck_Lock(&wstat_mtx);
-	VSC_main_Summ_wrk(VSC_C_main, wrk->stats);
-	Lck_Unlock(&wstat_mtx);
+	if (pool_stat_shard(wrk->stats))
+		return;
+	wrk->stats->summs++;
+	VSC_main_Add_wrk(VSC_C_main, wrk->stats);
 	memset(wrk->stats, 0, sizeof *wrk->stats);
 }
 
-int
-Pool_TrySumstat(const struct worker *wrk)
+/*--------------------------------------------------------------------
+ * The counters of a pool are kept in a shard of their own, or summed
+ * into the global counters by the herder.
+ */
+
+void
+pool_sumstat(struct pool *pp)
 {
-	if (Lck_Trylock(&wstat_mtx))
-		return (0);
-	VSC_main_Summ_wrk(VSC_C_main, wrk->stats);
-	Lck_Unlock(&wstat_mtx);
-	memset(wrk->stats, 0, sizeof *wrk->stats);
-	return (1);
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	if (pool_stat_shard(pp->stats))
+		return;
+	Lck_Lock(&pp->mtx);
+	VSC_main_Add_wrk(VSC_C_main, pp->stats);
+	memset(pp->stats, 0, sizeof *pp->stats);
+	Lck_Unlock(&pp->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -96,49 +220,221 @@ Pool_Task_Any(struct pool_task *task, enum task_prio prio)
 }
 
 /*--------------------------------------------------------------------
- * Helper function to update stats for purges under lock
+ * Work stealing: Hand pool_steal() to an idle thread of another pool,
+ * which will then take a task from the queue of this one.  The caller
+ * has accounted for the request in pp->nsteal.
  */
 
 void
-Pool_PurgeStat(unsigned nobj)
+pool_steal_request(struct pool *pp, enum task_prio prio)
 {
-	Lck_Lock(&wstat_mtx);
-	VSC_C_main->n_purges++;
-	VSC_C_main->n_obj_purged += nobj;
-	Lck_Unlock(&wstat_mtx);
+	struct pool *pp2;
+	struct worker *wrk = NULL;
+	unsigned i, n, u;
+	int pass;
+
+	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
+	u = __atomic_fetch_add(&pool_ring_next, 1, __ATOMIC_RELAXED);
+	PTOK(pthread_rwlock_rdlock(&pool_ring_rwl));
+	n = pool_ring_n;
+	/* Look for a thief on our own node first */
+	for (pass = 0; wrk == NULL && pass < 2; pass++) {
+		for (i = 0; i < n; i++) {
+			pp2 = pool_ring[(u + i) % n];
+			if (pp2 == NULL)
+				continue;
+			CHECK_OBJ(pp2, POOL_MAGIC);
+			if (pp2 == pp || pp2->die ||
+			    (pp2->node == pp->node) != (pass == 0))
+				continue;
+			/* Never wait for another pool, it may be stealing
+			 * from us */
+			if (Lck_Trylock(&pp2->mtx))
+				continue;
+			wrk = pool_getidleworker(pp2, prio);
+			if (wrk != NULL) {
+				AZ(wrk->task->func);
+				wrk->task->func = pool_steal;
+				wrk->task->priv = pp;
+			}
+			Lck_Unlock(&pp2->mtx);
+			if (wrk != NULL)
+				break;
+		}
+	}
+	PTOK(pthread_rwlock_unlock(&pool_ring_rwl));
+
+	if (wrk != NULL) {
+		// see signaling_note in cache_wrk.c
+		PTOK(pthread_cond_signal(&wrk->cond));
+		return;
+	}
+
+	Lck_Lock(&pp->mtx);
+	assert(pp->nsteal > 0);
+	pp->nsteal--;
+	pp->stats->steals_missed++;
+	Lck_Unlock(&pp->mtx);
 }
 
 /*--------------------------------------------------------------------
- * Special function to summ stats
+ * The live pool accepting on the fewest listen sockets, to take over
+ * those of pool pp, which is about to die.
  */
 
-void v_matchproto_(task_func_t)
-pool_stat_summ(struct worker *wrk, void *priv)
+struct pool *
+pool_heir(const struct pool *pp)
 {
-	struct VSC_main_wrk *src;
-	struct pool *pp;
+	struct pool *pp2, *heir = NULL;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	pp = wrk->pool;
-	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
-	AN(priv);
-	src = priv;
+	Lck_Lock(&pool_mtx);
+	VTAILQ_FOREACH(pp2, &pools, list) {
+		CHECK_OBJ_NOTNULL(pp2, POOL_MAGIC);
+		if (pp2 == pp || pp2->die)
+			continue;
+		if (heir == NULL || pp2->npoolsocks < heir->npoolsocks)
+			heir = pp2;
+	}
+	Lck_Unlock(&pool_mtx);
+	return (heir);
+}
 
-	Lck_Lock(&wstat_mtx);
-	VSC_main_Summ_wrk(VSC_C_main, src);
+/*--------------------------------------------------------------------
+ * CPU affinity
+ *
+ * With thread_pool_affinity, the pools are spread over the NUMA nodes of
+ * the CPUs we are allowed to run on, or over the CPUs themselves if there
+ * is only one node.  The herder, the mempool guards and the workers of a
+ * pool inherit the affinity of the thread which creates them, so it is
+ * enough to pin the pool_poolherder thread while it creates a pool.  The
+ * memory they touch first, sessions, workspaces and the storage allocated
+ * by the workers, is then local to the node of the pool.
+ */
 
-	Lck_Lock(&pp->mtx);
-	VSC_main_Summ_pool(VSC_C_main, pp->stats);
-	Lck_Unlock(&pp->mtx);
-	memset(pp->stats, 0, sizeof pp->stats);
+#ifdef POOL_AFFINITY
+
+#define POOL_MAX_NODES	64
+
+static cpu_set_t	pool_cpus;
+static cpu_set_t	pool_node_cpus[POOL_MAX_NODES];
+static int		pool_node_id[POOL_MAX_NODES];
+static int		pool_nnodes;
+
+static void
+pool_cpulist(const char *fn, cpu_set_t *set)
+{
+	FILE *f;
+	char buf[BUFSIZ], *p, *e;
+	unsigned long lo, hi;
+
+	CPU_ZERO(set);
+	f = fopen(fn, "r");
+	if (f == NULL)
+		return;
+	p = fgets(buf, sizeof buf, f);
+	(void)fclose(f);
+	while (p != NULL && *p >= '0' && *p <= '9') {
+		lo = hi = strtoul(p, &e, 10);
+		if (*e == '-')
+			hi = strtoul(e + 1, &e, 10);
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, set);
+		p = (*e == ',') ? e + 1 : NULL;
+	}
+}
+
+static void
+pool_affinity_init(void)
+{
+	char fn[64];
+	int n;
+
+	if (sched_getaffinity(0, sizeof pool_cpus, &pool_cpus)) {
+		VSL(SLT_Error, NO_VXID, "Cannot get CPU affinity: %s",
+		    VAS_errtxt(errno));
+		return;
+	}
+	for (n = 0; n < CPU_SETSIZE && pool_nnodes < POOL_MAX_NODES; n++) {
+		bprintf(fn, "/sys/devices/system/node/node%d/cpulist", n);
+		pool_cpulist(fn, &pool_node_cpus[pool_nnodes]);
+		CPU_AND(&pool_node_cpus[pool_nnodes],
+		    &pool_node_cpus[pool_nnodes], &pool_cpus);
+		if (CPU_COUNT(&pool_node_cpus[pool_nnodes]) == 0)
+			continue;
+		pool_node_id[pool_nnodes++] = n;
+	}
+	if (pool_nnodes == 0) {
+		pool_node_cpus[0] = pool_cpus;
+		pool_node_id[0] = 0;
+		pool_nnodes = 1;
+	}
+}
+
+/* Pin the calling thread to the share of pool_no and return its node */
+
+static int
+pool_pin(unsigned pool_no, cpu_set_t *saved, int *nodep)
+{
+	cpu_set_t set;
+	unsigned u, npools, nunits;
+	int c, i, node = -1;
+
+	if (pool_nnodes == 0)
+		return (0);
+	npools = vmax_t(unsigned, cache_param->wthread_pools, 1);
+	if (pool_nnodes > 1) {
+		nunits = pool_nnodes;
+		CPU_ZERO(&set);
+		for (u = 0; u < nunits; u++) {
+			if (npools <= nunits ? u % npools != pool_no % npools :
+			    u != pool_no % nunits)
+				continue;
+			CPU_OR(&set, &set, &pool_node_cpus[u]);
+			node = (node == -1) ? pool_node_id[u] : -2;
+		}
+	} else {
+		nunits = CPU_COUNT(&pool_cpus);
+		CPU_ZERO(&set);
+		for (c = 0, u = 0; c < CPU_SETSIZE; c++) {
+			if (!CPU_ISSET(c, &pool_cpus))
+				continue;
+			if (npools <= nunits ? u % npools == pool_no % npools :
+			    u == pool_no % nunits)
+				CPU_SET(c, &set);
+			u++;
+		}
+		node = pool_node_id[0];
+	}
+	if (node < 0)
+		node = -1;
+
+	i = pthread_getaffinity_np(pthread_self(), sizeof *saved, saved);
+	if (i == 0)
+		i = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+	if (i != 0) {
+		VSL(SLT_Error, NO_VXID, "Pool %u: cannot set CPU affinity: %s",
+		    pool_no, VAS_errtxt(i));
+		return (0);
+	}
+	VSL(SLT_Debug, NO_VXID, "Pool %u: node %d, %d cpus",
+	    pool_no, node, CPU_COUNT(&set));
+	*nodep = node;
+	return (1);
+}
 
-	Lck_Unlock(&wstat_mtx);
-	memset(src, 0, sizeof *src);
+static void
+pool_unpin(const cpu_set_t *saved)
+{
+	int i;
 
-	AZ(pp->b_stat);
-	pp->b_stat = src;
+	i = pthread_setaffinity_np(pthread_self(), sizeof *saved, saved);
+	if (i != 0)
+		VSL(SLT_Error, NO_VXID, "Cannot restore CPU affinity: %s",
+		    VAS_errtxt(i));
 }
 
+#endif
+
 /*--------------------------------------------------------------------
  * Add a thread pool
  */
@@ -148,15 +444,28 @@ pool_mkpool(unsigned pool_no)
 {
 	struct pool *pp;
 	int i;
+#ifdef POOL_AFFINITY
+	cpu_set_t saved;
+#endif
 
 	ALLOC_OBJ(pp, POOL_MAGIC);
 	if (pp == NULL)
 		return (NULL);
-	pp->a_stat = calloc(1, sizeof *pp->a_stat);
-	AN(pp->a_stat);
-	pp->b_stat = calloc(1, sizeof *pp->b_stat);
-	AN(pp->b_stat);
+	pp->stats = pool_stat_get();
+	if (pp->stats == NULL) {
+		pp->stats = calloc(1, sizeof *pp->stats);
+		AN(pp->stats);
+	}
 	Lck_New(&pp->mtx, lck_perpool);
+	pp->pool_no = pool_no;
+	pp->vsc = VSC_pool_New(NULL, &pp->vsc_seg, "%u", pool_no);
+	AN(pp->vsc);
+	pp->node = -1;
+	pp->pinned = 0;
+#ifdef POOL_AFFINITY
+	if (cache_param->wthread_affinity)
+		pp->pinned = pool_pin(pool_no, &saved, &pp->node);
+#endif
 
 	VTAILQ_INIT(&pp->idle_queue);
 	VTAILQ_INIT(&pp->poolsocks);
@@ -169,11 +478,51 @@ pool_mkpool(unsigned pool_no)
 		(void)usleep(10000);
 
 	SES_NewPool(pp, pool_no);
-	VCA_NewPool(pp);
+#ifdef POOL_AFFINITY
+	if (pp->pinned)
+		pool_unpin(&saved);
+#endif
+	VCA_NewPool(pp, pool_no);
 
 	return (pp);
 }
 
+/*--------------------------------------------------------------------
+ * Maintain the ring of pools seen by pool_steal_request()
+ */
+
+static void
+pool_ring_add(struct pool *pp)
+{
+	unsigned u;
+
+	PTOK(pthread_rwlock_wrlock(&pool_ring_rwl));
+	for (u = 0; u < POOL_RING_MAX; u++) {
+		if (pool_ring[u] != NULL)
+			continue;
+		pool_ring[u] = pp;
+		if (u >= pool_ring_n)
+			pool_ring_n = u + 1;
+		break;
+	}
+	/* If there was no room, this pool will not steal for others */
+	PTOK(pthread_rwlock_unlock(&pool_ring_rwl));
+}
+
+static void
+pool_ring_del(const struct pool *pp)
+{
+	unsigned u;
+
+	/* Once we have the write lock, no scan can still see pp */
+	PTOK(pthread_rwlock_wrlock(&pool_ring_rwl));
+	for (u = 0; u < pool_ring_n; u++) {
+		if (pool_ring[u] == pp)
+			pool_ring[u] = NULL;
+	}
+	PTOK(pthread_rwlock_unlock(&pool_ring_rwl));
+}
+
 /*--------------------------------------------------------------------
  * This thread adjusts the number of pools to match the parameter.
  *
@@ -202,6 +551,7 @@ pool_poolherder(void *priv)
 				Lck_Lock(&pool_mtx);
 				VTAILQ_INSERT_TAIL(&pools, pp, list);
 				Lck_Unlock(&pool_mtx);
+				pool_ring_add(pp);
 				VSC_C_main->pools++;
 				nwq++;
 				continue;
@@ -218,8 +568,10 @@ pool_poolherder(void *priv)
 			Lck_Unlock(&pool_mtx);
 			if (!pp->die) {
 				VSL(SLT_Debug, NO_VXID, "XXX Kill Pool %p", pp);
-				pp->die = 1;
+				/* Before the accept tasks can go away */
 				VCA_DestroyPool(pp);
+				pp->die = 1;
+				pool_ring_del(pp);
 				PTOK(pthread_cond_signal(&pp->herder_cond));
 			}
 		}
@@ -230,7 +582,7 @@ pool_poolherder(void *priv)
 		VTAILQ_FOREACH(pp, &pools, list) {
 			CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 
-			if (pp->die && pp->nthr == 0)
+			if (pp->die && pp->nthr == 0 && pp->nsteal == 0)
 				ppx = pp;
 			u += pp->lqueue;
 		}
@@ -238,9 +590,13 @@ pool_poolherder(void *priv)
 			VTAILQ_REMOVE(&pools, ppx, list);
 			PTOK(pthread_join(ppx->herder_thr, &rvp));
 			PTOK(pthread_cond_destroy(&ppx->herder_cond));
-			free(ppx->a_stat);
-			free(ppx->b_stat);
+			pool_sumstat(ppx);
+			if (pool_stat_shard(ppx->stats))
+				pool_stat_put(ppx->stats);
+			else
+				free(ppx->stats);
 			SES_DestroyPool(ppx);
+			VSC_pool_Destroy(&ppx->vsc_seg);
 			Lck_Delete(&ppx->mtx);
 			FREE_OBJ(ppx);
 			VSC_C_main->pools--;
@@ -264,7 +620,9 @@ pan_pool(struct vsb *vsb)
 			continue;
 		VSB_printf(vsb, "nidle = %u,\n", pp->nidle);
 		VSB_printf(vsb, "nthr = %u,\n", pp->nthr);
-		VSB_printf(vsb, "lqueue = %u\n", pp->lqueue);
+		VSB_printf(vsb, "lqueue = %u,\n", pp->lqueue);
+		VSB_printf(vsb, "nsteal = %u,\n", pp->nsteal);
+		VSB_printf(vsb, "node = %d\n", pp->node);
 		VSB_indent(vsb, -2);
 		VSB_cat(vsb, "},\n");
 	}
@@ -278,8 +636,11 @@ void
 Pool_Init(void)
 {
 
-	Lck_New(&wstat_mtx, lck_wstat);
 	Lck_New(&pool_mtx, lck_wq);
+	PTOK(pthread_rwlock_init(&pool_ring_rwl, NULL));
+#ifdef POOL_AFFINITY
+	pool_affinity_init();
+#endif
 	PTOK(pthread_create(&thr_pool_herder, NULL, pool_poolherder, NULL));
 	while (!VSC_C_main->pools)
 		(void)usleep(10000);
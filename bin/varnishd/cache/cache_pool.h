@@ -34,12 +34,15 @@
 VTAILQ_HEAD(taskhead, pool_task);
 
 struct poolsock;
+struct VSC_pool;
 
 struct pool {
 	unsigned			magic;
 #define POOL_MAGIC			0x606658fa
 	VTAILQ_ENTRY(pool)		list;
 	VTAILQ_HEAD(,poolsock)		poolsocks;
+	unsigned			npoolsocks;
+	unsigned			pool_no;
 
 	int				die;
 	pthread_cond_t			herder_cond;
@@ -51,10 +54,20 @@ struct pool {
 	struct taskhead			queues[TASK_QUEUE_RESERVE];
 	unsigned			nthr;
 	unsigned			lqueue;
+	unsigned			nsteal;
+	int				node;
+	int				pinned;
 	uintmax_t			ndequeued;
-	struct VSC_main_pool		stats[1];
-	struct VSC_main_wrk		*a_stat;
-	struct VSC_main_wrk		*b_stat;
+	uintmax_t			nqueued;
+	vtim_dur			qwait;
+
+	/* arrival rate, herder private */
+	vtim_mono			t_rate;
+	uintmax_t			nq_rate;
+	double				rate;
+	struct VSC_main_wrk		*stats;
+	struct VSC_pool			*vsc;
+	struct vsc_seg			*vsc_seg;
 
 	struct mempool			*mpl_req;
 	struct mempool			*mpl_sess;
@@ -62,7 +75,11 @@ struct pool {
 };
 
 void *pool_herder(void*);
-task_func_t pool_stat_summ;
+void pool_sumstat(struct pool *);
+task_func_t pool_steal;
+struct worker *pool_getidleworker(struct pool *, enum task_prio);
+void pool_steal_request(struct pool *, enum task_prio);
+struct pool *pool_heir(const struct pool *);
 extern struct lock			pool_mtx;
-void VCA_NewPool(struct pool *);
+void VCA_NewPool(struct pool *, unsigned);
 void VCA_DestroyPool(struct pool *);
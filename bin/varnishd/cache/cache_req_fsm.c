@@ -631,7 +631,14 @@ cnt_lookup(struct worker *wrk, struct req *req)
 
 	switch (wrk->vpi->handling) {
 	case VCL_RET_DELIVER:
-		if (busy != NULL) {
+		if (busy != NULL && lr == HSH_HIT) {
+			/* Refresh-ahead of a fresh object */
+			CHECK_OBJ_NOTNULL(busy->boc, BOC_MAGIC);
+			VBF_Fetch(wrk, req, busy, oc, VBF_REFRESH);
+			wrk->stats->s_fetch++;
+			wrk->stats->s_bgfetch++;
+			wrk->stats->s_refresh++;
+		} else if (busy != NULL) {
 			AZ(oc->flags & OC_F_HFM);
 			CHECK_OBJ_NOTNULL(busy->boc, BOC_MAGIC);
 			// XXX: shouldn't we go to miss?
@@ -665,6 +672,9 @@ cnt_lookup(struct worker *wrk, struct req *req)
 		WRONG("Illegal return from vcl_hit{}");
 	}
 
+	if (busy != NULL && lr == HSH_HIT)
+		HSH_RefreshCancel(oc);
+
 	/* Drop our object, we won't need it */
 	(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
 
@@ -480,6 +480,8 @@ ses_handle(struct waited *wp, enum wait_event ev, vtim_real now)
 		SES_Delete(sp, SC_REM_CLOSE, now);
 		break;
 	case WAITER_ACTION:
+		if (xp->waited != NULL && xp->waited(sp, now))
+			break;
 		pp = sp->pool;
 		CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 		/* SES_Wait() guarantees the next will not assert. */
@@ -666,7 +666,10 @@ VSM_Init(void)
 	heritage.proc_vsmw = VSMW_New(heritage.vsm_fd, 0640, "_.index");
 	AN(heritage.proc_vsmw);
 
-	VSC_C_main = VSC_main_New(NULL, NULL, "");
+	/* A shard of the worker counters per thread, see Pool_Getstat() */
+	u = vmin_t(uintmax_t, POOL_STAT_SHARDS, 64 +
+	    (uintmax_t)cache_param->wthread_pools * cache_param->wthread_max);
+	VSC_C_main = VSC_main_New(NULL, NULL, u, "");
 	AN(VSC_C_main);
 
 	AN(heritage.proc_vsmw);
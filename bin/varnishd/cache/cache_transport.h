@@ -46,6 +46,7 @@ typedef void vtr_req_fail_f (struct req *, stream_close_t);
 typedef void vtr_reembark_f (struct worker *, struct req *);
 typedef int vtr_poll_f (struct req *);
 typedef int vtr_minimal_response_f (struct req *, uint16_t status);
+typedef int vtr_waited_f (struct sess *, vtim_real now);
 
 struct transport {
 	unsigned			magic;
@@ -67,6 +68,7 @@ struct transport {
 	vtr_reembark_f			*reembark;
 	vtr_poll_f			*poll;
 	vtr_minimal_response_f		*minimal_response;
+	vtr_waited_f			*waited;
 
 	VTAILQ_ENTRY(transport)		list;
 };
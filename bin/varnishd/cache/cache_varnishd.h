@@ -265,12 +265,26 @@ void CLI_AddFuncs(struct cli_proto *p);
 void EXP_Init(void);
 void EXP_Shutdown(void);
 
+/* cache_fasthit.c [FHT] */
+#define FHT_MAXLEN		8192
+void FHT_Init(void);
+unsigned FHT_Gen(void);
+void FHT_Insert(unsigned gen, const uint8_t *digest, vtim_real t_origin,
+    vtim_real t_expire, const void *hdr, size_t hdrlen, const void *body,
+    size_t bodylen);
+size_t FHT_Lookup(const uint8_t *digest, vtim_real now, uint8_t *buf,
+    size_t *hdrlen, vtim_real *t_origin);
+void FHT_Forget(const uint8_t *digest);
+void FHT_Flush(void);
+
 /* cache_fetch.c */
 enum vbf_fetch_mode_e {
 	VBF_NORMAL = 0,
 	VBF_PASS = 1,
 	VBF_BACKGROUND = 2,
+	VBF_REFRESH = 3,
 };
+void VBF_Init(void);
 void VBF_Fetch(struct worker *wrk, struct req *req,
     struct objcore *oc, struct objcore *oldoc, enum vbf_fetch_mode_e);
 const char *VBF_Get_Filter_List(struct busyobj *);
@@ -293,6 +307,10 @@ extern const struct vfp VFP_esi_gzip;
 
 /* cache_http.c */
 void HTTP_Init(void);
+unsigned http_EstimateWire(const struct http *fm, unsigned how);
+void HTTP_EncodeWire(const uint8_t *fm, uint8_t *, unsigned len);
+const char *HTTP_GetWirePack(const char *pack, ssize_t len, ssize_t *packlen,
+    ssize_t *wirelen);
 
 /* cache_http1_proto.c */
 
@@ -301,6 +319,8 @@ uint16_t HTTP1_DissectRequest(struct http_conn *, struct http *);
 uint16_t HTTP1_DissectResponse(struct http_conn *, struct http *resp,
     const struct http *req);
 unsigned HTTP1_Write(const struct worker *w, const struct http *hp, const int*);
+unsigned HTTP1_WriteWire(const struct worker *w, const struct http *hp,
+    const char *pack, ssize_t packlen, const char *wire, ssize_t wirelen);
 
 /* cache_main.c */
 vxid_t VXID_Get(const struct worker *, uint64_t marker);
@@ -319,6 +339,7 @@ void THR_Init(void);
 
 /* cache_lck.c */
 void LCK_Init(void);
+void LCK_CLI_Init(void);
 
 /* cache_mempool.c */
 void MPL_AssertSane(const void *item);
@@ -400,9 +421,10 @@ void Pool_Init(void);
 int Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio);
 int Pool_Task_Arg(struct worker *, enum task_prio, task_func_t *,
     const void *arg, size_t arg_len);
+#define POOL_STAT_SHARDS	4096
+void Pool_Getstat(struct worker *, struct VSC_main_wrk *);
+void Pool_Putstat(struct worker *);
 void Pool_Sumstat(const struct worker *w);
-int Pool_TrySumstat(const struct worker *wrk);
-void Pool_PurgeStat(unsigned nobj);
 int Pool_Task_Any(struct pool_task *task, enum task_prio prio);
 void pan_pool(struct vsb *);
 
@@ -540,6 +562,14 @@ void WRK_Init(void);
 void WRK_AddStat(const struct worker *);
 void WRK_Log(enum VSL_tag_e, const char *, ...);
 
+enum vhist_bucket {
+#define VSC_HIST(t, b, v)	VHIST_##t,
+#include "tbl/vsc_hist.h"
+	VHIST_INF
+};
+unsigned VHIST_Bucket(double);
+double VHIST_Bound(unsigned);
+
 /* cache_vpi.c */
 extern const size_t vpi_wrk_len;
 void VPI_wrk_init(struct worker *, void *, size_t);
@@ -565,9 +595,6 @@ void WS_Rollback(struct ws *, uintptr_t);
 /* http1/cache_http1_pipe.c */
 void V1P_Init(void);
 
-/* cache_http2_deliver.c */
-void V2D_Init(void);
-
 /* stevedore.c */
 void STV_open(void);
 void STV_close(void);
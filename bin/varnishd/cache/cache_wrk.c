@@ -65,6 +65,8 @@
 
 #include "hash/hash_slinger.h"
 
+#include "VSC_pool.h"
+
 static void Pool_Work_Thread(struct pool *pp, struct worker *wrk);
 
 static uintmax_t reqpoolfail;
@@ -98,12 +100,11 @@ wrk_bgthread(void *arg)
 	INIT_OBJ(wpriv, WORKER_PRIV_MAGIC);
 	wrk.wpriv = wpriv;
 	// bgthreads do not have a vpi member
-	memset(&ds, 0, sizeof ds);
-	wrk.stats = &ds;
+	Pool_Getstat(&wrk, &ds);
 
 	r = bt->func(&wrk, bt->priv);
 	HSH_Cleanup(&wrk);
-	Pool_Sumstat(&wrk);
+	Pool_Putstat(&wrk);
 	return (r);
 }
 
@@ -143,8 +144,7 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 	INIT_OBJ(wpriv, WORKER_PRIV_MAGIC);
 	w->wpriv = wpriv;
 	w->lastused = NAN;
-	memset(&ds, 0, sizeof ds);
-	w->stats = &ds;
+	Pool_Getstat(w, &ds);
 	THR_SetWorker(w);
 	PTOK(pthread_cond_init(&w->cond, NULL));
 
@@ -162,36 +162,21 @@ WRK_Thread(struct pool *qp, size_t stacksize, unsigned thread_workspace)
 		VCL_Rel(&w->wpriv->vcl);
 	PTOK(pthread_cond_destroy(&w->cond));
 	HSH_Cleanup(w);
-	Pool_Sumstat(w);
+	Pool_Putstat(w);
 }
 
 /*--------------------------------------------------------------------
- * Summing of stats into pool counters
+ * Summing of stats into global counters, for threads without a shard
  */
 
 static unsigned
-wrk_addstat(const struct worker *wrk, const struct pool_task *tp, unsigned locked)
+wrk_addstat(const struct worker *wrk, const struct pool_task *tp)
 {
-	struct pool *pp;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	pp = wrk->pool;
-	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
-	if (locked)
-		Lck_AssertHeld(&pp->mtx);
-
 	if ((tp == NULL && wrk->stats->summs > 0) ||
-	    (wrk->stats->summs >= cache_param->wthread_stats_rate)) {
-		if (!locked)
-			Lck_Lock(&pp->mtx);
-
-		pp->a_stat->summs++;
-		VSC_main_Summ_wrk_wrk(pp->a_stat, wrk->stats);
-		memset(wrk->stats, 0, sizeof *wrk->stats);
-
-		if (!locked)
-			Lck_Unlock(&pp->mtx);
-	}
+	    (wrk->stats->summs >= cache_param->wthread_stats_rate))
+		Pool_Sumstat(wrk);
 
 	return (tp != NULL);
 }
@@ -200,10 +185,38 @@ void
 WRK_AddStat(const struct worker *wrk)
 {
 
-	(void)wrk_addstat(wrk, wrk->task, 0);
+	(void)wrk_addstat(wrk, wrk->task);
 	wrk->stats->summs++;
 }
 
+/*--------------------------------------------------------------------
+ * Buckets of the VSC histograms, see tbl/vsc_hist.h
+ */
+
+static const double vhist_bound[VHIST_INF] = {
+#define VSC_HIST(t, b, v)	v,
+#include "tbl/vsc_hist.h"
+};
+
+unsigned
+VHIST_Bucket(double v)
+{
+	unsigned u;
+
+	for (u = 0; u < VHIST_INF; u++)
+		if (v <= vhist_bound[u])
+			break;
+	return (u);
+}
+
+double
+VHIST_Bound(unsigned u)
+{
+
+	assert(u < VHIST_INF);
+	return (vhist_bound[u]);
+}
+
 /*--------------------------------------------------------------------
  * Pool reserve calculation
  */
@@ -227,7 +240,7 @@ pool_reserve(void)
 
 /*--------------------------------------------------------------------*/
 
-static struct worker *
+struct worker *
 pool_getidleworker(struct pool *pp, enum task_prio prio)
 {
 	struct pool_task *pt = NULL;
@@ -303,7 +316,7 @@ int
 Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 {
 	struct worker *wrk;
-	int retval = 0;
+	int retval = 0, steal;
 	CHECK_OBJ_NOTNULL(pp, POOL_MAGIC);
 	AN(task);
 	AN(task->func);
@@ -329,12 +342,15 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 		AZ(wrk->task->func);
 		wrk->task->func = task->func;
 		wrk->task->priv = task->priv;
+		pp->vsc->qwait_none++;
 		Lck_Unlock(&pp->mtx);
 		// see signaling_note at the top for explanation
 		PTOK(pthread_cond_signal(&wrk->cond));
 		return (0);
 	}
 
+	steal = 0;
+
 	/* Vital work is always queued. Only priority classes that can
 	 * fit under the reserve capacity are eligible to queuing.
 	 */
@@ -345,8 +361,14 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 	    cache_param->wthread_queue_limit) {
 		pp->stats->sess_queued++;
 		pp->lqueue++;
+		pp->nqueued++;
+		task->t_queued = VTIM_mono();
 		VTAILQ_INSERT_TAIL(&pp->queues[prio], task, list);
 		PTOK(pthread_cond_signal(&pp->herder_cond));
+		if (pp->nsteal < cache_param->wthread_steal) {
+			pp->nsteal++;
+			steal = 1;
+		}
 	} else {
 		/* NB: This is counter-intuitive but when we drop a REQ
 		 * task, it is an HTTP/1 request and we effectively drop
@@ -360,9 +382,77 @@ Pool_Task(struct pool *pp, struct pool_task *task, enum task_prio prio)
 		retval = -1;
 	}
 	Lck_Unlock(&pp->mtx);
+	if (steal)
+		pool_steal_request(pp, prio);
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * Account for the time a task spent in the queue.
+ */
+
+static void
+pool_qwait(struct pool *pp, const struct pool_task *tp)
+{
+	vtim_dur d;
+
+	Lck_AssertHeld(&pp->mtx);
+	d = VTIM_mono() - tp->t_queued;
+	pp->qwait += (d - pp->qwait) * .125;
+	(*VSC_pool_hist_qwait(pp->vsc, VHIST_Bucket(d)))++;
+}
+
+/*--------------------------------------------------------------------
+ * Run by an idle thread of another pool: take the most important task
+ * from the queue of the pool in priv and make it our next task.  While
+ * tasks remain queued, pass the steal request on to the next thief.
+ */
+
+void v_matchproto_(task_func_t)
+pool_steal(struct worker *wrk, void *priv)
+{
+	struct pool *pp;
+	struct pool_task *tp = NULL;
+	unsigned i, more = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(pp, priv, POOL_MAGIC);
+	assert(pp != wrk->pool);
+
+	Lck_Lock(&pp->mtx);
+	assert(pp->nsteal > 0);
+	for (i = 0; i < TASK_QUEUE_RESERVE; i++) {
+		tp = VTAILQ_FIRST(&pp->queues[i]);
+		if (tp != NULL) {
+			pp->lqueue--;
+			pp->ndequeued--;
+			VTAILQ_REMOVE(&pp->queues[i], tp, list);
+			pool_qwait(pp, tp);
+			AZ(wrk->task->func);
+			wrk->task->func = tp->func;
+			wrk->task->priv = tp->priv;
+			pp->stats->tasks_stolen++;
+			if (pp->node != wrk->pool->node)
+				pp->stats->tasks_stolen_remote++;
+			break;
+		}
+	}
+	if (tp == NULL)
+		pp->stats->steals_missed++;
+	for (; tp != NULL && i < TASK_QUEUE_RESERVE; i++) {
+		if (!VTAILQ_EMPTY(&pp->queues[i])) {
+			more = 1;
+			break;
+		}
+	}
+	if (!more)
+		pp->nsteal--;
+	Lck_Unlock(&pp->mtx);
+
+	if (more)
+		pool_steal_request(pp, (enum task_prio)i);
+}
+
 /*--------------------------------------------------------------------
  * Empty function used as a pointer value for the thread exit condition.
  */
@@ -383,7 +473,7 @@ static void
 Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 {
 	struct pool_task *tp;
-	struct pool_task tpx, tps;
+	struct pool_task tpx;
 	vtim_real tmo, now;
 	unsigned i, reserve;
 
@@ -407,20 +497,14 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 				pp->lqueue--;
 				pp->ndequeued--;
 				VTAILQ_REMOVE(&pp->queues[i], tp, list);
+				pool_qwait(pp, tp);
 				break;
 			}
 		}
 
-		if (wrk_addstat(wrk, tp, 1)) {
+		if (wrk_addstat(wrk, tp)) {
 			wrk->stats->summs++;
 			AN(tp);
-		} else if (pp->b_stat != NULL && pp->a_stat->summs) {
-			/* Nothing to do, push pool stats into global pool */
-			tps.func = pool_stat_summ;
-			tps.priv = pp->a_stat;
-			pp->a_stat = pp->b_stat;
-			pp->b_stat = NULL;
-			tp = &tps;
 		} else {
 			/* Nothing to do: To sleep, perchance to dream ... */
 			if (isnan(wrk->lastused))
@@ -432,17 +516,7 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 			now = wrk->lastused;
 			do {
 				// see signaling_note at the top for explanation
-				if (DO_DEBUG(DBG_VCLREL) &&
-				    pp->b_stat == NULL && pp->a_stat->summs)
-					/* We've released the VCL, but
-					 * there are pool stats not pushed
-					 * to the global stats and some
-					 * thread is busy pushing
-					 * stats. Set a 1 second timeout
-					 * so that we'll wake up and get a
-					 * chance to push stats. */
-					tmo = now + 1.;
-				else if (wrk->wpriv->vcl == NULL)
+				if (wrk->wpriv->vcl == NULL)
 					tmo = INFINITY;
 				else if (DO_DEBUG(DBG_VTC_MODE))
 					tmo = now + 1.;
@@ -455,25 +529,6 @@ Pool_Work_Thread(struct pool *pp, struct worker *wrk)
 					tpx = *wrk->task;
 					tp = &tpx;
 					wrk->stats->summs++;
-				} else if (pp->b_stat != NULL &&
-				    pp->a_stat->summs) {
-					/* Woken up to release the VCL,
-					 * and noticing that there are
-					 * pool stats not pushed to the
-					 * global stats and no active
-					 * thread currently doing
-					 * it. Remove ourself from the
-					 * idle queue and take on the
-					 * task. */
-					assert(pp->nidle > 0);
-					VTAILQ_REMOVE(&pp->idle_queue,
-					    wrk->task, list);
-					pp->nidle--;
-					tps.func = pool_stat_summ;
-					tps.priv = pp->a_stat;
-					pp->a_stat = pp->b_stat;
-					pp->b_stat = NULL;
-					tp = &tps;
 				} else {
 					// Presumably ETIMEDOUT but we do not
 					// assert this because pthread condvars
@@ -531,12 +586,13 @@ pool_thread(void *priv)
 	return (NULL);
 }
 
-static void
-pool_breed(struct pool *qp)
+static int
+pool_mkthread(struct pool *qp)
 {
 	pthread_t tp;
 	pthread_attr_t tp_attr;
 	struct pool_info *pi;
+	int e;
 
 	PTOK(pthread_attr_init(&tp_attr));
 	PTOK(pthread_attr_setdetachstate(&tp_attr, PTHREAD_CREATE_DETACHED));
@@ -550,28 +606,83 @@ pool_breed(struct pool *qp)
 	PTOK(pthread_attr_getstacksize(&tp_attr, &pi->stacksize));
 	pi->qp = qp;
 
-	errno = pthread_create(&tp, &tp_attr, pool_thread, pi);
-	if (errno) {
+	e = pthread_create(&tp, &tp_attr, pool_thread, pi);
+	errno = e;
+	if (e) {
 		FREE_OBJ(pi);
 		VSL(SLT_Debug, NO_VXID, "Create worker thread failed %d %s",
 		    errno, VAS_errtxt(errno));
 		Lck_Lock(&pool_mtx);
 		VSC_C_main->threads_failed++;
 		Lck_Unlock(&pool_mtx);
-		VTIM_sleep(cache_param->wthread_fail_delay);
 	} else {
 		qp->nthr++;
+		qp->vsc->threads = qp->nthr;
 		Lck_Lock(&pool_mtx);
 		VSC_C_main->threads++;
 		VSC_C_main->threads_created++;
 		Lck_Unlock(&pool_mtx);
-		if (cache_param->wthread_add_delay > 0.0)
-			VTIM_sleep(cache_param->wthread_add_delay);
-		else
-			(void)sched_yield();
 	}
 
 	PTOK(pthread_attr_destroy(&tp_attr));
+	return (e);
+}
+
+static void
+pool_breed(struct pool *qp, unsigned n)
+{
+
+	AN(n);
+	while (n-- > 0) {
+		if (pool_mkthread(qp)) {
+			VTIM_sleep(cache_param->wthread_fail_delay);
+			return;
+		}
+	}
+	if (cache_param->wthread_add_delay > 0.0)
+		VTIM_sleep(cache_param->wthread_add_delay);
+	else
+		(void)sched_yield();
+}
+
+/*--------------------------------------------------------------------
+ * With thread_pool_queue_target set, return how many threads the pool
+ * needs to drain its queue and absorb the expected arrivals in time.
+ * Return zero while queued tasks are below the target, and in *tmo how
+ * long until the oldest of them reaches it.
+ */
+
+static unsigned
+pool_need(struct pool *pp, vtim_dur *tmo)
+{
+	struct pool_task *tp;
+	vtim_dur target, wait = 0.;
+	vtim_mono now;
+	double dt;
+	unsigned i, n = 0;
+
+	target = cache_param->wthread_queue_target;
+	assert(target > 0.);
+
+	Lck_Lock(&pp->mtx);
+	now = VTIM_mono();
+	dt = now - pp->t_rate;
+	if (dt >= 0.1) {
+		pp->rate += ((pp->nqueued - pp->nq_rate) / dt - pp->rate) * .5;
+		pp->nq_rate = pp->nqueued;
+		pp->t_rate = now;
+	}
+	for (i = 0; i < TASK_QUEUE_RESERVE; i++) {
+		tp = VTAILQ_FIRST(&pp->queues[i]);
+		if (tp != NULL)
+			wait = vmax(wait, now - tp->t_queued);
+	}
+	if (pp->lqueue > 0 && (wait >= target || pp->qwait >= target))
+		n = pp->lqueue + (unsigned)(pp->rate * target);
+	else
+		*tmo = target - wait;
+	Lck_Unlock(&pp->mtx);
+	return (n);
 }
 
 /*--------------------------------------------------------------------
@@ -584,6 +695,10 @@ pool_breed(struct pool *qp)
  * pool_breed(), we sleep whenever we create a thread and a little while longer
  * whenever we fail to, hopefully missing a lot of cond_signals in the meantime.
  *
+ * With thread_pool_queue_target, we leave tasks queued until they are about
+ * to wait too long, and then create all the threads pool_need() asks for in
+ * one go before sleeping.
+ *
  * Idle threads are destroyed at a rate determined by wthread_destroy_delay
  *
  * XXX: probably need a lot more work.
@@ -598,7 +713,8 @@ pool_herder(void *priv)
 	double t_idle;
 	struct worker *wrk;
 	double delay;
-	unsigned wthread_min;
+	vtim_dur tmo;
+	unsigned n, wthread_min;
 	uintmax_t dq = (1ULL << 31);
 	vtim_mono dqt = 0;
 	int r = 0;
@@ -609,6 +725,8 @@ pool_herder(void *priv)
 	THR_Init();
 
 	while (!pp->die || pp->nthr > 0) {
+		pool_sumstat(pp);
+
 		/*
 		 * If the worker pool is configured too small, we can
 		 * end up deadlocking it (see #2418 for details).
@@ -641,12 +759,26 @@ pool_herder(void *priv)
 			wthread_min = 0;
 
 		/* Make more threads if needed and allowed */
-		if (pp->nthr < wthread_min ||
-		    (pp->lqueue > 0 && pp->nthr < cache_param->wthread_max)) {
-			pool_breed(pp);
+		if (pp->nthr < wthread_min) {
+			pool_breed(pp, 1);
 			continue;
 		}
 
+		tmo = 0.;
+		if (pp->lqueue > 0 && pp->nthr < cache_param->wthread_max) {
+			if (cache_param->wthread_queue_target == 0.) {
+				pool_breed(pp, 1);
+				continue;
+			}
+			n = pool_need(pp, &tmo);
+			if (n > 0) {
+				pool_breed(pp, vmin(n,
+				    cache_param->wthread_max - pp->nthr));
+				pp->vsc->batches++;
+				continue;
+			}
+		}
+
 		delay = cache_param->wthread_timeout;
 		assert(pp->nthr >= wthread_min);
 
@@ -679,6 +811,7 @@ pool_herder(void *priv)
 
 			if (wrk != NULL) {
 				pp->nthr--;
+				pp->vsc->threads = pp->nthr;
 				Lck_Lock(&pool_mtx);
 				VSC_C_main->threads--;
 				VSC_C_main->threads_destroyed++;
@@ -709,6 +842,9 @@ pool_herder(void *priv)
 				VSC_C_main->threads_limited++;
 			r = Lck_CondWaitTimeout(
 			    &pp->herder_cond, &pp->mtx, 1.0);
+		} else if (tmo > 0.) {
+			r = Lck_CondWaitTimeout(
+			    &pp->herder_cond, &pp->mtx, vmin(tmo, delay));
 		}
 		Lck_Unlock(&pp->mtx);
 	}
@@ -52,6 +52,9 @@ struct listen_sock {
 	const struct suckaddr		*addr;
 	const struct transport		*transport;
 	const struct uds_perms		*perms;
+	unsigned			shard;
+	unsigned			nshards;
+	unsigned			steer;
 	unsigned			test_heritage;
 	struct conn_heritage		*conn_heritage;
 	struct acceptor			*vca;
@@ -62,6 +62,8 @@ int VHT_SetMaxTableSize(struct vht_table *, size_t);
 int VHT_SetProtoMax(struct vht_table *, size_t);
 const char *VHT_LookupName(const struct vht_table *, unsigned, size_t *);
 const char *VHT_LookupValue(const struct vht_table *, unsigned, size_t *);
+unsigned VHT_Find(const struct vht_table *, const char *, size_t,
+    const char *, size_t, unsigned *);
 int VHT_Init(struct vht_table *, size_t);
 void VHT_Fini(struct vht_table *);
 
@@ -128,3 +130,30 @@ enum vhd_ret_e  VHD_Decode(struct vhd_decode *, struct vht_table *,
     const uint8_t *in, size_t inlen, size_t *p_inused,
     char *out, size_t outlen, size_t *p_outused);
 const char *VHD_Error(enum vhd_ret_e);
+
+/* VHE - Varnish HPACK Encoder */
+
+struct vsb;
+
+enum vhe_index_e {
+	VHE_INDEX,		/* Literal with incremental indexing */
+	VHE_NOINDEX,		/* Literal without indexing */
+	VHE_NEVER,		/* Literal never indexed */
+};
+
+struct vhe_encode {
+	unsigned		magic;
+#define VHE_ENCODE_MAGIC	0x4e1b8ac5
+
+	unsigned		dirty;
+	unsigned		update;
+	unsigned		update_min;
+	struct vht_table	tbl[1];
+};
+
+int VHE_Init(struct vhe_encode *, size_t limit);
+void VHE_Fini(struct vhe_encode *);
+void VHE_SetMaxTableSize(struct vhe_encode *, size_t);
+void VHE_Begin(struct vhe_encode *, struct vsb *);
+void VHE_Encode(struct vhe_encode *, struct vsb *, const char *name,
+    size_t namelen, const char *value, size_t valuelen, enum vhe_index_e);
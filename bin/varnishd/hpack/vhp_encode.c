@@ -0,0 +1,433 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HPACK encoder (RFC 7541)
+ *
+ * The encoder keeps its own copy of the dynamic table, which mirrors
+ * the decoder table of the peer as long as every header block produced
+ * is actually sent, in the order it was produced. The dirty flag tells
+ * the caller whether the last header block changed the shared state.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "miniobj.h"
+#include "vsb.h"
+
+#include "hpack/vhp.h"
+
+/* Initial SETTINGS_HEADER_TABLE_SIZE, rfc7540,l,4224,4224 */
+#define VHE_DEFAULT_TABLE_SIZE	4096
+
+static const struct {
+	uint32_t	code;
+	uint8_t		blen;
+} vhe_huf[256] = {
+#define HPH(c, h, l) [c] = { h, l },
+#include "tbl/vhp_huffman.h"
+};
+
+/* rfc7541,l,467,489 */
+static void
+vhe_integer(struct vsb *vsb, unsigned pfx, uint8_t b0, size_t val)
+{
+	unsigned mask;
+
+	assert(pfx > 0 && pfx < 8);
+	mask = (1U << pfx) - 1U;
+	if (val < mask) {
+		VSB_putc(vsb, b0 | (uint8_t)val);
+		return;
+	}
+	VSB_putc(vsb, b0 | (uint8_t)mask);
+	val -= mask;
+	while (val >= 128) {
+		VSB_putc(vsb, 0x80 | (uint8_t)(val & 0x7f));
+		val >>= 7;
+	}
+	VSB_putc(vsb, (uint8_t)val);
+}
+
+static size_t
+vhe_huffman_len(const char *s, size_t l)
+{
+	size_t bits = 0;
+
+	for (; l > 0; l--, s++)
+		bits += vhe_huf[(uint8_t)*s].blen;
+	return ((bits + 7) / 8);
+}
+
+/* rfc7541,l,559,583 */
+static void
+vhe_string(struct vsb *vsb, const char *s, size_t l)
+{
+	uint64_t acc = 0;
+	unsigned n = 0, c;
+	size_t hl;
+
+	hl = vhe_huffman_len(s, l);
+	if (hl > l) {
+		vhe_integer(vsb, 7, 0x00, l);
+		VSB_bcat(vsb, s, l);
+		return;
+	}
+
+	vhe_integer(vsb, 7, 0x80, hl);
+	for (; l > 0; l--, s++) {
+		c = (uint8_t)*s;
+		acc = (acc << vhe_huf[c].blen) | vhe_huf[c].code;
+		n += vhe_huf[c].blen;
+		while (n >= 8) {
+			n -= 8;
+			VSB_putc(vsb, (uint8_t)(acc >> n));
+		}
+	}
+	/* Pad with the most significant bits of EOS */
+	if (n > 0)
+		VSB_putc(vsb, (uint8_t)((acc << (8 - n)) | (0xffU >> n)));
+}
+
+/**********************************************************************/
+
+int
+VHE_Init(struct vhe_encode *enc, size_t limit)
+{
+
+	AN(enc);
+	INIT_OBJ(enc, VHE_ENCODE_MAGIC);
+	if (VHT_Init(enc->tbl, limit)) {
+		FINI_OBJ(enc);
+		return (-1);
+	}
+	/* The peer decoder starts out with the default size */
+	if (limit < VHE_DEFAULT_TABLE_SIZE) {
+		enc->update = 1;
+		enc->update_min = limit;
+	} else
+		AZ(VHT_SetMaxTableSize(enc->tbl, VHE_DEFAULT_TABLE_SIZE));
+	return (0);
+}
+
+void
+VHE_Fini(struct vhe_encode *enc)
+{
+
+	CHECK_OBJ_NOTNULL(enc, VHE_ENCODE_MAGIC);
+	VHT_Fini(enc->tbl);
+	FINI_OBJ(enc);
+}
+
+/*
+ * Adjust the table size, typically after the peer changed its
+ * SETTINGS_HEADER_TABLE_SIZE. The change is signalled at the beginning
+ * of the next header block.
+ */
+
+void
+VHE_SetMaxTableSize(struct vhe_encode *enc, size_t maxsize)
+{
+
+	CHECK_OBJ_NOTNULL(enc, VHE_ENCODE_MAGIC);
+	if (maxsize > enc->tbl->protomax)
+		maxsize = enc->tbl->protomax;
+	if (maxsize == enc->tbl->maxsize)
+		return;
+	AZ(VHT_SetMaxTableSize(enc->tbl, maxsize));
+	if (!enc->update || maxsize < enc->update_min)
+		enc->update_min = maxsize;
+	enc->update = 1;
+}
+
+/* rfc7541,l,1071,1096 */
+void
+VHE_Begin(struct vhe_encode *enc, struct vsb *vsb)
+{
+
+	CHECK_OBJ_NOTNULL(enc, VHE_ENCODE_MAGIC);
+	AN(vsb);
+	enc->dirty = 0;
+	if (!enc->update)
+		return;
+	if (enc->update_min < enc->tbl->maxsize)
+		vhe_integer(vsb, 5, 0x20, enc->update_min);
+	vhe_integer(vsb, 5, 0x20, enc->tbl->maxsize);
+	enc->update = 0;
+	enc->dirty = 1;
+}
+
+/*
+ * Encode one header field. The name must already be in lower case.
+ * Fields which would not fit in the dynamic table are never indexed,
+ * since inserting them would merely flush the table.
+ */
+
+void
+VHE_Encode(struct vhe_encode *enc, struct vsb *vsb, const char *name,
+    size_t namelen, const char *value, size_t valuelen, enum vhe_index_e how)
+{
+	unsigned idx, nidx;
+
+	CHECK_OBJ_NOTNULL(enc, VHE_ENCODE_MAGIC);
+	AN(vsb);
+	AN(name);
+	AN(value);
+
+	idx = VHT_Find(enc->tbl, name, namelen, value, valuelen, &nidx);
+	if (idx > 0 && how != VHE_NEVER) {
+		/* rfc7541,l,888,899 */
+		vhe_integer(vsb, 7, 0x80, idx);
+		return;
+	}
+
+	if (how == VHE_INDEX &&
+	    VHT_ENTRY_SIZE + namelen + valuelen > enc->tbl->maxsize)
+		how = VHE_NOINDEX;
+
+	switch (how) {
+	case VHE_INDEX:
+		vhe_integer(vsb, 6, 0x40, nidx);
+		break;
+	case VHE_NOINDEX:
+		vhe_integer(vsb, 4, 0x00, nidx);
+		break;
+	case VHE_NEVER:
+		vhe_integer(vsb, 4, 0x10, nidx);
+		break;
+	default:
+		WRONG("Invalid vhe_index_e");
+	}
+	if (nidx == 0)
+		vhe_string(vsb, name, namelen);
+	vhe_string(vsb, value, valuelen);
+
+	if (how != VHE_INDEX)
+		return;
+
+	VHT_NewEntry(enc->tbl);
+	VHT_AppendName(enc->tbl, name, namelen);
+	VHT_AppendValue(enc->tbl, value, valuelen);
+	enc->dirty = 1;
+}
+
+/* Test driver */
+
+#ifdef ENCODE_TEST_DRIVER
+
+static int verbose = 0;
+
+static void
+hexcmp(struct vsb *vsb, const char *h)
+{
+	const uint8_t *p;
+	char buf[3];
+	ssize_t l;
+
+	AN(h);
+	AZ(VSB_finish(vsb));
+	p = (const void *)VSB_data(vsb);
+	l = VSB_len(vsb);
+	for (; *h != '\0'; h++) {
+		if (*h == ' ')
+			continue;
+		assert(l > 0);
+		bprintf(buf, "%02x", *p);
+		if (verbose)
+			printf("%c%c", buf[0], buf[1]);
+		assert(h[0] == buf[0]);
+		assert(h[1] == buf[1]);
+		h++;
+		p++;
+		l--;
+	}
+	if (verbose)
+		printf("\n");
+	AZ(l);
+}
+
+#define ENC(e, v, n, val, how)						\
+	VHE_Encode(e, v, n, sizeof n - 1, val, sizeof val - 1, how)
+
+static void
+test_c6(void)
+{
+	struct vhe_encode e[1];
+	struct vsb *vsb;
+
+	/* See RFC 7541 Appendix C.6, with a table size update first */
+
+	AZ(VHE_Init(e, 256));
+	vsb = VSB_new_auto();
+	AN(vsb);
+
+	/* C.6.1 */
+	VHE_Begin(e, vsb);
+	ENC(e, vsb, ":status", "302", VHE_INDEX);
+	ENC(e, vsb, "cache-control", "private", VHE_INDEX);
+	ENC(e, vsb, "date", "Mon, 21 Oct 2013 20:13:21 GMT", VHE_INDEX);
+	ENC(e, vsb, "location", "https://www.example.com", VHE_INDEX);
+	hexcmp(vsb,
+	    "3fe1 01"
+	    "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+	    "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+	    "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+	    "e9ae 82ae 43d3");
+	AN(e->dirty);
+	assert(e->tbl->n == 4);
+	VSB_clear(vsb);
+
+	/* C.6.2 */
+	VHE_Begin(e, vsb);
+	ENC(e, vsb, ":status", "307", VHE_INDEX);
+	ENC(e, vsb, "cache-control", "private", VHE_INDEX);
+	ENC(e, vsb, "date", "Mon, 21 Oct 2013 20:13:21 GMT", VHE_INDEX);
+	ENC(e, vsb, "location", "https://www.example.com", VHE_INDEX);
+	hexcmp(vsb, "4883 640e ffc1 c0bf");
+	VSB_clear(vsb);
+
+	/* C.6.3 */
+	VHE_Begin(e, vsb);
+	ENC(e, vsb, ":status", "200", VHE_INDEX);
+	ENC(e, vsb, "cache-control", "private", VHE_INDEX);
+	ENC(e, vsb, "date", "Mon, 21 Oct 2013 20:13:22 GMT", VHE_INDEX);
+	ENC(e, vsb, "location", "https://www.example.com", VHE_INDEX);
+	ENC(e, vsb, "content-encoding", "gzip", VHE_INDEX);
+	ENC(e, vsb, "set-cookie",
+	    "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1",
+	    VHE_INDEX);
+	hexcmp(vsb,
+	    "88c1 6196 d07a be94 1054 d444 a820 0595"
+	    "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+	    "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+	    "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+	    "9587 3160 65c0 03ed 4ee5 b106 3d50 07");
+	assert(e->tbl->n == 3);
+	VSB_clear(vsb);
+
+	/* Nothing changes without indexing */
+	VHE_Begin(e, vsb);
+	ENC(e, vsb, "content-encoding", "gzip", VHE_NEVER);
+	ENC(e, vsb, "x-foo", "bar", VHE_NOINDEX);
+	hexcmp(vsb, "1f0b 839b d9ab 0084 f2b4 a73f 838c 767f");
+	AZ(e->dirty);
+	VSB_clear(vsb);
+
+	/* Shrink, grow, and signal the minimum first */
+	VHE_SetMaxTableSize(e, 64);
+	VHE_SetMaxTableSize(e, 128);
+	VHE_Begin(e, vsb);
+	hexcmp(vsb, "3f21 3f61");
+	AN(e->dirty);
+	assert(e->tbl->n == 0);
+
+	VSB_destroy(&vsb);
+	VHE_Fini(e);
+}
+
+static void
+test_roundtrip(void)
+{
+	struct vhe_encode e[1];
+	struct vht_table t[1];
+	struct vhd_decode d[1];
+	struct vsb *vsb;
+	enum vhd_ret_e r;
+	const char *exp[4];
+	char out[512], val[64];
+	size_t inu, outu;
+	unsigned u, k;
+
+	AZ(VHE_Init(e, 200));
+	AZ(VHT_Init(t, 4096));
+	vsb = VSB_new_auto();
+	AN(vsb);
+
+	for (u = 0; u < 100; u++) {
+		VSB_clear(vsb);
+		VHE_Begin(e, vsb);
+		bprintf(val, "value-%u", u % 7);
+		VHE_Encode(e, vsb, "x-rt", 4, val, strlen(val), VHE_INDEX);
+		ENC(e, vsb, "server", "Varnish", VHE_INDEX);
+		AZ(VSB_finish(vsb));
+
+		exp[0] = "x-rt";
+		exp[1] = val;
+		exp[2] = "server";
+		exp[3] = "Varnish";
+		VHD_Init(d);
+		inu = 0;
+		k = 0;
+		do {
+			outu = 0;
+			r = VHD_Decode(d, t, (const void *)VSB_data(vsb),
+			    VSB_len(vsb), &inu, out, sizeof out, &outu);
+			assert(r >= VHD_OK);
+			if (r != VHD_NAME && r != VHD_VALUE)
+				continue;
+			assert(k < 4);
+			out[outu] = '\0';
+			if (verbose)
+				printf("%s\n", out);
+			assert(!strcmp(out, exp[k]));
+			k++;
+		} while (inu < (size_t)VSB_len(vsb) || k < 4);
+		assert(k == 4);
+		assert(t->n == e->tbl->n);
+		assert(t->size == e->tbl->size);
+		assert(t->maxsize == e->tbl->maxsize);
+	}
+
+	VSB_destroy(&vsb);
+	VHT_Fini(t);
+	VHE_Fini(e);
+}
+
+int
+main(int argc, char **argv)
+{
+
+	if (argc == 2 && !strcmp(argv[1], "-v"))
+		verbose = 1;
+	else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+		return (1);
+	}
+
+	test_c6();
+	test_roundtrip();
+
+	return (0);
+}
+
+#endif	/* ENCODE_TEST_DRIVER */
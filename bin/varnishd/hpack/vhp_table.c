@@ -449,6 +449,55 @@ VHT_LookupValue(const struct vht_table *tbl, unsigned idx, size_t *plen)
 	return (tbl->buf + e->offset + e->namelen);
 }
 
+/*
+ * Find a header in the static and dynamic tables. Returns the lowest
+ * index of an entry matching both name and value, or zero. The lowest
+ * index of an entry matching the name only is returned in *pnameidx.
+ */
+
+unsigned
+VHT_Find(const struct vht_table *tbl, const char *name, size_t namelen,
+    const char *value, size_t valuelen, unsigned *pnameidx)
+{
+	const struct vht_static *s;
+	const struct vht_entry *e;
+	unsigned u;
+
+	AN(name);
+	AN(value);
+	AN(pnameidx);
+	*pnameidx = 0;
+
+	for (u = 0; u < VHT_STATIC_MAX; u++) {
+		s = &static_table[u];
+		if (s->namelen != namelen || memcmp(s->name, name, namelen))
+			continue;
+		if (*pnameidx == 0)
+			*pnameidx = u + 1;
+		if (s->valuelen == valuelen &&
+		    !memcmp(s->value, value, valuelen))
+			return (u + 1);
+	}
+
+	if (tbl == NULL)
+		return (0);
+	CHECK_OBJ_NOTNULL(tbl, VHT_TABLE_MAGIC);
+
+	for (u = 0; u < tbl->n; u++) {
+		e = TBLENTRY(tbl, u);
+		CHECK_OBJ_NOTNULL(e, VHT_ENTRY_MAGIC);
+		if (e->namelen != namelen ||
+		    memcmp(tbl->buf + e->offset, name, namelen))
+			continue;
+		if (*pnameidx == 0)
+			*pnameidx = VHT_STATIC_MAX + 1 + u;
+		if (e->valuelen == valuelen && !memcmp(
+		    tbl->buf + e->offset + namelen, value, valuelen))
+			return (VHT_STATIC_MAX + 1 + u);
+	}
+	return (0);
+}
+
 int
 VHT_Init(struct vht_table *tbl, size_t protomax)
 {
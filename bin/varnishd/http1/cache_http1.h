@@ -44,6 +44,10 @@ extern const int HTTP1_Resp[3];
 /* cache_http1_deliver.c */
 void V1D_Deliver(struct req *, struct boc *, int sendbody);
 
+/* cache_http1_fasthit.c [V1H] */
+void V1H_Insert(struct req *, struct boc *);
+int V1H_Waited(struct sess *, vtim_real now);
+
 /* cache_http1_pipe.c */
 struct v1p_acct {
 	uint64_t        req;
@@ -71,6 +71,8 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 	int err = 0, chunked = 0;
 	stream_close_t sc;
 	uint64_t hdrbytes, bytes;
+	const char *pack, *wire;
+	ssize_t len, packlen, wirelen;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
@@ -124,7 +126,16 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 		return;
 	}
 
-	hdrbytes = HTTP1_Write(req->wrk, req->resp, HTTP1_Resp);
+	wire = NULL;
+	pack = ObjGetAttr(req->wrk, req->objcore, OA_HEADERS, &len);
+	if (pack != NULL)
+		wire = HTTP_GetWirePack(pack, len, &packlen, &wirelen);
+	if (wire != NULL) {
+		req->wrk->stats->resp_wirehdrs++;
+		hdrbytes = HTTP1_WriteWire(req->wrk, req->resp,
+		    pack, packlen, wire, wirelen);
+	} else
+		hdrbytes = HTTP1_Write(req->wrk, req->resp, HTTP1_Resp);
 
 	if (sendbody) {
 		if (DO_DEBUG(DBG_FLUSH_HEAD))
@@ -146,4 +157,6 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 		sc = SC_REM_CLOSE;
 	if (sc != SC_NULL)
 		Req_Fail(req, sc);
+	else if (!err && sendbody && !chunked)
+		V1H_Insert(req, boc);
 }
@@ -0,0 +1,341 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HTTP/1 fast hits
+ *
+ * After delivering a plain hit, the worker leaves the response in the
+ * fast hit table.  When a session comes off the waiter, the waiter peeks
+ * at the request and, if it is a plain GET for such a response, writes
+ * it without scheduling a worker.  Anything it does not understand goes
+ * to a worker as usual.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_transport.h"
+#include "cache_http1.h"
+
+#include "vct.h"
+#include "vsha256.h"
+#include "vtim.h"
+
+#define V1H_REQLEN		2048
+
+/*--------------------------------------------------------------------
+ * The digest of the builtin vcl_hash{} for url and host
+ */
+
+static void
+v1h_digest(uint8_t *digest, const char *url, size_t urllen,
+    const char *host, size_t hostlen)
+{
+	struct VSHA256Context ctx[1];
+	const char nul = '\0';
+
+	VSHA256_Init(ctx);
+	VSHA256_Update(ctx, url, urllen);
+	VSHA256_Update(ctx, &nul, 1);
+	VSHA256_Update(ctx, host, hostlen);
+	VSHA256_Update(ctx, &nul, 1);
+	VSHA256_Final(digest, ctx);
+}
+
+/*--------------------------------------------------------------------
+ * Insert the response just delivered for req into the fast hit table
+ */
+
+struct v1h_body {
+	uint8_t			*p;
+	size_t			len;
+	size_t			space;
+};
+
+static int v_matchproto_(objiterate_f)
+v1h_body(void *priv, unsigned flush, const void *ptr, ssize_t len)
+{
+	struct v1h_body *vb;
+
+	(void)flush;
+	vb = priv;
+	AN(vb);
+	assert(len >= 0);
+	if ((size_t)len > vb->space - vb->len)
+		return (-1);
+	if (len > 0)
+		memcpy(vb->p + vb->len, ptr, len);
+	vb->len += len;
+	return (0);
+}
+
+static int
+v1h_fresh(const struct objcore *oc, vtim_real now)
+{
+
+	return (oc->t_origin + oc->ttl > now);
+}
+
+void
+V1H_Insert(struct req *req, struct boc *boc)
+{
+	struct objcore *oc;
+	struct http *hp;
+	const char *host;
+	uint8_t digest[DIGEST_LEN];
+	uint8_t buf[FHT_MAXLEN];
+	struct vsb vsb[1];
+	struct v1h_body vb[1];
+	vtim_real now;
+	uint64_t bodylen;
+	unsigned gen, u;
+	ssize_t hdrlen;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	oc = req->objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	if (!FEATURE(FEATURE_FAST_HIT) || !req->is_hit || boc != NULL ||
+	    req->esi_level > 0 || req->restarts > 0 ||
+	    req->doclose != SC_NULL)
+		return;
+	if (oc->flags & OC_F_TRANSIENT || oc->objhead == NULL)
+		return;
+	if (http_GetStatus(req->resp) != 200 ||
+	    req->http0->protover != 11 ||
+	    !http_method_eq(req->http0->hd[HTTP_HDR_METHOD].b, GET))
+		return;
+	if (req->vdp_filter_list == NULL || *req->vdp_filter_list != '\0')
+		return;
+	if (ObjHasAttr(req->wrk, oc, OA_VARY) ||
+	    ObjCheckFlag(req->wrk, oc, OF_GZIPED) ||
+	    ObjCheckFlag(req->wrk, oc, OF_ESIPROC))
+		return;
+
+	/* Only the builtin hash can be recomputed by the waiter */
+	if (http_CountHdr(req->http0, H_Host) != 1 ||
+	    !http_GetHdr(req->http0, H_Host, &host))
+		return;
+	v1h_digest(digest, req->http0->hd[HTTP_HDR_URL].b,
+	    Tlen(req->http0->hd[HTTP_HDR_URL]), host, strlen(host));
+	if (memcmp(digest, req->digest, sizeof digest))
+		return;
+
+	bodylen = ObjGetLen(req->wrk, oc);
+	if (bodylen >= FHT_MAXLEN)
+		return;
+
+	/* Anything happening to the object from here on bumps gen */
+	gen = FHT_Gen();
+	now = W_TIM_real(req->wrk);
+	if (oc->flags & OC_F_DYING || !v1h_fresh(oc, now))
+		return;
+
+	/* X-Varnish and Age are per request, the waiter adds Age back */
+	hp = req->resp;
+	AN(VSB_init(vsb, buf, sizeof buf));
+	VSB_printf(vsb, "%s %s %s\r\n", hp->hd[HTTP1_Resp[0]].b,
+	    hp->hd[HTTP1_Resp[1]].b, hp->hd[HTTP1_Resp[2]].b);
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (http_IsHdr(&hp->hd[u], "\012X-Varnish:") ||
+		    http_IsHdr(&hp->hd[u], H_Age))
+			continue;
+		VSB_bcat(vsb, hp->hd[u].b, Tlen(hp->hd[u]));
+		VSB_cat(vsb, "\r\n");
+	}
+	if (VSB_finish(vsb))
+		return;
+	hdrlen = VSB_len(vsb);
+	VSB_fini(vsb);
+	if ((uint64_t)hdrlen + bodylen > sizeof buf)
+		return;
+
+	vb->p = buf + hdrlen;
+	vb->len = 0;
+	vb->space = bodylen;
+	if (ObjIterate(req->wrk, oc, vb, v1h_body, 0) || vb->len != bodylen)
+		return;
+
+	FHT_Insert(gen, digest, oc->t_origin, oc->t_origin + oc->ttl,
+	    buf, hdrlen, buf + hdrlen, bodylen);
+}
+
+/*--------------------------------------------------------------------
+ * Parse a peeked request, return its length if it can be answered from
+ * the fast hit table, zero if not, and leave the digest of its hash.
+ */
+
+static size_t
+v1h_parse(const char *req, uint8_t *digest)
+{
+	const char *p, *b, *e, *url, *host = NULL;
+	size_t urllen, hostlen = 0;
+	txt hh;
+
+	e = strstr(req, "\r\n\r\n");
+	if (e == NULL)
+		return (0);
+	e += 2;
+
+	if (strncmp(req, "GET /", 5))
+		return (0);
+	url = req + 4;
+	for (p = url; *p != ' '; p++)
+		if (vct_isctl(*p))
+			return (0);
+	urllen = p - url;
+	if (strncmp(p, " HTTP/1.1\r\n", 11))
+		return (0);
+	p += 11;
+
+	while (p < e) {
+		b = p;
+		while (vct_istchar(*p))
+			p++;
+		if (p == b || *p != ':')
+			return (0);
+		hh.b = b;
+		for (p++; *p != '\r'; p++)
+			if (vct_isctl(*p) && *p != '\t')
+				return (0);
+		if (p[1] != '\n')
+			return (0);
+		hh.e = p;
+		p += 2;
+
+		if (http_IsHdr(&hh, H_Host)) {
+			if (host != NULL)
+				return (0);
+			host = hh.b + *H_Host;
+			while (vct_isows(*host))
+				host++;
+			b = hh.e;
+			while (b > host && vct_isows(b[-1]))
+				b--;
+			hostlen = b - host;
+		} else if (http_IsHdr(&hh, H_Connection)) {
+			b = hh.b + *H_Connection;
+			while (vct_isows(*b))
+				b++;
+			if (strncasecmp(b, "keep-alive", 10))
+				return (0);
+			for (b += 10; b < hh.e; b++)
+				if (!vct_isows(*b))
+					return (0);
+		} else if (http_IsHdr(&hh, H_Cookie) ||
+		    http_IsHdr(&hh, H_Authorization) ||
+		    http_IsHdr(&hh, H_Range) ||
+		    http_IsHdr(&hh, H_If_Match) ||
+		    http_IsHdr(&hh, H_If_None_Match) ||
+		    http_IsHdr(&hh, H_If_Modified_Since) ||
+		    http_IsHdr(&hh, H_If_Unmodified_Since) ||
+		    http_IsHdr(&hh, H_If_Range) ||
+		    http_IsHdr(&hh, H_Content_Length) ||
+		    http_IsHdr(&hh, H_Transfer_Encoding) ||
+		    http_IsHdr(&hh, H_Expect) ||
+		    http_IsHdr(&hh, H_Upgrade))
+			return (0);
+	}
+	assert(p == e);
+	if (host == NULL || hostlen == 0)
+		return (0);
+
+	v1h_digest(digest, url, urllen, host, hostlen);
+	return (e + 2 - req);
+}
+
+/*--------------------------------------------------------------------
+ * Called by the waiter when a request arrives on an idle session.
+ * Returns non-zero if the request was answered and the session taken
+ * care of, zero to hand the session to a worker.
+ */
+
+int v_matchproto_(vtr_waited_f)
+V1H_Waited(struct sess *sp, vtim_real now)
+{
+	char req[V1H_REQLEN + 1];
+	uint8_t buf[FHT_MAXLEN];
+	uint8_t digest[DIGEST_LEN];
+	char age[32];
+	struct iovec iov[3];
+	struct msghdr msg;
+	vtim_real t_origin;
+	size_t reqlen, len, hdrlen;
+	ssize_t l;
+
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	if (!FEATURE(FEATURE_FAST_HIT))
+		return (0);
+
+	l = recv(sp->fd, req, V1H_REQLEN, MSG_PEEK | MSG_DONTWAIT);
+	if (l <= 0)
+		return (0);
+	req[l] = '\0';
+	if (strlen(req) != (size_t)l)
+		return (0);
+	reqlen = v1h_parse(req, digest);
+	if (reqlen == 0)
+		return (0);
+
+	len = FHT_Lookup(digest, now, buf, &hdrlen, &t_origin);
+	if (len == 0)
+		return (0);
+	assert(hdrlen <= len);
+
+	bprintf(age, "Age: %.0f\r\n\r\n", floor(fmax(0., now - t_origin)));
+	iov[0].iov_base = buf;
+	iov[0].iov_len = hdrlen;
+	iov[1].iov_base = age;
+	iov[1].iov_len = strlen(age);
+	iov[2].iov_base = buf + hdrlen;
+	iov[2].iov_len = len - hdrlen;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 3;
+
+	l = sendmsg(sp->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return (0);
+	if (l != (ssize_t)(len + iov[1].iov_len)) {
+		SES_Delete(sp, SC_TX_ERROR, now);
+		return (1);
+	}
+
+	/* The request was only peeked at, consume it */
+	if (recv(sp->fd, req, reqlen, MSG_DONTWAIT) != (ssize_t)reqlen) {
+		SES_Delete(sp, SC_RX_JUNK, now);
+		return (1);
+	}
+
+	VSC_C_main->fast_hit++;
+	sp->t_idle = now;
+	SES_Wait(sp, &HTTP1_transport);
+	return (1);
+}
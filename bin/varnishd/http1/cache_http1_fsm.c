@@ -230,6 +230,7 @@ struct transport HTTP1_transport = {
 	.req_panic =		http1_req_panic,
 	.sess_panic =		http1_sess_panic,
 	.unwait =		http1_unwait,
+	.waited =		V1H_Waited,
 };
 
 /*----------------------------------------------------------------------
@@ -498,3 +498,77 @@ HTTP1_Write(const struct worker *w, const struct http *hp, const int *hf)
 	l += V1L_Write(w, "\r\n", -1);
 	return (l);
 }
+
+/*--------------------------------------------------------------------
+ * Write a response whose headers were decoded from the packed object
+ * headers, using the pre-serialized wire form (HTTP_GetWirePack()).
+ *
+ * Headers which still point into the packed string, in their original
+ * order, are coalesced into a single write from the wire form. Headers
+ * modified, added or reordered since HTTP_Decode() are written one by
+ * one as in HTTP1_Write().
+ */
+
+unsigned
+HTTP1_WriteWire(const struct worker *w, const struct http *hp,
+    const char *pack, ssize_t packlen, const char *wire, ssize_t wirelen)
+{
+	const char *pp, *pe, *wp, *we, *rb = NULL;
+	const txt *hh;
+	unsigned u, l;
+	size_t n;
+
+	AN(pack);
+	AN(wire);
+	assert(packlen > 4);
+	assert(wirelen > 0);
+	AN(hp->hd[HTTP_HDR_PROTO].b);
+	AN(hp->hd[HTTP_HDR_STATUS].b);
+	AN(hp->hd[HTTP_HDR_REASON].b);
+	l = http1_WrTxt(w, &hp->hd[HTTP_HDR_PROTO], " ");
+	l += http1_WrTxt(w, &hp->hd[HTTP_HDR_STATUS], " ");
+	l += http1_WrTxt(w, &hp->hd[HTTP_HDR_REASON], "\r\n");
+
+	pp = pack + 4;
+	pp = strchr(pp, '\0') + 1;	/* Skip :proto: */
+	pp = strchr(pp, '\0') + 1;	/* Skip :status: */
+	pp = strchr(pp, '\0') + 1;	/* Skip :reason: */
+	pe = pack + packlen;
+	wp = wire;
+	we = wire + wirelen;
+
+#define WIRE_FLUSH()						\
+	do {							\
+		if (rb != NULL)					\
+			l += V1L_Write(w, rb, wp - rb);		\
+		rb = NULL;					\
+	} while (0)
+
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		hh = &hp->hd[u];
+		if (hh->b >= pp && hh->b < pe) {
+			/* Skip packed headers unset since decode */
+			while (pp < hh->b && *pp != '\0') {
+				WIRE_FLUSH();
+				n = strlen(pp);
+				pp += n + 1;
+				wp += n + 2;
+			}
+			n = strlen(pp);
+			if (pp == hh->b && hh->e == pp + n && n > 0) {
+				assert(wp + n + 2 <= we);
+				if (rb == NULL)
+					rb = wp;
+				pp += n + 1;
+				wp += n + 2;
+				continue;
+			}
+		}
+		WIRE_FLUSH();
+		l += http1_WrTxt(w, hh, "\r\n");
+	}
+	WIRE_FLUSH();
+#undef WIRE_FLUSH
+	l += V1L_Write(w, "\r\n", -1);
+	return (l);
+}
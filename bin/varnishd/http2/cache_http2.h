@@ -151,9 +151,17 @@ struct h2_req {
 	struct worker			*wrk;
 
 	struct h2_rxbuf			*rxbuf;
+	/* rxthread is copying into rxbuf outside the lock */
+	int				rxbuf_busy;
 
 	VTAILQ_ENTRY(h2_req)		tx_list;
 	h2_error			error;
+
+	/* RFC 9218 priority, protected by sess->mtx */
+	uint8_t				urgency;
+#define H2_URGENCY_DEFAULT		3
+	uint8_t				incremental;
+	uint8_t				win_queued;
 };
 
 VTAILQ_HEAD(h2_req_s, h2_req);
@@ -185,6 +193,7 @@ struct h2_sess {
 	struct vsl_log			*vsl;
 	struct h2h_decode		*decode;
 	struct vht_table		dectbl[1];
+	struct vhe_encode		enctbl[1];
 
 	unsigned			rxf_len;
 	unsigned			rxf_type;
@@ -200,8 +209,24 @@ struct h2_sess {
 
 	VTAILQ_HEAD(,h2_req)		txqueue;
 
+	/* Coalesced frames, sess->mtx */
+	uint8_t				*txbuf;
+	uint8_t				*txbuf_spare;
+	unsigned			txbuf_sz;
+	unsigned			txbuf_len;
+
 	h2_error			error;
 
+	/* Receive window auto-tuning, see h2_rx_window_max */
+	unsigned			rxwin_max;
+	unsigned			rxwin_sess_max;
+	unsigned			rxwin_target;	// sess->mtx
+	uint64_t			rxwin_peak;	// sess->mtx
+	uint64_t			rxbuf_bytes;	// sess->mtx
+	vtim_mono			bdp_t0;		// rxthread
+	uint64_t			bdp_bytes;	// rxthread
+	uint64_t			bdp_seq;	// rxthread
+
 	// rst rate limit parameters, copied from h2_* parameters
 	vtim_dur			rapid_reset;
 	int64_t				rapid_reset_limit;
@@ -251,6 +276,7 @@ h2_error h2h_decode_bytes(struct h2_sess *h2, const uint8_t *ptr,
 /* cache_http2_send.c */
 void H2_Send_Get(struct worker *, struct h2_sess *, struct h2_req *);
 void H2_Send_Rel(struct h2_sess *, const struct h2_req *);
+h2_error H2_Send_Check(const struct h2_req *);
 
 void H2_Send_Frame(struct worker *, struct h2_sess *,
     h2_frame type, uint8_t flags, uint32_t len, uint32_t stream,
@@ -262,11 +288,15 @@ void H2_Send_RST(struct worker *wrk, struct h2_sess *h2,
 void H2_Send(struct worker *, struct h2_req *, h2_frame type, uint8_t flags,
     uint32_t len, const void *, uint64_t *acct);
 
+int H2_Send_Queue(struct worker *, struct h2_req *, uint8_t flags,
+    uint32_t len, const void *, uint64_t *acct);
+
 /* cache_http2_proto.c */
 struct h2_req * h2_new_req(struct h2_sess *, unsigned stream, struct req *);
 h2_error h2_stream_tmo(struct h2_sess *, const struct h2_req *, vtim_real);
 void h2_del_req(struct worker *, struct h2_req *);
 void h2_kill_req(struct worker *, struct h2_sess *, struct h2_req *, h2_error);
+void h2_rxwin_stat(struct worker *, uint64_t, int);
 int h2_rxframe(struct worker *, struct h2_sess *);
 h2_error h2_set_setting(struct h2_sess *, const uint8_t *);
 void h2_req_body(struct req*);
@@ -278,3 +308,19 @@ vtr_req_fail_f h2_req_fail;
 /* cache_http2_session.c */
 void
 H2S_Lock_VSLb(const struct h2_sess *, enum VSL_tag_e, const char *, ...);
+
+/* cache_http2_fetch.c */
+struct conn_pool;
+struct h2f_pool;
+struct VSC_vbe;
+struct h2f_pool *H2F_New(struct conn_pool *, unsigned streams, unsigned uds,
+    struct VSC_vbe *);
+void H2F_Destroy(struct h2f_pool **);
+int H2F_Get(struct h2f_pool *, struct busyobj *, vtim_dur tmo,
+    unsigned max_conn, int *err);
+int H2F_Owns(const struct http_conn *);
+VCL_IP H2F_GetIp(const struct http_conn *);
+void H2F_Log(const struct http_conn *, struct vsl_log *, const char *be);
+int H2F_SendReq(struct worker *, struct busyobj *);
+int H2F_FetchRespHdr(struct busyobj *);
+void H2F_Finish(struct busyobj *);
@@ -35,6 +35,7 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "cache/cache_filter.h"
 #include "cache/cache_transport.h"
@@ -45,33 +46,6 @@
 
 /**********************************************************************/
 
-struct hpack_static {
-	uint8_t			idx;
-	const char *		name;
-	const char *		val;
-};
-
-static const struct hpack_static hp_static[] = {
-#define HPS(I,N,V) [I] = { I, N ":", V },
-#include "tbl/vhp_static.h"
-	{ 0, "\377:", ""}		// Terminator
-};
-
-static const struct hpack_static *hp_idx[256];
-
-void
-V2D_Init(void)
-{
-	int i;
-#define HPS(I,N,V)						\
-	i = hp_static[I].name[0];				\
-	if (hp_idx[i] == NULL) hp_idx[i] = &hp_static[I];
-#include "tbl/vhp_static.h"
-#undef HPS
-}
-
-/**********************************************************************/
-
 static int v_matchproto_(vdp_init_f)
 h2_init(VRT_CTX, struct vdp_ctx *vdc, void **priv)
 {
@@ -105,6 +79,8 @@ h2_fini(struct vdp_ctx *vdc, void **priv)
 		return (0);
 	}
 
+	if (H2_Send_Queue(vdc->wrk, r2, H2FF_DATA_END_STREAM, 0, "", NULL))
+		return (0);
 	H2_Send_Get(vdc->wrk, r2->h2sess, r2);
 	H2_Send(vdc->wrk, r2, H2_F_DATA, H2FF_DATA_END_STREAM, 0, "", NULL);
 	H2_Send_Rel(r2->h2sess, r2);
@@ -125,8 +101,10 @@ h2_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 		return (-1);
 	if (len == 0)
 		return (0);
-	H2_Send_Get(vdc->wrk, r2->h2sess, r2);
 	vdc->bytes_done = 0;
+	if (H2_Send_Queue(vdc->wrk, r2, H2FF_NONE, len, ptr, &vdc->bytes_done))
+		return (0);
+	H2_Send_Get(vdc->wrk, r2->h2sess, r2);
 	H2_Send(vdc->wrk, r2, H2_F_DATA, H2FF_NONE, len, ptr, &vdc->bytes_done);
 	H2_Send_Rel(r2->h2sess, r2);
 	return (0);
@@ -164,12 +142,60 @@ h2_status(uint8_t *p, uint16_t status) {
 	return (l);
 }
 
+/*
+ * Header blocks are HPACK encoded against the session wide dynamic
+ * table, so they must be built and sent under the send token, in the
+ * order the peer decodes them. Nothing may be encoded for a stream
+ * which can no longer be sent on (see H2_Send_Check()).
+ */
+
+static void
+h2_hpack_begin(struct h2_sess *h2, struct vsb *vsb)
+{
+	uint32_t sz;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_Lock(&h2->sess->mtx);
+	sz = h2->remote_settings.header_table_size;
+	Lck_Unlock(&h2->sess->mtx);
+	VHE_SetMaxTableSize(h2->enctbl, sz);
+	VHE_Begin(h2->enctbl, vsb);
+}
+
+/*
+ * If a header block which changed the encoder state did not make it to
+ * the peer, its decoder is out of sync with us and the connection is
+ * beyond repair.
+ */
+
+static void
+h2_hpack_check(struct h2_req *r2, uint64_t sent, size_t len)
+{
+	struct h2_sess *h2;
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(h2->enctbl, VHE_ENCODE_MAGIC);
+
+	if (!h2->enctbl->dirty || sent == len)
+		return;
+	H2S_Lock_VSLb(h2, SLT_SessError,
+	    "H2: stream %u: lost HPACK header block", r2->stream);
+	Lck_Lock(&h2->sess->mtx);
+	if (h2->error == NULL)
+		h2->error = H2CE_COMPRESSION_ERROR;
+	Lck_Unlock(&h2->sess->mtx);
+}
+
 int v_matchproto_(vtr_minimal_response_f)
 h2_minimal_response(struct req *req, uint16_t status)
 {
 	struct h2_req *r2;
+	struct vsb vsb[1];
+	uint64_t hdrbytes = 0;
+	uint8_t buf[6], blk[16];
 	size_t l;
-	uint8_t buf[6];
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
@@ -190,12 +216,22 @@ h2_minimal_response(struct req *req, uint16_t status)
 
 	/* XXX return code checking once H2_Send returns anything but 0 */
 	H2_Send_Get(req->wrk, r2->h2sess, r2);
+	if (H2_Send_Check(r2) != NULL) {
+		H2_Send_Rel(r2->h2sess, r2);
+		return (0);
+	}
+	AN(VSB_init(vsb, blk, sizeof blk));
+	h2_hpack_begin(r2->h2sess, vsb);
+	VSB_bcat(vsb, buf, l);
+	AZ(VSB_finish(vsb));
 	H2_Send(req->wrk, r2,
 	    H2_F_HEADERS,
 	    H2FF_HEADERS_END_HEADERS |
 		(status < 200 ? 0 : H2FF_HEADERS_END_STREAM),
-	    l, buf, NULL);
+	    VSB_len(vsb), VSB_data(vsb), &hdrbytes);
+	h2_hpack_check(r2, hdrbytes, VSB_len(vsb));
 	H2_Send_Rel(r2->h2sess, r2);
+	VSB_fini(vsb);
 	return (0);
 }
 
@@ -234,20 +270,43 @@ static const uint8_t h2_500_resp[] = {
 	0x1f, 0x27, 0x07, 'V', 'a', 'r', 'n', 'i', 's', 'h',
 };
 
+/*
+ * Header fields which are (nearly) unique per response are not worth a
+ * slot in the dynamic table, and cookies must never be indexed.
+ */
+
+static enum vhe_index_e
+h2_hdr_index(const char *name, size_t l)
+{
+
+#define H2_HDR_IS(s) (l == sizeof s - 1 && !memcmp(name, s, l))
+	if (H2_HDR_IS("set-cookie"))
+		return (VHE_NEVER);
+	if (H2_HDR_IS("age") || H2_HDR_IS("x-varnish") ||
+	    H2_HDR_IS("content-range"))
+		return (VHE_NOINDEX);
+#undef H2_HDR_IS
+	return (VHE_INDEX);
+}
+
 static void
-h2_build_headers(struct vsb *resp, struct req *req)
+h2_build_headers(struct vsb *resp, struct req *req, struct h2_sess *h2)
 {
+	char name[256];
 	unsigned u, l;
-	int i;
 	struct http *hp;
 	const char *r;
-	const struct hpack_static *hps;
 	uint8_t buf[6];
-	ssize_t sz, sz1;
+	ssize_t sz, sz1, plain;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+
+	h2_hpack_begin(h2, resp);
 
 	assert(req->resp->status % 1000 >= 100);
 	l = h2_status(buf, req->resp->status % 1000);
 	VSB_bcat(resp, buf, l);
+	plain = sizeof ":status: 200\r\n" - 1;
 
 	hp = req->resp;
 	for (u = HTTP_HDR_FIRST; u < hp->nhd && !VSB_error(resp); u++) {
@@ -257,49 +316,106 @@ h2_build_headers(struct vsb *resp, struct req *req)
 		if (http_IsFiltered(hp, u, HTTPH_C_SPECIFIC))
 			continue; //rfc7540,l,2999,3006
 
-		hps = hp_idx[tolower(*hp->hd[u].b)];
-		sz = 1 + r - hp->hd[u].b;
+		plain += Tlen(hp->hd[u]) + 2;
+		sz = r - hp->hd[u].b;
 		assert(sz > 0);
-		while (hps != NULL && hps->idx > 0) {
-			i = strncasecmp(hps->name, hp->hd[u].b, sz);
-			if (i < 0) {
-				hps++;
-				continue;
-			}
-			if (i > 0)
-				hps = NULL;
-			break;
-		}
-		if (hps != NULL) {
-			VSLb(req->vsl, SLT_Debug,
-			    "HP {%d, \"%s\", \"%s\"} <%s>",
-			    hps->idx, hps->name, hps->val, hp->hd[u].b);
-			h2_enc_len(resp, 4, hps->idx, 0x10);
-		} else {
+		while (vct_islws(*++r))
+			continue;
+
+		if (sz > (ssize_t)sizeof name) {
+			/* Too long to bother, send as never indexed literal */
 			VSB_putc(resp, 0x10);
-			sz--;
 			h2_enc_len(resp, 7, sz, 0);
 			for (sz1 = 0; sz1 < sz; sz1++)
 				VSB_putc(resp, tolower(hp->hd[u].b[sz1]));
+			sz1 = hp->hd[u].e - r;
+			h2_enc_len(resp, 7, sz1, 0);
+			VSB_bcat(resp, r, sz1);
+			continue;
+		}
+
+		for (sz1 = 0; sz1 < sz; sz1++)
+			name[sz1] = tolower(hp->hd[u].b[sz1]);
+		VHE_Encode(h2->enctbl, resp, name, sz, r, hp->hd[u].e - r,
+		    h2_hdr_index(name, sz));
+	}
 
+	req->wrk->stats->s_resp_h2_hdrbytes_plain += plain;
+}
+
+/*
+ * Upper bound of the HPACK encoded size of the response headers: no field
+ * is encoded longer than as a literal, which adds a prefix byte and two
+ * length integers to the name and value. The header block is only built
+ * once this much workspace is reserved, so that running out of workspace
+ * never leaves the session wide encoder table ahead of the peer.
+ */
+
+static unsigned
+h2_headers_maxlen(const struct http *hp)
+{
+	unsigned u, l;
+
+	l = 6 + 12 + 1;		/* :status, table size updates and NUL */
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++)
+		l += Tlen(hp->hd[u]) + 16;
+	return (l);
+}
+
+static int
+h2_send_headers(struct req *req, struct h2_req *r2, int sendbody)
+{
+	struct vsb resp[1];
+	uint64_t hdrbytes;
+	const char *r = NULL;
+	unsigned u;
+	size_t sz;
+
+	u = WS_ReserveSize(req->ws, h2_headers_maxlen(req->resp));
+	if (u > 0) {
+		AN(VSB_init(resp, WS_Reservation(req->ws), u));
+		h2_build_headers(resp, req, r2->h2sess);
+		if (VSB_finish(resp) == 0) {
+			r = VSB_data(resp);
+			sz = VSB_len(resp);
+			WS_Release(req->ws, sz);
+		} else {
+			/* Cannot happen, but the block is lost */
+			WS_Release(req->ws, 0);
+			WS_MarkOverflow(req->ws);
 		}
+		VSB_fini(resp);
+	}
 
-		while (vct_islws(*++r))
-			continue;
-		sz = hp->hd[u].e - r;
-		h2_enc_len(resp, 7, sz, 0);
-		VSB_bcat(resp, r, sz);
+	if (r == NULL) {
+		VSLb(req->vsl, SLT_Error, "workspace_client overflow");
+		VSLb(req->vsl, SLT_RespStatus, "500");
+		VSLb(req->vsl, SLT_RespReason, "Internal Server Error");
+		req->wrk->stats->client_resp_500++;
+
+		r = (const char*)h2_500_resp;
+		sz = sizeof h2_500_resp;
+		sendbody = 0;
+		/* A block built and lost, h2_hpack_check() must know */
+		hdrbytes = req->acct.resp_hdrbytes + (u > 0);
+	} else {
+		req->wrk->stats->s_resp_h2_hdrbytes_hpack += sz;
+		hdrbytes = req->acct.resp_hdrbytes;
 	}
+
+	H2_Send(req->wrk, r2, H2_F_HEADERS,
+	    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) | H2FF_HEADERS_END_HEADERS,
+	    sz, r, &req->acct.resp_hdrbytes);
+	if (u > 0)
+		h2_hpack_check(r2, req->acct.resp_hdrbytes - hdrbytes, sz);
+	return (sendbody);
 }
 
 void v_matchproto_(vtr_deliver_f)
 h2_deliver(struct req *req, struct boc *boc, int sendbody)
 {
-	size_t sz;
-	const char *r;
 	struct sess *sp;
 	struct h2_req *r2;
-	struct vsb resp[1];
 	struct vrt_ctx ctx[1];
 	uintptr_t ss;
 
@@ -316,29 +432,13 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 
 	ss = WS_Snapshot(req->ws);
 
-	WS_VSB_new(resp, req->ws);
-	h2_build_headers(resp, req);
-	r = WS_VSB_finish(resp, req->ws, &sz);
-
-	if (r == NULL) {
-		VSLb(req->vsl, SLT_Error, "workspace_client overflow");
-		VSLb(req->vsl, SLT_RespStatus, "500");
-		VSLb(req->vsl, SLT_RespReason, "Internal Server Error");
-		req->wrk->stats->client_resp_500++;
-
-		r = (const char*)h2_500_resp;
-		sz = sizeof h2_500_resp;
-		sendbody = 0;
-	}
-
 	AZ(req->wrk->v1l);
 
 	r2->t_send = req->t_prev;
 
 	H2_Send_Get(req->wrk, r2->h2sess, r2);
-	H2_Send(req->wrk, r2, H2_F_HEADERS,
-	    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) | H2FF_HEADERS_END_HEADERS,
-	    sz, r, &req->acct.resp_hdrbytes);
+	if (H2_Send_Check(r2) == NULL)
+		sendbody = h2_send_headers(req, r2, sendbody);
 	H2_Send_Rel(r2->h2sess, r2);
 
 	WS_Reset(req->ws, ss);
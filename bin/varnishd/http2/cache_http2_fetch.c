@@ -0,0 +1,1499 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HTTP/2 cleartext backend connections ("h2c" with prior knowledge)
+ *
+ * Backends with the http2_streams attribute send their fetches as
+ * streams over a few shared connections instead of one connection per
+ * fetch.  Each connection has a receiver task, which reads all frames,
+ * decodes the response headers against the connection wide HPACK table
+ * and queues response bodies on their streams, from where the fetch
+ * threads pick them up.
+ *
+ * The receiver task keeps its worker thread for the lifetime of the
+ * connection, so each connection takes one thread out of the pool, and
+ * a connection is not opened when no worker is available for it.
+ *
+ * Frames are queued on hc->txq under hc->mtx and written by whoever
+ * holds hc->wmtx, so that no thread blocks on the socket while holding
+ * hc->mtx.  The lock order is hc->wmtx before hc->mtx.
+ *
+ * Only requests without a body are sent this way, the rest use HTTP/1.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_filter.h"
+#include "cache/cache_conn_pool.h"
+#include "http2/cache_http2.h"
+
+#include "vct.h"
+#include "vend.h"
+#include "vtcp.h"
+#include "vtim.h"
+
+#include "VSC_vbe.h"
+
+static const char h2f_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/* Receive window of each stream, connections get one per stream */
+#define H2F_WINDOW		(1U << 18)
+#define H2F_WINDOW_DEFAULT	65535U
+
+/* Our SETTINGS_MAX_FRAME_SIZE and SETTINGS_HEADER_TABLE_SIZE */
+#define H2F_FRAME_MAX		16384U
+#define H2F_TABLE_SIZE		4096U
+
+#define H2F_FRAME_HDR		9
+
+struct h2f_data {
+	VTAILQ_ENTRY(h2f_data)		list;
+	size_t				len;
+	size_t				off;
+	uint8_t				buf[];
+};
+
+struct h2f_stream {
+	unsigned			magic;
+#define H2F_STREAM_MAGIC		0x5b0a3c71
+	uint32_t			id;
+	struct h2f_conn			*conn;
+	VTAILQ_ENTRY(h2f_stream)	list;
+	pthread_cond_t			cond;
+	vtim_dur			between_bytes_timeout;
+
+	/* Protected by conn->mtx */
+	char				*hdrs;
+	size_t				hdrs_len;
+	uint64_t			hdrbytes;
+	VTAILQ_HEAD(, h2f_data)		data;
+	size_t				queued;
+	unsigned			unacked;
+	unsigned			hdrs_done:1;
+	unsigned			end_stream:1;
+	unsigned			retry:1;
+	const char			*error;
+};
+
+struct h2f_conn {
+	unsigned			magic;
+#define H2F_CONN_MAGIC			0x1ea6c0d9
+	struct h2f_pool			*pool;
+	VTAILQ_ENTRY(h2f_conn)		list;
+	int				fd;
+	VCL_IP				addr;
+	struct pool_task		task[1];
+
+	/* Protected by pool->mtx */
+	int				refcnt;
+	unsigned			n_streams;
+	unsigned			n_total;
+	unsigned			max_streams;
+	unsigned			closing;
+	vtim_real			t_idle;
+
+	struct lock			mtx;
+	VTAILQ_HEAD(, h2f_stream)	streams;
+	uint32_t			next_id;
+	uint32_t			max_frame;
+	uint32_t			enc_table_size;
+	unsigned			window;
+	unsigned			unacked;
+	unsigned			dead;
+	const char			*why;
+	struct vhe_encode		enctbl[1];
+	struct vsb			*txq;
+
+	/* Protected by wmtx */
+	struct lock			wmtx;
+	struct vsb			*txbuf;
+
+	/* Receiver task only */
+	struct vht_table		dectbl[1];
+	struct vsb			*hblk;
+	uint32_t			hblk_stream;
+	uint8_t				hblk_flags;
+	uint8_t				rxbuf[H2F_FRAME_MAX];
+};
+
+struct h2f_pool {
+	unsigned			magic;
+#define H2F_POOL_MAGIC			0x7d2c94e3
+	struct lock			mtx;
+	struct conn_pool		*conn_pool;
+	struct VSC_vbe			*vsc;
+	unsigned			streams;
+	unsigned			uds;
+	pthread_cond_t			cond;
+	unsigned			n_conn;
+	unsigned			n_opening;
+	VTAILQ_HEAD(, h2f_conn)		conns;
+};
+
+/*--------------------------------------------------------------------
+ * Socket I/O on the non-blocking socket, with an optional deadline
+ */
+
+static int
+h2f_poll(int fd, short events, vtim_real deadline)
+{
+	struct pollfd pfd[1];
+	int i, tmo;
+
+	do {
+		tmo = -1;
+		if (!isinf(deadline)) {
+			tmo = (int)((deadline - VTIM_real()) * 1e3);
+			if (tmo <= 0) {
+				errno = ETIMEDOUT;
+				return (-1);
+			}
+		}
+		pfd->fd = fd;
+		pfd->events = events;
+		i = poll(pfd, 1, tmo);
+	} while (i < 0 && errno == EINTR);
+	if (i == 0)
+		errno = ETIMEDOUT;
+	return (i > 0 ? 0 : -1);
+}
+
+static int
+h2f_write(int fd, const void *ptr, size_t len, vtim_real deadline)
+{
+	const uint8_t *p = ptr;
+	ssize_t l;
+
+	while (len > 0) {
+		l = write(fd, p, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (h2f_poll(fd, POLLOUT, deadline))
+				return (-1);
+			continue;
+		}
+		if (l <= 0)
+			return (-1);
+		p += l;
+		len -= l;
+	}
+	return (0);
+}
+
+static int
+h2f_read(int fd, void *ptr, size_t len, vtim_real deadline)
+{
+	uint8_t *p = ptr;
+	ssize_t l;
+
+	while (len > 0) {
+		l = read(fd, p, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (h2f_poll(fd, POLLIN, deadline))
+				return (-1);
+			continue;
+		}
+		if (l <= 0)
+			return (-1);
+		p += l;
+		len -= l;
+	}
+	return (0);
+}
+
+/*
+ * The deadline of a frame once it started, and of writes: a backend
+ * which stalls must not keep the receiver, or a sender holding wmtx,
+ * forever.
+ */
+
+static vtim_real
+h2f_deadline(void)
+{
+	vtim_dur tmo;
+
+	tmo = cache_param->between_bytes_timeout;
+	return (tmo > 0 ? VTIM_real() + tmo : INFINITY);
+}
+
+static void
+h2f_frame_hdr(uint8_t *p, uint32_t len, h2_frame ftyp, uint8_t flags,
+    uint32_t stream)
+{
+
+	assert(len < (1U << 24));
+	vbe32enc(p, len << 8);
+	p[3] = ftyp->type;
+	p[4] = flags;
+	vbe32enc(p + 5, stream);
+}
+
+/* Queue a frame, h2f_flush() sends it */
+
+static void
+h2f_send_locked(struct h2f_conn *hc, h2_frame ftyp, uint8_t flags,
+    uint32_t stream, const void *body, uint32_t len)
+{
+	uint8_t hdr[H2F_FRAME_HDR];
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->mtx);
+
+	if (hc->dead)
+		return;
+	h2f_frame_hdr(hdr, len, ftyp, flags, stream);
+	AZ(VSB_bcat(hc->txq, hdr, sizeof hdr));
+	if (len > 0)
+		AZ(VSB_bcat(hc->txq, body, len));
+}
+
+static void
+h2f_send_u32_locked(struct h2f_conn *hc, h2_frame ftyp, uint32_t stream,
+    uint32_t val)
+{
+	uint8_t buf[4];
+
+	vbe32enc(buf, val);
+	h2f_send_locked(hc, ftyp, 0, stream, buf, sizeof buf);
+}
+
+/*
+ * Write the queued frames.  The connection is dead if they cannot be
+ * sent in time, the shutdown wakes up the receiver, which then fails
+ * the connection and the streams on it.
+ */
+
+static int
+h2f_flush(struct h2f_conn *hc)
+{
+	struct vsb *vsb;
+	int i = 0;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	Lck_Lock(&hc->wmtx);
+	Lck_Lock(&hc->mtx);
+	vsb = hc->txq;
+	hc->txq = hc->txbuf;
+	hc->txbuf = vsb;
+	if (hc->dead)
+		i = -1;
+	Lck_Unlock(&hc->mtx);
+
+	if (i == 0 && VSB_len(vsb) > 0) {
+		AZ(VSB_finish(vsb));
+		i = h2f_write(hc->fd, VSB_data(vsb), VSB_len(vsb),
+		    h2f_deadline());
+	}
+	VSB_clear(vsb);
+	if (i) {
+		Lck_Lock(&hc->mtx);
+		if (!hc->dead && errno == ETIMEDOUT)
+			hc->why = "backend write timeout";
+		hc->dead = 1;
+		(void)shutdown(hc->fd, SHUT_RDWR);
+		Lck_Unlock(&hc->mtx);
+	}
+	Lck_Unlock(&hc->wmtx);
+	return (i);
+}
+
+/*--------------------------------------------------------------------
+ * Hand consumed bytes back to the peer as window updates
+ */
+
+static void
+h2f_credit_locked(struct h2f_conn *hc, struct h2f_stream *s, size_t n)
+{
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	CHECK_OBJ_ORNULL(s, H2F_STREAM_MAGIC);
+	Lck_AssertHeld(&hc->mtx);
+
+	hc->unacked += n;
+	if (hc->unacked >= hc->window / 2) {
+		h2f_send_u32_locked(hc, H2_F_WINDOW_UPDATE, 0, hc->unacked);
+		hc->unacked = 0;
+	}
+	if (s == NULL || s->end_stream || s->error != NULL)
+		return;
+	s->unacked += n;
+	if (s->unacked >= H2F_WINDOW / 2) {
+		h2f_send_u32_locked(hc, H2_F_WINDOW_UPDATE, s->id, s->unacked);
+		s->unacked = 0;
+	}
+}
+
+static struct h2f_stream *
+h2f_find_locked(const struct h2f_conn *hc, uint32_t id)
+{
+	struct h2f_stream *s;
+
+	Lck_AssertHeld(&hc->mtx);
+	VTAILQ_FOREACH(s, &hc->streams, list) {
+		CHECK_OBJ(s, H2F_STREAM_MAGIC);
+		if (s->id == id)
+			return (s);
+	}
+	return (NULL);
+}
+
+static void
+h2f_fail_locked(struct h2f_stream *s, const char *err, unsigned retry)
+{
+
+	CHECK_OBJ_NOTNULL(s, H2F_STREAM_MAGIC);
+	if (s->error != NULL)
+		return;
+	s->error = err;
+	s->retry = retry && !s->hdrs_done;
+	PTOK(pthread_cond_signal(&s->cond));
+}
+
+/*--------------------------------------------------------------------
+ * Connection life cycle
+ */
+
+static void
+h2f_conn_free(struct h2f_conn *hc)
+{
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AZ(hc->refcnt);
+	assert(VTAILQ_EMPTY(&hc->streams));
+	if (hc->fd >= 0)
+		closefd(&hc->fd);
+	VHE_Fini(hc->enctbl);
+	VHT_Fini(hc->dectbl);
+	if (hc->hblk != NULL)
+		VSB_destroy(&hc->hblk);
+	VSB_destroy(&hc->txq);
+	VSB_destroy(&hc->txbuf);
+	Lck_Delete(&hc->wmtx);
+	Lck_Delete(&hc->mtx);
+	FREE_OBJ(hc);
+}
+
+static void
+h2f_conn_rel(struct h2f_conn *hc, unsigned stream)
+{
+	struct h2f_pool *hp;
+	int refcnt;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	hp = hc->pool;
+	CHECK_OBJ_NOTNULL(hp, H2F_POOL_MAGIC);
+
+	Lck_Lock(&hp->mtx);
+	if (stream) {
+		assert(hc->n_streams > 0);
+		if (--hc->n_streams == 0)
+			hc->t_idle = VTIM_real();
+		PTOK(pthread_cond_signal(&hp->cond));
+	}
+	assert(hc->refcnt > 0);
+	refcnt = --hc->refcnt;
+	Lck_Unlock(&hp->mtx);
+
+	if (refcnt == 0)
+		h2f_conn_free(hc);
+}
+
+/* The receiver is done with the connection, fail what is left on it */
+
+static void
+h2f_conn_done(struct h2f_conn *hc, const char *why)
+{
+	struct h2f_pool *hp;
+	struct h2f_stream *s;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	hp = hc->pool;
+	CHECK_OBJ_NOTNULL(hp, H2F_POOL_MAGIC);
+
+	Lck_Lock(&hp->mtx);
+	hc->closing = 1;
+	VTAILQ_REMOVE(&hp->conns, hc, list);
+	assert(hp->n_conn > 0);
+	hp->n_conn--;
+	hp->vsc->h2_conn--;
+	PTOK(pthread_cond_broadcast(&hp->cond));
+	Lck_Unlock(&hp->mtx);
+
+	Lck_Lock(&hc->mtx);
+	hc->dead = 1;
+	(void)shutdown(hc->fd, SHUT_RDWR);
+	VTAILQ_FOREACH(s, &hc->streams, list)
+		h2f_fail_locked(s, why, 1);
+	Lck_Unlock(&hc->mtx);
+
+	h2f_conn_rel(hc, 0);
+}
+
+static void
+h2f_settings(struct h2f_conn *hc, const uint8_t *p, uint32_t len)
+{
+	uint16_t id;
+	uint32_t val;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	for (; len >= 6; len -= 6, p += 6) {
+		id = vbe16dec(p);
+		val = vbe32dec(p + 2);
+		if (id == H2_SET_HEADER_TABLE_SIZE->ident) {
+			Lck_Lock(&hc->mtx);
+			hc->enc_table_size = val;
+			Lck_Unlock(&hc->mtx);
+		} else if (id == H2_SET_MAX_CONCURRENT_STREAMS->ident) {
+			Lck_Lock(&hc->pool->mtx);
+			hc->max_streams = val;
+			Lck_Unlock(&hc->pool->mtx);
+		} else if (id == H2_SET_MAX_FRAME_SIZE->ident &&
+		    val >= H2_SET_MAX_FRAME_SIZE->minval &&
+		    val <= H2_SET_MAX_FRAME_SIZE->maxval) {
+			Lck_Lock(&hc->mtx);
+			hc->max_frame = val;
+			Lck_Unlock(&hc->mtx);
+		}
+	}
+}
+
+/*
+ * Send our preface and wait for the one of the server, so that its
+ * settings are known before the first stream.
+ */
+
+static int
+h2f_handshake(struct h2f_conn *hc, vtim_dur tmo)
+{
+	uint8_t buf[sizeof h2f_preface - 1 + H2F_FRAME_HDR + 12];
+	uint8_t *p, hdr[H2F_FRAME_HDR];
+	vtim_real deadline;
+	uint32_t len;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	p = buf;
+	memcpy(p, h2f_preface, sizeof h2f_preface - 1);
+	p += sizeof h2f_preface - 1;
+	h2f_frame_hdr(p, 12, H2_F_SETTINGS, 0, 0);
+	p += H2F_FRAME_HDR;
+	vbe16enc(p, H2_SET_ENABLE_PUSH->ident);
+	vbe32enc(p + 2, 0);
+	vbe16enc(p + 6, H2_SET_INITIAL_WINDOW_SIZE->ident);
+	vbe32enc(p + 8, H2F_WINDOW);
+	p += 12;
+	assert(p == buf + sizeof buf);
+	deadline = VTIM_real() + (tmo > 0 ? tmo : 1e3);
+	if (h2f_write(hc->fd, buf, sizeof buf, deadline))
+		return (-1);
+
+	if (h2f_read(hc->fd, hdr, sizeof hdr, deadline))
+		return (-1);
+	len = vbe32dec(hdr) >> 8;
+	if (hdr[3] != H2_F_SETTINGS->type || (hdr[4] & H2FF_SETTINGS_ACK) ||
+	    vbe32dec(hdr + 5) != 0 || len % 6 != 0 || len > sizeof hc->rxbuf)
+		return (-1);
+	if (h2f_read(hc->fd, hc->rxbuf, len, deadline))
+		return (-1);
+	h2f_settings(hc, hc->rxbuf, len);
+
+	Lck_Lock(&hc->mtx);
+	h2f_send_locked(hc, H2_F_SETTINGS, H2FF_SETTINGS_ACK, 0, NULL, 0);
+	h2f_send_u32_locked(hc, H2_F_WINDOW_UPDATE, 0,
+	    hc->window - H2F_WINDOW_DEFAULT);
+	Lck_Unlock(&hc->mtx);
+	return (h2f_flush(hc));
+}
+
+/*--------------------------------------------------------------------
+ * Receiver
+ */
+
+static int
+h2f_decode(struct h2f_conn *hc, const uint8_t *in, size_t in_l, char *out,
+    size_t out_l, size_t *lenp)
+{
+	struct vhd_decode vhd[1];
+	enum vhd_ret_e r;
+	size_t in_u = 0, ou = 0, ol = out_l;
+	char *o = out;
+	int ovf = 0;
+
+	VHD_Init(vhd);
+	while (1) {
+		r = VHD_Decode(vhd, hc->dectbl, in, in_l, &in_u, o, ol, &ou);
+		if (r < 0)
+			return (-1);
+		if (r == VHD_OK || r == VHD_MORE)
+			break;
+		if (!ovf) {
+			switch (r) {
+			case VHD_NAME_SEC:
+			case VHD_NAME:
+				if (ol - ou < 2) {
+					ovf = 1;
+					break;
+				}
+				o[ou++] = ':';
+				o[ou++] = ' ';
+				break;
+			case VHD_VALUE_SEC:
+			case VHD_VALUE:
+				if (ol - ou < 1) {
+					ovf = 1;
+					break;
+				}
+				o[ou++] = '\0';
+				o += ou;
+				ol -= ou;
+				ou = 0;
+				break;
+			case VHD_BUF:
+				ovf = 1;
+				break;
+			default:
+				WRONG("Unhandled return value");
+			}
+		}
+		if (ovf) {
+			/* Keep decoding for the table, but drop the output */
+			o = out;
+			ol = out_l;
+			ou = 0;
+		}
+	}
+	if (r != VHD_OK)
+		return (-1);
+	*lenp = o - out;
+	return (ovf);
+}
+
+static int
+h2f_rx_hdrs(struct h2f_conn *hc)
+{
+	struct h2f_stream *s;
+	size_t sz, len = 0;
+	char *buf;
+	int i;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AZ(VSB_finish(hc->hblk));
+	sz = cache_param->http_resp_size;
+	buf = malloc(sz);
+	AN(buf);
+	i = h2f_decode(hc, (const uint8_t *)VSB_data(hc->hblk),
+	    VSB_len(hc->hblk), buf, sz, &len);
+	if (i < 0) {
+		free(buf);
+		return (-1);
+	}
+
+	Lck_Lock(&hc->mtx);
+	s = h2f_find_locked(hc, hc->hblk_stream);
+	if (s != NULL && s->error == NULL) {
+		s->hdrbytes += VSB_len(hc->hblk);
+		if (i > 0)
+			h2f_fail_locked(s, "response headers too large", 0);
+		else if (!s->hdrs_done && len > 9 &&
+		    !strncmp(buf, ":status: 1", 10)) {
+			/* Informational response, wait for the real one */
+		} else if (!s->hdrs_done) {
+			s->hdrs = buf;
+			s->hdrs_len = len;
+			s->hdrs_done = 1;
+			buf = NULL;
+		}
+		if (hc->hblk_flags & H2FF_HEADERS_END_STREAM)
+			s->end_stream = 1;
+		PTOK(pthread_cond_signal(&s->cond));
+	}
+	Lck_Unlock(&hc->mtx);
+	free(buf);
+	hc->hblk_stream = 0;
+	VSB_clear(hc->hblk);
+	return (0);
+}
+
+static int
+h2f_rx_data(struct h2f_conn *hc, uint8_t flags, uint32_t stream,
+    const uint8_t *p, uint32_t len)
+{
+	struct h2f_stream *s;
+	struct h2f_data *d;
+	uint32_t flen = len;
+
+	if (flags & H2FF_DATA_PADDED) {
+		if (len < 1 || p[0] >= len)
+			return (-1);
+		len -= p[0] + 1;
+		p++;
+	}
+
+	Lck_Lock(&hc->mtx);
+	s = h2f_find_locked(hc, stream);
+	if (s == NULL || s->end_stream || s->error != NULL) {
+		/* Nobody will read it, give the window back right away */
+		h2f_credit_locked(hc, NULL, flen);
+		Lck_Unlock(&hc->mtx);
+		return (0);
+	}
+	if (s->queued + len > H2F_WINDOW) {
+		Lck_Unlock(&hc->mtx);
+		return (-1);
+	}
+	if (len > 0) {
+		d = malloc(sizeof *d + len);
+		AN(d);
+		d->len = len;
+		d->off = 0;
+		memcpy(d->buf, p, len);
+		VTAILQ_INSERT_TAIL(&s->data, d, list);
+		s->queued += len;
+	}
+	if (flags & H2FF_DATA_END_STREAM)
+		s->end_stream = 1;
+	/* Padding is consumed on arrival */
+	if (flen > len)
+		h2f_credit_locked(hc, s, flen - len);
+	PTOK(pthread_cond_signal(&s->cond));
+	Lck_Unlock(&hc->mtx);
+	return (0);
+}
+
+static int
+h2f_rx_frame(struct h2f_conn *hc, uint8_t type, uint8_t flags,
+    uint32_t stream, const uint8_t *p, uint32_t len)
+{
+	struct h2f_stream *s;
+	uint32_t last;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	if (hc->hblk_stream != 0 && (type != H2_F_CONTINUATION->type ||
+	    stream != hc->hblk_stream))
+		return (-1);
+
+	if (type == H2_F_DATA->type) {
+		return (h2f_rx_data(hc, flags, stream, p, len));
+	} else if (type == H2_F_HEADERS->type) {
+		if (stream == 0)
+			return (-1);
+		if (flags & H2FF_HEADERS_PADDED) {
+			if (len < 1 || p[0] >= len)
+				return (-1);
+			len -= p[0] + 1;
+			p++;
+		}
+		if (flags & H2FF_HEADERS_PRIORITY) {
+			if (len < 5)
+				return (-1);
+			len -= 5;
+			p += 5;
+		}
+		VSB_clear(hc->hblk);
+		VSB_bcat(hc->hblk, p, len);
+		hc->hblk_stream = stream;
+		hc->hblk_flags = flags;
+		if (flags & H2FF_HEADERS_END_HEADERS)
+			return (h2f_rx_hdrs(hc));
+	} else if (type == H2_F_CONTINUATION->type) {
+		if (hc->hblk_stream == 0)
+			return (-1);
+		VSB_bcat(hc->hblk, p, len);
+		if (VSB_len(hc->hblk) > (ssize_t)cache_param->http_resp_size * 2)
+			return (-1);
+		if (flags & H2FF_CONTINUATION_END_HEADERS)
+			return (h2f_rx_hdrs(hc));
+	} else if (type == H2_F_RST_STREAM->type) {
+		if (len != 4)
+			return (-1);
+		Lck_Lock(&hc->mtx);
+		s = h2f_find_locked(hc, stream);
+		if (s != NULL)
+			h2f_fail_locked(s, "backend reset the stream",
+			    vbe32dec(p) == H2SE_REFUSED_STREAM->val);
+		Lck_Unlock(&hc->mtx);
+	} else if (type == H2_F_SETTINGS->type) {
+		if (stream != 0 || len % 6 != 0)
+			return (-1);
+		if (flags & H2FF_SETTINGS_ACK)
+			return (0);
+		h2f_settings(hc, p, len);
+		Lck_Lock(&hc->mtx);
+		h2f_send_locked(hc, H2_F_SETTINGS, H2FF_SETTINGS_ACK,
+		    0, NULL, 0);
+		Lck_Unlock(&hc->mtx);
+	} else if (type == H2_F_PING->type) {
+		if (stream != 0 || len != 8)
+			return (-1);
+		if (flags & H2FF_PING_ACK)
+			return (0);
+		Lck_Lock(&hc->mtx);
+		h2f_send_locked(hc, H2_F_PING, H2FF_PING_ACK, 0, p, 8);
+		Lck_Unlock(&hc->mtx);
+	} else if (type == H2_F_GOAWAY->type) {
+		if (stream != 0 || len < 8)
+			return (-1);
+		last = vbe32dec(p) & 0x7fffffff;
+		Lck_Lock(&hc->pool->mtx);
+		hc->closing = 1;
+		Lck_Unlock(&hc->pool->mtx);
+		Lck_Lock(&hc->mtx);
+		VTAILQ_FOREACH(s, &hc->streams, list)
+			if (s->id > last)
+				h2f_fail_locked(s, "backend going away", 1);
+		Lck_Unlock(&hc->mtx);
+	} else if (type == H2_F_PUSH_PROMISE->type) {
+		/* We disabled push */
+		return (-1);
+	}
+	/* PRIORITY, WINDOW_UPDATE and unknown frames are of no concern */
+	return (0);
+}
+
+/*
+ * Wait for the next frame, and close idle connections, or connections
+ * which were told to go away once their streams are done.
+ */
+
+static int
+h2f_rx_wait(struct h2f_conn *hc)
+{
+	struct pollfd pfd[1];
+	struct h2f_pool *hp;
+	int done;
+
+	hp = hc->pool;
+	while (1) {
+		pfd->fd = hc->fd;
+		pfd->events = POLLIN;
+		if (poll(pfd, 1, 1000) != 0)
+			return (0);
+		Lck_Lock(&hp->mtx);
+		done = hc->n_streams == 0 && (hc->closing ||
+		    VTIM_real() - hc->t_idle > cache_param->backend_idle_timeout);
+		if (done)
+			hc->closing = 1;
+		Lck_Unlock(&hp->mtx);
+		if (done)
+			return (-1);
+	}
+}
+
+static void v_matchproto_(task_func_t)
+h2f_rx_task(struct worker *wrk, void *priv)
+{
+	struct h2f_conn *hc;
+	uint8_t hdr[H2F_FRAME_HDR];
+	const char *why = "backend closed the connection";
+	uint32_t len, stream;
+	vtim_real deadline;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(hc, priv, H2F_CONN_MAGIC);
+
+	while (h2f_rx_wait(hc) == 0) {
+		/* A frame has started, the rest of it must follow */
+		deadline = h2f_deadline();
+		if (h2f_read(hc->fd, hdr, sizeof hdr, deadline)) {
+			if (errno == ETIMEDOUT)
+				why = "backend read timeout";
+			break;
+		}
+		len = vbe32dec(hdr) >> 8;
+		stream = vbe32dec(hdr + 5) & 0x7fffffff;
+		if (len > sizeof hc->rxbuf) {
+			why = "backend frame too large";
+			break;
+		}
+		if (h2f_read(hc->fd, hc->rxbuf, len, deadline)) {
+			if (errno == ETIMEDOUT)
+				why = "backend read timeout";
+			break;
+		}
+		if (h2f_rx_frame(hc, hdr[3], hdr[4], stream, hc->rxbuf, len)) {
+			why = "backend protocol error";
+			Lck_Lock(&hc->mtx);
+			h2f_send_u32_locked(hc, H2_F_GOAWAY, 0, 0);
+			Lck_Unlock(&hc->mtx);
+			(void)h2f_flush(hc);
+			break;
+		}
+		if (h2f_flush(hc))
+			break;
+	}
+	Lck_Lock(&hc->mtx);
+	if (hc->why != NULL)
+		why = hc->why;
+	Lck_Unlock(&hc->mtx);
+	h2f_conn_done(hc, why);
+}
+
+/*--------------------------------------------------------------------
+ * Pick a connection with a free stream, or decide to open one.  While
+ * a connection is being opened, or max_conn are open, wait for a stream
+ * to become available instead.
+ */
+
+static struct h2f_conn *
+h2f_pick(struct worker *wrk, struct h2f_pool *hp, unsigned max_conn,
+    vtim_real deadline, unsigned *full)
+{
+	struct h2f_conn *hc;
+
+	*full = 0;
+	Lck_Lock(&hp->mtx);
+	while (1) {
+		VTAILQ_FOREACH(hc, &hp->conns, list) {
+			CHECK_OBJ(hc, H2F_CONN_MAGIC);
+			if (hc->closing ||
+			    hc->n_streams >= vmin(hp->streams, hc->max_streams))
+				continue;
+			hc->n_streams++;
+			hc->n_total++;
+			hc->refcnt++;
+			wrk->stats->backend_reuse++;
+			break;
+		}
+		if (hc != NULL)
+			break;
+		if (hp->n_opening == 0 &&
+		    (max_conn == 0 || hp->n_conn < max_conn)) {
+			hp->n_conn++;
+			hp->n_opening++;
+			break;
+		}
+		if (Lck_CondWaitUntil(&hp->cond, &hp->mtx, deadline) ==
+		    ETIMEDOUT) {
+			*full = 1;
+			break;
+		}
+	}
+	Lck_Unlock(&hp->mtx);
+	return (hc);
+}
+
+static struct h2f_conn *
+h2f_open(struct h2f_pool *hp, vtim_dur tmo, int *err)
+{
+	struct h2f_conn *hc;
+
+	ALLOC_OBJ(hc, H2F_CONN_MAGIC);
+	AN(hc);
+	hc->pool = hp;
+	hc->max_streams = UINT_MAX;
+	hc->max_frame = H2_SET_MAX_FRAME_SIZE->defval;
+	hc->enc_table_size = H2_SET_HEADER_TABLE_SIZE->defval;
+	hc->window = H2F_WINDOW * hp->streams;
+	hc->next_id = 1;
+	Lck_New(&hc->mtx, lck_backend_h2);
+	Lck_New(&hc->wmtx, lck_backend_h2_tx);
+	VTAILQ_INIT(&hc->streams);
+	hc->txq = VSB_new_auto();
+	AN(hc->txq);
+	hc->txbuf = VSB_new_auto();
+	AN(hc->txbuf);
+	AZ(VHE_Init(hc->enctbl, cache_param->h2_encoder_table_size));
+	AZ(VHT_Init(hc->dectbl, H2F_TABLE_SIZE));
+	hc->hblk = VSB_new_auto();
+	AN(hc->hblk);
+
+	hc->fd = VCP_Open(hp->conn_pool, tmo, &hc->addr, err);
+	if (hc->fd >= 0) {
+		VTCP_nonblocking(hc->fd);
+		errno = 0;
+		if (h2f_handshake(hc, tmo)) {
+			*err = errno != 0 ? errno : EPROTO;
+			closefd(&hc->fd);
+		}
+	}
+	if (hc->fd < 0) {
+		Lck_Lock(&hp->mtx);
+		hp->n_conn--;
+		hp->n_opening--;
+		PTOK(pthread_cond_broadcast(&hp->cond));
+		Lck_Unlock(&hp->mtx);
+		h2f_conn_free(hc);
+		return (NULL);
+	}
+
+	hc->task->func = h2f_rx_task;
+	hc->task->priv = hc;
+	Lck_Lock(&hp->mtx);
+	VTAILQ_INSERT_TAIL(&hp->conns, hc, list);
+	hp->vsc->h2_conn++;
+	VSC_C_main->backend_conn++;
+	hc->refcnt = 2;		// receiver and caller
+	hc->n_streams = 1;
+	hc->n_total = 1;
+	hp->n_opening--;
+	PTOK(pthread_cond_broadcast(&hp->cond));
+	Lck_Unlock(&hp->mtx);
+
+	if (Pool_Task_Any(hc->task, TASK_QUEUE_BO)) {
+		*err = EAGAIN;
+		h2f_conn_done(hc, "no worker for the receiver");
+		h2f_conn_rel(hc, 1);
+		return (NULL);
+	}
+	return (hc);
+}
+
+/*--------------------------------------------------------------------
+ * Public interface
+ */
+
+struct h2f_pool *
+H2F_New(struct conn_pool *cp, unsigned streams, unsigned uds,
+    struct VSC_vbe *vsc)
+{
+	struct h2f_pool *hp;
+
+	AN(cp);
+	AN(vsc);
+	assert(streams > 0);
+	ALLOC_OBJ(hp, H2F_POOL_MAGIC);
+	AN(hp);
+	Lck_New(&hp->mtx, lck_backend_h2);
+	PTOK(pthread_cond_init(&hp->cond, NULL));
+	hp->conn_pool = cp;
+	hp->streams = streams;
+	hp->uds = uds;
+	hp->vsc = vsc;
+	VTAILQ_INIT(&hp->conns);
+	return (hp);
+}
+
+void
+H2F_Destroy(struct h2f_pool **hpp)
+{
+	struct h2f_pool *hp;
+	struct h2f_conn *hc;
+
+	TAKE_OBJ_NOTNULL(hp, hpp, H2F_POOL_MAGIC);
+
+	Lck_Lock(&hp->mtx);
+	VTAILQ_FOREACH(hc, &hp->conns, list) {
+		hc->closing = 1;
+		(void)shutdown(hc->fd, SHUT_RDWR);
+	}
+	while (hp->n_conn > 0) {
+		Lck_Unlock(&hp->mtx);
+		(void)usleep(20000);
+		Lck_Lock(&hp->mtx);
+	}
+	Lck_Unlock(&hp->mtx);
+	PTOK(pthread_cond_destroy(&hp->cond));
+	Lck_Delete(&hp->mtx);
+	FREE_OBJ(hp);
+}
+
+/*
+ * Get a stream on a connection for bo.  Returns one if max_conn are in
+ * use without a free stream, minus one with *err set if opening a
+ * connection failed.
+ */
+
+int
+H2F_Get(struct h2f_pool *hp, struct busyobj *bo, vtim_dur tmo,
+    unsigned max_conn, int *err)
+{
+	struct h2f_conn *hc;
+	struct h2f_stream *s;
+	unsigned full;
+
+	CHECK_OBJ_NOTNULL(hp, H2F_POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	AN(err);
+
+	*err = 0;
+	hc = h2f_pick(bo->wrk, hp, max_conn, VTIM_real() + tmo, &full);
+	if (hc == NULL && full)
+		return (1);
+	if (hc == NULL)
+		hc = h2f_open(hp, tmo, err);
+	if (hc == NULL)
+		return (-1);
+
+	ALLOC_OBJ(s, H2F_STREAM_MAGIC);
+	AN(s);
+	s->conn = hc;
+	PTOK(pthread_cond_init(&s->cond, NULL));
+	VTAILQ_INIT(&s->data);
+	s->between_bytes_timeout = bo->htc->between_bytes_timeout;
+	bo->htc->priv = s;
+	bo->htc->rfd = &hc->fd;
+	return (0);
+}
+
+int
+H2F_Owns(const struct http_conn *htc)
+{
+	const struct h2f_stream *s;
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	s = htc->priv;
+	return (s != NULL && s->magic == H2F_STREAM_MAGIC);
+}
+
+VCL_IP
+H2F_GetIp(const struct http_conn *htc)
+{
+	const struct h2f_stream *s;
+
+	CAST_OBJ_NOTNULL(s, htc->priv, H2F_STREAM_MAGIC);
+	CHECK_OBJ_NOTNULL(s->conn, H2F_CONN_MAGIC);
+	return (s->conn->addr);
+}
+
+void
+H2F_Log(const struct http_conn *htc, struct vsl_log *vsl, const char *be)
+{
+	const struct h2f_stream *s;
+	struct h2f_conn *hc;
+	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
+	char pbuf1[VTCP_PORTBUFSIZE], pbuf2[VTCP_PORTBUFSIZE];
+	unsigned reuse;
+
+	CAST_OBJ_NOTNULL(s, htc->priv, H2F_STREAM_MAGIC);
+	hc = s->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	if (hc->pool->uds) {
+		bprintf(abuf1, "%s", "0.0.0.0");
+		bprintf(pbuf1, "%s", "0");
+		bprintf(abuf2, "%s", "0.0.0.0");
+		bprintf(pbuf2, "%s", "0");
+	} else {
+		VTCP_myname(hc->fd, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
+		VTCP_hisname(hc->fd, abuf2, sizeof abuf2, pbuf2, sizeof pbuf2);
+	}
+	Lck_Lock(&hc->pool->mtx);
+	reuse = hc->n_total > 1;
+	Lck_Unlock(&hc->pool->mtx);
+	VSLb(vsl, SLT_BackendOpen, "%d %s %s %s %s %s %s",
+	    hc->fd, be, abuf2, pbuf2, abuf1, pbuf1,
+	    reuse ? "reuse" : "connect");
+}
+
+/*--------------------------------------------------------------------
+ * Send the request headers
+ */
+
+static enum vhe_index_e
+h2f_hdr_index(const char *name, size_t l)
+{
+
+#define H2F_HDR_IS(s) (l == sizeof s - 1 && !memcmp(name, s, l))
+	if (H2F_HDR_IS("cookie") || H2F_HDR_IS("authorization"))
+		return (VHE_NEVER);
+#undef H2F_HDR_IS
+	return (VHE_INDEX);
+}
+
+static void
+h2f_encode(struct h2f_conn *hc, struct vsb *vsb, const struct http *hp)
+{
+	char name[256];
+	const char *p, *host;
+	unsigned u;
+	size_t l, i;
+
+	VHE_SetMaxTableSize(hc->enctbl, hc->enc_table_size);
+	VHE_Begin(hc->enctbl, vsb);
+
+#define H2F_ENC(n, v, vl, idx) \
+	VHE_Encode(hc->enctbl, vsb, n, sizeof n - 1, v, vl, idx)
+	H2F_ENC(":method", hp->hd[HTTP_HDR_METHOD].b,
+	    Tlen(hp->hd[HTTP_HDR_METHOD]), VHE_INDEX);
+	H2F_ENC(":scheme", "http", 4, VHE_INDEX);
+	if (http_GetHdr(hp, H_Host, &host))
+		H2F_ENC(":authority", host, strlen(host), VHE_INDEX);
+	H2F_ENC(":path", hp->hd[HTTP_HDR_URL].b,
+	    Tlen(hp->hd[HTTP_HDR_URL]), VHE_NOINDEX);
+#undef H2F_ENC
+
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (http_IsFiltered(hp, u, HTTPH_C_SPECIFIC))
+			continue;
+		if (http_IsHdr(&hp->hd[u], H_Host))
+			continue;
+		p = strchr(hp->hd[u].b, ':');
+		AN(p);
+		l = p - hp->hd[u].b;
+		if (l == 0 || l > sizeof name) {
+			VSLbt(hp->vsl, SLT_LostHeader, hp->hd[u]);
+			continue;
+		}
+		for (i = 0; i < l; i++)
+			name[i] = tolower(hp->hd[u].b[i]);
+		if (l == 2 && !memcmp(name, "te", 2))
+			continue;
+		while (vct_islws(*++p))
+			continue;
+		VHE_Encode(hc->enctbl, vsb, name, l, p, hp->hd[u].e - p,
+		    h2f_hdr_index(name, l));
+	}
+}
+
+int
+H2F_SendReq(struct worker *wrk, struct busyobj *bo)
+{
+	struct h2f_stream *s;
+	struct h2f_conn *hc;
+	struct vsb *vsb;
+	uint8_t hdr[H2F_FRAME_HDR];
+	size_t len, off, l, nfr;
+	uint8_t flags;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(s, bo->htc->priv, H2F_STREAM_MAGIC);
+	hc = s->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AZ(s->id);
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+
+	/* Stream ids and header blocks must be queued in order */
+	Lck_Lock(&hc->mtx);
+	if (hc->dead || hc->next_id > 0x7fffffff) {
+		Lck_Unlock(&hc->mtx);
+		VSB_destroy(&vsb);
+		VSLb(bo->vsl, SLT_FetchError, "backend connection lost");
+		bo->htc->doclose = SC_TX_ERROR;
+		return (1);
+	}
+	s->id = hc->next_id;
+	hc->next_id += 2;
+	VTAILQ_INSERT_TAIL(&hc->streams, s, list);
+
+	h2f_encode(hc, vsb, bo->bereq);
+	AZ(VSB_finish(vsb));
+
+	len = VSB_len(vsb);
+	nfr = len == 0 ? 1 : (len + hc->max_frame - 1) / hc->max_frame;
+	off = 0;
+	do {
+		l = vmin_t(size_t, len - off, hc->max_frame);
+		flags = off + l == len ? H2FF_HEADERS_END_HEADERS : 0;
+		if (off == 0)
+			h2f_frame_hdr(hdr, l, H2_F_HEADERS,
+			    flags | H2FF_HEADERS_END_STREAM, s->id);
+		else
+			h2f_frame_hdr(hdr, l, H2_F_CONTINUATION, flags, s->id);
+		AZ(VSB_bcat(hc->txq, hdr, sizeof hdr));
+		AZ(VSB_bcat(hc->txq, VSB_data(vsb) + off, l));
+		off += l;
+	} while (off < len);
+	Lck_Unlock(&hc->mtx);
+
+	/* If this fails, the peer lost track of the HPACK table */
+	i = h2f_flush(hc);
+
+	VSB_destroy(&vsb);
+	bo->acct.bereq_hdrbytes += len + nfr * H2F_FRAME_HDR;
+	VSLb_ts_busyobj(bo, "Bereq", W_TIM_real(wrk));
+
+	if (i) {
+		VSLb(bo->vsl, SLT_FetchError, "backend write error: %d (%s)",
+		    errno, VAS_errtxt(errno));
+		bo->htc->doclose = SC_TX_ERROR;
+		return (1);
+	}
+	Lck_Lock(&hc->pool->mtx);
+	hc->pool->vsc->h2_stream++;
+	Lck_Unlock(&hc->pool->mtx);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Receive the response headers and set up the body fetch
+ */
+
+static enum vfp_status v_matchproto_(vfp_pull_f)
+h2f_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p, ssize_t *lp)
+{
+	struct h2f_stream *s;
+	struct h2f_conn *hc;
+	struct h2f_data *d;
+	vtim_real deadline = INFINITY;
+	const char *err;
+	size_t n;
+	int r, end, flush;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+	CAST_OBJ_NOTNULL(s, vfe->priv1, H2F_STREAM_MAGIC);
+	hc = s->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AN(p);
+	AN(lp);
+
+	if (s->between_bytes_timeout > 0)
+		deadline = VTIM_real() + s->between_bytes_timeout;
+
+	Lck_Lock(&hc->mtx);
+	while ((d = VTAILQ_FIRST(&s->data)) == NULL && !s->end_stream &&
+	    s->error == NULL) {
+		r = Lck_CondWaitUntil(&s->cond, &hc->mtx, deadline);
+		if (r == ETIMEDOUT) {
+			Lck_Unlock(&hc->mtx);
+			*lp = 0;
+			return (VFP_Error(vc, "between bytes timeout"));
+		}
+	}
+	if (d == NULL) {
+		err = s->error;
+		Lck_Unlock(&hc->mtx);
+		*lp = 0;
+		if (err != NULL)
+			return (VFP_Error(vc, "%s", err));
+		if (vfe->priv2 > 0)
+			return (VFP_Error(vc, "straight insufficient bytes"));
+		return (VFP_END);
+	}
+	n = vmin_t(size_t, *lp, d->len - d->off);
+	memcpy(p, d->buf + d->off, n);
+	d->off += n;
+	if (d->off == d->len) {
+		VTAILQ_REMOVE(&s->data, d, list);
+		free(d);
+	}
+	s->queued -= n;
+	h2f_credit_locked(hc, s, n);
+	end = s->end_stream && VTAILQ_EMPTY(&s->data);
+	flush = VSB_len(hc->txq) > 0;
+	Lck_Unlock(&hc->mtx);
+	if (flush)
+		(void)h2f_flush(hc);
+
+	*lp = n;
+	if (vfe->priv2 >= 0) {
+		if ((ssize_t)n > vfe->priv2)
+			return (VFP_Error(vc, "straight too many bytes"));
+		vfe->priv2 -= n;
+		if (end && vfe->priv2 > 0)
+			return (VFP_Error(vc, "straight insufficient bytes"));
+	}
+	return (end ? VFP_END : VFP_OK);
+}
+
+static const struct vfp h2f_vfp = {
+	.name = "H2F",
+	.pull = h2f_pull,
+};
+
+static int
+h2f_resp(struct busyobj *bo, char *b, size_t len)
+{
+	struct http *hp;
+	char *e, *q;
+	unsigned status = 0;
+
+	hp = bo->beresp;
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	e = b + len;
+	for (; b < e; b = strchr(b, '\0') + 1) {
+		if (*b != ':') {
+			http_SetHeader(hp, b);
+			continue;
+		}
+		if (strncmp(b, ":status: ", 9) || status != 0)
+			return (-1);
+		status = strtoul(b + 9, &q, 10);
+		if (*q != '\0' || status < 100 || status > 999)
+			return (-1);
+	}
+	if (status == 0)
+		return (-1);
+	http_PutResponse(hp, "HTTP/2.0", status, NULL);
+	return (0);
+}
+
+int
+H2F_FetchRespHdr(struct busyobj *bo)
+{
+	struct http_conn *htc;
+	struct h2f_stream *s;
+	struct h2f_conn *hc;
+	struct vfp_entry *vfe;
+	vtim_real deadline;
+	char *hdrs, *b;
+	size_t len;
+	unsigned eos, retry;
+	const char *err;
+	int r;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	htc = bo->htc;
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(s, htc->priv, H2F_STREAM_MAGIC);
+	hc = s->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	VSC_C_main->backend_req++;
+
+	deadline = VTIM_real() + htc->first_byte_timeout;
+	Lck_Lock(&hc->mtx);
+	while (!s->hdrs_done && s->error == NULL) {
+		r = Lck_CondWaitUntil(&s->cond, &hc->mtx, deadline);
+		if (r == ETIMEDOUT)
+			break;
+	}
+	bo->acct.beresp_hdrbytes += s->hdrbytes;
+	s->hdrbytes = 0;
+	err = s->error;
+	retry = s->retry;
+	hdrs = s->hdrs;
+	len = s->hdrs_len;
+	s->hdrs = NULL;
+	eos = s->end_stream && VTAILQ_EMPTY(&s->data);
+	Lck_Unlock(&hc->mtx);
+
+	if (hdrs == NULL) {
+		if (err != NULL) {
+			VSLb(bo->vsl, SLT_FetchError, "%s", err);
+			htc->doclose = SC_RX_BAD;
+		} else {
+			VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+			htc->doclose = SC_RX_TIMEOUT;
+		}
+		return (retry ? 1 : -1);
+	}
+
+	b = WS_Copy(bo->ws, hdrs, len);
+	free(hdrs);
+	if (b == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "out of workspace");
+		htc->doclose = SC_RX_OVERFLOW;
+		return (-1);
+	}
+	if (h2f_resp(bo, b, len)) {
+		VSLb(bo->vsl, SLT_FetchError, "http format error");
+		htc->doclose = SC_RX_JUNK;
+		return (-1);
+	}
+
+	htc->content_length = -1;
+	if (http_method_eq(http_GetMethod(bo->bereq), HEAD)) {
+		bo->wrk->stats->fetch_head++;
+		htc->body_status = BS_NONE;
+	} else if (http_IsStatus(bo->beresp, 204)) {
+		bo->wrk->stats->fetch_204++;
+		htc->body_status = BS_NONE;
+	} else if (http_IsStatus(bo->beresp, 304)) {
+		bo->wrk->stats->fetch_304++;
+		htc->body_status = BS_NONE;
+	} else if (eos) {
+		bo->wrk->stats->fetch_none++;
+		htc->body_status = BS_NONE;
+	} else {
+		htc->content_length = http_GetContentLength(bo->beresp);
+		if (htc->content_length > 0) {
+			bo->wrk->stats->fetch_length++;
+			htc->body_status = BS_LENGTH;
+		} else {
+			bo->wrk->stats->fetch_eof++;
+			htc->content_length = -1;
+			htc->body_status = BS_EOF;
+		}
+	}
+
+	if (htc->body_status == BS_NONE)
+		return (0);
+	vfe = VFP_Push(bo->vfc, &h2f_vfp);
+	if (vfe == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "overflow");
+		htc->doclose = SC_RX_OVERFLOW;
+		return (-1);
+	}
+	vfe->priv1 = s;
+	vfe->priv2 = htc->content_length;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Done with the stream, cancel it if the response is not complete
+ */
+
+void
+H2F_Finish(struct busyobj *bo)
+{
+	struct h2f_stream *s;
+	struct h2f_conn *hc;
+	struct h2f_data *d;
+	size_t n = 0;
+	int flush;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(s, bo->htc->priv, H2F_STREAM_MAGIC);
+	bo->htc->priv = NULL;
+	bo->htc->rfd = NULL;
+	hc = s->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+
+	Lck_Lock(&hc->mtx);
+	if (s->id > 0) {
+		if (!s->end_stream && s->error == NULL)
+			h2f_send_u32_locked(hc, H2_F_RST_STREAM, s->id,
+			    H2SE_CANCEL->val);
+		VTAILQ_REMOVE(&hc->streams, s, list);
+		while ((d = VTAILQ_FIRST(&s->data)) != NULL) {
+			VTAILQ_REMOVE(&s->data, d, list);
+			n += d->len - d->off;
+			free(d);
+		}
+		if (n > 0)
+			h2f_credit_locked(hc, NULL, n);
+	}
+	flush = VSB_len(hc->txq) > 0;
+	Lck_Unlock(&hc->mtx);
+	if (flush)
+		(void)h2f_flush(hc);
+
+	free(s->hdrs);
+	PTOK(pthread_cond_destroy(&s->cond));
+	FREE_OBJ(s);
+	h2f_conn_rel(hc, 1);
+}
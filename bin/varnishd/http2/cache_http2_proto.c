@@ -42,6 +42,7 @@
 #include "cache/cache_objhead.h"
 #include "storage/storage.h"
 
+#include "vct.h"
 #include "vend.h"
 #include "vtcp.h"
 #include "vtim.h"
@@ -164,6 +165,7 @@ h2_new_req(struct h2_sess *h2, unsigned stream, struct req *req)
 		r2->counted = 1;
 	r2->r_window = h2->local_settings.initial_window_size;
 	r2->t_window = h2->remote_settings.initial_window_size;
+	r2->urgency = H2_URGENCY_DEFAULT;
 	req->transport_priv = r2;
 	Lck_Lock(&h2->sess->mtx);
 	if (stream)
@@ -174,12 +176,53 @@ h2_new_req(struct h2_sess *h2, unsigned stream, struct req *req)
 	return (r2);
 }
 
+/**********************************************************************
+ * Receive window size histograms, for streams the size of the request
+ * body buffer, for sessions the largest connection window granted.
+ */
+
+void
+h2_rxwin_stat(struct worker *wrk, uint64_t w, int sess)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	u = VHIST_Bucket(w * 1e-6);
+	if (sess)
+		(*VSC_main_hist_h2_rxwin_sess(wrk->stats, u))++;
+	else
+		(*VSC_main_hist_h2_rxwin_stream(wrk->stats, u))++;
+}
+
+static void
+h2_rxbuf_free(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
+{
+	struct stv_buffer *stvbuf = NULL;
+	unsigned sz = 0;
+
+	Lck_Lock(&h2->sess->mtx);
+	CHECK_OBJ_ORNULL(r2->rxbuf, H2_RXBUF_MAGIC);
+	if (r2->rxbuf != NULL) {
+		AZ(r2->rxbuf_busy);
+		sz = r2->rxbuf->size;
+		stvbuf = r2->rxbuf->stvbuf;
+		r2->rxbuf = NULL;
+		assert(h2->rxbuf_bytes >= sz);
+		h2->rxbuf_bytes -= sz;
+	}
+	Lck_Unlock(&h2->sess->mtx);
+	if (stvbuf == NULL)
+		return;
+	h2_rxwin_stat(wrk, sz, 0);
+	STV_FreeBuf(wrk, &stvbuf);
+	AZ(stvbuf);
+}
+
 void
 h2_del_req(struct worker *wrk, struct h2_req *r2)
 {
 	struct h2_sess *h2;
 	struct sess *sp;
-	struct stv_buffer *stvbuf;
 
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
 	AZ(r2->scheduled);
@@ -197,13 +240,7 @@ h2_del_req(struct worker *wrk, struct h2_req *r2)
 	assert(!WS_IsReserved(r2->req->ws));
 	AZ(r2->req->ws->r);
 
-	CHECK_OBJ_ORNULL(r2->rxbuf, H2_RXBUF_MAGIC);
-	if (r2->rxbuf) {
-		stvbuf = r2->rxbuf->stvbuf;
-		r2->rxbuf = NULL;
-		STV_FreeBuf(wrk, &stvbuf);
-		AZ(stvbuf);
-	}
+	h2_rxbuf_free(wrk, h2, r2);
 
 	Req_Cleanup(sp, wrk, r2->req);
 	if (FEATURE(FEATURE_BUSY_STATS_RATE))
@@ -292,6 +329,41 @@ h2_vsl_frame(const struct h2_sess *h2, const void *ptr, size_t len)
 /**********************************************************************
  */
 
+/**********************************************************************
+ * Receive window auto-tuning
+ *
+ * While request body data arrives, a PING is sent and the bytes
+ * received until its ACK are counted. This is the bandwidth-delay
+ * product seen through the current window. If it used most of the
+ * window, the window was the bottleneck and the target is raised to
+ * twice the sample, up to the session limit. Streams grow their
+ * buffers towards the target as they consume them, see h2_vfp_body().
+ */
+
+static void
+h2_rx_bdp(struct h2_sess *h2)
+{
+	vtim_dur rtt;
+	uint64_t w;
+
+	ASSERT_RXTHR(h2);
+	rtt = VTIM_mono() - h2->bdp_t0;
+	h2->bdp_t0 = 0;
+
+	Lck_Lock(&h2->sess->mtx);
+	if (h2->bdp_bytes * 3 >= h2->rxwin_target * 2ULL) {
+		w = h2->bdp_bytes * 2;
+		if (w > h2->rxwin_sess_max)
+			w = h2->rxwin_sess_max;
+		if (w > h2->rxwin_target)
+			h2->rxwin_target = w;
+	}
+	VSLb(h2->vsl, SLT_Debug,
+	    "H2: BDP %ju bytes rtt %.6f rx window %u",
+	    (uintmax_t)h2->bdp_bytes, rtt, h2->rxwin_target);
+	Lck_Unlock(&h2->sess->mtx);
+}
+
 static h2_error v_matchproto_(h2_rxframe_f)
 h2_rx_ping(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -306,7 +378,12 @@ h2_rx_ping(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 		return (H2CE_FRAME_SIZE_ERROR);
 	}
 	AZ(h2->rxf_stream);				// rfc7540,l,2359,2362
-	if (h2->rxf_flags != 0)	{			// We never send pings
+	if (h2->rxf_flags != 0 && h2->bdp_t0 > 0 &&
+	    vbe64dec(h2->rxf_data) == h2->bdp_seq) {
+		h2_rx_bdp(h2);
+		return (0);
+	}
+	if (h2->rxf_flags != 0)	{	// We only send pings for the BDP
 		H2S_Lock_VSLb(h2, SLT_SessError, "H2: rx ping ack");
 		return (H2SE_PROTOCOL_ERROR);
 	}
@@ -474,6 +551,103 @@ h2_rx_priority(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	return (0);
 }
 
+/**********************************************************************
+ * RFC9218 priority parameters, from the priority header field or a
+ * PRIORITY_UPDATE frame. The value is a structured field dictionary,
+ * members we do not understand or with invalid values are ignored.
+ */
+
+static void
+h2_priority_parse(const char *b, const char *e, uint8_t *u, uint8_t *i)
+{
+	const char *k, *v;
+	size_t kl, vl;
+
+	AN(b);
+	AN(e);
+	AN(u);
+	AN(i);
+	*u = H2_URGENCY_DEFAULT;
+	*i = 0;
+
+	while (b < e) {
+		while (b < e && (vct_isows(*b) || *b == ','))
+			b++;
+		k = b;
+		while (b < e && *b != '=' && *b != ';' && *b != ',' &&
+		    !vct_isows(*b))
+			b++;
+		kl = b - k;
+		v = NULL;
+		vl = 0;
+		if (b < e && *b == '=') {
+			v = ++b;
+			while (b < e && *b != ';' && *b != ',' &&
+			    !vct_isows(*b))
+				b++;
+			vl = b - v;
+		}
+		while (b < e && *b != ',')	/* parameters */
+			b++;
+
+		if (kl != 1)
+			continue;
+		if (*k == 'u' && vl == 1 && *v >= '0' && *v <= '7')
+			*u = *v - '0';
+		else if (*k == 'i' && v == NULL)
+			*i = 1;
+		else if (*k == 'i' && vl == 2 && v[0] == '?' &&
+		    (v[1] == '0' || v[1] == '1'))
+			*i = v[1] - '0';
+	}
+}
+
+/**********************************************************************
+ * Incoming PRIORITY_UPDATE, RFC9218 section 7.1
+ */
+
+static h2_error v_matchproto_(h2_rxframe_f)
+h2_rx_priority_update(struct worker *wrk, struct h2_sess *h2,
+    struct h2_req *r2)
+{
+	uint32_t stream;
+	uint8_t u, i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	ASSERT_RXTHR(h2);
+	CHECK_OBJ_ORNULL(r2, H2_REQ_MAGIC);
+
+	if (h2->rxf_len < 4) {
+		H2S_Lock_VSLb(h2, SLT_SessError,
+		    "H2: rx priority_update with (len < 4)");
+		return (H2CE_FRAME_SIZE_ERROR);
+	}
+	stream = vbe32dec(h2->rxf_data) & ~(1LU<<31);
+	if (stream == 0) {
+		H2S_Lock_VSLb(h2, SLT_SessError,
+		    "H2: rx priority_update for stream 0");
+		return (H2CE_PROTOCOL_ERROR);
+	}
+
+	h2_priority_parse((const char *)h2->rxf_data + 4,
+	    (const char *)h2->rxf_data + h2->rxf_len, &u, &i);
+
+	/* Updates for streams not (yet) open are not buffered */
+	VTAILQ_FOREACH(r2, &h2->streams, list)
+		if (r2->stream == stream)
+			break;
+	if (r2 == NULL)
+		return (0);
+
+	Lck_Lock(&h2->sess->mtx);
+	r2->urgency = u;
+	r2->incremental = i;
+	VSLb(h2->vsl, SLT_Debug, "H2: stream %u: priority u=%u%s",
+	    stream, u, i ? ", i" : "");
+	Lck_Unlock(&h2->sess->mtx);
+	return (0);
+}
+
 /**********************************************************************
  * Incoming SETTINGS, possibly an ACK of one we sent.
  */
@@ -638,6 +812,7 @@ h2_end_headers(struct worker *wrk, struct h2_sess *h2,
     struct req *req, struct h2_req *r2)
 {
 	h2_error h2e;
+	const char *p;
 	ssize_t cl;
 
 	ASSERT_RXTHR(h2);
@@ -708,6 +883,10 @@ h2_end_headers(struct worker *wrk, struct h2_sess *h2,
 		return (H2SE_PROTOCOL_ERROR); //rfc7540,l,3068,3071
 	}
 
+	if (http_GetHdr(req->http, "\011priority:", &p))
+		h2_priority_parse(p, p + strlen(p), &r2->urgency,
+		    &r2->incremental);
+
 	assert(req->req_step == R_STP_TRANSPORT);
 	VCL_TaskEnter(req->privs);
 	VCL_TaskEnter(req->top->privs);
@@ -856,10 +1035,13 @@ static h2_error v_matchproto_(h2_rxframe_f)
 h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
 	char buf[4];
+	uint8_t ping[8];
 	ssize_t l;
 	uint64_t l2, head;
+	int64_t incr;
 	const uint8_t *src;
 	unsigned len;
+	int bdp;
 
 	/* XXX: Shouldn't error handling, setting of r2->error and
 	 * r2->cond signalling be handled more generally at the end of
@@ -939,12 +1121,37 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 		return (H2CE_FLOW_CONTROL_ERROR);
 	}
 	h2->req0->r_window -= h2->rxf_len;
-	if (h2->req0->r_window < cache_param->h2_rx_window_low_water) {
-		h2->req0->r_window += cache_param->h2_rx_window_increment;
-		vbe32enc(buf, cache_param->h2_rx_window_increment);
+	incr = 0;
+	if (h2->req0->r_window < cache_param->h2_rx_window_low_water)
+		incr = cache_param->h2_rx_window_increment;
+	if (h2->rxwin_max > 0 &&
+	    h2->req0->r_window + incr < h2->rxwin_target)
+		incr = h2->rxwin_target - h2->req0->r_window;
+	if (incr > 0) {
+		h2->req0->r_window += incr;
+		if (h2->req0->r_window > h2->rxwin_peak)
+			h2->rxwin_peak = h2->req0->r_window;
+	}
+	bdp = 0;
+	if (h2->bdp_t0 > 0)
+		h2->bdp_bytes += h2->rxf_len;
+	else if (h2->rxwin_max > 0 &&
+	    h2->rxwin_target < h2->rxwin_sess_max) {
+		h2->bdp_t0 = VTIM_mono();
+		h2->bdp_bytes = h2->rxf_len;
+		vbe64enc(ping, ++h2->bdp_seq);
+		bdp = 1;
+	}
+	if (incr > 0 || bdp) {
 		Lck_Unlock(&h2->sess->mtx);
 		H2_Send_Get(wrk, h2, h2->req0);
-		H2_Send_Frame(wrk, h2, H2_F_WINDOW_UPDATE, 0, 4, 0, buf);
+		if (incr > 0) {
+			vbe32enc(buf, incr);
+			H2_Send_Frame(wrk, h2, H2_F_WINDOW_UPDATE, 0, 4, 0,
+			    buf);
+		}
+		if (bdp)
+			H2_Send_Frame(wrk, h2, H2_F_PING, 0, 8, 0, ping);
 		H2_Send_Rel(h2, h2->req0);
 		Lck_Lock(&h2->sess->mtx);
 	}
@@ -1043,9 +1250,9 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 		rxbuf->size = bufsize;
 		rxbuf->stvbuf = stvbuf;
 
-		r2->rxbuf = rxbuf;
-
 		Lck_Lock(&h2->sess->mtx);
+		r2->rxbuf = rxbuf;
+		h2->rxbuf_bytes += bufsize;
 	}
 
 	CHECK_OBJ_NOTNULL(r2->rxbuf, H2_RXBUF_MAGIC);
@@ -1055,6 +1262,8 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	l = r2->rxbuf->size - l;
 	assert(len <= l); /* Stream window handling ensures this */
 
+	AZ(r2->rxbuf_busy);
+	r2->rxbuf_busy = 1;
 	Lck_Unlock(&h2->sess->mtx);
 
 	l = len;
@@ -1071,6 +1280,7 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	} while (l > 0);
 
 	Lck_Lock(&h2->sess->mtx);
+	r2->rxbuf_busy = 0;
 
 	/* Charge stream window. The entire frame including padding
 	 * (h2->rxf_len) counts towards the window. The used padding
@@ -1089,17 +1299,95 @@ h2_rx_data(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	return (0);
 }
 
+/*
+ * Replace the stream's receive buffer by a bigger one if the auto-tuned
+ * window allows. Called with the session lock held, returns non-zero if
+ * the buffer grew. A buffer to be freed after unlocking, the old one or
+ * a new one which could not be used, is returned in *freep.
+ */
+
+static int
+h2_rxbuf_grow(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2,
+    struct stv_buffer **freep)
+{
+	struct h2_rxbuf *rxbuf, *old;
+	struct stv_buffer *stvbuf;
+	uint64_t w, avail, pos;
+	size_t bstest, l, o, d;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	AN(freep);
+	AZ(*freep);
+	old = r2->rxbuf;
+	CHECK_OBJ_NOTNULL(old, H2_RXBUF_MAGIC);
+	if (h2->rxwin_max == 0 || r2->state >= H2_S_CLOS_REM ||
+	    r2->rxbuf_busy)
+		return (0);
+
+	w = vmin_t(uint64_t, h2->rxwin_target, h2->rxwin_max);
+	avail = 0;
+	if (h2->rxwin_sess_max > h2->rxbuf_bytes)
+		avail = h2->rxwin_sess_max - h2->rxbuf_bytes;
+	if (w > old->size + avail)
+		w = old->size + avail;
+	if (w <= old->size)
+		return (0);
+
+	Lck_Unlock(&h2->sess->mtx);
+	CHECK_OBJ_NOTNULL(stv_h2_rxbuf, STEVEDORE_MAGIC);
+	stvbuf = STV_AllocBuf(wrk, stv_h2_rxbuf, w + sizeof *rxbuf);
+	Lck_Lock(&h2->sess->mtx);
+	if (stvbuf == NULL)
+		return (0);
+	if (r2->rxbuf_busy) {
+		/* The rxthread started filling the old buffer meanwhile */
+		*freep = stvbuf;
+		return (0);
+	}
+
+	rxbuf = STV_GetBufPtr(stvbuf, &bstest);
+	AN(rxbuf);
+	assert(bstest >= w + sizeof *rxbuf);
+	assert(PAOK(rxbuf));
+	INIT_OBJ(rxbuf, H2_RXBUF_MAGIC);
+	rxbuf->size = w;
+	rxbuf->stvbuf = stvbuf;
+	rxbuf->tail = old->tail;
+	rxbuf->head = old->head;
+
+	for (pos = old->tail; pos < old->head; pos += l) {
+		l = old->head - pos;
+		o = pos % old->size;
+		d = pos % rxbuf->size;
+		if (o + l > old->size)
+			l = old->size - o;
+		if (d + l > rxbuf->size)
+			l = rxbuf->size - d;
+		memcpy(&rxbuf->data[d], &old->data[o], l);
+	}
+
+	h2->rxbuf_bytes += rxbuf->size;
+	h2->rxbuf_bytes -= old->size;
+	r2->rxbuf = rxbuf;
+	wrk->stats->h2_rxwin_grow++;
+	VSLb(h2->vsl, SLT_Debug, "H2: stream %u: rx buffer %u",
+	    r2->stream, rxbuf->size);
+	*freep = old->stvbuf;
+	return (1);
+}
+
 static enum vfp_status v_matchproto_(vfp_pull_f)
 h2_vfp_body(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr, ssize_t *lp)
 {
 	struct h2_req *r2;
 	struct h2_sess *h2;
+	struct stv_buffer *stvbuf = NULL;
 	enum vfp_status retval;
 	ssize_t l, l2;
 	uint64_t tail;
 	uint8_t *dst;
 	char buf[4];
-	int i;
+	int i, grown;
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
@@ -1170,7 +1458,9 @@ h2_vfp_body(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr, ssize_t *lp)
 	r2->rxbuf->tail = tail;
 	assert(r2->rxbuf->tail <= r2->rxbuf->head);
 
-	if (r2->r_window < cache_param->h2_rx_window_low_water &&
+	grown = h2_rxbuf_grow(vc->wrk, h2, r2, &stvbuf);
+
+	if ((r2->r_window < cache_param->h2_rx_window_low_water || grown) &&
 	    r2->state < H2_S_CLOS_REM) {
 		/* l is free buffer space */
 		/* l2 is calculated window increment */
@@ -1185,6 +1475,11 @@ h2_vfp_body(struct vfp_ctx *vc, struct vfp_entry *vfe, void *ptr, ssize_t *lp)
 
 	Lck_Unlock(&h2->sess->mtx);
 
+	if (stvbuf != NULL) {
+		STV_FreeBuf(vc->wrk, &stvbuf);
+		AZ(stvbuf);
+	}
+
 	if (l2 > 0) {
 		vbe32enc(buf, l2);
 		H2_Send_Get(vc->wrk, h2, r2);
@@ -1201,7 +1496,6 @@ h2_vfp_body_fini(struct vfp_ctx *vc, struct vfp_entry *vfe)
 {
 	struct h2_req *r2;
 	struct h2_sess *h2;
-	struct stv_buffer *stvbuf = NULL;
 
 	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
@@ -1220,19 +1514,8 @@ h2_vfp_body_fini(struct vfp_ctx *vc, struct vfp_entry *vfe)
 		Lck_Unlock(&h2->sess->mtx);
 	}
 
-	if (r2->state >= H2_S_CLOS_REM && r2->rxbuf != NULL) {
-		Lck_Lock(&h2->sess->mtx);
-		CHECK_OBJ_ORNULL(r2->rxbuf, H2_RXBUF_MAGIC);
-		if (r2->rxbuf != NULL) {
-			stvbuf = r2->rxbuf->stvbuf;
-			r2->rxbuf = NULL;
-		}
-		Lck_Unlock(&h2->sess->mtx);
-		if (stvbuf != NULL) {
-			STV_FreeBuf(vc->wrk, &stvbuf);
-			AZ(stvbuf);
-		}
-	}
+	if (r2->state >= H2_S_CLOS_REM && r2->rxbuf != NULL)
+		h2_rxbuf_free(vc->wrk, h2, r2);
 }
 
 static const struct vfp h2_body = {
@@ -1517,7 +1800,7 @@ h2_rxframe(struct worker *wrk, struct h2_sess *h2)
 	h2_vsl_frame(h2, h2->htc->rxbuf_b, 9L + h2->rxf_len);
 	h2->srq->acct.req_hdrbytes += 9;
 
-	if (h2->rxf_type >= H2FMAX) {
+	if (h2->rxf_type >= H2FMAX || h2flist[h2->rxf_type] == NULL) {
 		// rfc7540,l,679,681
 		// XXX: later, drain rest of frame
 		h2->bogosity++;
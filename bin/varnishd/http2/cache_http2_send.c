@@ -32,6 +32,7 @@
 #include "config.h"
 
 #include <sys/uio.h>
+#include <stdlib.h>
 
 #include "cache/cache_varnishd.h"
 
@@ -43,6 +44,9 @@
 
 #define H2_SEND_HELD(h2, r2) (VTAILQ_FIRST(&(h2)->txqueue) == (r2))
 
+/* Frames which are always worth coalescing */
+#define H2_TX_SMALL 1024
+
 static h2_error
 h2_errcheck(const struct h2_req *r2, const struct h2_sess *h2)
 {
@@ -98,6 +102,72 @@ h2_cond_wait(pthread_cond_t *cond, struct h2_sess *h2, struct h2_req *r2)
 	return (h2e != NULL ? -1 : 0);
 }
 
+/*
+ * RFC9218 scheduling: Stream zero always goes first, then streams by
+ * urgency. Within an urgency, non-incremental streams are served in
+ * stream order ahead of incremental ones, which take turns.
+ */
+
+static int
+h2_sched_before(const struct h2_req *a, const struct h2_req *b)
+{
+
+	if (b->stream == 0)
+		return (0);
+	if (a->stream == 0)
+		return (1);
+	if (a->urgency != b->urgency)
+		return (a->urgency < b->urgency);
+	if (a->incremental != b->incremental)
+		return (!a->incremental);
+	if (!a->incremental)
+		return (a->stream < b->stream);
+	return (0);
+}
+
+/*
+ * Queue for the send token, but never ahead of the current holder.
+ */
+
+static void
+h2_sched_enqueue(struct h2_sess *h2, struct h2_req *r2)
+{
+	struct h2_req *r2b;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	r2b = VTAILQ_FIRST(&h2->txqueue);
+	if (r2b == NULL) {
+		VTAILQ_INSERT_HEAD(&h2->txqueue, r2, tx_list);
+		return;
+	}
+	do
+		r2b = VTAILQ_NEXT(r2b, tx_list);
+	while (r2b != NULL && !h2_sched_before(r2, r2b));
+	if (r2b == NULL)
+		VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+	else
+		VTAILQ_INSERT_BEFORE(r2b, r2, tx_list);
+}
+
+/*
+ * A stream must leave the connection window to streams of a more
+ * urgent class waiting for it.
+ */
+
+static int
+h2_sched_win_preempted(const struct h2_sess *h2, const struct h2_req *r2)
+{
+	const struct h2_req *r2b;
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	if (h2->winup_streams == 0 || r2->urgency == 0)
+		return (0);
+	VTAILQ_FOREACH(r2b, &h2->streams, list)
+		if (r2b->win_queued && r2b->urgency < r2->urgency)
+			return (1);
+	return (0);
+}
+
 static void
 h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
@@ -110,7 +180,7 @@ h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	if (&wrk->cond == h2->cond)
 		ASSERT_RXTHR(h2);
 	r2->wrk = wrk;
-	VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+	h2_sched_enqueue(h2, r2);
 	while (!H2_SEND_HELD(h2, r2))
 		AZ(Lck_CondWait(&wrk->cond, &h2->sess->mtx));
 	r2->wrk = NULL;
@@ -145,6 +215,104 @@ h2_send_rel_locked(struct h2_sess *h2, const struct h2_req *r2)
 	}
 }
 
+/*
+ * Write out the coalesced frames, plus optionally one more frame which
+ * did not fit. Called by the send token holder with the session mtx held,
+ * which is dropped for the write. Frames queued by other streams while
+ * the write is in progress go to the spare buffer.
+ */
+
+static void
+h2_tx_write(struct h2_sess *h2, const uint8_t *hdr, const void *ptr,
+    uint32_t len, uint32_t stream)
+{
+	struct iovec iov[3];
+	uint8_t *buf = NULL;
+	ssize_t s, l;
+	int n = 0;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+
+	memset(iov, 0, sizeof iov);
+	l = h2->txbuf_len;
+	if (l > 0) {
+		buf = h2->txbuf;
+		iov[n].iov_base = buf;
+		iov[n++].iov_len = l;
+		h2->txbuf = h2->txbuf_spare;
+		h2->txbuf_spare = NULL;
+		h2->txbuf_len = 0;
+	}
+	if (hdr != NULL) {
+		iov[n].iov_base = TRUST_ME(hdr);
+		iov[n++].iov_len = 9;
+		l += 9;
+	}
+	if (len > 0) {
+		iov[n].iov_base = TRUST_ME(ptr);
+		iov[n++].iov_len = len;
+		l += len;
+	}
+	if (n == 0)
+		return;
+
+	Lck_Unlock(&h2->sess->mtx);
+	s = writev(h2->sess->fd, iov, n);
+	Lck_Lock(&h2->sess->mtx);
+	if (buf != NULL) {
+		AZ(h2->txbuf_spare);
+		h2->txbuf_spare = buf;
+	}
+	if (s != l) {
+		if (errno == EWOULDBLOCK) {
+			VSLb(h2->vsl, SLT_SessError,
+			     "H2: stream %u: Hit idle_send_timeout", stream);
+		}
+		/*
+		 * There is no point in being nice here, we will be unable
+		 * to send a GOAWAY once the code unrolls, so go directly
+		 * to the finale and be done with it.
+		 */
+		h2->error = H2CE_PROTOCOL_ERROR;
+	}
+}
+
+/*
+ * Copy a frame to the coalescing buffer, if it fits.
+ */
+
+static int
+h2_tx_append(struct worker *wrk, struct h2_sess *h2, const uint8_t *hdr,
+    const void *ptr, uint32_t len)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+
+	if (h2->txbuf_sz < 9 + len ||
+	    h2->txbuf_len > h2->txbuf_sz - (9 + len))
+		return (0);
+	if (h2->txbuf == NULL) {
+		h2->txbuf = malloc(h2->txbuf_sz);
+		AN(h2->txbuf);
+	}
+	memcpy(h2->txbuf + h2->txbuf_len, hdr, 9);
+	h2->txbuf_len += 9;
+	if (len > 0)
+		memcpy(h2->txbuf + h2->txbuf_len, ptr, len);
+	h2->txbuf_len += len;
+	wrk->stats->s_h2_tx_coalesced++;
+	return (1);
+}
+
+/*
+ * The last sender in line writes out whatever the streams before it
+ * left in the coalescing buffer, including frames queued while it
+ * was writing.
+ */
+
 void
 H2_Send_Rel(struct h2_sess *h2, const struct h2_req *r2)
 {
@@ -152,10 +320,26 @@ H2_Send_Rel(struct h2_sess *h2, const struct h2_req *r2)
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
 
 	Lck_Lock(&h2->sess->mtx);
+	while (h2->txbuf_len > 0 && VTAILQ_NEXT(r2, tx_list) == NULL)
+		h2_tx_write(h2, NULL, NULL, 0, r2->stream);
 	h2_send_rel_locked(h2, r2);
 	Lck_Unlock(&h2->sess->mtx);
 }
 
+/*
+ * Check if frames can still be sent on the stream, the send token
+ * must be held to not race the check.
+ */
+
+h2_error
+H2_Send_Check(const struct h2_req *r2)
+{
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	AN(H2_SEND_HELD(r2->h2sess, r2));
+	return (h2_errcheck(r2, r2->h2sess));
+}
+
 static void
 h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
     uint32_t len, uint32_t stream)
@@ -169,10 +353,28 @@ h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
 	vbe32enc(hdr + 5, stream);
 }
 
+static void
+h2_tx_log(struct h2_sess *h2, h2_frame ftyp, const uint8_t *hdr,
+    uint32_t len, const void *ptr)
+{
+
+	Lck_AssertHeld(&h2->sess->mtx);
+	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, hdr);
+	h2->srq->acct.resp_hdrbytes += 9;
+	if (ftyp->overhead)
+		h2->srq->acct.resp_bodybytes += len;
+	if (len > 0)
+		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
+}
+
 /*
  * This is the "raw" frame sender, all per-stream accounting and
  * prioritization must have happened before this is called, and
- * the session mtx must be held.
+ * the send token must be held.
+ *
+ * Small frames, and any frame while other streams are queued for the
+ * send token, are copied to the coalescing buffer if they fit. Other
+ * frames are written directly, together with the buffer contents.
  */
 
 void
@@ -181,10 +383,9 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
     uint32_t len, uint32_t stream, const void *ptr)
 {
 	uint8_t hdr[9];
-	ssize_t s;
-	struct iovec iov[2];
+	int waiting;
 
-	(void)wrk;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
 	AN(ftyp);
 	AZ(flags & ~(ftyp->flags));
@@ -194,35 +395,78 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
 		AZ(ftyp->act_snonzero);
 
 	h2_mk_hdr(hdr, ftyp, flags, len, stream);
+	wrk->stats->s_h2_tx_frames++;
 	Lck_Lock(&h2->sess->mtx);
-	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, hdr);
-	h2->srq->acct.resp_hdrbytes += 9;
-	if (ftyp->overhead)
-		h2->srq->acct.resp_bodybytes += len;
+	h2_tx_log(h2, ftyp, hdr, len, ptr);
+	waiting = VTAILQ_NEXT(VTAILQ_FIRST(&h2->txqueue), tx_list) != NULL;
+	if ((!waiting && len > H2_TX_SMALL) ||
+	    !h2_tx_append(wrk, h2, hdr, ptr, len))
+		h2_tx_write(h2, hdr, ptr, len, stream);
 	Lck_Unlock(&h2->sess->mtx);
+}
 
-	memset(iov, 0, sizeof iov);
-	iov[0].iov_base = (void*)hdr;
-	iov[0].iov_len = sizeof hdr;
-	iov[1].iov_base = TRUST_ME(ptr);
-	iov[1].iov_len = len;
-	s = writev(h2->sess->fd, iov, len == 0 ? 1 : 2);
-	if (s != sizeof hdr + len) {
-		if (errno == EWOULDBLOCK) {
-			H2S_Lock_VSLb(h2, SLT_SessError,
-			     "H2: stream %u: Hit idle_send_timeout", stream);
+/*
+ * Queue a DATA frame without waiting for the send token. This only
+ * works while another stream holds the token, which then writes the
+ * frame out with its own, and when the frame needs no window or
+ * scheduling decisions. Returns zero if the caller must go through
+ * H2_Send_Get() and H2_Send() instead.
+ */
+
+int
+H2_Send_Queue(struct worker *wrk, struct h2_req *r2, uint8_t flags,
+    uint32_t len, const void *ptr, uint64_t *counter)
+{
+	const struct h2_req *r2b;
+	struct h2_sess *h2;
+	uint8_t hdr[9];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(h2->req0, H2_REQ_MAGIC);
+	assert(len == 0 || ptr != NULL);
+	AZ(flags & ~(H2_F_DATA->flags));
+
+	if (h2->txbuf_sz < sizeof hdr + len)
+		return (0);
+
+	Lck_Lock(&h2->sess->mtx);
+	r2b = VTAILQ_FIRST(&h2->txqueue);
+	if (r2b == NULL || h2_errcheck(r2, h2) != NULL ||
+	    h2->winup_streams > 0 ||
+	    len > h2->remote_settings.max_frame_size ||
+	    r2->t_window < len || h2->req0->t_window < len) {
+		Lck_Unlock(&h2->sess->mtx);
+		return (0);
+	}
+	while ((r2b = VTAILQ_NEXT(r2b, tx_list)) != NULL) {
+		if (h2_sched_before(r2b, r2)) {
+			Lck_Unlock(&h2->sess->mtx);
+			return (0);
 		}
-		/*
-		 * There is no point in being nice here, we will be unable
-		 * to send a GOAWAY once the code unrolls, so go directly
-		 * to the finale and be done with it.
-		 */
-		h2->error = H2CE_PROTOCOL_ERROR;
-	} else if (len > 0) {
-		Lck_Lock(&h2->sess->mtx);
-		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
+	}
+	h2_mk_hdr(hdr, H2_F_DATA, flags, len, r2->stream);
+	if (!h2_tx_append(wrk, h2, hdr, ptr, len)) {
 		Lck_Unlock(&h2->sess->mtx);
+		return (0);
+	}
+	h2_tx_log(h2, H2_F_DATA, hdr, len, ptr);
+	r2->t_window -= len;
+	h2->req0->t_window -= len;
+	if (r2->counted && (flags & H2FF_DATA_END_STREAM)) {
+		assert(h2->open_streams > 0);
+		h2->open_streams--;
+		r2->counted = 0;
 	}
+	Lck_Unlock(&h2->sess->mtx);
+
+	wrk->stats->s_h2_tx_frames++;
+	wrk->stats->s_h2_tx_queued++;
+	if (counter != NULL)
+		*counter += len;
+	return (1);
 }
 
 static int64_t
@@ -263,7 +507,13 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 		return (0);
 
 	Lck_Lock(&h2->sess->mtx);
-	if (r2->t_window <= 0 || h2->req0->t_window <= 0) {
+	/* The peer may be waiting for what we have buffered */
+	while (h2->txbuf_len > 0 &&
+	    (r2->t_window <= 0 || h2->req0->t_window <= 0 ||
+	    h2_sched_win_preempted(h2, r2)))
+		h2_tx_write(h2, NULL, NULL, 0, r2->stream);
+	if (r2->t_window <= 0 || h2->req0->t_window <= 0 ||
+	    h2_sched_win_preempted(h2, r2)) {
 		r2->t_winupd = VTIM_real();
 		h2_send_rel_locked(h2, r2);
 
@@ -276,8 +526,12 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 			r2->cond = NULL;
 		}
 
-		while (h2->req0->t_window <= 0 && h2_errcheck(r2, h2) == NULL)
+		r2->win_queued = 1;
+		while ((h2->req0->t_window <= 0 ||
+		    h2_sched_win_preempted(h2, r2)) &&
+		    h2_errcheck(r2, h2) == NULL)
 			(void)h2_cond_wait(h2->winupd_cond, h2, r2);
+		r2->win_queued = 0;
 
 		if (h2_errcheck(r2, h2) == NULL) {
 			w = vmin_t(int64_t, h2_win_limit(r2, h2), wanted);
@@ -285,6 +539,10 @@ h2_do_window(struct worker *wrk, struct h2_req *r2,
 			assert (w > 0);
 		}
 
+		/* Less urgent streams may have been waiting for us */
+		if (h2->req0->t_window > 0 && h2->winup_streams > 1)
+			PTOK(pthread_cond_broadcast(h2->winupd_cond));
+
 		if (r2->error == H2SE_BROKE_WINDOW &&
 		    h2->open_streams <= h2->winup_streams) {
 			VSLb(h2->vsl, SLT_SessError, "H2: window bankrupt");
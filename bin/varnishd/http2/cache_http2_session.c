@@ -34,6 +34,7 @@
 #include "cache/cache_varnishd.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
@@ -162,6 +163,11 @@ h2_init_sess(struct sess *sp,
 	AZ(isnan(h2->last_rst));
 
 	AZ(VHT_Init(h2->dectbl, h2->local_settings.header_table_size));
+	AZ(VHE_Init(h2->enctbl, cache_param->h2_encoder_table_size));
+	h2->txbuf_sz = cache_param->h2_tx_coalesce;
+	h2->rxwin_max = cache_param->h2_rx_window_max;
+	h2->rxwin_sess_max = cache_param->h2_rx_session_window_max;
+	h2->rxwin_target = h2->local_settings.initial_window_size;
 
 	*up = (uintptr_t)h2;
 
@@ -180,6 +186,13 @@ h2_del_sess(struct worker *wrk, struct h2_sess *h2, stream_close_t reason)
 	AN(reason);
 
 	VHT_Fini(h2->dectbl);
+	VHE_Fini(h2->enctbl);
+	AZ(h2->txbuf_len);
+	free(h2->txbuf);
+	free(h2->txbuf_spare);
+	AZ(h2->rxbuf_bytes);
+	if (h2->rxwin_peak > 0)
+		h2_rxwin_stat(wrk, h2->rxwin_peak, 1);
 	PTOK(pthread_cond_destroy(h2->winupd_cond));
 	TAKE_OBJ_NOTNULL(req, &h2->srq, REQ_MAGIC);
 	assert(!WS_IsReserved(req->ws));
@@ -152,7 +152,7 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	if (!isnan(oc->last_lru)) {
 		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
 		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-		VSC_C_main->n_lru_moved++;
+		wrk->stats->n_lru_moved++;
 		oc->last_lru = now;
 	}
 	Lck_Unlock(&lru->mtx);
@@ -174,7 +174,7 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 
 	if (wrk->strangelove-- <= 0) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU reached nuke_limit");
-		VSC_C_main->n_lru_limited++;
+		wrk->stats->n_lru_limited++;
 		return (0);
 	}
 
@@ -188,7 +188,7 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 		    oc, oc->flags, oc->refcnt);
 
 		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
+			wrk->stats->n_lru_nuked++; // XXX per lru ?
 			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
 			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
 			break;
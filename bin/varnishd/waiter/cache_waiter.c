@@ -34,6 +34,7 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "vbh.h"
@@ -158,6 +159,11 @@ Wait_Enter(const struct waiter *w, struct waited *wp)
 	assert(wp->fd > 0);			// stdin never comes here
 	AN(wp->func);
 	wp->idx = VBH_NOIDX;
+	if (w->nshard > 0) {
+		/* The same fd always goes to the same instance */
+		w = w->shard[wp->fd % w->nshard];
+		CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	}
 	return (w->impl->enter(w->priv, wp));
 }
 
@@ -173,8 +179,8 @@ Waiter_GetName(void)
 		return ("(No Waiter?)");
 }
 
-struct waiter *
-Waiter_New(const char *name)
+static struct waiter *
+waiter_new(const char *name)
 {
 	struct waiter *w;
 
@@ -201,15 +207,57 @@ Waiter_New(const char *name)
 	return (w);
 }
 
-void
-Waiter_Destroy(struct waiter **wp)
+/*--------------------------------------------------------------------
+ * With thread_pool_waiters > 1, the waiter of a pool is really several
+ * instances of the waiter implementation, each with its own thread,
+ * heap and counters.  Sessions are spread over them by fd in
+ * Wait_Enter(), shard zero being the waiter itself.
+ */
+
+struct waiter *
+Waiter_New(const char *name)
 {
 	struct waiter *w;
+	char nb[32];
+	unsigned u;
 
-	TAKE_OBJ_NOTNULL(w, wp, WAITER_MAGIC);
+	w = waiter_new(name);
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	if (cache_param->wthread_waiters < 2)
+		return (w);
+
+	w->nshard = cache_param->wthread_waiters;
+	w->shard = calloc(w->nshard, sizeof *w->shard);
+	AN(w->shard);
+	w->shard[0] = w;
+	for (u = 1; u < w->nshard; u++) {
+		bprintf(nb, "%s.%u", name, u);
+		w->shard[u] = waiter_new(nb);
+	}
+	return (w);
+}
+
+static void
+waiter_destroy(struct waiter *w)
+{
 
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
 	AZ(VBH_root(w->heap));
 	AN(w->impl->fini);
 	w->impl->fini(w);
 	FREE_OBJ(w);
 }
+
+void
+Waiter_Destroy(struct waiter **wp)
+{
+	struct waiter *w;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(w, wp, WAITER_MAGIC);
+
+	for (u = 1; u < w->nshard; u++)
+		waiter_destroy(w->shard[u]);
+	free(w->shard);
+	waiter_destroy(w);
+}
@@ -51,6 +51,15 @@
 #  define EPOLLRDHUP 0
 #endif
 
+/*
+ * Registrations are one-shot: the kernel disarms an fd once it reported
+ * an event, so we need no EPOLL_CTL_DEL for it.  When the session comes
+ * back, re-arming is a single EPOLL_CTL_MOD, while a closed fd has
+ * already left the epoll set and gets added anew.  Only timeouts, where
+ * the fd is still armed, need the EPOLL_CTL_DEL.
+ */
+#define VWE_EVENTS	(EPOLLIN | EPOLLRDHUP | EPOLLONESHOT)
+
 #define NEEV	8192
 
 struct vwe {
@@ -142,7 +151,6 @@ vwe_thread(void *priv)
 				    "epoll: spurious event (%d)", wp->fd);
 				continue;
 			}
-			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
 			if (ep->events & EPOLLIN) {
 				if (ep->events & EPOLLRDHUP &&
 				    recv(wp->fd, &c, 1, MSG_PEEK) == 0)
@@ -175,12 +183,15 @@ vwe_enter(void *priv, struct waited *wp)
 	struct epoll_event ee;
 
 	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	ee.events = EPOLLIN | EPOLLRDHUP;
+	ee.events = VWE_EVENTS;
 	ee.data.ptr = wp;
 	Lck_Lock(&vwe->mtx);
 	vwe->nwaited++;
 	Wait_HeapInsert(vwe->waiter, wp);
-	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
+	if (epoll_ctl(vwe->epfd, EPOLL_CTL_MOD, wp->fd, &ee)) {
+		assert(errno == ENOENT);
+		AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, wp->fd, &ee));
+	}
 	/* If the epoll isn't due before our timeout, poke it via the pipe */
 	if (Wait_When(wp) < vwe->next)
 		assert(write(vwe->pipe[1], "X", 1) == 1);
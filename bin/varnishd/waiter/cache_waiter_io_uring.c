@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * An io_uring based waiter.
+ *
+ * Waited fds are one-shot polls on the ring.  Arming a poll is one
+ * io_uring_enter(2) from the thread handing over the fd, but everything
+ * else rides along with the waiter thread's own wait for completions:
+ * a completed poll needs no disarming, timed out polls are cancelled in
+ * the same call, and a poke for an earlier deadline is a no-op entry on
+ * the ring instead of a pipe write and read.
+ *
+ * Every poll produces exactly one completion, also when cancelled, so
+ * a waited whose completion arrives after it left the timeout heap has
+ * timed out.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "waiter/waiter.h"
+#include "waiter/waiter_priv.h"
+#include "vtim.h"
+#include "vuring.h"
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define NCQE	1024
+
+struct vwu {
+	unsigned		magic;
+#define VWU_MAGIC		0x2f9c61d4
+	struct vuring		*ring;
+	struct waiter		*waiter;
+	pthread_t		thread;
+	double			next;
+	unsigned		nwaited;
+	int			die;
+	struct lock		mtx;
+};
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_event(const struct vwu *vwu, struct waited *wp,
+    const struct vuring_cqe *cqe, double now)
+{
+	char c;
+
+	if (cqe->res < 0)
+		Wait_Call(vwu->waiter, wp, WAITER_REMCLOSE, now);
+	else if (cqe->res & POLLIN) {
+		if (cqe->res & POLLRDHUP &&
+		    recv(wp->fd, &c, 1, MSG_PEEK) == 0)
+			Wait_Call(vwu->waiter, wp, WAITER_REMCLOSE, now);
+		else
+			Wait_Call(vwu->waiter, wp, WAITER_ACTION, now);
+	} else
+		Wait_Call(vwu->waiter, wp, WAITER_REMCLOSE, now);
+}
+
+static void *
+vwu_thread(void *priv)
+{
+	struct vuring_cqe *cqe, *cp;
+	struct waited *wp;
+	struct waiter *w;
+	double now, then;
+	unsigned u, n;
+	int active;
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	THR_SetName("cache-io_uring");
+	THR_Init();
+	cqe = malloc(sizeof *cqe * NCQE);
+	AN(cqe);
+
+	now = VTIM_real();
+	while (1) {
+		Lck_Lock(&vwu->mtx);
+		while (1) {
+			then = Wait_HeapDue(w, &wp);
+			if (wp == NULL) {
+				vwu->next = now + 100;
+				break;
+			} else if (then > now) {
+				vwu->next = then;
+				break;
+			}
+			/* Completed by the cancellation below */
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AN(Wait_HeapDelete(w, wp));
+			VURING_PollRemove(vwu->ring, (uintptr_t)wp, 0);
+		}
+		VURING_Flush(vwu->ring);
+		then = vwu->next - now;
+		Lck_Unlock(&vwu->mtx);
+
+		assert(VURING_Enter(vwu->ring, 1, then) >= 0);
+		now = VTIM_real();
+		n = VURING_Reap(vwu->ring, cqe, NCQE);
+		for (cp = cqe, u = 0; u < n; u++, cp++) {
+			if (cp->data == 0)
+				continue;
+			CAST_OBJ_NOTNULL(wp, (void *)(uintptr_t)cp->data,
+			    WAITED_MAGIC);
+			Lck_Lock(&vwu->mtx);
+			active = Wait_HeapDelete(w, wp);
+			AN(vwu->nwaited);
+			vwu->nwaited--;
+			Lck_Unlock(&vwu->mtx);
+			if (active == 0)
+				Wait_Call(w, wp, WAITER_TIMEOUT, now);
+			else
+				vwu_event(vwu, wp, cp, now);
+		}
+		if (vwu->nwaited == 0 && vwu->die)
+			break;
+	}
+	free(cqe);
+	VURING_Destroy(&vwu->ring);
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(waiter_enter_f)
+vwu_enter(void *priv, struct waited *wp)
+{
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	vwu->nwaited++;
+	Wait_HeapInsert(vwu->waiter, wp);
+	VURING_Poll(vwu->ring, wp->fd, POLLIN | POLLRDHUP, (uintptr_t)wp);
+	/* If the waiter isn't due before our timeout, poke it */
+	if (Wait_When(wp) < vwu->next)
+		VURING_Nop(vwu->ring, 0);
+	VURING_Flush(vwu->ring);
+	Lck_Unlock(&vwu->mtx);
+	assert(VURING_Enter(vwu->ring, 0, 0.) >= 0);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void v_matchproto_(waiter_init_f)
+vwu_init(struct waiter *w)
+{
+	struct vwu *vwu;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwu = w->priv;
+	INIT_OBJ(vwu, VWU_MAGIC);
+	vwu->waiter = w;
+
+	/* mgt made sure we have io_uring */
+	vwu->ring = VURING_New(4096);
+	AN(vwu->ring);
+	Lck_New(&vwu->mtx, lck_waiter);
+
+	PTOK(pthread_create(&vwu->thread, NULL, vwu_thread, vwu));
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void v_matchproto_(waiter_fini_f)
+vwu_fini(struct waiter *w)
+{
+	struct vwu *vwu;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwu, w->priv, VWU_MAGIC);
+
+	Lck_Lock(&vwu->mtx);
+	vwu->die = 1;
+	VURING_Nop(vwu->ring, 0);
+	VURING_Flush(vwu->ring);
+	Lck_Unlock(&vwu->mtx);
+	assert(VURING_Enter(vwu->ring, 0, 0.) >= 0);
+	PTOK(pthread_join(vwu->thread, &vp));
+	Lck_Delete(&vwu->mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+#include "waiter/mgt_waiter.h"
+
+const struct waiter_impl waiter_io_uring = {
+	.name =		"io_uring",
+	.init =		vwu_init,
+	.fini =		vwu_fini,
+	.enter =	vwu_enter,
+	.size =		sizeof(struct vwu),
+};
+
+#endif /* defined(HAVE_IO_URING) */
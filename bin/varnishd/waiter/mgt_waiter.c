@@ -37,6 +37,11 @@
 #include "waiter/mgt_waiter.h"
 #include "common/heritage.h"
 
+#if defined(HAVE_IO_URING)
+#  include <sys/socket.h>
+#  include "vuring.h"
+#endif
+
 static const struct choice waiter_choice[] = {
 #define WAITER(nm) { #nm, &waiter_##nm },
 #include "tbl/waiters.h"
@@ -55,4 +60,19 @@ Wait_config(const char *arg)
 		waiter = MGT_Pick(waiter_choice, arg, "waiter");
 	else
 		waiter = waiter_choice[0].ptr;
+
+#if defined(HAVE_IO_URING)
+	/* Kernels and sandboxes may not let us have io_uring */
+	if (waiter == &waiter_io_uring) {
+		struct vuring *vu = VURING_New(1);
+
+		if (vu != NULL) {
+			VURING_Destroy(&vu);
+			return;
+		}
+		MGT_Complain(C_INFO, "io_uring unavailable (%s), using %s",
+		    VAS_errtxt(errno), waiter_choice[0].name);
+		waiter = waiter_choice[0].ptr;
+	}
+#endif
 }
@@ -45,6 +45,10 @@ struct waiter {
 	void				*priv;
 	struct vbh			*heap;
 	struct VSC_waiter		*vsc;
+
+	/* Additional instances sharing the sessions, by fd */
+	unsigned			nshard;
+	struct waiter			**shard;
 };
 
 typedef void waiter_init_f(struct waiter *);
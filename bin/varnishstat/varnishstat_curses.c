@@ -105,10 +105,10 @@ static VTAILQ_HEAD(, pt) ptlist = VTAILQ_HEAD_INITIALIZER(ptlist);
 static int n_ptlist = 0;
 static int n_ptarray = 0;
 static struct pt **ptarray = NULL;
-static const volatile uint64_t *mgt_uptime;
-static const volatile uint64_t *main_uptime;
-static const volatile uint64_t *main_cache_hit;
-static const volatile uint64_t *main_cache_miss;
+static const struct VSC_point *mgt_uptime;
+static const struct VSC_point *main_uptime;
+static const struct VSC_point *main_cache_hit;
+static const struct VSC_point *main_cache_miss;
 
 static int l_status, l_bar_t, l_points, l_bar_b, l_info;
 static unsigned colw_name = COLW_NAME_MIN;
@@ -143,8 +143,8 @@ init_hitrate(void)
 {
 	memset(&hitrate, 0, sizeof (struct hitrate));
 	if (main_cache_hit != NULL) {
-		hitrate.lhit = *main_cache_hit;
-		hitrate.lmiss = *main_cache_miss;
+		hitrate.lhit = VSC_Value(main_cache_hit);
+		hitrate.lmiss = VSC_Value(main_cache_miss);
 	}
 	hitrate.hr_10.nmax = 10;
 	hitrate.hr_100.nmax = 100;
@@ -245,8 +245,10 @@ static void
 sample_points(void)
 {
 	struct pt *pt;
-	uint64_t v;
+	uint64_t v, up = 0;
 
+	if (main_uptime != NULL)
+		up = VSC_Value(main_uptime);
 	VTAILQ_FOREACH(pt, &ptlist, list) {
 		AN(pt->vpt);
 		AN(pt->vpt->ptr);
@@ -272,8 +274,8 @@ sample_points(void)
 			update_ma(&pt->ma_100, (int64_t)pt->cur);
 			update_ma(&pt->ma_1000, (int64_t)pt->cur);
 		} else if (pt->vpt->semantics == 'c') {
-			if (main_uptime != NULL && *main_uptime)
-				pt->avg = pt->cur / (double)*main_uptime;
+			if (up)
+				pt->avg = pt->cur / (double)up;
 			else
 				pt->avg = 0.;
 			if (pt->t_last) {
@@ -294,8 +296,8 @@ sample_hitrate(void)
 	if (main_cache_hit == NULL)
 		return;
 
-	hit = *main_cache_hit;
-	miss = *main_cache_miss;
+	hit = VSC_Value(main_cache_hit);
+	miss = VSC_Value(main_cache_miss);
 	hr = hit - hitrate.lhit;
 	mr = miss - hitrate.lmiss;
 	hitrate.lhit = hit;
@@ -437,9 +439,9 @@ draw_status(void)
 	werase(w_status);
 
 	if (mgt_uptime != NULL)
-		up_mgt = *mgt_uptime;
+		up_mgt = VSC_Value(mgt_uptime);
 	if (main_uptime != NULL)
-		up_chld = *main_uptime;
+		up_chld = VSC_Value(main_uptime);
 
 	mvwprintw(w_status, 0, 0, "Uptime mgt:   ");
 	running(w_status, up_mgt, VSM_MGT_RUNNING);
@@ -1113,13 +1115,13 @@ newpt(void *priv, const struct VSC_point *const vpt)
 	AZ(strcmp(vpt->ctype, "uint64_t"));
 
 	if (!strcmp(vpt->name, "MGT.uptime"))
-		mgt_uptime = vpt->ptr;
+		mgt_uptime = vpt;
 	if (!strcmp(vpt->name, "MAIN.uptime"))
-		main_uptime = vpt->ptr;
+		main_uptime = vpt;
 	if (!strcmp(vpt->name, "MAIN.cache_hit"))
-		main_cache_hit = vpt->ptr;
+		main_cache_hit = vpt;
 	if (!strcmp(vpt->name, "MAIN.cache_miss"))
-		main_cache_miss = vpt->ptr;
+		main_cache_miss = vpt;
 	return (pt);
 }
 
@@ -1134,13 +1136,13 @@ delpt(void *priv, const struct VSC_point *const vpt)
 	VTAILQ_REMOVE(&ptlist, pt, list);
 	n_ptlist--;
 	FREE_OBJ(pt);
-	if (vpt->ptr == mgt_uptime)
+	if (vpt == mgt_uptime)
 		mgt_uptime = NULL;
-	if (vpt->ptr == main_uptime)
+	if (vpt == main_uptime)
 		main_uptime = NULL;
-	if (vpt->ptr == main_cache_hit)
+	if (vpt == main_cache_hit)
 		main_cache_hit = NULL;
-	if (vpt->ptr == main_cache_miss)
+	if (vpt == main_cache_miss)
 		main_cache_miss = NULL;
 }
 
@@ -314,6 +314,7 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	const struct hpk_txt *t;
 	uint32_t num;
 	int must_index = 0;
+	enum hpk_result ret;
 	assert(iter);
 	assert(iter->buf < iter->end);
 	/* Indexed Header Field */
@@ -363,9 +364,15 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	/* Dynamic Table Size Update */
 	/* XXX if under max allowed value */
 	else if (*iter->buf >> 5 == 1) {
-		if (hpk_done != num_decode(&num, iter, 5))
+		ret = num_decode(&num, iter, 5);
+		if (ret == hpk_err)
+			return (hpk_err);
+		if (HPK_ResizeTbl(iter->ctx, num) != hpk_done)
 			return (hpk_err);
-		return (HPK_ResizeTbl(iter->ctx, num));
+		if (ret == hpk_done)
+			return (hpk_done);
+		/* Updates precede the first field of the block */
+		return (HPK_DecHdr(iter, header));
 	} else {
 		return (hpk_err);
 	}
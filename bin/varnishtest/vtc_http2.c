@@ -83,6 +83,10 @@ enum h2_type_e {
 	TYPE_MAX
 };
 
+/* The frame types are not contiguous, there are gaps in h2_types[] */
+#define H2_TYPE_NAME(t) \
+	((t) < TYPE_MAX && h2_types[t] != NULL ? h2_types[t] : "?")
+
 //lint -save -e849	Same enum value
 enum {
 	ACK = 0x1,
@@ -338,7 +342,7 @@ write_frame(struct stream *sp, const struct frame *f, const unsigned lock)
 	vtc_log(sp->vl, 3,
 	    "tx: stream: %d, type: %s (%d), flags: 0x%02x, size: %d",
 	    f->stid,
-	    f->type < TYPE_MAX ? h2_types[f->type] : "?",
+	    H2_TYPE_NAME(f->type),
 	    f->type, f->flags, f->size);
 
 	if (f->type == TYPE_DATA) {
@@ -759,7 +763,7 @@ receive_frame(void *priv)
 		vtc_log(hp->vl, 3, "rx: stream: %d, type: %s (%d), "
 				"flags: 0x%02x, size: %d",
 				f->stid,
-				f->type < TYPE_MAX ? h2_types[f->type] : "?",
+				H2_TYPE_NAME(f->type),
 				f->type, f->flags, f->size);
 		explain_flags(f->flags, f->type, hp->vl);
 
@@ -2154,8 +2158,8 @@ rxstuff(struct stream *s)
 		vtc_fatal(vl, "Frame #%d for %s was of type %s (%d) " \
 		    "instead of %s (%d)", \
 		    rcv, func, \
-		    rt < TYPE_MAX ? h2_types[rt] : "?", rt, \
-		    wt < TYPE_MAX ? h2_types[wt] : "?", wt); \
+		    H2_TYPE_NAME(rt), rt, \
+		    H2_TYPE_NAME(wt), wt); \
 	} while (0);
 
 /* SECTION: stream.spec.data_11 rxhdrs
@@ -2458,8 +2462,7 @@ cmd_rxsettings(CMD_ARGS)
 		if (s->frame != NULL && s->frame->type != TYPE_ ## upctype) \
 			vtc_fatal(vl, \
 			    "Wrong frame type %s (%d) wanted %s", \
-			    s->frame->type < TYPE_MAX ? \
-			    h2_types[s->frame->type] : "?", \
+			    H2_TYPE_NAME(s->frame->type), \
 			    s->frame->type, #upctype); \
 	}
 
@@ -443,6 +443,16 @@ CLI_CMD(STORAGE_LIST,
 	0, 0
 )
 
+CLI_CMD(LOCK_PROFILE,
+	"lock.profile",
+	"lock.profile [-j]",
+	"Show the lock contention profile.",
+	"  Summarizes the lock operations sampled per lock class, see\n"
+	"  the lck_profile_rate parameter.\n\n"
+	"  ``-j`` specifies JSON output.",
+	0, 0
+)
+
 CLI_CMD(PID,
 	"pid",
 	"pid [-j]",
@@ -96,6 +96,21 @@ FEATURE_BIT(VCL_REQ_RESET,			vcl_req_reset,
     "When this happens MAIN.req_reset is incremented."
 )
 
+FEATURE_BIT(WIRE_HEADERS,		wire_headers,
+    "Store a pre-serialized HTTP/1 copy of the response headers with "
+    "new objects. Headers left untouched by VCL are then delivered "
+    "from it in a single write instead of one per header."
+)
+
+FEATURE_BIT(FAST_HIT,			fast_hit,
+    "Answer repeated HTTP/1 GET requests for small, fully fetched hits "
+    "from the waiter, without a worker. Requests are only answered "
+    "this way if they carry no cookie, authorization, range, "
+    "conditional or body headers and the hash of their object was the "
+    "default one, but vcl_recv, vcl_hit and vcl_deliver are not run "
+    "for them and they are not logged."
+)
+
 #undef FEATURE_BIT
 
 /*lint -restore */
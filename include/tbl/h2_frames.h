@@ -132,6 +132,15 @@
 	0x04,				// rfc7540,l,2753,2754
 	0
   )
+  H2_FRAME(priority_update,	PRIORITY_UPDATE,0x10, 0x00,
+	0,
+	H2CE_PROTOCOL_ERROR,		// RFC9218 7.1
+	H2CE_PROTOCOL_ERROR,
+	0,
+	0,
+	0,
+	1
+  )
   #undef H2_FRAME
 #endif
 
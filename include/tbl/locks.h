@@ -32,10 +32,12 @@
 /*lint -save -e525 -e539 */
 
 LOCK(ban)
+LOCK(bgfetch)
 LOCK(busyobj)
 LOCK(cli)
 LOCK(director)
 LOCK(exp)
+LOCK(fasthit)
 LOCK(hcb)
 LOCK(lru)
 LOCK(mempool)
@@ -45,13 +47,15 @@ LOCK(pipestat)
 LOCK(probe)
 LOCK(sess)
 LOCK(conn_pool)
+LOCK(conn_pool_shard)
+LOCK(backend_h2)
+LOCK(backend_h2_tx)
 LOCK(vbe)
 LOCK(vcapace)
 LOCK(vcl)
 LOCK(vxid)
 LOCK(waiter)
 LOCK(wq)
-LOCK(wstat)
 #undef LOCK
 
 /*lint -restore */
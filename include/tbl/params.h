@@ -345,13 +345,73 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	backend_probe_threads,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"2",
+	/* units */	"threads",
+	/* descr */
+	"Number of threads running backend health probes.  Each of them "
+	"polls the connections of all the probes it has in progress, so "
+	"probes do not use worker threads.",
+	/* flags */	MUST_RESTART | EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	backend_hedge_percentile,
+	/* type */	double,
+	/* min */	"0",
+	/* max */	"99.9",
+	/* def */	"0",
+	/* units */	NULL,
+	/* descr */
+	"Percentile of the recent response times of a backend after which "
+	"a fetch for a cacheable GET request without a body is sent a "
+	"second time, to whichever backend the director picks then. The "
+	"first response is used and the other connection is closed.\n\n"
+	"The default of 0 (zero) disables hedged requests. A percentile "
+	"of 95 sends a second request for about one in twenty fetches.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	bgfetch_max,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"fetches",
+	/* descr */
+	"How many background fetches may run at the same time. Background "
+	"fetches beyond this wait in a queue, the ones for the objects "
+	"with the most hits first, and the clients are served the stale "
+	"object meanwhile.\n\n"
+	"The default of 0 (zero) does not limit background fetches.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	bgfetch_queue_max,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"1000",
+	/* units */	"fetches",
+	/* descr */
+	"How many background fetches may wait for one of the bgfetch_max "
+	"slots. Background fetches beyond this fail, which leaves the "
+	"stale object in cache for a later grace hit to try again.",
+	/* flags */	EXPERIMENTAL
+)
 
 PARAM_SIMPLE(
 	/* name */	cli_limit,
 	/* type */	bytes_u,
 	/* min */	"128b",
 	/* max */	"99999999b",
-	/* def */	"64k",
+	/* def */	"96k",
 	/* units */	"bytes",
 	/* descr */
 	"Maximum size of CLI response.  If the response exceeds this "
@@ -693,6 +753,23 @@ PARAM_SIMPLE(
 	/* flags */	DELAYED_EFFECT
 )
 
+PARAM_SIMPLE(
+	/* name */	lck_profile_rate,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"operations",
+	/* descr */
+	"Lock profiling sample rate.\n"
+	"One in this many lock operations of each lock class is sampled: "
+	"whether it had to wait for the lock, how long, and how long the "
+	"lock was then held are added to the LCK.*.prof_* counters, which "
+	"the lock.profile CLI command summarizes.\n"
+	"Zero disables lock profiling.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	listen_depth,
 	/* type */	uint,
@@ -855,6 +932,53 @@ PARAM_SIMPLE(
 	"IPv4 and IPv6 addresses."
 )
 
+PARAM_SIMPLE(
+	/* name */	refresh_ahead,
+	/* type */	double,
+	/* min */	"0",
+	/* max */	"1",
+	/* def */	"0",
+	/* units */	NULL,
+	/* descr */
+	"Fraction of the TTL of an object, counted back from its expiry, "
+	"within which a hit starts a background fetch to refresh it, so "
+	"that it is replaced before it goes stale. With 0.1, an object "
+	"with a TTL of 10 minutes is refreshed by a hit in its last "
+	"minute.\n\n"
+	"Only objects with refresh_ahead_hits hits qualify, each object is "
+	"refreshed at most once, and at most refresh_ahead_max refreshes "
+	"run at the same time.\n\n"
+	"The default of 0 (zero) disables refresh-ahead.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	refresh_ahead_hits,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* def */	"10",
+	/* units */	"hits",
+	/* descr */
+	"How many hits an object needs to be refreshed ahead of its "
+	"expiry, see refresh_ahead.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	refresh_ahead_max,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* def */	"10",
+	/* units */	"fetches",
+	/* descr */
+	"How many refresh-ahead fetches may run at the same time. Hits "
+	"beyond this do not start one, a later hit on the object still "
+	"can.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	rush_exponent,
 	/* type */	uint,
@@ -1258,6 +1382,59 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	h2_rx_window_max,
+	/* type */	bytes_u,
+	/* min */	"0b",
+	/* max */	"1G",
+	/* def */	"0b",
+	/* units */	"bytes",
+	/* descr */
+	"HTTP2 maximum auto-tuned stream receive window.\n"
+	"When non-zero, the bandwidth-delay product of request body "
+	"uploads is measured with PING frames, and the receive buffer "
+	"and flow control window of a stream grow up to this size while "
+	"the window limits the transfer rate. Zero disables auto-tuning, "
+	"the stream receive window is then h2_initial_window_size.\n"
+	"Changes take effect for new HTTP2 sessions.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	h2_rx_session_window_max,
+	/* type */	bytes_u,
+	/* min */	"64k",
+	/* max */	"1G",
+	/* def */	"32M",
+	/* units */	"bytes",
+	/* descr */
+	"HTTP2 maximum auto-tuned session receive window.\n"
+	"Limits the receive window auto-tuning enabled by h2_rx_window_max "
+	"per HTTP2 session: streams stop growing their receive buffers "
+	"once the buffers of all streams of the session add up to this "
+	"size.\n"
+	"Changes take effect for new HTTP2 sessions.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	h2_tx_coalesce,
+	/* type */	bytes_u,
+	/* min */	"0b",
+	/* max */	"1M",
+	/* def */	"32k",
+	/* units */	"bytes",
+	/* descr */
+	"HTTP2 transmit coalescing buffer size.\n"
+	"Frames queued by the streams of an HTTP2 session are collected "
+	"in a buffer of this size and written in a single system call "
+	"when the last waiting stream releases the connection. The buffer "
+	"is allocated when first needed. Zero disables coalescing, every "
+	"frame is then written on its own.\n"
+	"Changes take effect for new HTTP2 sessions.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	h2_window_timeout,
 	/* type */	timeout,
@@ -1272,6 +1449,23 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	h2_encoder_table_size,
+	/* type */	bytes_u,
+	/* min */	"0b",
+	/* max */	NULL,
+	/* def */	"4k",
+	/* units */	"bytes",
+	/* descr */
+	"HTTP2 HPACK encoder table size.\n"
+	"The maximum size of the HPACK dynamic table used to compress "
+	"response headers, further limited by the SETTINGS_HEADER_TABLE_SIZE "
+	"announced by the client. Zero disables indexing of response "
+	"headers, leaving only Huffman coding and the static table.\n"
+	"Changes take effect for new HTTP2 sessions.",
+	/* flags */	EXPERIMENTAL
+)
+
 #define H2_SETTING_NAME(nm) "SETTINGS_" #nm
 #define H2_SETTING_DESCR(nm)						\
 	"\n\nThe value of this parameter defines " H2_SETTING_NAME(nm)	\
@@ -1647,9 +1841,11 @@ PARAM_THREAD(
 	/* def */	"10",
 	/* units */	"requests",
 	/* descr */
-	"Worker threads accumulate statistics, and dump these into "
-	"the global stats counters if the lock is free when they "
-	"finish a job (request/fetch etc.)\n"
+	"Worker threads count into a shard of the global stats "
+	"counters of their own.  Threads left without one, when there "
+	"are more than the thread pools can have, accumulate "
+	"statistics and dump these into the global stats counters "
+	"when they finish a job (request/fetch etc.) and go idle.\n"
 	"This parameters defines the maximum number of jobs "
 	"a worker thread may handle, before it is forced to dump "
 	"its accumulated stats into the global counters.",
@@ -1673,6 +1869,95 @@ PARAM_THREAD(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_THREAD(
+	/* name */	thread_pool_steal,
+	/* field */	steal,
+	/* type */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"threads",
+	/* descr */
+	"Work stealing between thread pools.\n"
+	"\n"
+	"When a task has to be queued because a pool has no idle "
+	"thread, an idle thread of another pool is asked to take it "
+	"from the queue. This limits the number of such steal requests "
+	"in progress for one pool at any time, which bounds the rate "
+	"at which other pools are disturbed.\n"
+	"\n"
+	"Zero disables work stealing.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_affinity,
+	/* field */	affinity,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Pin thread pools to CPUs.\n"
+	"\n"
+	"When enabled, each new thread pool is pinned to a share of the "
+	"CPUs varnishd may run on: to one NUMA node, or to a subset of "
+	"the CPUs if there is only one node. Its herder, worker threads "
+	"and memory pools run there, so sessions, workspaces and "
+	"storage allocated by its workers stay local to the node. Work "
+	"stealing prefers pools on the same node.\n"
+	"\n"
+	"Only has an effect on Linux, "
+	"and on pools created after the change.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_waiters,
+	/* field */	waiters,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"threads",
+	/* descr */
+	"Number of waiter threads per thread pool.\n"
+	"\n"
+	"The idle sessions of a pool are spread over this many waiter "
+	"instances by file descriptor, each with its own thread, "
+	"kernel event queue and timeout heap. Raise this when a "
+	"single waiter thread cannot keep up with the events and "
+	"timeouts of the idle connections of a pool.\n"
+	"\n"
+	"Only has an effect on pools created after the change.",
+	/* flags */	EXPERIMENTAL | DELAYED_EFFECT
+)
+
+PARAM_THREAD(
+	/* name */	thread_pool_queue_target,
+	/* field */	queue_target,
+	/* type */	duration,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"seconds",
+	/* descr */
+	"Target for the time tasks wait in the queue of a pool.\n"
+	"\n"
+	"When set, the pool herder watches how long tasks wait for a "
+	"thread and how fast they arrive. Once the oldest queued task, "
+	"or the average wait, reaches this target, threads are created "
+	"in a batch large enough to drain the queue and absorb the "
+	"arrivals expected within the target, without waiting "
+	"thread_pool_add_delay in between. Below the target, no new "
+	"thread is created for queued tasks.\n"
+	"\n"
+	"Zero keeps creating one thread at a time for as long as "
+	"tasks are queued.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_THREAD(
 	/* name */	thread_pool_stack,
 	/* field */	stacksize,
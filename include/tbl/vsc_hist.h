@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The buckets of the histograms in the VSC counters, see the
+ * varnish_vsc_hist directive of lib/libvsc/vsctool.py, which reads
+ * this file too.  A value falls into the first bucket whose bound it
+ * does not exceed, or into the "inf" bucket after the last one.
+ *
+ * VSC_HIST(t, b, v)
+ *    t - Counter suffix for times
+ *    b - Counter suffix for sizes
+ *    v - Upper bound, in seconds or megabytes
+ */
+
+/*lint -save -e525 -e539 */
+
+VSC_HIST(100us,	100B,	1e-4)
+VSC_HIST(200us,	200B,	2e-4)
+VSC_HIST(500us,	500B,	5e-4)
+VSC_HIST(1ms,	1kB,	1e-3)
+VSC_HIST(2ms,	2kB,	2e-3)
+VSC_HIST(5ms,	5kB,	5e-3)
+VSC_HIST(10ms,	10kB,	1e-2)
+VSC_HIST(20ms,	20kB,	2e-2)
+VSC_HIST(50ms,	50kB,	5e-2)
+VSC_HIST(100ms,	100kB,	1e-1)
+VSC_HIST(200ms,	200kB,	2e-1)
+VSC_HIST(500ms,	500kB,	5e-1)
+VSC_HIST(1s,	1MB,	1e0)
+VSC_HIST(2s,	2MB,	2e0)
+VSC_HIST(5s,	5MB,	5e0)
+VSC_HIST(10s,	10MB,	1e1)
+VSC_HIST(20s,	20MB,	2e1)
+VSC_HIST(50s,	50MB,	5e1)
+#undef VSC_HIST
+
+/*lint -restore */
@@ -49,7 +49,7 @@ struct VSC_level_desc {
 };
 
 struct VSC_point {
-	const volatile uint64_t *ptr;	/* field value			*/
+	const volatile uint64_t *ptr;	/* field value, see VSC_Value()	*/
 	const char *name;		/* field name			*/
 	const char *ctype;		/* C-type			*/
 	int semantics;			/* semantics
@@ -166,15 +166,15 @@ unsigned VSC_IsRaw(const struct vsc *);
 	 * Returns zero if gauges are adjusted by VSC_Value().
 	 */
 
-static inline uint64_t
-VSC_Value(const struct VSC_point * const pt)
-{
-	uint64_t val;
-
-	val = *pt->ptr;
-	if (!pt->raw && pt->semantics == 'g' && val > INT64_MAX)
-		val = 0;
-	return (val);
-}
+uint64_t VSC_Value(const struct VSC_point * const pt);
+	/*
+	 * Return the value of a point handed out by VSC_Iter() or to
+	 * the VSC_new_f function.
+	 *
+	 * Some counters are summed over per-thread shards, for those
+	 * *pt->ptr is only part of the value.
+	 *
+	 * Gauges are adjusted unless pt->raw is set, see VSC_IsRaw().
+	 */
 
 #endif /* VAPI_VSC_H_INCLUDED */
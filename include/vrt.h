@@ -58,6 +58,11 @@
  * binary/load-time compatible, increment MAJOR version
  *
  * NEXT (2025-03-15)
+ *	VRT_BackendLoad() added
+ *	struct vrt_backend.min_connections added
+ *	struct vrt_backend.min_idle added
+ *	struct vrt_backend.max_idle added
+ *	struct vrt_backend.http2_streams added
  * 20.1 (2024-11-08 7.6.1)
  *	VDI_EVENT_SICK added to enum vcl_event_e
  * 20.0 (2024-09-13)
@@ -601,8 +606,12 @@ struct vrt_endpoint {
 	vtim_dur			between_bytes_timeout;	\
 	vtim_dur			backend_wait_timeout;	\
 	unsigned			max_connections;	\
+	unsigned			min_connections;	\
 	unsigned			proxy_header;		\
-	unsigned			backend_wait_limit;
+	unsigned			backend_wait_limit;	\
+	unsigned			min_idle;		\
+	unsigned			max_idle;		\
+	unsigned			http2_streams;
 
 #define VRT_BACKEND_INIT(be)					\
 	do {							\
@@ -623,8 +632,12 @@ struct vrt_endpoint {
 		DN(between_bytes_timeout);	\
 		DN(backend_wait_timeout);	\
 		DN(max_connections);		\
+		DN(min_connections);		\
 		DN(proxy_header);		\
 		DN(backend_wait_limit);		\
+		DN(min_idle);			\
+		DN(max_idle);			\
+		DN(http2_streams);		\
 	} while(0)
 
 struct vrt_backend {
@@ -669,6 +682,7 @@ VCL_BACKEND VRT_new_backend_clustered(VRT_CTX,
     struct vsmw_cluster *, const struct vrt_backend *, VCL_BACKEND);
 size_t VRT_backend_vsm_need(VRT_CTX);
 void VRT_delete_backend(VRT_CTX, VCL_BACKEND *);
+int VRT_BackendLoad(VRT_CTX, VCL_BACKEND, unsigned *, VCL_DURATION *);
 struct vrt_endpoint *VRT_Endpoint_Clone(const struct vrt_endpoint *vep);
 
 
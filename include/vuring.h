@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * A minimal io_uring ring, talking to the kernel directly.
+ *
+ * Requests are queued with the VURING_{Poll,Accept,...}() functions and
+ * made visible to the kernel by VURING_Flush(), all of which must be
+ * serialized by the caller.  VURING_Enter() submits whatever has been
+ * flushed and optionally waits for completions; it may run concurrently
+ * with queueing on another thread.  Completions are consumed by a single
+ * thread with VURING_Reap().
+ */
+
+struct vuring;
+struct sockaddr;
+
+struct vuring_cqe {
+	uint64_t		data;
+	int			res;
+	unsigned		flags;
+};
+
+struct vuring *VURING_New(unsigned entries);
+void VURING_Destroy(struct vuring **);
+void VURING_Poll(struct vuring *, int fd, unsigned events, uint64_t data);
+void VURING_PollRemove(struct vuring *, uint64_t target, uint64_t data);
+void VURING_Accept(struct vuring *, int fd, struct sockaddr *,
+    socklen_t *, uint64_t data);
+void VURING_Nop(struct vuring *, uint64_t data);
+void VURING_CancelAll(struct vuring *, uint64_t data);
+void VURING_Flush(struct vuring *);
+int VURING_Enter(struct vuring *, unsigned wait_nr, vtim_dur tmo);
+unsigned VURING_Reap(struct vuring *, struct vuring_cqe *, unsigned);
@@ -418,8 +418,8 @@ VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -445,6 +445,22 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		e = setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof val);
+#else
+		e = -1;
+		errno = ENOPROTOOPT;
+#endif
+		if (e != 0) {
+			if (errp != NULL)
+				*errp = "setsockopt(SO_REUSEPORT, 1)";
+			e = errno;
+			closefd(&sd);
+			errno = e;
+			return (-1);
+		}
+	}
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -470,6 +486,26 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+/*--------------------------------------------------------------------
+ * As VTCP_bind(), but with SO_REUSEPORT set, so that several sockets can
+ * be bound to the same address and the kernel spreads the connections
+ * over them.
+ */
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
@@ -0,0 +1,298 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * A minimal io_uring ring, without liburing.
+ *
+ * Only what the waiter and the acceptor need is here: one ring without
+ * kernel side polling, a handful of opcodes and batched completions.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vdef.h"
+#include "vas.h"
+#include "miniobj.h"
+#include "vuring.h"
+
+struct vuring {
+	unsigned		magic;
+#define VURING_MAGIC		0x3c1e7d05
+	int			fd;
+
+	void			*ring;
+	size_t			ring_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_array;
+	unsigned		sq_mask;
+	unsigned		sqe_tail;	/* Queued, maybe not flushed */
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+#define VURING_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define VURING_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/*--------------------------------------------------------------------*/
+
+struct vuring *
+VURING_New(unsigned entries)
+{
+	struct io_uring_params p;
+	struct vuring *vu;
+	char *r;
+	int fd, e;
+
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CLAMP;
+	fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0)
+		return (NULL);
+
+	/* We rely on these, all present since Linux 5.11 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_EXT_ARG)) {
+		closefd(&fd);
+		errno = ENOSYS;
+		return (NULL);
+	}
+
+	ALLOC_OBJ(vu, VURING_MAGIC);
+	AN(vu);
+	vu->fd = fd;
+	vu->ring_sz = vmax_t(size_t,
+	    p.sq_off.array + p.sq_entries * sizeof(unsigned),
+	    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+	vu->ring = mmap(NULL, vu->ring_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	vu->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	vu->sqes = mmap(NULL, vu->sqes_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (vu->ring == MAP_FAILED || vu->sqes == MAP_FAILED) {
+		e = errno;
+		VURING_Destroy(&vu);
+		errno = e;
+		return (NULL);
+	}
+
+	r = vu->ring;
+	vu->sq_head = (void *)(r + p.sq_off.head);
+	vu->sq_tail = (void *)(r + p.sq_off.tail);
+	vu->sq_array = (void *)(r + p.sq_off.array);
+	vu->sq_mask = *(unsigned *)(r + p.sq_off.ring_mask);
+	vu->sqe_tail = *vu->sq_tail;
+	vu->cq_head = (void *)(r + p.cq_off.head);
+	vu->cq_tail = (void *)(r + p.cq_off.tail);
+	vu->cq_mask = *(unsigned *)(r + p.cq_off.ring_mask);
+	vu->cqes = (void *)(r + p.cq_off.cqes);
+	return (vu);
+}
+
+void
+VURING_Destroy(struct vuring **vup)
+{
+	struct vuring *vu;
+
+	TAKE_OBJ_NOTNULL(vu, vup, VURING_MAGIC);
+	if (vu->sqes != NULL && vu->sqes != MAP_FAILED)
+		AZ(munmap(vu->sqes, vu->sqes_sz));
+	if (vu->ring != NULL && vu->ring != MAP_FAILED)
+		AZ(munmap(vu->ring, vu->ring_sz));
+	closefd(&vu->fd);
+	FREE_OBJ(vu);
+}
+
+/*--------------------------------------------------------------------
+ * Get a cleared submission entry.  Without kernel side polling the
+ * kernel consumes all flushed entries on io_uring_enter(2), so a full
+ * queue is emptied by submitting it.
+ */
+
+static struct io_uring_sqe *
+vuring_sqe(struct vuring *vu, uint8_t opcode, int fd, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	CHECK_OBJ_NOTNULL(vu, VURING_MAGIC);
+	if (vu->sqe_tail - VURING_LOAD(vu->sq_head) > vu->sq_mask) {
+		VURING_Flush(vu);
+		assert(VURING_Enter(vu, 0, 0.) > 0);
+		assert(vu->sqe_tail - VURING_LOAD(vu->sq_head) <= vu->sq_mask);
+	}
+	idx = vu->sqe_tail & vu->sq_mask;
+	sqe = &vu->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = data;
+	vu->sq_array[idx] = idx;
+	vu->sqe_tail++;
+	return (sqe);
+}
+
+void
+VURING_Poll(struct vuring *vu, int fd, unsigned events, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	assert(fd >= 0);
+	sqe = vuring_sqe(vu, IORING_OP_POLL_ADD, fd, data);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* The kernel reads this as two 16 bit halves */
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->poll32_events = events;
+}
+
+void
+VURING_PollRemove(struct vuring *vu, uint64_t target, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = vuring_sqe(vu, IORING_OP_POLL_REMOVE, -1, data);
+	sqe->addr = target;
+}
+
+void
+VURING_Accept(struct vuring *vu, int fd, struct sockaddr *sa,
+    socklen_t *salen, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	assert(fd >= 0);
+	AN(sa);
+	AN(salen);
+	sqe = vuring_sqe(vu, IORING_OP_ACCEPT, fd, data);
+	sqe->addr = (uintptr_t)sa;
+	sqe->addr2 = (uintptr_t)salen;
+}
+
+void
+VURING_Nop(struct vuring *vu, uint64_t data)
+{
+
+	(void)vuring_sqe(vu, IORING_OP_NOP, -1, data);
+}
+
+void
+VURING_CancelAll(struct vuring *vu, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = vuring_sqe(vu, IORING_OP_ASYNC_CANCEL, -1, data);
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY;
+}
+
+void
+VURING_Flush(struct vuring *vu)
+{
+
+	CHECK_OBJ_NOTNULL(vu, VURING_MAGIC);
+	VURING_STORE(vu->sq_tail, vu->sqe_tail);
+}
+
+/*--------------------------------------------------------------------
+ * Submit the flushed entries and wait for up to tmo seconds for wait_nr
+ * completions, forever if tmo is negative.  Returns the number of entries
+ * submitted, a timeout or a signal is not an error.
+ */
+
+int
+VURING_Enter(struct vuring *vu, unsigned wait_nr, vtim_dur tmo)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned n, flags = 0;
+	int i;
+
+	CHECK_OBJ_NOTNULL(vu, VURING_MAGIC);
+	n = VURING_LOAD(vu->sq_tail) - VURING_LOAD(vu->sq_head);
+	if (n == 0 && wait_nr == 0)
+		return (0);
+	if (wait_nr > 0)
+		flags |= IORING_ENTER_GETEVENTS;
+	if (wait_nr > 0 && tmo >= 0.) {
+		ts.tv_sec = (long long)tmo;
+		ts.tv_nsec = (long long)((tmo - ts.tv_sec) * 1e9);
+		memset(&arg, 0, sizeof arg);
+		arg.ts = (uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		i = (int)syscall(__NR_io_uring_enter, vu->fd, n, wait_nr,
+		    flags, &arg, sizeof arg);
+	} else {
+		i = (int)syscall(__NR_io_uring_enter, vu->fd, n, wait_nr,
+		    flags, NULL, 0);
+	}
+	if (i < 0 && (errno == ETIME || errno == EINTR))
+		i = 0;
+	return (i);
+}
+
+/*--------------------------------------------------------------------*/
+
+unsigned
+VURING_Reap(struct vuring *vu, struct vuring_cqe *cqe, unsigned n)
+{
+	const struct io_uring_cqe *c;
+	unsigned head, tail, u;
+
+	CHECK_OBJ_NOTNULL(vu, VURING_MAGIC);
+	AN(cqe);
+	head = *vu->cq_head;
+	tail = VURING_LOAD(vu->cq_tail);
+	for (u = 0; u < n && head != tail; u++, head++) {
+		c = &vu->cqes[head & vu->cq_mask];
+		cqe[u].data = c->user_data;
+		cqe[u].res = c->res;
+		cqe[u].flags = c->flags;
+	}
+	VURING_STORE(vu->cq_head, head);
+	return (u);
+}
+
+#endif /* HAVE_IO_URING */
@@ -76,6 +76,12 @@ VTAILQ_HEAD(vsc_sf_head, vsc_sf);
 struct vsc_pt {
 	struct VSC_point	point;
 	char			*name;
+
+	/* Per-thread shards of the counter, see VSC_Value() */
+	const volatile uint64_t	*shard_hdr;
+	const char		*shard;
+	size_t			shard_stride;
+	unsigned		shard_max;
 };
 
 enum vsc_seg_type {
@@ -98,6 +104,11 @@ struct vsc_seg {
 	unsigned		npoints;
 	struct vsc_pt		*points;
 
+	const volatile uint64_t	*shard_hdr;
+	const char		*shards;
+	size_t			shard_stride;
+	unsigned		shard_max;
+
 	int			mapped;
 	int			exposed;
 };
@@ -320,6 +331,50 @@ vsc_fill_point(const struct vsc *vsc, const struct vsc_seg *seg,
 
 	point->point.ptr = (volatile const void*)(seg->body + atoi(vt->value));
 	point->point.raw = vsc->raw;
+
+	vt = vjsn_child(vv, "shard");
+	if (vt == NULL || seg->shard_hdr == NULL)
+		return;
+	point->shard_hdr = seg->shard_hdr;
+	point->shard = seg->shards + atoi(vt->value);
+	point->shard_stride = seg->shard_stride;
+	point->shard_max = seg->shard_max;
+}
+
+/*--------------------------------------------------------------------
+ * Find the per-thread shards of a counter segment, which follow the
+ * counters, and how many of them fit into the segment.
+ */
+
+static void
+vsc_map_shards(struct vsc_seg *sp, const struct vjsn_val *vj)
+{
+	const struct vjsn_val *vv, *vt;
+	size_t off, stride, align, len;
+
+	vv = vjsn_child(vj, "shards");
+	if (vv == NULL)
+		return;
+	vt = vjsn_child(vv, "offset");
+	AN(vt);
+	off = strtoul(vt->value, NULL, 0);
+	vt = vjsn_child(vv, "stride");
+	AN(vt);
+	stride = strtoul(vt->value, NULL, 0);
+	vt = vjsn_child(vv, "align");
+	AN(vt);
+	align = strtoul(vt->value, NULL, 0);
+	assert(align >= 2 * sizeof(uint64_t));
+	if (stride == 0)
+		return;
+
+	len = (const char *)sp->fantom->e - sp->body;
+	if (len < off + align)
+		return;
+	sp->shard_hdr = (const volatile void *)(sp->body + off);
+	sp->shards = sp->body + off + align;
+	sp->shard_stride = stride;
+	sp->shard_max = (len - off - align) / stride;
 }
 
 static struct vsc_seg *
@@ -356,6 +411,8 @@ vsc_unmap_seg(const struct vsc *vsc, struct vsm *vsm, struct vsc_seg *sp)
 		free(sp->points);
 		sp->points = NULL;
 		sp->npoints = 0;
+		sp->shard_hdr = NULL;
+		sp->shards = NULL;
 		AZ(sp->vj);
 	} else if (sp->type == VSC_SEG_DOCS) {
 		if (sp->vj != NULL)
@@ -443,6 +500,8 @@ vsc_map_seg(const struct vsc *vsc, struct vsm *vsm, struct vsc_seg *sp)
 		return (-1);
 	}
 
+	vsc_map_shards(sp, spd->vj->value);
+
 	/* Create the VSC points list */
 	vve = vjsn_child(spd->vj->value, "elements");
 	AN(vve);
@@ -656,6 +715,34 @@ VSC_State(struct vsc *vsc, VSC_new_f *fn, VSC_destroy_f *fd, void *priv)
 	vsc->priv = priv;
 }
 
+/*--------------------------------------------------------------------
+ * The value of a counter is the sum of the counter itself and of its
+ * per-thread shards ever used by varnishd.  Gauges can go up in one
+ * shard and down in another, the unsigned sum still comes out right.
+ */
+
+uint64_t
+VSC_Value(const struct VSC_point * const pt)
+{
+	const struct vsc_pt *pp;
+	uint64_t val, n;
+	const char *p;
+
+	AN(pt);
+	pp = (const void *)pt;
+	val = *pt->ptr;
+	if (pp->shard_hdr != NULL) {
+		n = pp->shard_hdr[1];
+		n = vmin_t(uint64_t, n, pp->shard_hdr[0]);
+		n = vmin_t(uint64_t, n, pp->shard_max);
+		for (p = pp->shard; n > 0; n--, p += pp->shard_stride)
+			val += *(const volatile uint64_t *)(const void *)p;
+	}
+	if (!pt->raw && pt->semantics == 'g' && val > INT64_MAX)
+		val = 0;
+	return (val);
+}
+
 /*--------------------------------------------------------------------
  */
 
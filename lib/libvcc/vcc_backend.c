@@ -411,12 +411,16 @@ vcc_ParseHostDef(struct vcc *tl, struct symbol *sym,
 	    "?between_bytes_timeout",
 	    "?probe",
 	    "?max_connections",
+	    "?min_connections",
 	    "?proxy_header",
 	    "?preamble",
 	    "?via",
 	    "?authority",
 	    "?wait_timeout",
 	    "?wait_limit",
+	    "?min_idle",
+	    "?max_idle",
+	    "?http2_streams",
 	    NULL);
 
 	tl->fb = VSB_new_auto();
@@ -495,6 +499,11 @@ vcc_ParseHostDef(struct vcc *tl, struct symbol *sym,
 			ERRCHK(tl);
 			SkipToken(tl, ';');
 			Fb(tl, 0, "\t.max_connections = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "min_connections")) {
+			u = vcc_UintVal(tl);
+			ERRCHK(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.min_connections = %u,\n", u);
 		} else if (vcc_IdIs(t_field, "proxy_header")) {
 			t_val = tl->t;
 			u = vcc_UintVal(tl);
@@ -581,6 +590,21 @@ vcc_ParseHostDef(struct vcc *tl, struct symbol *sym,
 			ERRCHK(tl);
 			SkipToken(tl, ';');
 			Fb(tl, 0, "\t.backend_wait_limit = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "min_idle")) {
+			u = vcc_UintVal(tl);
+			ERRCHK(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.min_idle = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "max_idle")) {
+			u = vcc_UintVal(tl);
+			ERRCHK(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.max_idle = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "http2_streams")) {
+			u = vcc_UintVal(tl);
+			ERRCHK(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.http2_streams = %u,\n", u);
 		} else {
 			ErrInternal(tl);
 			VSB_destroy(&tl->fb);
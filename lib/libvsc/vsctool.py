@@ -39,6 +39,8 @@ it with this program to get a *real* `.rst` file.
 
 import getopt
 import json
+import os
+import re
 import sys
 import collections
 import codecs
@@ -58,6 +60,27 @@ PARAMS = {
     "format": FORMATS,
 }
 
+# Units of 'varnish_vsc_hist', first element is default
+HIST_UNITS = ["seconds", "bytes"]
+
+# Alignment of the shards of a counter set, see CounterSet.shard_layout()
+SHARD_ALIGN = 64
+
+def hist_buckets():
+
+    '''Read the histogram buckets from tbl/vsc_hist.h'''
+
+    d = os.path.dirname(os.path.abspath(__file__))
+    for i in (("..", "..", "include"), ("..", "..", "include", "varnish")):
+        fn = os.path.join(*((d,) + i + ("tbl", "vsc_hist.h")))
+        if os.path.exists(fn):
+            break
+    else:
+        sys.stderr.write("Cannot find tbl/vsc_hist.h\n")
+        exit(2)
+    with open(fn) as f:
+        return re.findall(r"^VSC_HIST\((\w+),\s*(\w+),", f.read(), re.M)
+
 def genhdr(fo, name):
 
     '''Emit .[ch] file boiler-plate warning'''
@@ -91,6 +114,7 @@ class CounterSet(object):
         self.struct = "struct VSC_" + name
         self.mbrs = []
         self.groups = {}
+        self.hists = []
         self.head = m
         self.completed = False
         self.off = 0
@@ -114,6 +138,29 @@ class CounterSet(object):
         self.completed = True
         self.gnames = list(self.groups.keys())
         self.gnames.sort()
+        g = self.head.param.get('shards')
+        if g is not None and g not in self.groups:
+            sys.stderr.write("Unknown shards group '" + g + "'\n")
+            exit(2)
+
+    def shard_layout(self):
+        '''
+        The group of counters with per-thread shards, or None
+
+        The shards follow the counters, starting at the returned
+        offset with a header of two uint64_t, the number of shards
+        and the number of shards ever used.  The shards themselves
+        are copies of the group struct, each on its own cache lines,
+        starting SHARD_ALIGN bytes after the header.  Readers sum
+        a counter of the group over the shards ever used and the
+        counter itself.
+        '''
+        g = self.head.param.get('shards')
+        if g is None:
+            return None
+        off = -(-self.off // SHARD_ALIGN) * SHARD_ALIGN
+        stride = -(-8 * len(self.groups[g]) // SHARD_ALIGN) * SHARD_ALIGN
+        return (g, off, stride)
 
 
     def emit_json(self, fo):
@@ -126,6 +173,13 @@ class CounterSet(object):
         dd["order"] = int(self.head.param["order"])
         dd["docs"] = "\n".join(self.head.getdoc())
         dd["elements"] = len(self.mbrs)
+        sl = self.shard_layout()
+        if sl is not None:
+            sd = collections.OrderedDict()
+            sd["offset"] = sl[1]
+            sd["stride"] = sl[2]
+            sd["align"] = SHARD_ALIGN
+            dd["shards"] = sd
         el = collections.OrderedDict()
         dd["elem"] = el
         for i in self.mbrs:
@@ -135,6 +189,8 @@ class CounterSet(object):
                 if j in i.param:
                     ed[j] = i.param[j]
             ed["index"] = i.param["index"]
+            if sl is not None and i.param.get("group") == sl[0]:
+                ed["shard"] = 8 * self.groups[sl[0]].index(i)
             ed["name"] = i.arg
             ed["docs"] = "\n".join(i.getdoc())
         s = json.dumps(dd, separators=(",", ":")) + "\0"
@@ -192,16 +248,31 @@ class CounterSet(object):
             fo.write("};\n")
             fo.write("\n")
 
+        for i, j in self.hists:
+            fo.write("#define VSC_%s_hist_%s(p, u)\t\t\t\t\\\n" %
+                     (self.name, i))
+            fo.write("\t((uint64_t *)(void *)((char *)&(p)->%s +\t\\\n" % j)
+            fo.write("\t    (u) * sizeof(uint64_t)))\n")
+            fo.write("\n")
+
         fo.write("#define VSC_" + self.name +
                  "_size PRNDUP(sizeof(" + self.struct + "))\n\n")
 
+        sl = self.shard_layout()
+        if sl is not None:
+            self.emit_h_shards(fo, sl)
+
         fo.write("struct vsmw_cluster;\n");
         fo.write("struct vsc_seg;\n");
         fo.write("\n");
 
         fo.write(self.struct + " *VSC_" + self.name + "_New")
         fo.write("(struct vsmw_cluster *,\n")
-        fo.write("    struct vsc_seg **, const char *fmt, ...);\n")
+        if sl is not None:
+            fo.write("    struct vsc_seg **, unsigned nshard, "
+                     "const char *fmt, ...);\n")
+        else:
+            fo.write("    struct vsc_seg **, const char *fmt, ...);\n")
 
         fo.write("void VSC_" + self.name + "_Destroy")
         fo.write("(struct vsc_seg **);\n")
@@ -220,6 +291,33 @@ class CounterSet(object):
                     fo.write("(" + self.struct + "_" + j[0] + " *, ")
                     fo.write("const " + self.struct + "_" + j[1] + " *);\n")
 
+        if sl is not None:
+            fo.write("void VSC_" + self.name + "_Add_" + sl[0])
+            fo.write("(" + self.struct + " *, ")
+            fo.write("const " + self.struct + "_" + sl[0] + " *);\n")
+
+    def emit_h_shards(self, fo, sl):
+        '''Emit the layout of the shards'''
+        pfx = "VSC_" + self.name + "_shard"
+        fo.write(self.struct + "_shards {\n")
+        fo.write("\tuint64_t\tn;\n")
+        fo.write("\tuint64_t\thwm;\n")
+        fo.write("};\n")
+        fo.write("\n")
+        fo.write("#define %ss_off\t%d\n" % (pfx, sl[1]))
+        fo.write("#define %s_stride\t%d\n" % (pfx, sl[2]))
+        fo.write("#define %ss_size(n)\t\t\t\t\t\\\n" % pfx)
+        fo.write("\t(%ss_off + %d + (n) * %s_stride)\n" %
+                 (pfx, SHARD_ALIGN, pfx))
+        fo.write("#define %ss(p)\t\t\t\t\t\t\\\n" % pfx)
+        fo.write("\t((%s_shards *)(void *)((char *)(p) + %ss_off))\n" %
+                 (self.struct, pfx))
+        fo.write("#define %s(p, u)\t\t\t\t\t\\\n" % pfx)
+        fo.write("\t((%s_%s *)(void *)((char *)(p) +\t\\\n" %
+                 (self.struct, sl[0]))
+        fo.write("\t    %ss_size(u)))\n" % pfx)
+        fo.write("\n")
+
     def emit_c_paranoia(self, fo):
         '''Emit asserts to make sure compiler gets same byte index'''
         fo.write("#define PARANOIA(a,n)\t\t\t\t\\\n")
@@ -233,6 +331,16 @@ class CounterSet(object):
 
         fo.write("#undef PARANOIA\n")
 
+        sl = self.shard_layout()
+        if sl is not None:
+            fo.write("\nv_static_assert(sizeof(" + self.struct + ") <=\n")
+            fo.write("    VSC_" + self.name + "_shards_off,\n")
+            fo.write("    \"VSC shards overlap the counters\");\n")
+            fo.write("v_static_assert(sizeof(" + self.struct + "_" +
+                     sl[0] + ") <=\n")
+            fo.write("    VSC_" + self.name + "_shard_stride,\n")
+            fo.write("    \"VSC shards overlap each other\");\n")
+
     def emit_c_sumfunc(self, fo, tgt):
         '''Emit a function summ up countersets'''
         fo.write("\n")
@@ -258,24 +366,63 @@ class CounterSet(object):
                 fo.write(s1 + "\n\t    " + s2 + "\n")
         fo.write("}\n")
 
+    def emit_c_addfunc(self, fo, tgt):
+        '''Emit a function to add a group to the counters atomically'''
+        fo.write("\n")
+        fo.write("void\n")
+        fo.write("VSC_" + self.name + "_Add_" + tgt)
+        fo.write("(" + self.struct + " *dst, ")
+        fo.write("const " + self.struct + "_" + tgt + " *src)\n")
+        fo.write("{\n")
+        fo.write("\n")
+        fo.write("\tAN(dst);\n")
+        fo.write("\tAN(src);\n")
+        for i in self.groups[tgt]:
+            fo.write("\tif (src->" + i.arg + " != 0)\n")
+            s1 = "\t\t(void)__atomic_fetch_add(&dst->" + i.arg + ","
+            s2 = "src->" + i.arg + ", __ATOMIC_RELAXED);"
+            if len((s1 + " " + s2).expandtabs()) < 79:
+                fo.write(s1 + " " + s2 + "\n")
+            else:
+                fo.write(s1 + "\n\t\t    " + s2 + "\n")
+        fo.write("}\n")
+
     def emit_c_newfunc(self, fo):
         '''Emit New function'''
+        sl = self.shard_layout()
         fo.write("\n")
         fo.write(self.struct + "*\n")
         fo.write("VSC_" + self.name + "_New")
         fo.write("(struct vsmw_cluster *vc,\n")
-        fo.write("    struct vsc_seg **sg, const char *fmt, ...)\n")
+        if sl is not None:
+            fo.write("    struct vsc_seg **sg, unsigned nshard, "
+                     "const char *fmt, ...)\n")
+        else:
+            fo.write("    struct vsc_seg **sg, const char *fmt, ...)\n")
         fo.write("{\n")
         fo.write("\tva_list ap;\n")
         fo.write("\t" + self.struct + " *retval;\n")
+        if sl is not None:
+            fo.write("\tsize_t sz = VSC_" + self.name + "_size;\n")
+            fo.write("\n")
+            fo.write("\tif (nshard > 0)\n")
+            fo.write("\t\tsz = VSC_" + self.name +
+                     "_shards_size(nshard);\n")
         fo.write("\n")
         fo.write("\tva_start(ap, fmt);\n")
         fo.write("\tretval = VRT_VSC_Alloc")
         fo.write("(vc, sg, vsc_" + self.name + "_name, ")
-        fo.write("VSC_" + self.name + "_size,\n")
+        if sl is not None:
+            fo.write("sz,\n")
+        else:
+            fo.write("VSC_" + self.name + "_size,\n")
         fo.write("\t    vsc_" + self.name + "_json, ")
         fo.write("sizeof vsc_" + self.name + "_json, fmt, ap);\n")
         fo.write("\tva_end(ap);\n")
+        if sl is not None:
+            fo.write("\tif (retval != NULL)\n")
+            fo.write("\t\tVSC_" + self.name +
+                     "_shards(retval)->n = nshard;\n")
         fo.write("\treturn(retval);\n")
         fo.write("}\n")
 
@@ -327,6 +474,9 @@ class CounterSet(object):
         if sf is not None:
             for i in sf.split():
                 self.emit_c_sumfunc(fo, i.split("_"))
+        sl = self.shard_layout()
+        if sl is not None:
+            self.emit_c_addfunc(fo, sl[0])
 
 #######################################################################
 
@@ -424,6 +574,40 @@ class RstVscDirective(OurDirective):
             fo.write("\t" + self.param["oneliner"] + "\n")
             fo.write("\n".join(self.ldoc))
 
+class RstVscDirectiveHist(OurDirective):
+
+    '''
+        `varnish_vsc_hist` directive - one counter per bucket of
+        tbl/vsc_hist.h, named after the argument, and one for the
+        values above the last bucket.  The `:unit:` parameter picks
+        the names of the buckets, the other parameters and the docs
+        of the first counter are those of `varnish_vsc`.
+    '''
+
+    def __init__(self, s, vsc_set, fo):
+        super(RstVscDirectiveHist, self).__init__(s)
+        unit = self.param.pop("unit", HIST_UNITS[0])
+        if unit not in HIST_UNITS:
+            sys.stderr.write("Wrong unit '" + unit)
+            sys.stderr.write("' on histogram '" + self.arg + "'\n")
+            exit(2)
+        oneliner = self.param.pop("oneliner")
+        bkt = [i[HIST_UNITS.index(unit)] for i in hist_buckets()]
+        hdr = []
+        for i, v in self.param.items():
+            hdr.append("\t:%s:\t%s" % (i, v))
+        doc = self.ldoc
+        for i, v in enumerate(bkt + ["inf"]):
+            if v != "inf":
+                ol = oneliner + " up to " + v
+            else:
+                ol = oneliner + " above " + bkt[-1]
+            t = "varnish_vsc:: %s_%s\n" % (self.arg, v)
+            t += "\n".join(hdr + ["\t:oneliner:\t" + ol] + doc)
+            RstVscDirective(t, vsc_set, fo)
+            doc = [""]
+        vsc_set[-1].hists.append((self.arg, self.arg + "_" + bkt[0]))
+
 class RstVscDirectiveEnd(OurDirective):
 
     '''
@@ -475,6 +659,7 @@ def mainfunc(argv):
         f = {
             "varnish_vsc_begin::":  RstVscDirectiveBegin,
             "varnish_vsc::":        RstVscDirective,
+            "varnish_vsc_hist::":   RstVscDirectiveHist,
             "varnish_vsc_end::":    RstVscDirectiveEnd,
         }.get(j[0])
         if f is not None:
@@ -0,0 +1,284 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+
+#include "vbm.h"
+#include "vrnd.h"
+#include "vsb.h"
+
+#include "vmod_directors.h"
+
+#include "vcc_directors_if.h"
+
+/* Response time assumed for backends without samples */
+#define VLL_EWMA_MIN	0.001
+
+struct vmod_directors_least_loaded {
+	unsigned				magic;
+#define VMOD_DIRECTORS_LEAST_LOADED_MAGIC	0x5e1a0d7b
+	struct vdir				*vd;
+};
+
+static double
+vll_score(VRT_CTX, VCL_BACKEND be, unsigned *inflight, VCL_DURATION *ewma)
+{
+
+	AN(inflight);
+	AN(ewma);
+	if (!VRT_BackendLoad(ctx, be, inflight, ewma)) {
+		/* not a backend, no idea */
+		*inflight = 0;
+		*ewma = 0;
+	}
+	return ((*inflight + 1) * vmax(*ewma, VLL_EWMA_MIN));
+}
+
+/* the n-th healthy backend */
+static unsigned
+vll_healthy_nth(const struct vdir *vd, unsigned n)
+{
+	unsigned u;
+
+	for (u = 0; u < vd->n_backend; u++) {
+		if (!vbit_test(vd->healthy, u))
+			continue;
+		if (n-- == 0)
+			return (u);
+	}
+	WRONG("healthy backend count");
+}
+
+static VCL_BOOL v_matchproto_(vdi_healthy)
+vmod_least_loaded_healthy(VRT_CTX, VCL_BACKEND dir, VCL_TIME *changed)
+{
+	struct vmod_directors_least_loaded *ll;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(ll, dir->priv, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	return (vdir_any_healthy(ctx, ll->vd, changed));
+}
+
+static void v_matchproto_(vdi_list_f)
+vmod_least_loaded_list(VRT_CTX, VCL_BACKEND dir, struct vsb *vsb, int pflag,
+    int jflag)
+{
+	struct vmod_directors_least_loaded *ll;
+	struct vdir *vd;
+	VCL_BACKEND be;
+	VCL_DURATION ewma;
+	unsigned u, inflight;
+	double score;
+	int h;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(ll, dir->priv, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vd = ll->vd;
+	CHECK_OBJ_NOTNULL(vd, VDIR_MAGIC);
+
+	if (!pflag) {
+		vdir_list(ctx, vd, vsb, pflag, jflag, 0);
+		return;
+	}
+
+	if (jflag) {
+		VSB_cat(vsb, "{\n");
+		VSB_indent(vsb, 2);
+		VSB_cat(vsb, "\"backends\": {\n");
+		VSB_indent(vsb, 2);
+	} else {
+		VSB_cat(vsb, "\n\n\tBackend\tInflight\tScore\tHealth\n");
+	}
+
+	vdir_rdlock(vd);
+	vdir_update_health(ctx, vd);
+	for (u = 0; u < vd->n_backend; u++) {
+		be = vd->backend[u];
+		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+		h = vbit_test(vd->healthy, u);
+		score = vll_score(ctx, be, &inflight, &ewma);
+
+		if (jflag) {
+			if (u)
+				VSB_cat(vsb, ",\n");
+			VSB_printf(vsb, "\"%s\": {\n", be->vcl_name);
+			VSB_indent(vsb, 2);
+			VSB_printf(vsb, "\"inflight\": %u,\n", inflight);
+			VSB_printf(vsb, "\"ewma\": %.6f,\n", ewma);
+			VSB_printf(vsb, "\"score\": %.6f,\n", score);
+			VSB_printf(vsb, "\"health\": \"%s\"\n",
+			    h ? "healthy" : "sick");
+			VSB_indent(vsb, -2);
+			VSB_cat(vsb, "}");
+		} else {
+			VSB_printf(vsb, "\t%s\t%u\t%.6f\t%s\n",
+			    be->vcl_name, inflight, score,
+			    h ? "healthy" : "sick");
+		}
+	}
+	vdir_unlock(vd);
+
+	if (jflag) {
+		VSB_cat(vsb, "\n");
+		VSB_indent(vsb, -2);
+		VSB_cat(vsb, "}\n");
+		VSB_indent(vsb, -2);
+		VSB_cat(vsb, "},\n");
+	}
+}
+
+/*
+ * Power of two choices: of two random healthy backends, take the one
+ * with the lower score
+ */
+
+static VCL_BACKEND v_matchproto_(vdi_resolve_f)
+vmod_least_loaded_resolve(VRT_CTX, VCL_BACKEND dir)
+{
+	struct vmod_directors_least_loaded *ll;
+	struct vdir *vd;
+	VCL_BACKEND be = NULL, be2;
+	VCL_DURATION ewma;
+	unsigned a, b, inflight;
+	double s;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(ll, dir->priv, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vd = ll->vd;
+
+	vdir_wrlock(vd);
+	vdir_update_health(ctx, vd);
+	if (vd->n_healthy > 0) {
+		a = VRND_RandomTestable() % vd->n_healthy;
+		be = vd->backend[vll_healthy_nth(vd, a)];
+		CHECK_OBJ_NOTNULL(be, DIRECTOR_MAGIC);
+	}
+	if (vd->n_healthy > 1) {
+		b = VRND_RandomTestable() % (vd->n_healthy - 1);
+		if (b >= a)
+			b++;
+		be2 = vd->backend[vll_healthy_nth(vd, b)];
+		CHECK_OBJ_NOTNULL(be2, DIRECTOR_MAGIC);
+		s = vll_score(ctx, be, &inflight, &ewma);
+		if (vll_score(ctx, be2, &inflight, &ewma) < s)
+			be = be2;
+	}
+	vdir_unlock(vd);
+	return (be);
+}
+
+static void v_matchproto_(vdi_release_f)
+vmod_least_loaded_release(VCL_BACKEND dir)
+{
+	struct vmod_directors_least_loaded *ll;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(ll, dir->priv, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vdir_release(ll->vd);
+}
+
+static void v_matchproto_(vdi_destroy_f)
+vmod_least_loaded_destroy(VCL_BACKEND dir)
+{
+	struct vmod_directors_least_loaded *ll;
+
+	CHECK_OBJ_NOTNULL(dir, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(ll, dir->priv, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vdir_delete(&ll->vd);
+	FREE_OBJ(ll);
+}
+
+static const struct vdi_methods vmod_least_loaded_methods[1] = {{
+	.magic =		VDI_METHODS_MAGIC,
+	.type =			"least_loaded",
+	.healthy =		vmod_least_loaded_healthy,
+	.resolve =		vmod_least_loaded_resolve,
+	.release =		vmod_least_loaded_release,
+	.destroy =		vmod_least_loaded_destroy,
+	.list =			vmod_least_loaded_list
+}};
+
+VCL_VOID v_matchproto_()
+vmod_least_loaded__init(VRT_CTX, struct vmod_directors_least_loaded **llp,
+    const char *vcl_name)
+{
+	struct vmod_directors_least_loaded *ll;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	AN(llp);
+	AZ(*llp);
+	ALLOC_OBJ(ll, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	AN(ll);
+	*llp = ll;
+	vdir_new(ctx, &ll->vd, vcl_name, vmod_least_loaded_methods, ll);
+}
+
+VCL_VOID v_matchproto_()
+vmod_least_loaded__fini(struct vmod_directors_least_loaded **llp)
+{
+	struct vmod_directors_least_loaded *ll;
+
+	TAKE_OBJ_NOTNULL(ll, llp, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	VRT_DelDirector(&ll->vd->dir);
+}
+
+VCL_VOID v_matchproto_()
+vmod_least_loaded_add_backend(VRT_CTX,
+    struct vmod_directors_least_loaded *ll, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ll, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vdir_add_backend(ctx, ll->vd, be, 1.0);
+}
+
+VCL_VOID v_matchproto_()
+vmod_least_loaded_remove_backend(VRT_CTX,
+    struct vmod_directors_least_loaded *ll, VCL_BACKEND be)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ll, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	vdir_remove_backend(ctx, ll->vd, be, NULL);
+}
+
+VCL_BACKEND v_matchproto_()
+vmod_least_loaded_backend(VRT_CTX, struct vmod_directors_least_loaded *ll)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ll, VMOD_DIRECTORS_LEAST_LOADED_MAGIC);
+	return (ll->vd->dir);
+}
@@ -296,6 +296,20 @@ vmod_shard_set_rampup(VRT_CTX, struct vmod_directors_shard *vshard,
 	shardcfg_set_rampup(vshard->shardd, duration);
 }
 
+VCL_VOID v_matchproto_(td_directors_shard_set_maglev)
+vmod_shard_set_maglev(VRT_CTX, struct vmod_directors_shard *vshard,
+    VCL_INT size)
+{
+	CHECK_OBJ_NOTNULL(vshard, VMOD_SHARD_SHARD_MAGIC);
+	if (size < 0 || size >= SHARD_MAGLEV_MAX ||
+	    (size > 0 && !shard_maglev_prime((uint32_t)size))) {
+		shard_notice(ctx->vsl, vshard->shardd->name,
+		    ".set_maglev(%ld) ignored", size);
+		return;
+	}
+	shardcfg_set_maglev(ctx->vsl, vshard->shardd, (uint32_t)size);
+}
+
 VCL_VOID v_matchproto_(td_directors_shard_associate)
 vmod_shard_associate(VRT_CTX,
     struct vmod_directors_shard *vshard, VCL_BLOB b)
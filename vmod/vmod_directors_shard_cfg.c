@@ -316,6 +316,55 @@ shardcfg_hashcircle(struct sharddir *shardd)
 		    shardd->hashcircle[i].host);
 }
 
+/*
+ * ============================================================
+ * maglev table init
+ */
+
+static void
+shardcfg_maglev(struct vsl_log *vsl, struct sharddir *shardd)
+{
+	struct shard_maglev_perm *perm;
+	const struct shard_backend *b;
+	const char *ident;
+	uint32_t size;
+	unsigned h;
+
+	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
+
+	if (shardd->maglev)
+		free(shardd->maglev);
+	shardd->maglev = NULL;
+
+	size = shardd->maglev_size;
+	if (size == 0 || shardd->n_backend == 0)
+		return;
+	if (size < shardd->n_backend) {
+		shard_err(vsl, shardd->name,
+		    "maglev table size %u below %u backends, using the ring",
+		    size, shardd->n_backend);
+		return;
+	}
+
+	perm = calloc(shardd->n_backend, sizeof *perm);
+	AN(perm);
+	for (h = 0, b = shardd->backend; h < shardd->n_backend; h++, b++) {
+		ident = b->ident ? b->ident : VRT_BACKEND_string(b->backend);
+		AN(ident);
+		perm[h].offset =
+		    VRT_HashStrands32(TOSTRANDS(2, ident, "offset")) % size;
+		perm[h].skip = size == 1 ? 1 :
+		    VRT_HashStrands32(TOSTRANDS(2, ident, "skip")) %
+		    (size - 1) + 1;
+		perm[h].weight = vmax_t(uint32_t, b->replicas, 1);
+	}
+
+	shardd->maglev = calloc(size, sizeof *shardd->maglev);
+	AN(shardd->maglev);
+	shard_maglev_fill(shardd->maglev, size, perm, shardd->n_backend);
+	free(perm);
+}
+
 /*
  * ============================================================
  * configure the director backends
@@ -633,6 +682,9 @@ change_reconfigure(VRT_CTX, struct shard_change *change, VCL_INT replicas)
 	if (shardd->hashcircle)
 		free(shardd->hashcircle);
 	shardd->hashcircle = NULL;
+	if (shardd->maglev)
+		free(shardd->maglev);
+	shardd->maglev = NULL;
 
 	if (shardd->n_backend == 0) {
 		shard_err0(ctx->vsl, shardd->name,
@@ -642,6 +694,7 @@ change_reconfigure(VRT_CTX, struct shard_change *change, VCL_INT replicas)
 	}
 
 	shardcfg_hashcircle(shardd);
+	shardcfg_maglev(ctx->vsl, shardd);
 	sharddir_unlock(shardd);
 	return (1);
 }
@@ -680,6 +733,8 @@ shardcfg_delete(const struct sharddir *shardd)
 		free(shardd->backend);
 	if (shardd->hashcircle)
 		free(shardd->hashcircle);
+	if (shardd->maglev)
+		free(shardd->maglev);
 }
 
 VCL_VOID
@@ -702,6 +757,19 @@ shardcfg_set_rampup(struct sharddir *shardd, VCL_DURATION duration)
 	sharddir_unlock(shardd);
 }
 
+VCL_VOID
+shardcfg_set_maglev(struct vsl_log *vsl, struct sharddir *shardd,
+    uint32_t size)
+{
+	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
+	assert(size == 0 || shard_maglev_prime(size));
+	sharddir_wrlock(shardd);
+	shardd->maglev_size = size;
+	if (shardd->hashcircle != NULL)
+		shardcfg_maglev(vsl, shardd);
+	sharddir_unlock(shardd);
+}
+
 VCL_DURATION
 shardcfg_get_rampup(const struct sharddir *shardd, unsigned host)
 {
@@ -36,3 +36,5 @@ VCL_BOOL shardcfg_clear(VRT_CTX, struct sharddir *shardd);
 VCL_BOOL shardcfg_reconfigure(VRT_CTX, struct sharddir *, VCL_INT);
 VCL_VOID shardcfg_set_warmup(struct sharddir *shardd, VCL_REAL ratio);
 VCL_VOID shardcfg_set_rampup(struct sharddir *shardd, VCL_DURATION duration);
+VCL_VOID shardcfg_set_maglev(struct vsl_log *, struct sharddir *shardd,
+    uint32_t size);
@@ -90,41 +90,21 @@ sharddir_log(struct vsl_log *vsl, enum VSL_tag_e tag,  const char *fmt, ...)
 	va_end(ap);
 }
 
-static int
+static uint32_t
 shard_lookup(const struct sharddir *shardd, const uint32_t key)
 {
 	CHECK_OBJ_NOTNULL(shardd, SHARDDIR_MAGIC);
 
-	const uint32_t n = shardd->n_points;
-	uint32_t i, idx = UINT32_MAX, high = n, low = 0;
-
-	assert (n < idx);
-
-	do {
-	    i = (high + low) / 2 ;
-	    if (shardd->hashcircle[i].point == key)
-		idx = i;
-	    else if (i == n - 1)
-		idx = n - 1;
-	    else if (shardd->hashcircle[i].point < key &&
-		     shardd->hashcircle[i+1].point >= key)
-		idx = i + 1;
-	    else if (shardd->hashcircle[i].point > key)
-		if (i == 0)
-		    idx = 0;
-		else
-		    high = i;
-	    else
-		low = i;
-	} while (idx == UINT32_MAX);
-
-	return (idx);
+	if (shardd->maglev != NULL)
+		return (key % shardd->maglev_size);
+	return (shard_ring_lookup(shardd->hashcircle, shardd->n_points, key));
 }
 
 static int
 shard_next(struct shard_state *state, VCL_INT skip, VCL_BOOL healthy)
 {
 	int c, chosen = -1;
+	uint32_t n_idx;
 	VCL_BACKEND be;
 	vtim_real changed;
 	struct shard_be_info *sbe;
@@ -132,12 +112,15 @@ shard_next(struct shard_state *state, VCL_INT skip, VCL_BOOL healthy)
 	AN(state);
 	CHECK_OBJ_NOTNULL(state->shardd, SHARDDIR_MAGIC);
 
+	n_idx = state->shardd->maglev != NULL ?
+	    state->shardd->maglev_size : state->shardd->n_points;
+
 	if (state->pickcount >= state->shardd->n_backend)
 		return (-1);
 
 	while (state->pickcount < state->shardd->n_backend && skip >= 0) {
 
-		c = state->shardd->hashcircle[state->idx].host;
+		c = sharddir_host(state->shardd, state->idx);
 
 		if (!vbit_test(state->picklist, c)) {
 
@@ -173,7 +156,7 @@ shard_next(struct shard_state *state, VCL_INT skip, VCL_BOOL healthy)
 				break;
 		}
 
-		if (++(state->idx) == state->shardd->n_points)
+		if (++(state->idx) == n_idx)
 			state->idx = 0;
 	}
 	return (chosen);
@@ -329,7 +312,7 @@ sharddir_pick_be_locked(VRT_CTX, const struct sharddir *shardd, uint32_t key,
 	assert(state->idx < UINT32_MAX);
 
 	SHDBG(SHDBG_LOOKUP, shardd, "lookup key %x idx %u host %u",
-	    key, state->idx, shardd->hashcircle[state->idx].host);
+	    key, state->idx, sharddir_host(shardd, state->idx));
 
 	if (alt > 0) {
 		if (shard_next(state, alt - 1,
@@ -46,6 +46,15 @@ struct shard_backend {
 	uint32_t		replicas;
 };
 
+/* per backend permutation of the maglev table slots */
+struct shard_maglev_perm {
+	uint32_t		offset;
+	uint32_t		skip;
+	uint32_t		weight;
+};
+
+#define SHARD_MAGLEV_MAX	(1U << 24)
+
 struct vmod_directors_shard_param;
 
 #define	SHDBG_LOOKUP	 1
@@ -71,6 +80,9 @@ struct sharddir {
 	VCL_REAL				warmup;
 
 	uint32_t				n_points;
+
+	uint32_t				maglev_size;
+	uint32_t				*maglev;
 };
 
 /* VRT_priv_task() id offsets */
@@ -79,6 +91,18 @@ enum shard_task_off_e {
 	task_off_cfg = 1
 };
 
+/* host at a position of the lookup table in use */
+static inline unsigned
+sharddir_host(const struct sharddir *shardd, uint32_t idx)
+{
+	if (shardd->maglev != NULL) {
+		assert(idx < shardd->maglev_size);
+		return (shardd->maglev[idx]);
+	}
+	assert(idx < shardd->n_points);
+	return (shardd->hashcircle[idx].host);
+}
+
 static inline VCL_BACKEND
 sharddir_backend(const struct sharddir *shardd, unsigned id)
 {
@@ -125,3 +149,10 @@ VCL_BACKEND sharddir_pick_be(VRT_CTX, struct sharddir *, uint32_t, VCL_INT,
 void shardcfg_backend_clear(struct sharddir *shardd);
 void shardcfg_delete(const struct sharddir *shardd);
 VCL_DURATION shardcfg_get_rampup(const struct sharddir *shardd, unsigned host);
+
+/* in shard_lookup.c */
+uint32_t shard_ring_lookup(const struct shard_circlepoint *, uint32_t n_points,
+    uint32_t key);
+int shard_maglev_prime(uint32_t);
+void shard_maglev_fill(uint32_t *table, uint32_t size,
+    const struct shard_maglev_perm *, unsigned n_backend);
@@ -0,0 +1,280 @@
+/*-
+ * Copyright (c) 2025 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Backend lookup tables for the shard director
+ *
+ * The consistent hashing ring is searched in O(log n).  Optionally, a
+ * Maglev table (Eisenbud et al., NSDI 2016) maps the key modulo its
+ * prime size straight to a backend.  Each backend walks its own
+ * permutation of the table slots, given by an offset and a skip derived
+ * from its ident, and backends take turns claiming the next free slot
+ * in their permutation until the table is full.  Backends with a higher
+ * weight take proportionally more turns.  When a backend is added or
+ * removed, most slots keep their backend.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache.h"
+
+#include "vmod_directors_shard_dir.h"
+
+uint32_t
+shard_ring_lookup(const struct shard_circlepoint *circle, uint32_t n,
+    uint32_t key)
+{
+	uint32_t i, idx = UINT32_MAX, high = n, low = 0;
+
+	AN(circle);
+	assert (n < idx);
+
+	do {
+	    i = (high + low) / 2 ;
+	    if (circle[i].point == key)
+		idx = i;
+	    else if (i == n - 1)
+		idx = n - 1;
+	    else if (circle[i].point < key &&
+		     circle[i+1].point >= key)
+		idx = i + 1;
+	    else if (circle[i].point > key)
+		if (i == 0)
+		    idx = 0;
+		else
+		    high = i;
+	    else
+		low = i;
+	} while (idx == UINT32_MAX);
+
+	return (idx);
+}
+
+int
+shard_maglev_prime(uint32_t n)
+{
+	uint32_t d;
+
+	if (n < 2)
+		return (0);
+	for (d = 2; d <= n / d; d++)
+		if (n % d == 0)
+			return (0);
+	return (1);
+}
+
+void
+shard_maglev_fill(uint32_t *table, uint32_t size,
+    const struct shard_maglev_perm *perm, unsigned n_backend)
+{
+	uint32_t *next, *placed, wmax, filled, slot;
+	uint64_t round, want;
+	unsigned h;
+
+	AN(table);
+	AN(perm);
+	assert(n_backend > 0);
+	assert(size >= n_backend);
+
+	wmax = 0;
+	for (h = 0; h < n_backend; h++) {
+		assert(perm[h].offset < size);
+		assert(perm[h].skip > 0);
+		assert(perm[h].skip < size || size == 1);
+		AN(perm[h].weight);
+		wmax = vmax(wmax, perm[h].weight);
+	}
+
+	next = calloc(n_backend, sizeof *next);
+	AN(next);
+	placed = calloc(n_backend, sizeof *placed);
+	AN(placed);
+	memset(table, 0xff, size * sizeof *table);
+
+	filled = 0;
+	for (round = 1; filled < size; round++) {
+		for (h = 0; h < n_backend && filled < size; h++) {
+			/* the heaviest backends claim one slot per round */
+			want = (round * perm[h].weight + wmax - 1) / wmax;
+			while (placed[h] < want && filled < size) {
+				do {
+					assert(next[h] < size);
+					slot = (uint32_t)((perm[h].offset +
+					    (uint64_t)next[h] * perm[h].skip) %
+					    size);
+					next[h]++;
+				} while (table[slot] != UINT32_MAX);
+				table[slot] = h;
+				placed[h]++;
+				filled++;
+			}
+		}
+	}
+
+	free(next);
+	free(placed);
+}
+
+#ifdef TEST_DRIVER
+
+/*
+ * Micro benchmark of ring versus maglev lookups, with a rough check of
+ * balance and disruption
+ */
+
+#include <limits.h>
+#include <stdio.h>
+
+#include "vrnd.h"
+#include "vtim.h"
+
+#define N_BACKEND	400
+#define REPLICAS	67
+#define MAGLEV_SIZE	65537
+#define N_KEY		(1 << 20)
+#define N_ROUND		16
+
+static uint32_t keys[N_KEY];
+
+static int
+point_cmp(const void *a, const void *b)
+{
+	const struct shard_circlepoint *pa = a, *pb = b;
+
+	if (pa->point == pb->point)
+		return (0);
+	return (pa->point > pb->point ? 1 : -1);
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+int
+main(void)
+{
+	struct shard_circlepoint *circle;
+	struct shard_maglev_perm perm[N_BACKEND];
+	uint32_t *table, *table2, i, n_points, changed, moved;
+	unsigned h, r, sum, count[N_BACKEND], cmin, cmax;
+	vtim_mono t0;
+	double ring_ns, maglev_ns;
+
+	VRND_SeedTestable(1);
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	AN(shard_maglev_prime(MAGLEV_SIZE));
+	AZ(shard_maglev_prime(MAGLEV_SIZE - 2));
+
+	n_points = N_BACKEND * REPLICAS;
+	circle = calloc(n_points, sizeof *circle);
+	AN(circle);
+	for (i = 0; i < n_points; i++) {
+		circle[i].point = (uint32_t)VRND_RandomTestable();
+		circle[i].host = i / REPLICAS;
+	}
+	qsort(circle, n_points, sizeof *circle, point_cmp);
+
+	for (h = 0; h < N_BACKEND; h++) {
+		perm[h].offset = VRND_RandomTestable() % MAGLEV_SIZE;
+		perm[h].skip = VRND_RandomTestable() % (MAGLEV_SIZE - 1) + 1;
+		perm[h].weight = REPLICAS;
+	}
+	table = calloc(MAGLEV_SIZE, sizeof *table);
+	AN(table);
+	t0 = VTIM_mono();
+	shard_maglev_fill(table, MAGLEV_SIZE, perm, N_BACKEND);
+	printf("maglev fill %u slots: %.3f ms\n", MAGLEV_SIZE,
+	    (VTIM_mono() - t0) * 1e3);
+
+	for (i = 0; i < N_KEY; i++)
+		keys[i] = (uint32_t)VRND_RandomTestable() ^
+		    ((uint32_t)VRND_RandomTestable() << 16);
+
+	sum = 0;
+	t0 = VTIM_mono();
+	for (r = 0; r < N_ROUND; r++)
+		for (i = 0; i < N_KEY; i++)
+			sum += circle[shard_ring_lookup(circle, n_points,
+			    keys[i])].host;
+	ring_ns = (VTIM_mono() - t0) * 1e9 / ((double)N_ROUND * N_KEY);
+
+	t0 = VTIM_mono();
+	for (r = 0; r < N_ROUND; r++)
+		for (i = 0; i < N_KEY; i++)
+			sum += table[keys[i] % MAGLEV_SIZE];
+	maglev_ns = (VTIM_mono() - t0) * 1e9 / ((double)N_ROUND * N_KEY);
+
+	printf("%u backends x %u replicas, %u keys x %u (sum %u)\n",
+	    N_BACKEND, REPLICAS, N_KEY, N_ROUND, sum);
+	printf("ring   lookup: %6.1f ns\n", ring_ns);
+	printf("maglev lookup: %6.1f ns\n", maglev_ns);
+
+	memset(count, 0, sizeof count);
+	for (i = 0; i < MAGLEV_SIZE; i++) {
+		assert(table[i] < N_BACKEND);
+		count[table[i]]++;
+	}
+	cmin = UINT_MAX;
+	cmax = 0;
+	for (h = 0; h < N_BACKEND; h++) {
+		AN(count[h]);
+		cmin = vmin(cmin, count[h]);
+		cmax = vmax(cmax, count[h]);
+	}
+	printf("maglev slots per backend: min %u max %u\n", cmin, cmax);
+	assert(cmax - cmin <= 1);
+
+	/* remove one backend from the middle */
+	r = N_BACKEND / 2;
+	memmove(&perm[r], &perm[r + 1], (N_BACKEND - r - 1) * sizeof *perm);
+	table2 = calloc(MAGLEV_SIZE, sizeof *table2);
+	AN(table2);
+	shard_maglev_fill(table2, MAGLEV_SIZE, perm, N_BACKEND - 1);
+	changed = moved = 0;
+	for (i = 0; i < MAGLEV_SIZE; i++) {
+		h = table2[i] < r ? table2[i] : table2[i] + 1;
+		if (h == table[i])
+			continue;
+		changed++;
+		if (table[i] != r)
+			moved++;
+	}
+	printf("maglev removal: %u slots changed, %u not of the removed "
+	    "backend (%.2f%%)\n", changed, moved, 100. * moved / MAGLEV_SIZE);
+	assert(moved < MAGLEV_SIZE / 20);
+
+	free(circle);
+	free(table);
+	free(table2);
+	return (0);
+}
+#endif